@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "base/dir_walker.h"
+#include "lua/lua_bundle.h"
+//---------------------------------------------------------------------------
+
+using namespace std;
+using namespace VVal;
+
+// Compiles all .lua files below the given directories into one bundle,
+// that the runtime maps at startup (see lib/lua/lua_bundle.h):
+//
+//     lalrt_bundle [-s] <out.bundle> <dir>[=<prefix>] ...
+//
+// The module name is the path below dir with '.' instead of '/'
+// and prefix (if given) in front: lalrtlib/lua/lalrt/tests/mp_tests.lua
+// becomes "lalrt.tests.mp_tests". -s strips the debug information.
+
+//---------------------------------------------------------------------------
+
+static bool ends_with(const string &s, const string &suffix)
+{
+    return s.size() >= suffix.size()
+        && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+//---------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    bool strip = false;
+    int  argi  = 1;
+    if (argi < argc && strcmp(argv[argi], "-s") == 0)
+    {
+        strip = true;
+        argi++;
+    }
+
+    if (argc - argi < 2)
+    {
+        cerr << "usage: lalrt_bundle [-s] <out.bundle> <dir>[=<prefix>] ..." << endl;
+        return 1;
+    }
+    string out_path = argv[argi++];
+
+    try
+    {
+        Lua::BundleWriter writer(strip);
+
+        for (; argi < argc; argi++)
+        {
+            string root = argv[argi];
+            string prefix;
+            size_t eq = root.find('=');
+            if (eq != string::npos)
+            {
+                prefix = root.substr(eq + 1) + ".";
+                root   = root.substr(0, eq);
+            }
+            while (root.size() > 1 && (root.back() == '/' || root.back() == '\\'))
+                root.pop_back();
+
+            dir_walker::Options opts;
+            opts.convert = [](const dir_walker::Entry &e) -> VV
+            {
+                if (e.type != dir_walker::T_REGULAR || !ends_with(e.path, ".lua"))
+                    return vv_undef();
+                return vv(e.path);
+            };
+
+            vector<string> files;
+            dir_walker::Walker walker(root, opts);
+            for (VV batch = walker.next_batch(); batch->is_defined(); batch = walker.next_batch())
+                for (auto f : *batch)
+                    files.push_back(f->s());
+            if (walker.errors() > 0)
+                throw Lua::InstanceException("Can't read directory tree " + root);
+            sort(files.begin(), files.end());
+
+            for (auto &f : files)
+            {
+                string module = f.substr(root.size() + 1, f.size() - root.size() - 5);
+                replace(module.begin(), module.end(), '/', '.');
+                replace(module.begin(), module.end(), '\\', '.');
+                writer.add(prefix + module, f);
+            }
+        }
+
+        writer.write(out_path);
+        cout << out_path << ": " << writer.count() << " modules" << endl;
+    }
+    catch (const std::exception &e)
+    {
+        cerr << "lalrt_bundle: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+//---------------------------------------------------------------------------
@@ -1,7 +1,7 @@
 local tc = require 'lal.util.test_case'
 require 'lal.util.strict'
 
-local t = tc.TestCase("basic-mp-tests", 3)
+local t = tc.TestCase("basic-mp-tests", 7)
 
 function t:prepare_spawn()
     self._pid = proc.spawn([[
@@ -20,6 +20,18 @@ function t:test_spawn()
     tc.assert_eq("reply", r[4], "got reply from spawned process")
 end
 
+function t:test_spawn_gc_options()
+    local pid = proc.spawn([[
+        function main(args)
+            local junk = {}
+            for i = 1, 100000 do junk[i % 100 + 1] = { i } end
+            mp.send(args[1], { "gc-mode", collectgarbage("generational") })
+        end
+    ]], { proc.pid() }, { ["gc-mode"] = "generational", ["gc-minor-mul"] = 10 })
+    tc.assert_eq("generational", mp.waitInfinite("gc-mode")[4],
+                 "spawned process runs in generational mode")
+end
+
 function t:test_self_msg()
     mp.send(proc.pid(), { "foobar" })
     tc.assert_eq("foobar", mp.wait("foobar")[3], "got message from self")
@@ -50,4 +62,51 @@ function t:test_def_handlers()
         "default handlers correctly called");
 end
 
+function t:test_node_loopback()
+    -- All processes share one node, so this only links it to itself.
+    -- Links between nodes with the same and with different secrets
+    -- are tested in tests/rt_test.cpp.
+    mp.nodeSecret("mptest-secret")
+    local port = mp.nodeStart("mptest", 0, "127.0.0.1")
+    mp.nodeConnect("mptest", "127.0.0.1", port)
+    mp.send("mptest:" .. proc.pid(), { "remote", 42 })
+    local m = mp.wait("remote", 2000)
+    tc.assert_eq(42, m[4], "got message addressed to this node")
+    tc.assert_eq("mptest:" .. proc.pid(), mp.globalPid(), "global pid")
+end
+
+function t:test_exec_async()
+    if package.config:sub(1, 1) == "\\" then return end -- no async: on Windows
+
+    local id  = sys.execM("async", "sort", {}, { stdin = "b\na\n" })
+    local out = ""
+    while true do
+        local m = mp.wait({ "sys::exec-stdout", "sys::exec-exit" }, 2000)
+        if m[4] == id and m[3] == "sys::exec-stdout" then
+            out = out .. m[5]
+        elseif m[4] == id then
+            tc.assert_eq(0, m[5]["exit-code"], "child exited with 0")
+            break
+        end
+    end
+    tc.assert_eq("a\nb\n", out, "stdin was passed, stdout received")
+end
+
+function t:test_profile()
+    local function busy_loop(n)
+        local x = 0
+        for i = 1, n do x = x + i % 7 end
+        return x
+    end
+
+    proc.profileStart(1)
+    local t0 = os.clock()
+    while os.clock() - t0 < 0.2 do busy_loop(10000) end
+    local samples = proc.profileStop()
+
+    tc.ok(samples > 0, "profiler took samples")
+    tc.assert_match("busy_loop %(.*mp_tests%.lua:%d+%) %d+\n",
+                    proc.profileDump(), "folded stack with busy_loop")
+end
+
 t:run()
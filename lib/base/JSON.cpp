@@ -194,6 +194,29 @@ bool Parser::parseJSONString(std::string &sOut)
 
     while (bInString)
     {
+        // Copy the run up to the next '"', '\\' or control character
+        // at once. The stop characters are ASCII, so the run always
+        // ends at a character boundary.
+        const char *p   = m_u8Buf->buffer();
+        const char *end = p + m_u8Buf->length();
+        const char *q   = simd::find_special(p, end, '"', '\\', 0x1F);
+        if (q > p)
+        {
+            if (!utf8::valid(p, q))
+            {
+                this->onError(m_u8Buf, "UTF-8 Encoding Error");
+                return false;
+            }
+            u8String.append_bytes(p, q - p);
+            m_u8Buf->skip_bytes(q - p);
+        }
+
+        if (m_u8Buf->length() == 0)
+        {
+            this->onError(m_u8Buf, "string: unterminated string");
+            return false;
+        }
+
         if (m_u8Buf->first_is_ascii())
         {
             unsigned char chr = m_u8Buf->first_ascii();
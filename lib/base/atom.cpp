@@ -0,0 +1,172 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "atom.h"
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+namespace VVal
+{
+namespace atom
+{
+//---------------------------------------------------------------------------
+
+namespace
+{
+
+struct Entry
+{
+    std::string str;
+    uint32_t    hash;
+    uint32_t    id;
+
+    Entry(const char *s, size_t len, uint32_t h, uint32_t i)
+        : str(s, len), hash(h), id(i)
+    { }
+};
+
+/* Open addressing hash table with twice as many slots as atoms. Slots
+ * and ids are published with release stores after the entry is
+ * complete, readers never see a partially constructed entry. */
+class Table
+{
+    private:
+        static const uint32_t SLOTS = MAX_ATOMS * 2;
+
+        std::atomic<const Entry *> m_slots[SLOTS];
+        std::atomic<const Entry *> m_by_id[MAX_ATOMS + 1];
+        std::atomic<uint32_t>      m_count;
+        std::mutex                 m_mutex;
+        std::deque<Entry>          m_entries; // stable addresses
+
+        static uint32_t hash(const char *s, size_t len)
+        {
+            uint32_t h = 2166136261u; // FNV-1a
+            for (size_t i = 0; i < len; i++)
+                h = (h ^ (unsigned char) s[i]) * 16777619u;
+            return h;
+        }
+
+        /// Returns the entry of s or the index of the free slot for it.
+        const Entry *probe(const char *s, size_t len, uint32_t h, uint32_t &slot) const
+        {
+            slot = h & (SLOTS - 1);
+            for (;;)
+            {
+                const Entry *e = m_slots[slot].load(std::memory_order_acquire);
+                if (!e)
+                    return nullptr;
+                if (e->hash == h
+                    && e->str.size() == len
+                    && std::memcmp(e->str.data(), s, len) == 0)
+                    return e;
+                slot = (slot + 1) & (SLOTS - 1);
+            }
+        }
+
+    public:
+        Table() : m_count(0)
+        {
+            for (auto &s : m_slots) s.store(nullptr, std::memory_order_relaxed);
+            for (auto &e : m_by_id) e.store(nullptr, std::memory_order_relaxed);
+
+            static const char *predefined[] = {
+                "command", "pid", "token", "process::exit", "ok", "exception",
+                "sys::exec-stdout", "sys::exec-stderr", "sys::exec-exit",
+            };
+            for (auto p : predefined)
+                intern(p, std::strlen(p));
+        }
+
+        uint32_t find(const char *s, size_t len) const
+        {
+            if (len > MAX_LEN)
+                return NONE;
+            uint32_t slot;
+            const Entry *e = probe(s, len, hash(s, len), slot);
+            return e ? e->id : NONE;
+        }
+
+        uint32_t intern(const char *s, size_t len)
+        {
+            if (len > MAX_LEN)
+                return NONE;
+            uint32_t h = hash(s, len);
+            uint32_t slot;
+            const Entry *e = probe(s, len, h, slot);
+            if (e)
+                return e->id;
+
+            // a full table must not serialize all callers on the mutex
+            if (m_count.load(std::memory_order_acquire) >= MAX_ATOMS)
+                return NONE;
+
+            std::lock_guard<std::mutex> lg(m_mutex);
+            e = probe(s, len, h, slot); // added by another thread meanwhile?
+            if (e)
+                return e->id;
+
+            uint32_t id = m_count.load(std::memory_order_relaxed) + 1;
+            if (id > MAX_ATOMS)
+                return NONE;
+            m_entries.emplace_back(s, len, h, id);
+            e = &m_entries.back();
+            m_by_id[id].store(e, std::memory_order_release);
+            m_slots[slot].store(e, std::memory_order_release);
+            m_count.store(id, std::memory_order_release);
+            return id;
+        }
+
+        const std::string &str(uint32_t id) const
+        {
+            static const std::string empty;
+            if (id == NONE || id > MAX_ATOMS)
+                return empty;
+            const Entry *e = m_by_id[id].load(std::memory_order_acquire);
+            return e ? e->str : empty;
+        }
+
+        uint32_t count() const { return m_count.load(std::memory_order_acquire); }
+};
+//---------------------------------------------------------------------------
+
+Table &table()
+{
+    static Table t;
+    return t;
+}
+
+} // namespace
+//---------------------------------------------------------------------------
+
+uint32_t intern(const char *s, size_t len) { return table().intern(s, len); }
+uint32_t find(const char *s, size_t len)   { return table().find(s, len); }
+const std::string &str(uint32_t id)        { return table().str(id); }
+uint32_t count()                           { return table().count(); }
+
+//---------------------------------------------------------------------------
+
+} // namespace atom
+} // namespace VVal
@@ -0,0 +1,90 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include "compat_stdint.h"
+
+/* Global table of atoms: short strings that are used over and over as
+ * map keys and message names ("command", "pid", "process::exit", ...).
+ * Every atom has a small integer id, that is valid in all threads for
+ * the lifetime of the program. Atoms are never removed or changed, so
+ * lookups don't need a lock. Only adding a new atom takes one. As the
+ * table is never cleaned up, only the fixed vocabulary of the runtime
+ * should be interned, never keys or values that come with the data.
+ *
+ * VV strings can refer to an atom by its id (see vv_atom() in vval.h).
+ * A Lua state keeps the interned string of every atom it has seen, so
+ * an atom crosses the VV/Lua boundary without hashing or allocating. */
+
+namespace VVal
+{
+namespace atom
+{
+//---------------------------------------------------------------------------
+
+/// Upper limit for the number of atoms. When the table is full,
+/// intern() returns NONE and callers use plain strings.
+const uint32_t MAX_ATOMS = 4096;
+
+/// Longest atom. Atoms have to be short strings in Lua
+/// (LUAI_MAXSHORTLEN), so that they are interned there too.
+const size_t   MAX_LEN   = 40;
+
+/// Atoms that are registered at startup, in this order.
+enum Predefined : uint32_t
+{
+    NONE = 0,
+    COMMAND,            // "command"
+    PID,                // "pid"
+    TOKEN,              // "token"
+    PROCESS_EXIT,       // "process::exit"
+    OK,                 // "ok"
+    EXCEPTION,          // "exception"
+    SYS_EXEC_STDOUT,    // "sys::exec-stdout"
+    SYS_EXEC_STDERR,    // "sys::exec-stderr"
+    SYS_EXEC_EXIT,      // "sys::exec-exit"
+    PREDEFINED_END
+};
+
+/// Returns the id of the atom s, adds it if it is new.
+/// Returns NONE if s is longer than MAX_LEN or the table is full.
+uint32_t intern(const char *s, size_t len);
+inline uint32_t intern(const std::string &s) { return intern(s.data(), s.size()); }
+
+/// Returns the id of the atom s or NONE if there is no such atom.
+uint32_t find(const char *s, size_t len);
+inline uint32_t find(const std::string &s) { return find(s.data(), s.size()); }
+
+/// The string of an atom. Returns an empty string for unknown ids.
+const std::string &str(uint32_t id);
+
+/// Number of atoms, the valid ids are 1 to count().
+uint32_t count();
+
+//---------------------------------------------------------------------------
+
+} // namespace atom
+} // namespace VVal
@@ -22,8 +22,15 @@
 ******************************************************************************/
 
 #include "csv.h"
-#include <regex>
-#include <algorithm>
+#include "simd.h"
+#include <cerrno>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#   include <io.h>
+#else
+#   include <unistd.h>
+#endif
 
 using namespace VVal;
 using namespace std;
@@ -34,249 +41,564 @@ namespace csv
 {
 //---------------------------------------------------------------------------
 
-class CSVParser
+Reader::Reader(char sep, const string &row_sep)
+    : m_sep(sep), m_row_sep(row_sep), m_finished(false),
+      m_ext(nullptr), m_ext_len(0),
+      m_pos(0), m_scan(0), m_row_done(false),
+      m_in_field(false), m_quoted(false), m_after_quote(false),
+      m_field_start(0), m_garbage_start(0)
 {
-    private:
-        char    m_delim;
-        string  m_row_sep;
-        string  m_data;
-        int     m_pos;
+    if (m_row_sep.empty()) m_row_sep = "\r\n";
+}
+//---------------------------------------------------------------------------
 
-        int rest_len() { return (int) m_data.size() - m_pos; }
-        void skip_char(int cnt = 1) { m_pos += cnt; }
+void Reader::set_input(const char *data, size_t len)
+{
+    m_ext      = data;
+    m_ext_len  = len;
+    m_finished = true;
+}
+//---------------------------------------------------------------------------
 
-        char next_char(bool do_skip = false)
-        {
-            if (rest_len() <= 0) return '\0';
-            char c = m_data[m_pos];
-            if (do_skip) skip_char();
-            return c;
-        }
+/// Drops the already returned rows in front of the buffer.
+void Reader::compact()
+{
+    if (m_ext || m_pos == 0 || (m_pos < 64 * 1024 && m_pos * 2 < m_buf.size()))
+        return;
+
+    m_buf.erase(0, m_pos);
+    m_scan -= m_pos;
+    if (m_in_field && !m_quoted && !m_after_quote) m_field_start -= m_pos;
+    if (m_after_quote) m_garbage_start -= m_pos;
+    m_pos = 0;
+}
+//---------------------------------------------------------------------------
 
-        bool check_char(char c)
-        {
-            if (rest_len() < 1) return false;
-            return next_char() == c;
-        }
+void Reader::feed(const char *data, size_t len)
+{
+    if (m_row_done)
+    {
+        m_pos      = m_scan;
+        m_row_done = false;
+        m_refs.clear();
+        m_scratch.clear();
+    }
+    compact();
+    m_buf.append(data, len);
+}
+//---------------------------------------------------------------------------
 
-        bool check_substr(const string &chrs)
-        {
-            if (((size_t) rest_len()) < chrs.size()) return false;
-            size_t i = 0;
-            for (auto c : chrs)
-                if (m_data[m_pos + i++] != c) return false;
-            return true;
-        }
+/// Finishes the current field, which ends in front of offset end.
+void Reader::end_field(size_t end)
+{
+    FieldRef r;
+    if (m_after_quote)
+    {
+        // Garbage after the closing quote is kept, instead of throwing
+        // away the rest of the input.
+        m_scratch.append(data() + m_garbage_start, end - m_garbage_start);
+        r.in_scratch = true;
+        r.offs       = m_field_start;
+        r.len        = m_scratch.size() - m_field_start;
+    }
+    else
+    {
+        r.in_scratch = false;
+        r.offs       = m_field_start - m_pos;
+        r.len        = end - m_field_start;
+    }
+    m_refs.push_back(r);
 
-        bool check_oneof(const string &chrs)
-        {
-            if (((size_t) rest_len()) < 1) return false;
-            for (auto c : chrs)
-                if (m_data[m_pos] == c) return true;
-            return false;
-        }
+    m_in_field    = false;
+    m_quoted      = false;
+    m_after_quote = false;
+}
+//---------------------------------------------------------------------------
+
+/// Returns 1 if a row was completed, 0 if more input is needed
+/// or the input ended.
+int Reader::scan_row()
+{
+    const char *b   = data();
+    const char *end = b + size();
+    char        rs0 = m_row_sep[0];
 
-        bool parse_escaped_field()
+    for (;;)
+    {
+        if (!m_in_field)
         {
-            string field_data;
+            if (b + m_scan >= end)
+            {
+                if (!m_finished || m_refs.empty()) return 0;
+                // the last row ended with a separator
+                m_field_start = m_scan;
+                end_field(m_scan);
+                return 1;
+            }
 
-            bool end_found = false;
-            while (!end_found && rest_len() > 0)
+            m_in_field = true;
+            if (b[m_scan] == '"')
             {
-                if (check_char('"'))
-                {
-                    skip_char();
-
-                    if (check_char('"'))
-                    {
-                        skip_char();
-                        field_data += '"';
-                    }
-                    else
-                        end_found = true;
-                }
-                else if (check_char('\x0d'))
-                {
-                    skip_char();
-                    if (check_char('\x0a')) skip_char();
-                    field_data += "\x0a";
-                }
-                else if (check_char('\x0a'))
-                {
-                    skip_char();
-                    field_data += "\x0a";
-                }
-                else
-                    field_data += next_char(true);
+                m_quoted      = true;
+                m_field_start = m_scratch.size();
+                m_scan++;
             }
+            else
+                m_field_start = m_scan;
+        }
 
-            if (rest_len() <= 0) end_found = true;
+        if (m_quoted)
+        {
+            const char *p = simd::find_either(b + m_scan, end, '"', '\r');
+            m_scratch.append(b + m_scan, p - (b + m_scan));
+            m_scan = p - b;
 
-            if (end_found) this->on_field(field_data);
+            if (p == end)
+            {
+                if (!m_finished) return 0;
+                // unterminated quoted field at the end
+                m_after_quote   = true;
+                m_garbage_start = m_scan;
+                end_field(m_scan);
+                return 1;
+            }
+            if (p + 1 == end && !m_finished)
+                return 0; // need to look at the next character
 
-            if (rest_len() <= 0 || check_substr(m_row_sep))
+            if (*p == '\r')
             {
-                skip_char((int) m_row_sep.size());
-                this->on_row_end();
+                m_scratch += '\n';
+                m_scan += (p + 1 < end && p[1] == '\n') ? 2 : 1;
+            }
+            else if (p + 1 < end && p[1] == '"')
+            {
+                m_scratch += '"';
+                m_scan += 2;
             }
-            else if (check_char(m_delim))
-                skip_char();
             else
-                return false; // kein korrekter feld-abschluss!
-
-
-            return end_found;
+            {
+                m_scan++;
+                m_quoted        = false;
+                m_after_quote   = true;
+                m_garbage_start = m_scan;
+            }
+            continue;
         }
 
-        bool parse_delimited_field()
+        const char *p       = simd::find_either(b + m_scan, end, m_sep, rs0);
+        bool        row_end = false;
+        while (p != end)
         {
-            string field_data;
-            bool end_found = false;
-            bool row_end   = false;
-
-            while (!end_found && rest_len() > 0)
+            if (*p == rs0)
             {
-                if (check_substr(m_row_sep))
+                size_t rest = end - p;
+                if (rest < m_row_sep.size() && !m_finished)
                 {
-                    skip_char((int) m_row_sep.size());
-                    end_found = true;
-                    row_end   = true;
+                    m_scan = p - b;
+                    return 0; // maybe a partial row separator
                 }
-                else if (check_char(m_delim))
+                if (rest >= m_row_sep.size()
+                    && memcmp(p, m_row_sep.data(), m_row_sep.size()) == 0)
                 {
-                    skip_char();
-                    end_found = true;
+                    row_end = true;
+                    break;
                 }
-                else
-                    field_data += next_char(true);
             }
+            if (*p == m_sep)
+                break;
 
-            if (rest_len() <= 0)
-            {
-                end_found = true;
-                row_end   = true;
-            }
+            p = simd::find_either(p + 1, end, m_sep, rs0);
+        }
 
-            if (end_found) this->on_field(field_data);
-            if (row_end)   this->on_row_end();
+        m_scan = p - b;
+        if (p == end && !m_finished) return 0;
 
-            return end_found;
+        end_field(m_scan);
+        if (p == end) return 1;
+        if (row_end)
+        {
+            m_scan += m_row_sep.size();
+            return 1;
         }
+        m_scan++; // the separator
+    }
+}
+//---------------------------------------------------------------------------
 
-        bool parse_field()
+bool Reader::next_row()
+{
+    for (;;)
+    {
+        if (m_row_done)
         {
-            if (rest_len() < 1) return false;
-            if (next_char() == '"')
-            {
-                skip_char();
-                return parse_escaped_field();
-            }
-            else
+            m_pos      = m_scan;
+            m_row_done = false;
+            m_refs.clear();
+            m_scratch.clear();
+        }
+
+        if (scan_row())
+        {
+            m_row_done = true;
+
+            const char *row = data() + m_pos;
+            m_fields.resize(m_refs.size());
+            for (size_t i = 0; i < m_refs.size(); i++)
             {
-                return parse_delimited_field();
+                const FieldRef &r = m_refs[i];
+                m_fields[i].data  = (r.in_scratch ? m_scratch.data() : row) + r.offs;
+                m_fields[i].len   = r.len;
             }
+            return true;
         }
 
-    public:
-        CSVParser(char cDelim, const string &row_sep)
-            : m_delim(cDelim), m_row_sep(row_sep)
+        if (m_finished || !m_source) return false;
+
+        compact();
+        const size_t chunk = 64 * 1024;
+        size_t       old   = m_buf.size();
+        m_buf.resize(old + chunk);
+        size_t n = m_source(&m_buf[old], chunk);
+        m_buf.resize(old + n);
+        if (n == 0) finish();
+    }
+}
+//---------------------------------------------------------------------------
+
+bool Reader::next(VV &row)
+{
+    if (!next_row()) return false;
+    row = vv_list();
+    for (auto &f : m_fields)
+        row << f.str();
+    return true;
+}
+//---------------------------------------------------------------------------
+
+VVal::VV from_csv(const string &csv, char sep, const string &row_sep)
+{
+    VV table = vv_list();
+    VV row;
+
+    Reader r(sep, row_sep);
+    r.set_input(csv.data(), csv.size());
+    while (r.next(row))
+        table << row;
+
+    return table;
+}
+//---------------------------------------------------------------------------
+
+static const char *field_end(const Reader::Field &f) { return f.data + f.len; }
+
+static table::Type field_type(const Reader::Field &f, table::Type t)
+{
+    if (t == table::T_STRING)
+        return t;
+
+    int64_t i;
+    double  d;
+    if (t == table::T_INT && numconv::parse_int64(f.data, field_end(f), i) == field_end(f))
+        return table::T_INT;
+    if (numconv::parse_double(f.data, field_end(f), d) == field_end(f))
+        return table::T_DOUBLE;
+    return table::T_STRING;
+}
+//---------------------------------------------------------------------------
+
+VVal::VV from_csv_table(const string &csv, char sep, const string &row_sep, bool header)
+{
+    std::vector<string>      names;
+    std::vector<table::Type> types;
+    std::vector<bool>        seen;
+    size_t                   rows = 0;
+
+    Reader r(sep, row_sep);
+    r.set_input(csv.data(), csv.size());
+    if (header && r.next_row())
+        for (auto &f : r.fields())
+            names.push_back(f.str());
+
+    while (r.next_row())
+    {
+        auto &fields = r.fields();
+        if (types.size() < fields.size())
         {
+            types.resize(fields.size(), table::T_INT);
+            seen.resize(fields.size(), false);
         }
+        for (size_t i = 0; i < fields.size(); i++)
+        {
+            if (fields[i].len == 0) continue;
+            types[i] = field_type(fields[i], types[i]);
+            seen[i]  = true;
+        }
+        rows++;
+    }
 
-        virtual ~CSVParser() { }
-
-        virtual void on_field(const string &sData) = 0;
-        virtual void on_row_end() = 0;
+    table::TablePtr t = std::make_shared<table::Table>();
+    if (types.size() < names.size())
+    {
+        types.resize(names.size(), table::T_INT);
+        seen.resize(names.size(), false);
+    }
+    std::vector<table::Column *> cols;
+    for (size_t i = 0; i < types.size(); i++)
+    {
+        string name = i < names.size() ? names[i] : string();
+        if (name.empty() || t->column(name))
+            name = numconv::int64_string((int64_t) i);
+        // a column without any value can't tell its type
+        table::ColumnPtr c = t->add_column(name, seen[i] ? types[i] : table::T_STRING);
+        c->reserve(rows);
+        cols.push_back(c.get());
+    }
 
-        void parse(const string &sData)
+    Reader r2(sep, row_sep);
+    r2.set_input(csv.data(), csv.size());
+    if (header) r2.next_row();
+    while (r2.next_row())
+    {
+        auto &fields = r2.fields();
+        for (size_t i = 0; i < fields.size(); i++)
         {
-            m_data = sData;
-            m_pos  = 0;
+            const Reader::Field &f = fields[i];
+            table::Column       *c = cols[i];
+            if (f.len == 0)
+            {
+                c->push_null();
+                continue;
+            }
 
-            while (rest_len() > 0)
+            switch (c->type())
             {
-                if (!parse_field())
+                case table::T_INT:
                 {
-                    return;
+                    int64_t v = 0;
+                    numconv::parse_int64(f.data, field_end(f), v);
+                    c->push_int(v);
+                    break;
                 }
+                case table::T_DOUBLE:
+                {
+                    double v = 0.0;
+                    numconv::parse_double(f.data, field_end(f), v);
+                    c->push_double(v);
+                    break;
+                }
+                default:
+                    c->push_string(f.data, f.len);
+                    break;
             }
         }
-};
+        t->end_row();
+    }
+
+    return vv_table(t);
+}
 //---------------------------------------------------------------------------
 
-class VVCSVParser : public CSVParser
+Writer::Writer(char sep, const string &row_sep)
+    : Writer(sink_func(), sep, row_sep)
 {
-    private:
-        VV m_table;
-        VV m_row;
+}
+//---------------------------------------------------------------------------
 
-    public:
-        VVCSVParser(char delim, const string &row_sep)
-            : CSVParser(delim, row_sep), m_table(vv_list()), m_row(vv_list())
+Writer::Writer(const sink_func &sink, char sep, const string &row_sep)
+    : m_sep(sep), m_row_sep(row_sep), m_sink(sink), m_first_field(true)
+{
+    if (m_row_sep.empty()) m_row_sep = "\r\n";
+
+    // The old regex based writer quoted on white space too, keep that.
+    string special = "\"\r\n\t ";
+    if (special.find(m_sep) == string::npos)
+        special += m_sep;
+    if (special.find(m_row_sep[0]) == string::npos)
+        special += m_row_sep[0];
+    memcpy(m_special, special.c_str(), special.size() + 1);
+}
+//---------------------------------------------------------------------------
 
-        {
-        }
+bool Writer::needs_quotes(const char *data, size_t len) const
+{
+    const char *end = data + len;
+    while (end - data >= 64)
+    {
+        if (simd::oneof_mask64(data, m_special))
+            return true;
+        data += 64;
+    }
 
-        virtual ~VVCSVParser() {}
-        virtual void on_field(const string &data)
-        {
-            m_row << data;
-        }
-        virtual void on_row_end()
+    char tail[64];
+    uint64_t valid = simd::load_tail(tail, data, end - data, '\0');
+    return (simd::oneof_mask64(tail, m_special) & valid) != 0;
+}
+//---------------------------------------------------------------------------
+
+void Writer::field(const char *data, size_t len)
+{
+    if (!m_first_field) m_buf += m_sep;
+    m_first_field = false;
+
+    if (!needs_quotes(data, len))
+    {
+        m_buf.append(data, len);
+        return;
+    }
+
+    m_buf += '"';
+    const char *end = data + len;
+    for (;;)
+    {
+        const char *q = (const char *) memchr(data, '"', end - data);
+        if (!q)
         {
-            m_table << m_row;
-            m_row = vv_list();
+            m_buf.append(data, end - data);
+            break;
         }
-
-        VV table() { return m_table; }
-};
+        m_buf.append(data, q + 1 - data);
+        m_buf += '"';
+        data = q + 1;
+    }
+    m_buf += '"';
+}
 //---------------------------------------------------------------------------
 
-VVal::VV from_csv(const string &csv, char sep, const string &row_sep)
+void Writer::end_row()
 {
-    VVCSVParser csvp(sep, row_sep);
-    csvp.parse(csv);
-    return csvp.table();
+    m_buf += m_row_sep;
+    m_first_field = true;
+
+    if (m_sink && m_buf.size() >= 64 * 1024)
+        flush();
 }
 //---------------------------------------------------------------------------
 
-string to_csv(const VVal::VV &table, char sep, const string &row_sep)
+void Writer::row(const VV &row)
 {
-    regex re("[\t\r\n " + string(&sep, 1) + "]");
+    for (auto cell : *row)
+    {
+        field(cell->s());
+    }
+    end_row();
+}
+//---------------------------------------------------------------------------
 
-    stringstream ss;
+void Writer::table(const table::Table &t, bool header)
+{
+    if (header)
+    {
+        for (size_t c = 0; c < t.columns(); c++)
+            field(t.name(c));
+        end_row();
+    }
 
-    for (auto row : *table)
+    char buf[numconv::FORMAT_BUF_SIZE];
+    for (size_t r = 0; r < t.rows(); r++)
     {
-        bool first_field = true;
-        for (auto cell : *row)
+        for (size_t c = 0; c < t.columns(); c++)
         {
-            if (!first_field) ss << sep;
-            else first_field = false;
-
-            string field = cell->s();
-
-            smatch match;
-            if (regex_search(field, match, re))
+            const table::Column &col = *t.column(c);
+            if (col.is_null(r))
             {
-                stringstream field_out;
-                field_out << "\"";
-                for (auto c : field)
-                {
-                    if (c == '"') field_out << "\"\"";
-                    else          field_out << c;
-                }
-                field_out << "\"";
-                field = field_out.str();
-
+                field("", 0);
+                continue;
             }
 
-            ss << field;
+            switch (col.type())
+            {
+                case table::T_INT:
+                    field(buf, numconv::format_int64(col.ints()[r], buf));
+                    break;
+                case table::T_DOUBLE:
+                    field(buf, numconv::format_double(col.dbls()[r], buf));
+                    break;
+                case table::T_BOOL:
+                    field(col.bools()[r] ? "1" : "", col.bools()[r] ? 1 : 0);
+                    break;
+                case table::T_STRING:
+                    field(col.dict()[col.codes()[r]]);
+                    break;
+            }
         }
-        ss << row_sep;
+        end_row();
     }
+}
+//---------------------------------------------------------------------------
+
+static void write_rows(Writer &w, const VVal::VV &table)
+{
+    table::TablePtr t = vv_to_table(table);
+    if (t)
+    {
+        w.table(*t);
+        return;
+    }
+
+    for (auto row : *table)
+        w.row(row);
+}
+//---------------------------------------------------------------------------
+
+void Writer::flush()
+{
+    if (!m_sink || m_buf.empty()) return;
+    m_sink(m_buf.data(), m_buf.size());
+    m_buf.clear();
+}
+//---------------------------------------------------------------------------
+
+string escape_csv_field(const string &data, char sep)
+{
+    Writer w(sep);
+    w.field(data);
+    return w.take();
+}
+//---------------------------------------------------------------------------
 
-    return ss.str();
+string to_csv(const VVal::VV &table, char sep, const string &row_sep)
+{
+    Writer w(sep, row_sep);
+    write_rows(w, table);
+    return w.take();
+}
+//---------------------------------------------------------------------------
+
+void write_csv(std::ostream &out, const VVal::VV &table, char sep, const string &row_sep)
+{
+    Writer w([&out](const char *data, size_t len)
+    {
+        out.write(data, len);
+        if (!out)
+            throw VariantValueException(
+                vv_undef(), "csv: writing to output stream failed");
+    }, sep, row_sep);
+    write_rows(w, table);
+    w.flush();
+}
+//---------------------------------------------------------------------------
+
+void write_csv(int fd, const VVal::VV &table, char sep, const string &row_sep)
+{
+    Writer w([fd](const char *data, size_t len)
+    {
+        while (len > 0)
+        {
+#if defined(_MSC_VER)
+            int n = _write(fd, data, (unsigned int) len);
+#else
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0 && errno == EINTR) continue;
+#endif
+            if (n <= 0)
+                throw VariantValueException(
+                    vv_undef(), "csv: writing to file descriptor failed");
+            data += n;
+            len  -= (size_t) n;
+        }
+    }, sep, row_sep);
+    write_rows(w, table);
+    w.flush();
 }
 //---------------------------------------------------------------------------
 
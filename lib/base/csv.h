@@ -21,8 +21,13 @@
 * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 ******************************************************************************/
 
+
 #pragma once
 #include "vval.h"
+#include "vv_table.h"
+#include <functional>
+#include <ostream>
+#include <vector>
 
 namespace VVal
 {
@@ -30,10 +35,150 @@ namespace csv
 {
 //---------------------------------------------------------------------------
 
+/// Incremental CSV reader.
+///
+/// Fields are located with SIMD scans for the separator, the first
+/// character of the row separator and quotes. Unquoted fields point
+/// directly into the input, only quoted fields are unescaped into a
+/// scratch buffer. The input either comes in chunks (feed() or a
+/// source function), or is a borrowed block of memory (set_input(),
+/// e.g. for memory mapped files), which is not copied at all.
+///
+/// Quoted fields may contain the separators, `""` for a quote and line
+/// breaks, which are normalized to "\n".
+class Reader
+{
+    public:
+        /// Fills buf with up to len bytes, returns 0 at the end of input.
+        typedef std::function<size_t(char *buf, size_t len)> source_func;
+
+        struct Field
+        {
+            const char *data;
+            size_t      len;
+
+            std::string str() const { return std::string(data, len); }
+        };
+
+    private:
+        struct FieldRef
+        {
+            bool   in_scratch;
+            size_t offs;
+            size_t len;
+        };
+
+        char                    m_sep;
+        std::string             m_row_sep;
+        source_func             m_source;
+        bool                    m_finished;
+
+        std::string             m_buf;
+        const char             *m_ext;      // borrowed input
+        size_t                  m_ext_len;
+
+        size_t                  m_pos;      // start of the current row
+        size_t                  m_scan;
+        bool                    m_row_done;
+
+        bool                    m_in_field;
+        bool                    m_quoted;
+        bool                    m_after_quote;
+        size_t                  m_field_start;
+        size_t                  m_garbage_start;
+
+        std::vector<FieldRef>   m_refs;
+        std::string             m_scratch;
+        std::vector<Field>      m_fields;
+
+        const char *data() const { return m_ext ? m_ext : m_buf.data(); }
+        size_t      size() const { return m_ext ? m_ext_len : m_buf.size(); }
+
+        void compact();
+        void end_field(size_t end);
+        int  scan_row();
+
+    public:
+        Reader(char sep = ',', const std::string &row_sep = "\r\n");
+
+        /// Reads from [data, data + len), which has to stay valid as long
+        /// as the reader is used.
+        void set_input(const char *data, size_t len);
+        /// Installs a source, that next_row() pulls more input from.
+        void set_source(const source_func &src) { m_source = src; }
+
+        void feed(const char *data, size_t len);
+        /// Marks the end of input.
+        void finish() { m_finished = true; }
+
+        /// Reads the next row. Returns false if more input is needed
+        /// or the end of the input was reached.
+        /// The fields stay valid until the next call.
+        bool next_row();
+        const std::vector<Field> &fields() const { return m_fields; }
+
+        /// Like next_row(), but returns the row as list of strings.
+        bool next(VV &row);
+};
+//---------------------------------------------------------------------------
+
+/// CSV writer, that appends rows to a growing buffer and hands it in
+/// chunks to a sink, if one is given. Fields are quoted only if they
+/// contain the separators, quotes or white space. That is decided with
+/// a single SIMD scan over the field.
+class Writer
+{
+    public:
+        typedef std::function<void(const char *data, size_t len)> sink_func;
+
+    private:
+        char            m_sep;
+        std::string     m_row_sep;
+        char            m_special[8];
+        sink_func       m_sink;
+        std::string     m_buf;
+        bool            m_first_field;
+
+        bool needs_quotes(const char *data, size_t len) const;
+
+    public:
+        /// Collects the output in memory, see str().
+        Writer(char sep = ',', const std::string &row_sep = "\r\n");
+        /// Passes the output in chunks to sink.
+        Writer(const sink_func &sink, char sep = ',', const std::string &row_sep = "\r\n");
+
+        void field(const char *data, size_t len);
+        void field(const std::string &s) { field(s.data(), s.size()); }
+        void end_row();
+        /// Writes all cells of the list row and ends the row.
+        void row(const VV &row);
+        /// Writes the column names as first row (if header is true)
+        /// and the rows of t, nulls as empty fields.
+        void table(const table::Table &t, bool header = true);
+        void flush();
+
+        const std::string &str() const { return m_buf; }
+        std::string take() { std::string s; s.swap(m_buf); return s; }
+};
+//---------------------------------------------------------------------------
+
 std::string escape_csv_field(const std::string &data, char sep);
 
 VVal::VV from_csv(const std::string &csv, char sep, const std::string &row_sep);
+/// Reads the CSV into a columnar TableValue (see vv_table.h). The
+/// column names come from the first row if header is true, otherwise
+/// they are "0", "1", ... The input is read twice: first to pick the
+/// narrowest type for each column (int, double or string), then to
+/// fill the typed columns. Empty fields are null.
+VVal::VV from_csv_table(const std::string &csv, char sep, const std::string &row_sep, bool header = true);
+/// table is a list of lists or a TableValue, the latter is written
+/// with its column names as header.
 std::string to_csv(const VVal::VV &table, char sep, const std::string &row_sep);
+/// Streams the table through a Writer, throws VariantValueException
+/// if the stream goes bad.
+void write_csv(std::ostream &out, const VVal::VV &table, char sep, const std::string &row_sep);
+/// Throws VariantValueException if writing to the descriptor fails.
+void write_csv(int fd, const VVal::VV &table, char sep, const std::string &row_sep);
 
 } // namespace VVal::csv
 } // namespace VVal
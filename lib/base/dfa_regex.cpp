@@ -0,0 +1,1386 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "dfa_regex.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace dfa_regex
+{
+//---------------------------------------------------------------------------
+
+typedef Regex::ByteSet ByteSet;
+typedef Regex::Inst    Inst;
+
+/// Upper limit for the program size, counted repetitions are expanded.
+static const size_t MAX_PROG_SIZE  = 100000;
+/// The DFA is abandoned (and the NFA used instead) beyond this.
+static const size_t MAX_DFA_STATES = 4096;
+
+static bool is_word(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9') || c == '_';
+}
+//---------------------------------------------------------------------------
+
+struct Node
+{
+    enum Type { EMPTY, SET, ANY, CAT, ALT, GROUP, REPEAT,
+                A_BOL, A_EOL, A_WORDB, A_NWORDB };
+
+    Type                                type;
+    ByteSet                             set;
+    std::vector<std::unique_ptr<Node>>  kids;
+    int                                 group;
+    int                                 min, max;   // max < 0: unbounded
+    bool                                greedy;
+
+    explicit Node(Type t)
+        : type(t), group(-1), min(0), max(0), greedy(true)
+    { }
+};
+typedef std::unique_ptr<Node> NodeP;
+//---------------------------------------------------------------------------
+
+class Parser
+{
+    private:
+        const char *m_p;
+        const char *m_end;
+        bool        m_icase;
+        int         m_ngroups;
+
+        bool at_end() const { return m_p >= m_end; }
+
+        void add_char(ByteSet &s, unsigned char c) const
+        {
+            s.set(c);
+            if (m_icase)
+            {
+                if (c >= 'a' && c <= 'z') s.set(c - 'a' + 'A');
+                if (c >= 'A' && c <= 'Z') s.set(c - 'A' + 'a');
+            }
+        }
+
+        static void add_range(ByteSet &s, int from, int to)
+        {
+            for (int c = from; c <= to; c++)
+                s.set((unsigned char) c);
+        }
+
+        static void add_class(ByteSet &s, char cls)
+        {
+            ByteSet t;
+            switch (cls)
+            {
+                case 'd': case 'D':
+                    add_range(t, '0', '9');
+                    break;
+                case 'w': case 'W':
+                    for (int c = 0; c < 256; c++)
+                        if (is_word((unsigned char) c)) t.set((unsigned char) c);
+                    break;
+                case 's': case 'S':
+                    add_range(t, '\t', '\r');
+                    t.set(' ');
+                    break;
+            }
+            bool neg = cls == 'D' || cls == 'W' || cls == 'S';
+            for (int i = 0; i < 4; i++)
+                s.w[i] |= neg ? ~t.w[i] : t.w[i];
+        }
+
+        static int hex_val(char c)
+        {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        int parse_hex(int digits)
+        {
+            if (m_end - m_p < digits)
+                throw RegexError("bad hex escape");
+            int v = 0;
+            for (int i = 0; i < digits; i++)
+            {
+                int h = hex_val(*m_p++);
+                if (h < 0) throw RegexError("bad hex escape");
+                v = v * 16 + h;
+            }
+            return v;
+        }
+
+        /// Parses the character of a simple escape (after the '\').
+        /// Returns -1 for class escapes (\d, \w, ...), which are added
+        /// to s instead.
+        int parse_escape_char(ByteSet &s, bool in_class)
+        {
+            if (at_end()) throw RegexError("trailing backslash");
+            char c = *m_p++;
+            switch (c)
+            {
+                case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+                    add_class(s, c);
+                    return -1;
+                case 'n': return '\n';
+                case 't': return '\t';
+                case 'r': return '\r';
+                case 'f': return '\f';
+                case 'v': return '\v';
+                case '0': return '\0';
+                case 'b':
+                    if (in_class) return '\b';
+                    break;
+                case 'x': return parse_hex(2);
+                case 'u':
+                {
+                    int v = parse_hex(4);
+                    if (v > 0x7F)
+                        throw RegexError("\\u escapes above U+007F are not supported, use UTF-8");
+                    return v;
+                }
+                case 'c':
+                    if (at_end()) throw RegexError("bad \\c escape");
+                    return *m_p++ % 32;
+                default:
+                    if (c >= '1' && c <= '9')
+                        throw RegexError("backreferences are not supported");
+                    return (unsigned char) c;
+            }
+            return (unsigned char) c;
+        }
+
+        NodeP parse_class()
+        {
+            NodeP n(new Node(Node::SET));
+            bool neg = false;
+            if (!at_end() && *m_p == '^')
+            {
+                neg = true;
+                m_p++;
+            }
+
+            ByteSet s;
+            for (;;)
+            {
+                if (at_end()) throw RegexError("missing ']'");
+                if (*m_p == ']')
+                {
+                    m_p++;
+                    break;
+                }
+
+                int lo;
+                if (*m_p == '\\')
+                {
+                    m_p++;
+                    lo = parse_escape_char(s, true);
+                    if (lo < 0) continue;
+                }
+                else
+                    lo = (unsigned char) *m_p++;
+
+                if (m_end - m_p >= 2 && *m_p == '-' && m_p[1] != ']')
+                {
+                    m_p++;
+                    int hi;
+                    if (*m_p == '\\')
+                    {
+                        m_p++;
+                        ByteSet dummy;
+                        hi = parse_escape_char(dummy, true);
+                        if (hi < 0) throw RegexError("bad class range");
+                    }
+                    else
+                        hi = (unsigned char) *m_p++;
+
+                    if (hi < lo) throw RegexError("bad class range");
+                    for (int c = lo; c <= hi; c++)
+                        add_char(s, (unsigned char) c);
+                }
+                else
+                    add_char(s, (unsigned char) lo);
+            }
+
+            if (neg)
+                for (int i = 0; i < 4; i++) s.w[i] = ~s.w[i];
+            n->set = s;
+            return n;
+        }
+
+        NodeP parse_atom()
+        {
+            char c = *m_p++;
+            switch (c)
+            {
+                case '(':
+                {
+                    int group = -1;
+                    if (m_end - m_p >= 2 && m_p[0] == '?')
+                    {
+                        if (m_p[1] != ':')
+                            throw RegexError("lookahead is not supported");
+                        m_p += 2;
+                    }
+                    else
+                        group = ++m_ngroups;
+
+                    NodeP n(new Node(Node::GROUP));
+                    n->group = group;
+                    n->kids.push_back(parse_alt());
+                    if (at_end() || *m_p != ')')
+                        throw RegexError("missing ')'");
+                    m_p++;
+                    return n;
+                }
+                case '[': return parse_class();
+                case '.': return NodeP(new Node(Node::ANY));
+                case '^': return NodeP(new Node(Node::A_BOL));
+                case '$': return NodeP(new Node(Node::A_EOL));
+                case '*': case '+': case '?':
+                    throw RegexError("nothing to repeat");
+                case '\\':
+                {
+                    if (!at_end() && (*m_p == 'b' || *m_p == 'B'))
+                        return NodeP(new Node(*m_p++ == 'b' ? Node::A_WORDB
+                                                            : Node::A_NWORDB));
+                    NodeP n(new Node(Node::SET));
+                    int ch = parse_escape_char(n->set, false);
+                    if (ch >= 0) add_char(n->set, (unsigned char) ch);
+                    return n;
+                }
+                default:
+                {
+                    NodeP n(new Node(Node::SET));
+                    add_char(n->set, (unsigned char) c);
+                    return n;
+                }
+            }
+        }
+
+        /// Parses "{n}", "{n,}" or "{n,m}". Returns false (and leaves the
+        /// position alone) if it's not a quantifier, the '{' is a literal.
+        bool parse_braces(int &min, int &max)
+        {
+            const char *p = m_p + 1;
+            auto number = [&](int &out) -> bool
+            {
+                if (p >= m_end || *p < '0' || *p > '9') return false;
+                out = 0;
+                while (p < m_end && *p >= '0' && *p <= '9')
+                {
+                    out = out * 10 + (*p++ - '0');
+                    if (out > 10000) throw RegexError("repetition count too big");
+                }
+                return true;
+            };
+
+            if (!number(min)) return false;
+            max = min;
+            if (p < m_end && *p == ',')
+            {
+                p++;
+                if (!number(max)) max = -1;
+            }
+            if (p >= m_end || *p != '}') return false;
+            if (max >= 0 && max < min) throw RegexError("bad repetition range");
+            m_p = p + 1;
+            return true;
+        }
+
+        NodeP parse_repeat()
+        {
+            NodeP atom = parse_atom();
+            if (at_end()) return atom;
+
+            int min, max;
+            switch (*m_p)
+            {
+                case '*': min = 0; max = -1; m_p++; break;
+                case '+': min = 1; max = -1; m_p++; break;
+                case '?': min = 0; max = 1;  m_p++; break;
+                case '{':
+                    if (!parse_braces(min, max)) return atom;
+                    break;
+                default:
+                    return atom;
+            }
+
+            if (atom->type >= Node::A_BOL)
+                throw RegexError("nothing to repeat");
+
+            NodeP n(new Node(Node::REPEAT));
+            n->min = min;
+            n->max = max;
+            if (!at_end() && *m_p == '?')
+            {
+                n->greedy = false;
+                m_p++;
+            }
+            if (!at_end() && (*m_p == '*' || *m_p == '+' || *m_p == '?'))
+                throw RegexError("nothing to repeat");
+            n->kids.push_back(std::move(atom));
+            return n;
+        }
+
+        NodeP parse_concat()
+        {
+            NodeP n(new Node(Node::CAT));
+            while (!at_end() && *m_p != '|' && *m_p != ')')
+                n->kids.push_back(parse_repeat());
+            return n;
+        }
+
+        NodeP parse_alt()
+        {
+            NodeP first = parse_concat();
+            if (at_end() || *m_p != '|')
+                return first;
+
+            NodeP n(new Node(Node::ALT));
+            n->kids.push_back(std::move(first));
+            while (!at_end() && *m_p == '|')
+            {
+                m_p++;
+                n->kids.push_back(parse_concat());
+            }
+            return n;
+        }
+
+    public:
+        Parser(const std::string &pattern, bool icase)
+            : m_p(pattern.data()),
+              m_end(pattern.data() + pattern.size()),
+              m_icase(icase),
+              m_ngroups(0)
+        { }
+
+        NodeP parse()
+        {
+            NodeP n = parse_alt();
+            if (!at_end())
+                throw RegexError("unmatched ')'");
+            return n;
+        }
+
+        int groups() const { return m_ngroups; }
+};
+//---------------------------------------------------------------------------
+
+class Compiler
+{
+    private:
+        std::vector<Inst>    &m_prog;
+        std::vector<ByteSet> &m_sets;
+        size_t                m_base;
+        int                   m_iter_depth;     // of the current iteration
+        int                   m_max_iter_depth;
+
+        int emit(Regex::Op op, int arg = 0, int x = 0, int y = 0)
+        {
+            if (m_prog.size() - m_base >= MAX_PROG_SIZE)
+                throw RegexError("pattern too large");
+            Inst i;
+            i.op  = op;
+            i.arg = arg;
+            i.x   = x;
+            i.y   = y;
+            m_prog.push_back(i);
+            return (int) m_prog.size() - 1;
+        }
+
+        int pc() const { return (int) m_prog.size(); }
+
+        void set_split(int split, int body, int skip, bool greedy)
+        {
+            m_prog[split].x = greedy ? body : skip;
+            m_prog[split].y = greedy ? skip : body;
+        }
+
+        /// Finds the first and last group number in n, the groups
+        /// are numbered in order. Returns false if there is none.
+        static bool group_range(const Node &n, int &first, int &last)
+        {
+            bool found = false;
+            if (n.type == Node::GROUP && n.group >= 0)
+            {
+                first = last = n.group;
+                found = true;
+            }
+            for (auto &k : n.kids)
+            {
+                int f = -1, l = -1;
+                if (!group_range(*k, f, l))
+                    continue;
+                if (!found) first = f;
+                last  = l;
+                found = true;
+            }
+            return found;
+        }
+
+        /// Can n match the empty string?
+        static bool nullable(const Node &n)
+        {
+            switch (n.type)
+            {
+                case Node::SET:
+                case Node::ANY:
+                    return false;
+                case Node::CAT:
+                    for (auto &k : n.kids)
+                        if (!nullable(*k)) return false;
+                    return true;
+                case Node::ALT:
+                    for (auto &k : n.kids)
+                        if (nullable(*k)) return true;
+                    return false;
+                case Node::GROUP:
+                    return nullable(*n.kids[0]);
+                case Node::REPEAT:
+                    return n.min == 0 || nullable(*n.kids[0]);
+                default:
+                    return true;
+            }
+        }
+
+        /// Compiles one iteration of a quantified atom, which starts
+        /// with clearing the groups of the previous iteration. A checked
+        /// iteration is one beyond the minimum count, that must not
+        /// match the empty string.
+        void compile_iteration(const Node &k, bool has_groups, int first, int last,
+                               bool checked = false)
+        {
+            if (checked)
+            {
+                emit(Regex::ITER_BEGIN);
+                m_max_iter_depth = std::max(m_max_iter_depth, ++m_iter_depth);
+            }
+            if (has_groups)
+                emit(Regex::RESET, first, 0, last);
+            compile(k);
+            if (checked)
+            {
+                emit(Regex::ITER_END);
+                m_iter_depth--;
+            }
+        }
+
+    public:
+        Compiler(std::vector<Inst> &prog, std::vector<ByteSet> &sets)
+            : m_prog(prog), m_sets(sets), m_base(prog.size()),
+              m_iter_depth(0), m_max_iter_depth(0)
+        { }
+
+        /// How deep the checked iterations are nested.
+        int max_iter_depth() const { return m_max_iter_depth; }
+
+        void compile(const Node &n)
+        {
+            switch (n.type)
+            {
+                case Node::EMPTY:
+                    break;
+
+                case Node::SET:
+                {
+                    int count = 0, last = 0;
+                    for (int c = 0; c < 256 && count < 2; c++)
+                        if (n.set.has((unsigned char) c)) { count++; last = c; }
+
+                    if (count == 1)
+                        emit(Regex::CHAR, last);
+                    else
+                    {
+                        m_sets.push_back(n.set);
+                        emit(Regex::CLASS, (int) m_sets.size() - 1);
+                    }
+                    break;
+                }
+
+                case Node::ANY:      emit(Regex::ANY);    break;
+                case Node::A_BOL:    emit(Regex::BOL);    break;
+                case Node::A_EOL:    emit(Regex::EOL);    break;
+                case Node::A_WORDB:  emit(Regex::WORDB);  break;
+                case Node::A_NWORDB: emit(Regex::NWORDB); break;
+
+                case Node::CAT:
+                    for (auto &k : n.kids)
+                        compile(*k);
+                    break;
+
+                case Node::ALT:
+                {
+                    std::vector<int> jumps;
+                    for (size_t i = 0; i + 1 < n.kids.size(); i++)
+                    {
+                        int split = emit(Regex::SPLIT);
+                        m_prog[split].x = pc();
+                        compile(*n.kids[i]);
+                        jumps.push_back(emit(Regex::JMP));
+                        m_prog[split].y = pc();
+                    }
+                    compile(*n.kids.back());
+                    for (int j : jumps)
+                        m_prog[j].x = pc();
+                    break;
+                }
+
+                case Node::GROUP:
+                    if (n.group >= 0) emit(Regex::SAVE, 2 * n.group);
+                    compile(*n.kids[0]);
+                    if (n.group >= 0) emit(Regex::SAVE, 2 * n.group + 1);
+                    break;
+
+                case Node::REPEAT:
+                {
+                    const Node &k = *n.kids[0];
+                    int  first = 0, last = 0;
+                    bool has_groups = group_range(k, first, last);
+
+                    for (int i = 0; i < n.min; i++)
+                        compile_iteration(k, has_groups, first, last);
+
+                    // like in ECMAScript, the optional iterations fail
+                    // if they match the empty string
+                    bool checked = nullable(k);
+
+                    if (n.max < 0)
+                    {
+                        int split = emit(Regex::SPLIT);
+                        compile_iteration(k, has_groups, first, last, checked);
+                        emit(Regex::JMP, 0, split);
+                        set_split(split, split + 1, pc(), n.greedy);
+                    }
+                    else
+                    {
+                        std::vector<int> splits;
+                        for (int i = n.min; i < n.max; i++)
+                        {
+                            splits.push_back(emit(Regex::SPLIT));
+                            compile_iteration(k, has_groups, first, last, checked);
+                        }
+                        for (int s : splits)
+                            set_split(s, s + 1, pc(), n.greedy);
+                    }
+                    break;
+                }
+            }
+        }
+};
+//---------------------------------------------------------------------------
+
+Regex::Regex(const std::string &pattern, bool icase)
+    : m_ngroups(0), m_iter_depth(0), m_dfa_usable(true)
+{
+    Parser p(pattern, icase);
+    NodeP root = p.parse();
+    m_ngroups = p.groups();
+
+    Compiler c(m_prog, m_sets);
+    Inst save0 = { SAVE, 0, 0, 0 };
+    m_prog.push_back(save0);
+    c.compile(*root);
+    m_iter_depth = c.max_iter_depth();
+    Inst save1 = { SAVE, 1, 0, 0 };
+    Inst match = { MATCH, 0, 0, 0 };
+    m_prog.push_back(save1);
+    m_prog.push_back(match);
+
+    // \b needs the previous byte, which is not part of a DFA state
+    for (auto &i : m_prog)
+        if (i.op == WORDB || i.op == NWORDB)
+            m_dfa_usable = false;
+
+    // all instructions but JMP and SPLIT continue with the next one
+    for (size_t i = 0; i < m_prog.size(); i++)
+        if (m_prog[i].op != JMP && m_prog[i].op != SPLIT)
+            m_prog[i].x = (int) i + 1;
+}
+//---------------------------------------------------------------------------
+
+// The DFA states are sets of NFA instructions, that either consume a
+// byte (CHAR, ANY, CLASS), or MATCH or EOL. '^' is resolved while
+// building the start state.
+
+/// Follows the epsilon transitions from seeds. '^' only holds at_start.
+static void closure(const std::vector<Inst> &prog, const std::vector<int> &seeds,
+                    bool at_start, std::vector<int> &out)
+{
+    std::vector<char> seen(prog.size(), 0);
+    std::vector<int>  stack(seeds.rbegin(), seeds.rend());
+    out.clear();
+
+    while (!stack.empty())
+    {
+        int pc = stack.back();
+        stack.pop_back();
+        if (seen[pc]) continue;
+        seen[pc] = 1;
+
+        const Inst &i = prog[pc];
+        switch (i.op)
+        {
+            case Regex::JMP:  stack.push_back(i.x); break;
+            case Regex::SPLIT:
+                stack.push_back(i.y);
+                stack.push_back(i.x);
+                break;
+            case Regex::SAVE:
+            case Regex::RESET:
+            case Regex::ITER_BEGIN:
+            case Regex::ITER_END: stack.push_back(i.x); break;
+            case Regex::BOL:
+                if (at_start) stack.push_back(i.x);
+                break;
+            default:
+                out.push_back(pc);
+        }
+    }
+    std::sort(out.begin(), out.end());
+}
+//---------------------------------------------------------------------------
+
+/// Collects the args of the MATCH instructions, that are reached if the
+/// input ends in a state with pcs. '$' holds there, so everything behind
+/// it is reachable too.
+static void end_matches(const std::vector<Inst> &prog, const std::vector<int> &pcs,
+                        bool at_start, std::vector<int> &out)
+{
+    std::vector<char> seen(prog.size(), 0);
+    std::vector<int>  todo(pcs);
+    std::vector<int>  more;
+    out.clear();
+
+    while (!todo.empty())
+    {
+        int pc = todo.back();
+        todo.pop_back();
+        if (seen[pc]) continue;
+        seen[pc] = 1;
+
+        if (prog[pc].op == Regex::MATCH)
+            out.push_back(prog[pc].arg);
+        else if (prog[pc].op == Regex::EOL)
+        {
+            std::vector<int> seed(1, prog[pc].x);
+            closure(prog, seed, at_start, more);
+            todo.insert(todo.end(), more.begin(), more.end());
+        }
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+//---------------------------------------------------------------------------
+
+/// Collects the successors of the instructions in pcs, that consume c.
+static void consume(const std::vector<Inst> &prog, const std::vector<ByteSet> &sets,
+                    const std::vector<int> &pcs, unsigned char c,
+                    std::vector<int> &seeds)
+{
+    seeds.clear();
+    for (int pc : pcs)
+    {
+        const Inst &i = prog[pc];
+        bool ok = false;
+        switch (i.op)
+        {
+            case Regex::CHAR:  ok = i.arg == c; break;
+            case Regex::ANY:   ok = c != '\n' && c != '\r'; break;
+            case Regex::CLASS: ok = sets[i.arg].has(c); break;
+            default: break;
+        }
+        if (ok) seeds.push_back(i.x);
+    }
+}
+//---------------------------------------------------------------------------
+
+struct Regex::DFA
+{
+    struct State
+    {
+        std::vector<int> pcs;
+        bool             has_match;     // a match was already seen
+        bool             accepts_at_end;
+        int              next[256];
+    };
+
+    const Regex                    &m_re;
+    bool                            m_whole;
+    std::vector<State>              m_states;
+    std::map<std::vector<int>, int> m_index;
+    std::vector<int>                m_restart;  // closure of pc 0 w/o '^'
+    bool                            m_overflow;
+    int                             m_start;
+
+    DFA(const Regex &re, bool whole)
+        : m_re(re), m_whole(whole), m_overflow(false), m_start(-1)
+    {
+        std::vector<int> seed(1, 0);
+        closure(m_re.m_prog, seed, false, m_restart);
+
+        std::vector<int> start;
+        closure(m_re.m_prog, seed, true, start);
+        m_start = state(start);
+    }
+
+    int state(std::vector<int> &pcs)
+    {
+        auto it = m_index.find(pcs);
+        if (it != m_index.end())
+            return it->second;
+
+        if (m_states.size() >= MAX_DFA_STATES)
+        {
+            m_overflow = true;
+            return -1;
+        }
+
+        State s;
+        s.has_match = false;
+        for (int pc : pcs)
+            if (m_re.m_prog[pc].op == MATCH) s.has_match = true;
+        std::vector<int> ends;
+        end_matches(m_re.m_prog, pcs, false, ends);
+        s.accepts_at_end = !ends.empty();
+        for (int i = 0; i < 256; i++) s.next[i] = -1;
+        s.pcs = pcs;
+
+        m_states.push_back(std::move(s));
+        int idx = (int) m_states.size() - 1;
+        m_index[pcs] = idx;
+        return idx;
+    }
+
+    int step(int st, unsigned char c)
+    {
+        std::vector<int> seeds;
+        consume(m_re.m_prog, m_re.m_sets, m_states[st].pcs, c, seeds);
+
+        std::vector<int> next;
+        closure(m_re.m_prog, seeds, false, next);
+        if (!m_whole)
+        {
+            // a new match attempt may start at every position
+            std::vector<int> merged;
+            std::set_union(next.begin(), next.end(),
+                           m_restart.begin(), m_restart.end(),
+                           std::back_inserter(merged));
+            next.swap(merged);
+        }
+
+        int ns = state(next);
+        if (ns >= 0)
+            m_states[st].next[c] = ns;
+        return ns;
+    }
+
+    /// 1: match, 0: no match, -1: too many states, use the NFA
+    int run(const char *p, const char *e)
+    {
+        // on empty input '^' may also follow '$', leave that to the NFA
+        if (m_overflow || p == e) return -1;
+
+        int st = m_start;
+        for (; p < e; p++)
+        {
+            if (!m_whole && m_states[st].has_match)
+                return 1;
+            if (m_states[st].pcs.empty())
+                return 0;
+
+            int ns = m_states[st].next[(unsigned char) *p];
+            if (ns < 0)
+            {
+                ns = step(st, (unsigned char) *p);
+                if (ns < 0) return -1;
+            }
+            st = ns;
+        }
+        return m_states[st].accepts_at_end ? 1 : 0;
+    }
+};
+//---------------------------------------------------------------------------
+
+Regex::~Regex()
+{
+}
+//---------------------------------------------------------------------------
+
+int Regex::dfa_check(bool whole, const char *b, const char *e) const
+{
+    if (!m_dfa_usable)
+        return -1;
+
+    // Another thread is using the DFA, simulating the NFA is
+    // still better than waiting.
+    std::unique_lock<std::mutex> lock(m_dfa_mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        return -1;
+
+    std::unique_ptr<DFA> &dfa = whole ? m_dfa_whole : m_dfa_search;
+    if (!dfa)
+        dfa.reset(new DFA(*this, whole));
+    return dfa->run(b, e);
+}
+//---------------------------------------------------------------------------
+
+namespace
+{
+struct ThreadList
+{
+    std::vector<int>          pcs;
+    std::vector<const char *> caps;
+    std::vector<uint32_t>     mark;
+    uint32_t                  gen;
+
+    ThreadList(size_t prog_size) : mark(prog_size, 0), gen(1) { }
+
+    void clear()
+    {
+        pcs.clear();
+        caps.clear();
+        gen++;
+    }
+};
+
+struct StackEntry
+{
+    int           pc;
+    int           iters;    // checked iterations begun at this position
+    const char  **slot;     // if set: restore *slot to old
+    const char   *old;
+};
+}
+//---------------------------------------------------------------------------
+
+bool Regex::pike(int flags, const char *b, const char *e,
+                 const char *start, Match &m) const
+{
+    const bool anchored = (flags & (P_ANCHORED | P_WHOLE)) != 0;
+    const bool whole    = (flags & P_WHOLE) != 0;
+    const bool not_null = (flags & P_NOT_NULL) != 0;
+
+    const size_t ncap = 2 * (m_ngroups + 1);
+
+    // An iteration, that began at the current position, must not end
+    // there. The iterations begun at p on a path are always the
+    // innermost ones, so their number is all that matters for where
+    // the path can go. It's part of the marks of the epsilon moves, but
+    // not of the threads, as it's 0 again after consuming a byte.
+    const size_t stride = (size_t) m_iter_depth + 1;
+
+    ThreadList clist(m_prog.size() * stride), nlist(m_prog.size() * stride);
+    std::vector<StackEntry>   stack;
+    std::vector<const char *> fresh(ncap, nullptr);
+    std::vector<const char *> work(ncap);
+    bool matched = false;
+
+    // Adds the thread at pc0 with the captures in caps (which are
+    // modified temporarily) and everything reachable by epsilon moves
+    // to l, in priority order.
+    auto add = [&](ThreadList &l, int pc0, const char **caps, const char *p)
+    {
+        StackEntry first = { pc0, 0, nullptr, nullptr };
+        stack.push_back(first);
+        while (!stack.empty())
+        {
+            StackEntry se = stack.back();
+            stack.pop_back();
+            if (se.slot)
+            {
+                *se.slot = se.old;
+                continue;
+            }
+
+            int pc = se.pc;
+            const Inst &i = m_prog[pc];
+            // CHAR, ANY, CLASS and MATCH end the epsilon moves
+            size_t key = pc * stride + (i.op <= MATCH ? 0 : se.iters);
+            if (l.mark[key] == l.gen) continue;
+            l.mark[key] = l.gen;
+
+            StackEntry next = { i.x, se.iters, nullptr, nullptr };
+            switch (i.op)
+            {
+                case JMP:
+                    stack.push_back(next);
+                    break;
+                case SPLIT:
+                {
+                    StackEntry alt = { i.y, se.iters, nullptr, nullptr };
+                    stack.push_back(alt);
+                    stack.push_back(next);
+                    break;
+                }
+                case SAVE:
+                {
+                    StackEntry restore = { 0, 0, &caps[i.arg], caps[i.arg] };
+                    stack.push_back(restore);
+                    caps[i.arg] = p;
+                    stack.push_back(next);
+                    break;
+                }
+                case RESET:
+                {
+                    for (int s = 2 * i.arg; s <= 2 * i.y + 1; s++)
+                    {
+                        StackEntry restore = { 0, 0, &caps[s], caps[s] };
+                        stack.push_back(restore);
+                        caps[s] = nullptr;
+                    }
+                    stack.push_back(next);
+                    break;
+                }
+                case ITER_BEGIN:
+                    next.iters++;
+                    stack.push_back(next);
+                    break;
+                case ITER_END:
+                    if (se.iters == 0) stack.push_back(next);
+                    break;
+                case BOL:
+                    if (p == b) stack.push_back(next);
+                    break;
+                case EOL:
+                    if (p == e) stack.push_back(next);
+                    break;
+                case WORDB:
+                case NWORDB:
+                {
+                    bool before = p > b && is_word((unsigned char) p[-1]);
+                    bool after  = p < e && is_word((unsigned char) *p);
+                    if ((before != after) == (i.op == WORDB))
+                        stack.push_back(next);
+                    break;
+                }
+                default:
+                    l.pcs.push_back(pc);
+                    l.caps.insert(l.caps.end(), caps, caps + ncap);
+            }
+        }
+    };
+
+    for (const char *p = start; ; p++)
+    {
+        if (!matched && (!anchored || p == start))
+        {
+            std::copy(fresh.begin(), fresh.end(), work.begin());
+            add(clist, 0, work.data(), p);
+        }
+        if (clist.pcs.empty() && (matched || anchored))
+            break;
+
+        nlist.clear();
+        unsigned char c = p < e ? (unsigned char) *p : 0;
+        for (size_t t = 0; t < clist.pcs.size(); t++)
+        {
+            const Inst &i = m_prog[clist.pcs[t]];
+            const char **tcaps = &clist.caps[t * ncap];
+
+            bool ok = false;
+            switch (i.op)
+            {
+                case CHAR:  ok = p < e && i.arg == c; break;
+                case ANY:   ok = p < e && c != '\n' && c != '\r'; break;
+                case CLASS: ok = p < e && m_sets[i.arg].has(c); break;
+                case MATCH:
+                    if ((whole && p != e) || (not_null && tcaps[0] == p))
+                        break;
+                    m.m_caps.assign(tcaps, tcaps + ncap);
+                    matched = true;
+                    // threads with lower priority can't win anymore
+                    t = clist.pcs.size();
+                    continue;
+                default:
+                    break;
+            }
+            if (ok)
+                add(nlist, i.x, tcaps, p + 1);
+        }
+
+        std::swap(clist, nlist);
+        if (p >= e)
+            break;
+    }
+
+    return matched;
+}
+//---------------------------------------------------------------------------
+
+bool Regex::match(const char *b, const char *e, Match &m) const
+{
+    if (dfa_check(true, b, e) == 0)
+        return false;
+    return pike(P_WHOLE, b, e, b, m);
+}
+//---------------------------------------------------------------------------
+
+bool Regex::search(const char *b, const char *e, const char *start, Match &m) const
+{
+    if (start == b && dfa_check(false, b, e) == 0)
+        return false;
+    return pike(0, b, e, start, m);
+}
+//---------------------------------------------------------------------------
+
+bool Regex::next(const char *b, const char *e, Match &m) const
+{
+    if (m.size() == 0)
+        return search(b, e, b, m);
+
+    const char *pos = m.end(0);
+    if (m.begin(0) != pos)
+        return search(b, e, pos, m);
+
+    if (pos >= e)
+        return false;
+    if (pike(P_ANCHORED | P_NOT_NULL, b, e, pos, m))
+        return true;
+    return search(b, e, pos + 1, m);
+}
+//---------------------------------------------------------------------------
+
+std::string Regex::replace(const std::string &in, const std::string &fmt) const
+{
+    const char *b   = in.data();
+    const char *e   = b + in.size();
+    const char *pos = b;
+    std::string out;
+    Match m;
+
+    while (next(b, e, m))
+    {
+        out.append(pos, m.begin(0) - pos);
+
+        for (size_t i = 0; i < fmt.size(); i++)
+        {
+            char c = fmt[i];
+            if (c != '$' || i + 1 >= fmt.size())
+            {
+                out += c;
+                continue;
+            }
+
+            char n = fmt[++i];
+            if (n == '$')       out += '$';
+            else if (n == '&')  out.append(m.begin(0), m.end(0) - m.begin(0));
+            else if (n == '`')  out.append(b, m.begin(0) - b);
+            else if (n == '\'') out.append(m.end(0), e - m.end(0));
+            else if (n >= '0' && n <= '9')
+            {
+                size_t g = n - '0';
+                if (i + 1 < fmt.size() && fmt[i + 1] >= '0' && fmt[i + 1] <= '9'
+                    && g * 10 + (fmt[i + 1] - '0') < m.size())
+                    g = g * 10 + (fmt[++i] - '0');
+                if (g < m.size()) out += m.str(g);
+            }
+            else
+            {
+                out += '$';
+                out += n;
+            }
+        }
+
+        pos = m.end(0);
+    }
+
+    if (pos < e)
+        out.append(pos, e - pos);
+    return out;
+}
+//---------------------------------------------------------------------------
+
+// The patterns of a RegexSet are compiled one after another into the same
+// program, every one ends with a MATCH that has the index of the pattern
+// as arg. A new attempt of every unanchored pattern begins at each
+// position: the closure of their entries (the restart set) is part of
+// every state. It is left out of the stored states and the transitions
+// out of it are computed once, otherwise every state would hold all
+// patterns. A MATCH of an unanchored pattern stays in the states once
+// reached, so the final state holds all patterns that matched somewhere.
+
+RegexSet::RegexSet()
+{
+}
+//---------------------------------------------------------------------------
+
+RegexSet::~RegexSet()
+{
+}
+//---------------------------------------------------------------------------
+
+int RegexSet::add(const std::string &pattern, int flags)
+{
+    const bool icase = (flags & ICASE) != 0;
+    const bool whole = (flags & WHOLE) != 0;
+
+    Parser p(pattern, icase);
+    NodeP root = p.parse();
+
+    int    index = (int) m_whole.size();
+    size_t prog0 = m_prog.size();
+    size_t sets0 = m_sets.size();
+
+    Compiler c(m_prog, m_sets);
+    c.compile(*root);
+
+    bool nfa_only = false;
+    for (size_t i = prog0; i < m_prog.size(); i++)
+    {
+        if (m_prog[i].op == Regex::WORDB || m_prog[i].op == Regex::NWORDB)
+            nfa_only = true;
+        if (m_prog[i].op != Regex::JMP && m_prog[i].op != Regex::SPLIT)
+            m_prog[i].x = (int) i + 1;
+    }
+
+    if (nfa_only)
+    {
+        m_prog.resize(prog0);
+        m_sets.resize(sets0);
+
+        NFAOnly n;
+        n.index = index;
+        n.whole = whole;
+        n.re.reset(new Regex(pattern, icase));
+        m_nfa_only.push_back(std::move(n));
+    }
+    else
+    {
+        Inst match = { Regex::MATCH, index, 0, 0 };
+        m_prog.push_back(match);
+        m_entries.push_back((int) prog0);
+    }
+
+    m_whole.push_back(whole);
+    m_dfa.reset();
+    return index;
+}
+//---------------------------------------------------------------------------
+
+/// Everything a RegexSet needs to step from one set of instructions to
+/// the next, without the restart set in the sets.
+struct SetStepper
+{
+    const std::vector<Inst>    &m_prog;
+    const std::vector<ByteSet> &m_sets;
+    const std::vector<char>    &m_whole;
+
+    std::vector<int>            m_restart;
+    std::vector<char>           m_in_restart;
+    std::vector<int>            m_restart_seeds[256];
+    std::vector<int>            m_start;
+    std::vector<int>            m_seeds;
+    std::vector<int>            m_tmp;
+
+    SetStepper(const std::vector<Inst> &prog, const std::vector<ByteSet> &sets,
+               const std::vector<char> &whole, const std::vector<int> &entries)
+        : m_prog(prog), m_sets(sets), m_whole(whole),
+          m_in_restart(prog.size(), 0)
+    {
+        std::vector<int> unanchored;
+        for (int e : entries)
+            if (!whole[m_prog[next_match(e)].arg])
+                unanchored.push_back(e);
+
+        closure(m_prog, unanchored, false, m_restart);
+        for (int pc : m_restart)
+            m_in_restart[pc] = 1;
+        for (int c = 0; c < 256; c++)
+            consume(m_prog, m_sets, m_restart, (unsigned char) c, m_restart_seeds[c]);
+
+        closure(m_prog, entries, true, m_tmp);
+        without_restart(m_tmp, m_start);
+    }
+
+    /// The MATCH at the end of the pattern that starts at pc.
+    int next_match(int pc) const
+    {
+        while (m_prog[pc].op != Regex::MATCH) pc++;
+        return pc;
+    }
+
+    void without_restart(const std::vector<int> &in, std::vector<int> &out) const
+    {
+        out.clear();
+        for (int pc : in)
+            if (!m_in_restart[pc])
+                out.push_back(pc);
+    }
+
+    void step(const std::vector<int> &pcs, unsigned char c, std::vector<int> &next)
+    {
+        consume(m_prog, m_sets, pcs, c, m_seeds);
+        m_seeds.insert(m_seeds.end(),
+                       m_restart_seeds[c].begin(), m_restart_seeds[c].end());
+
+        // a match of an unanchored pattern stays, whatever follows
+        for (int pc : pcs)
+            if (m_prog[pc].op == Regex::MATCH && !m_whole[m_prog[pc].arg])
+                m_seeds.push_back(pc);
+
+        closure(m_prog, m_seeds, false, m_tmp);
+        without_restart(m_tmp, next);
+    }
+
+    void ends(const std::vector<int> &pcs, bool at_start, std::vector<int> &out)
+    {
+        m_tmp = pcs;
+        m_tmp.insert(m_tmp.end(), m_restart.begin(), m_restart.end());
+        end_matches(m_prog, m_tmp, at_start, out);
+    }
+};
+//---------------------------------------------------------------------------
+
+struct RegexSet::DFA
+{
+    struct State
+    {
+        std::vector<int> pcs;
+        std::vector<int> ends;      // matching patterns if the input ends here
+        bool             ends_done;
+        int              next[256];
+    };
+
+    SetStepper                      m_stepper;
+    std::vector<State>              m_states;
+    std::map<std::vector<int>, int> m_index;
+    int                             m_start;
+    size_t                          m_flushes;
+    std::vector<int>                m_next;
+
+    explicit DFA(const RegexSet &rs)
+        : m_stepper(rs.m_prog, rs.m_sets, rs.m_whole, rs.m_entries),
+          m_start(-1),
+          m_flushes(0)
+    {
+    }
+
+    int state(const std::vector<int> &pcs)
+    {
+        auto it = m_index.find(pcs);
+        if (it != m_index.end())
+            return it->second;
+
+        if (m_states.size() >= MAX_DFA_STATES)
+        {
+            // start over instead of giving up, only the states that are
+            // really in use come back
+            m_states.clear();
+            m_index.clear();
+            m_start = -1;
+            m_flushes++;
+        }
+
+        State s;
+        s.pcs       = pcs;
+        s.ends_done = false;
+        for (int i = 0; i < 256; i++) s.next[i] = -1;
+
+        m_states.push_back(std::move(s));
+        int idx = (int) m_states.size() - 1;
+        m_index[pcs] = idx;
+        return idx;
+    }
+
+    void run(const char *p, const char *e, std::vector<int> &out)
+    {
+        if (m_start < 0)
+            m_start = state(m_stepper.m_start);
+
+        int st = m_start;
+        for (; p < e; p++)
+        {
+            unsigned char c = (unsigned char) *p;
+            int ns = m_states[st].next[c];
+            if (ns < 0)
+            {
+                m_stepper.step(m_states[st].pcs, c, m_next);
+
+                size_t flushes = m_flushes;
+                ns = state(m_next);
+                // st is gone, if the cache was flushed
+                if (flushes == m_flushes)
+                    m_states[st].next[c] = ns;
+            }
+            st = ns;
+        }
+
+        State &s = m_states[st];
+        if (!s.ends_done)
+        {
+            m_stepper.ends(s.pcs, false, s.ends);
+            s.ends_done = true;
+        }
+        out.insert(out.end(), s.ends.begin(), s.ends.end());
+    }
+};
+//---------------------------------------------------------------------------
+
+void RegexSet::nfa_matches(const char *b, const char *e, std::vector<int> &out) const
+{
+    SetStepper stepper(m_prog, m_sets, m_whole, m_entries);
+    std::vector<int> pcs(stepper.m_start), next, ends;
+    for (const char *p = b; p < e; p++)
+    {
+        stepper.step(pcs, (unsigned char) *p, next);
+        pcs.swap(next);
+    }
+    stepper.ends(pcs, b == e, ends);
+    out.insert(out.end(), ends.begin(), ends.end());
+}
+//---------------------------------------------------------------------------
+
+void RegexSet::matches(const char *b, const char *e, std::vector<int> &out) const
+{
+    out.clear();
+
+    if (!m_entries.empty())
+    {
+        // on empty input '^' may also follow '$', see Regex::DFA::run()
+        std::unique_lock<std::mutex> lock(m_dfa_mutex, std::try_to_lock);
+        if (b != e && lock.owns_lock())
+        {
+            if (!m_dfa)
+                m_dfa.reset(new DFA(*this));
+            m_dfa->run(b, e, out);
+        }
+        else
+            nfa_matches(b, e, out);
+    }
+
+    Match m;
+    for (auto &n : m_nfa_only)
+    {
+        bool ok = n.whole ? n.re->match(b, e, m) : n.re->search(b, e, b, m);
+        if (ok) out.push_back(n.index);
+    }
+    std::sort(out.begin(), out.end());
+}
+//---------------------------------------------------------------------------
+
+} // namespace dfa_regex
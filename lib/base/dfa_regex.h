@@ -0,0 +1,231 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include "compat_stdint.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Regular expressions, that are matched in time linear to the length of
+ * the input, independent of the pattern.
+ *
+ * The pattern (a subset of the ECMAScript syntax: no backreferences and
+ * no lookahead) is compiled into a small NFA program. Whether a string
+ * matches at all is decided by a lazily built DFA, which caches the
+ * transitions between sets of NFA states per regex. Only if there is a
+ * match, the NFA is simulated once more (Pike VM) to find the leftmost
+ * match and the submatches. As most lines in a typical grep don't match,
+ * most of the input is only ever seen by the DFA.
+ *
+ * Matching works on bytes, '.' and character classes match single bytes
+ * of UTF-8 input. A Regex can be used by multiple threads at once.
+ *
+ * Like in ECMAScript, the groups inside a quantified atom are cleared at
+ * the start of every iteration: "(?:(a)|b)+" leaves group 1 unmatched
+ * on "ab", and an iteration beyond the minimum count fails if it matches
+ * the empty string: "(\w*?)?" matches "c" at the start of "c 11", not "".
+ * The DFA ignores that rule, it never changes whether there is a match,
+ * only where it ends and what the groups contain.
+ *
+ * A RegexSet combines many patterns into one DFA, which tells in a single
+ * pass over the input, which of the patterns match. */
+
+namespace dfa_regex
+{
+//---------------------------------------------------------------------------
+
+class RegexError : public std::runtime_error
+{
+    public:
+        explicit RegexError(const std::string &msg)
+            : std::runtime_error("dfa_regex: " + msg)
+        { }
+};
+//---------------------------------------------------------------------------
+
+/// Positions of a match and its submatches. Group 0 is the whole match,
+/// unmatched groups have null pointers.
+class Match
+{
+    private:
+        std::vector<const char *> m_caps;
+        friend class Regex;
+
+    public:
+        size_t size() const { return m_caps.size() / 2; }
+        bool   matched(size_t i) const { return m_caps[2 * i] != nullptr; }
+        const char *begin(size_t i) const { return m_caps[2 * i]; }
+        const char *end(size_t i) const   { return m_caps[2 * i + 1]; }
+        std::string str(size_t i) const
+        {
+            if (!matched(i)) return std::string();
+            return std::string(begin(i), end(i) - begin(i));
+        }
+};
+//---------------------------------------------------------------------------
+
+class Regex
+{
+    public:
+        struct ByteSet
+        {
+            uint64_t w[4];
+
+            ByteSet() { w[0] = w[1] = w[2] = w[3] = 0; }
+            void set(unsigned char c)       { w[c >> 6] |= ((uint64_t) 1) << (c & 63); }
+            bool has(unsigned char c) const { return (w[c >> 6] >> (c & 63)) & 1; }
+        };
+
+        enum Op
+        {
+            CHAR, ANY, CLASS, MATCH, JMP, SPLIT, SAVE, BOL, EOL, WORDB, NWORDB,
+            RESET, ITER_BEGIN, ITER_END
+        };
+
+        struct Inst
+        {
+            Op  op;
+            int arg;    // CHAR: byte, CLASS: set index, SAVE: slot,
+                        // RESET: first group to clear
+            int x, y;   // JMP: x, SPLIT: x is preferred over y,
+                        // RESET: y is the last group to clear
+        };
+
+    private:
+        struct DFA;
+
+        std::vector<Inst>       m_prog;
+        std::vector<ByteSet>    m_sets;
+        int                     m_ngroups;
+        int                     m_iter_depth;   // see pike()
+        bool                    m_dfa_usable;
+
+        // the DFAs are built while matching, guarded by m_dfa_mutex
+        mutable std::mutex              m_dfa_mutex;
+        mutable std::unique_ptr<DFA>    m_dfa_search;
+        mutable std::unique_ptr<DFA>    m_dfa_whole;
+
+        enum PikeFlags
+        {
+            P_ANCHORED  = 1,    // the match has to begin at start
+            P_WHOLE     = 2,    // ... and end at e
+            P_NOT_NULL  = 4     // empty matches are not accepted
+        };
+
+        int  dfa_check(bool whole, const char *b, const char *e) const;
+        bool pike(int flags, const char *b, const char *e,
+                  const char *start, Match &m) const;
+
+    public:
+        /// Throws RegexError on syntax errors and unsupported features.
+        Regex(const std::string &pattern, bool icase = false);
+        ~Regex();
+
+        /// Number of capture groups, not counting the whole match.
+        size_t mark_count() const { return (size_t) m_ngroups; }
+
+        /// Does [b, e) match completely?
+        bool match(const char *b, const char *e, Match &m) const;
+        /// Finds the leftmost match in [start, e). b is the beginning of
+        /// the whole input, for '^' and '\b'.
+        bool search(const char *b, const char *e, const char *start, Match &m) const;
+
+        /// Finds the match after m in [b, e), or the first one if m is
+        /// empty. Like std::regex_iterator, a non empty match is tried
+        /// at the end of an empty one before moving on by one byte.
+        bool next(const char *b, const char *e, Match &m) const;
+
+        /// m points into s, which has to outlive it. Temporaries are
+        /// rejected for that reason.
+        bool match(const std::string &s, Match &m) const
+        { return match(s.data(), s.data() + s.size(), m); }
+        bool search(const std::string &s, Match &m) const
+        { return search(s.data(), s.data() + s.size(), s.data(), m); }
+        bool match(std::string &&s, Match &m) const = delete;
+        bool search(std::string &&s, Match &m) const = delete;
+
+        /// Replaces all matches like std::regex_replace(). The format
+        /// may contain $n, $&, $`, $' and $$.
+        std::string replace(const std::string &in, const std::string &fmt) const;
+};
+//---------------------------------------------------------------------------
+
+/// Patterns, that are matched against an input at once. The DFA cache
+/// is flushed when it gets full, so the time per input byte doesn't
+/// depend on the number of patterns. Patterns with \b and \B are
+/// matched one by one. All patterns have to be added before matching,
+/// matches() can then be used by multiple threads.
+class RegexSet
+{
+    public:
+        enum Flags
+        {
+            ICASE   = 1,
+            WHOLE   = 2     // the whole input has to match
+        };
+
+    private:
+        struct DFA;
+
+        struct NFAOnly
+        {
+            int                     index;
+            bool                    whole;
+            std::unique_ptr<Regex>  re;
+        };
+
+        std::vector<Regex::Inst>    m_prog;
+        std::vector<Regex::ByteSet> m_sets;
+        std::vector<int>            m_entries;  // first instruction of each pattern
+        std::vector<char>           m_whole;    // by pattern index
+        std::vector<NFAOnly>        m_nfa_only;
+
+        mutable std::mutex              m_dfa_mutex;
+        mutable std::unique_ptr<DFA>    m_dfa;
+
+        void nfa_matches(const char *b, const char *e, std::vector<int> &out) const;
+
+    public:
+        RegexSet();
+        ~RegexSet();
+
+        /// Adds a pattern and returns its index, the indices are counted
+        /// from 0. Throws RegexError like Regex().
+        int add(const std::string &pattern, int flags = 0);
+
+        size_t size() const { return m_whole.size(); }
+
+        /// Stores the indices of the matching patterns in out, ascending.
+        /// Patterns without WHOLE may match anywhere in [b, e).
+        void matches(const char *b, const char *e, std::vector<int> &out) const;
+        void matches(const std::string &s, std::vector<int> &out) const
+        { matches(s.data(), s.data() + s.size(), out); }
+};
+//---------------------------------------------------------------------------
+
+} // namespace dfa_regex
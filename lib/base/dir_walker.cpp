@@ -0,0 +1,405 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "dir_walker.h"
+#include <algorithm>
+
+#if defined(_WIN32)
+#   include <boost/filesystem.hpp>
+#else
+#   include <dirent.h>
+#   include <fcntl.h>
+#   include <sys/stat.h>
+#   include <sys/types.h>
+#   include <unistd.h>
+#endif
+
+using namespace VVal;
+
+namespace dir_walker
+{
+//---------------------------------------------------------------------------
+
+const char *file_type_name(FileType t)
+{
+    switch (t)
+    {
+        case T_REGULAR:     return "regular";
+        case T_DIRECTORY:   return "directory";
+        case T_SYMLINK:     return "symlink";
+        case T_BLOCK:       return "block";
+        case T_CHAR:        return "char";
+        case T_FIFO:        return "fifo";
+        case T_SOCKET:      return "socket";
+        case T_NOT_FOUND:   return "not_found";
+        case T_ERROR:       return "error";
+        case T_UNKNOWN:
+        default:            return "unknown";
+    }
+}
+//---------------------------------------------------------------------------
+
+Walker::Walker(const std::string &root, const Options &opts)
+    : m_opts(opts), m_inline(false), m_pending(1), m_running(0),
+      m_stop(false), m_errors(0)
+{
+    if (m_opts.batch_size == 0)  m_opts.batch_size  = 1;
+    if (m_opts.max_batches == 0) m_opts.max_batches = 1;
+
+    m_dirs.push_back(root);
+
+    m_inline = !m_opts.recursive || m_opts.threads == 1;
+    if (m_inline)
+        return;
+
+    int n = m_opts.threads;
+    if (n <= 0)
+        n = std::max(4, (int) std::thread::hardware_concurrency());
+
+    m_running = n;
+    for (int i = 0; i < n; i++)
+        m_threads.push_back(std::thread([this]() { worker(); }));
+}
+//---------------------------------------------------------------------------
+
+Walker::~Walker()
+{
+    stop();
+    for (auto &t : m_threads)
+        t.join();
+}
+//---------------------------------------------------------------------------
+
+void Walker::stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_dirs.clear();
+    m_work_cv.notify_all();
+    m_space_cv.notify_all();
+    m_out_cv.notify_all();
+}
+//---------------------------------------------------------------------------
+
+int64_t Walker::errors()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_errors;
+}
+//---------------------------------------------------------------------------
+
+VV Walker::next_batch()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_inline)
+    {
+        // read directories until at least one batch is complete,
+        // publish() doesn't wait for room in this mode
+        VV batch = vv_list();
+        while (m_batches.empty() && !m_dirs.empty())
+        {
+            std::string dir = std::move(m_dirs.front());
+            m_dirs.pop_front();
+            lock.unlock();
+
+            read_directory(dir, batch);
+
+            lock.lock();
+        }
+        if (batch->size() > 0 && !m_stop)
+            m_batches.push_back(batch);
+    }
+    else
+        m_out_cv.wait(lock, [this]() { return !m_batches.empty() || m_running == 0; });
+
+    if (m_batches.empty())
+        return vv_undef();
+
+    VV batch = m_batches.front();
+    m_batches.pop_front();
+    m_space_cv.notify_one();
+    return batch;
+}
+//---------------------------------------------------------------------------
+
+void Walker::publish(VV &batch)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_space_cv.wait(lock, [this]()
+    {
+        return m_inline || m_stop || m_batches.size() < m_opts.max_batches;
+    });
+    if (!m_stop)
+    {
+        m_batches.push_back(batch);
+        m_out_cv.notify_one();
+    }
+    batch = vv_list();
+}
+//---------------------------------------------------------------------------
+
+void Walker::worker()
+{
+    VV batch = vv_list();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        // hand out what we have before waiting for more work
+        if (m_dirs.empty() && batch->size() > 0)
+        {
+            lock.unlock();
+            publish(batch);
+            lock.lock();
+            continue;
+        }
+
+        m_work_cv.wait(lock, [this]()
+        {
+            return m_stop || !m_dirs.empty() || m_pending == 0;
+        });
+        if (m_stop || m_dirs.empty())
+            break;
+
+        std::string dir = std::move(m_dirs.front());
+        m_dirs.pop_front();
+        lock.unlock();
+
+        read_directory(dir, batch);
+
+        lock.lock();
+        if (--m_pending == 0)
+            m_work_cv.notify_all();
+    }
+
+    if (--m_running == 0)
+        m_out_cv.notify_all();
+}
+//---------------------------------------------------------------------------
+
+void Walker::add_entry(Entry &e, VV &batch)
+{
+    if (m_opts.recursive && e.type == T_DIRECTORY && !e.is_link)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_stop)
+        {
+            m_dirs.push_back(e.path);
+            m_pending++;
+            m_work_cv.notify_one();
+        }
+    }
+
+    VV v;
+    try
+    {
+        v = m_opts.convert ? m_opts.convert(e) : vv(e.path);
+    }
+    catch (const std::exception &)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_errors++;
+        return;
+    }
+
+    if (v->is_undef())
+        return;
+
+    batch << v;
+    if ((size_t) batch->size() >= m_opts.batch_size)
+        publish(batch);
+}
+//---------------------------------------------------------------------------
+
+#if defined(_WIN32)
+
+static FileType status_type(const boost::filesystem::file_status &s)
+{
+    using namespace boost::filesystem;
+    switch (s.type())
+    {
+        case status_error:      return T_ERROR;
+        case file_not_found:    return T_NOT_FOUND;
+        case regular_file:      return T_REGULAR;
+        case directory_file:    return T_DIRECTORY;
+        case symlink_file:      return T_SYMLINK;
+        case block_file:        return T_BLOCK;
+        case character_file:    return T_CHAR;
+        case fifo_file:         return T_FIFO;
+        case socket_file:       return T_SOCKET;
+        default:                return T_UNKNOWN;
+    }
+}
+//---------------------------------------------------------------------------
+
+void Walker::read_directory(const std::string &dir, VV &batch)
+{
+    using namespace boost::filesystem;
+
+    boost::system::error_code ec;
+    directory_iterator it(path(dir), ec), end;
+    if (ec)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_errors++;
+        return;
+    }
+
+    for (; it != end && !m_stop; it.increment(ec))
+    {
+        if (ec) break;
+
+        Entry e;
+        e.path     = it->path().generic_string();
+        e.is_link  = is_symlink(it->symlink_status(ec));
+        e.type     = status_type(it->status(ec));
+        e.has_stat = m_opts.need_stat;
+        e.size     = -1;
+        e.perms    = 0;
+        e.mtime    = 0;
+        if (e.has_stat)
+        {
+            if (e.type == T_REGULAR)
+                e.size = (int64_t) file_size(it->path(), ec);
+            e.perms = it->status(ec).permissions();
+            e.mtime = last_write_time(it->path(), ec);
+        }
+
+        add_entry(e, batch);
+    }
+}
+//---------------------------------------------------------------------------
+
+#else
+
+static FileType mode_type(mode_t m)
+{
+    if (S_ISREG(m))  return T_REGULAR;
+    if (S_ISDIR(m))  return T_DIRECTORY;
+    if (S_ISLNK(m))  return T_SYMLINK;
+    if (S_ISBLK(m))  return T_BLOCK;
+    if (S_ISCHR(m))  return T_CHAR;
+    if (S_ISFIFO(m)) return T_FIFO;
+    if (S_ISSOCK(m)) return T_SOCKET;
+    return T_UNKNOWN;
+}
+//---------------------------------------------------------------------------
+
+static FileType dirent_type(const struct dirent *de)
+{
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(DT_UNKNOWN)
+    switch (de->d_type)
+    {
+        case DT_REG:  return T_REGULAR;
+        case DT_DIR:  return T_DIRECTORY;
+        case DT_LNK:  return T_SYMLINK;
+        case DT_BLK:  return T_BLOCK;
+        case DT_CHR:  return T_CHAR;
+        case DT_FIFO: return T_FIFO;
+        case DT_SOCK: return T_SOCKET;
+        default:      return T_UNKNOWN;
+    }
+#else
+    (void) de;
+    return T_UNKNOWN;
+#endif
+}
+//---------------------------------------------------------------------------
+
+static void fill_stat(Entry &e, const struct stat &st)
+{
+    e.type     = mode_type(st.st_mode);
+    e.has_stat = true;
+    e.size     = e.type == T_REGULAR ? (int64_t) st.st_size : -1;
+    e.perms    = st.st_mode & 07777;
+    e.mtime    = st.st_mtime;
+}
+//---------------------------------------------------------------------------
+
+void Walker::read_directory(const std::string &dir, VV &batch)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_errors++;
+        return;
+    }
+
+    int         dfd    = dirfd(d);
+    std::string prefix = dir;
+    if (prefix.empty() || prefix[prefix.size() - 1] != '/')
+        prefix += '/';
+
+    struct dirent *de;
+    while (!m_stop && (de = readdir(d)) != nullptr)
+    {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+            continue;
+
+        Entry e;
+        e.path     = prefix + name;
+        e.type     = dirent_type(de);
+        e.is_link  = false;
+        e.has_stat = false;
+        e.size     = -1;
+        e.perms    = 0;
+        e.mtime    = 0;
+
+        struct stat st;
+        if (e.type == T_UNKNOWN)
+        {
+            // no d_type, we need to know about symlinks to not follow them
+            if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                e.type = T_ERROR;
+            else if (S_ISLNK(st.st_mode))
+                e.type = T_SYMLINK;
+            else
+                fill_stat(e, st);
+        }
+
+        if (e.type == T_SYMLINK)
+        {
+            e.is_link = true;
+            if (fstatat(dfd, name, &st, 0) == 0)
+                fill_stat(e, st);
+            else
+                e.type = T_NOT_FOUND;   // dangling
+        }
+        else if (m_opts.need_stat && !e.has_stat && e.type != T_ERROR)
+        {
+            if (fstatat(dfd, name, &st, 0) == 0)
+                fill_stat(e, st);
+        }
+
+        add_entry(e, batch);
+    }
+
+    closedir(d);
+}
+//---------------------------------------------------------------------------
+
+#endif
+
+} // namespace dir_walker
@@ -0,0 +1,141 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include "vval.h"
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Walks a directory tree with a pool of threads. Every thread takes a
+ * directory from a shared queue, reads it and queues the subdirectories
+ * it finds. The type of an entry is taken from the directory listing
+ * (d_type) if the file system provides it, otherwise, and for the file
+ * status, every entry costs exactly one stat() call.
+ *
+ * The entries are converted to VVs in the walker threads and handed out
+ * in batches (lists), as soon as they are complete. The number of
+ * batches waiting to be fetched is limited, so the walk pauses if the
+ * consumer is slow. The order of the entries is not specified.
+ *
+ * A single directory or a walk with one thread gains nothing from the
+ * pool, such walks read the directories in next_batch() instead, on
+ * the thread of the caller and one batch at a time. */
+
+namespace dir_walker
+{
+//---------------------------------------------------------------------------
+
+enum FileType
+{
+    T_UNKNOWN, T_REGULAR, T_DIRECTORY, T_SYMLINK, T_BLOCK, T_CHAR,
+    T_FIFO, T_SOCKET, T_NOT_FOUND, T_ERROR
+};
+
+const char *file_type_name(FileType t);
+
+struct Entry
+{
+    std::string path;       // root + '/' + path below the root
+    FileType    type;       // symlinks are followed, see is_link
+    bool        is_link;
+    bool        has_stat;   // size, perms and mtime are set
+    int64_t     size;       // -1 if not a regular file
+    unsigned    perms;
+    std::time_t mtime;
+};
+//---------------------------------------------------------------------------
+
+struct Options
+{
+    bool    recursive;
+    /// Fill in size, perms and mtime of every entry.
+    bool    need_stat;
+    /// Number of walker threads, 0: number of CPUs, but at least 4,
+    /// as most of the time is spent waiting for the file system.
+    /// 1 and non-recursive walks don't start threads, see above.
+    int     threads;
+    size_t  batch_size;
+    size_t  max_batches;
+    /// Called in the walker threads, returns the value for the batch
+    /// or an undefined VV to drop the entry.
+    std::function<VVal::VV(const Entry &)> convert;
+
+    Options()
+        : recursive(true), need_stat(false), threads(0),
+          batch_size(1000), max_batches(16)
+    { }
+};
+//---------------------------------------------------------------------------
+
+class Walker
+{
+    private:
+        Options                     m_opts;
+        bool                        m_inline;       // no threads, see above
+
+        std::mutex                  m_mutex;
+        std::condition_variable     m_work_cv;      // new directories or done
+        std::condition_variable     m_out_cv;       // new batches or done
+        std::condition_variable     m_space_cv;     // room for batches
+        std::deque<std::string>     m_dirs;
+        size_t                      m_pending;      // queued + being read
+        std::deque<VVal::VV>        m_batches;
+        size_t                      m_running;      // threads not finished
+        std::atomic<bool>           m_stop;
+        int64_t                     m_errors;
+
+        std::vector<std::thread>    m_threads;
+
+        void worker();
+        void read_directory(const std::string &dir, VVal::VV &batch);
+        void add_entry(Entry &e, VVal::VV &batch);
+        void publish(VVal::VV &batch);
+
+    public:
+        /// Starts walking at root immediately, unless the walk is inline.
+        Walker(const std::string &root, const Options &opts);
+        /// Stops and joins the walker threads.
+        ~Walker();
+
+        /// Returns the next batch of values (a list), waits for it if
+        /// necessary. Returns an undefined VV when the walk is finished.
+        VVal::VV next_batch();
+
+        /// Stops the walk early, next_batch() returns what's left.
+        void stop();
+
+        /// Number of directories, that could not be read, and entries
+        /// for which convert threw an exception (they are left out).
+        int64_t errors();
+};
+//---------------------------------------------------------------------------
+
+} // namespace dir_walker
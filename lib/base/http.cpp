@@ -36,6 +36,7 @@
 #include <Poco/URI.h>
 #include <Poco/Net/HTTPServerResponse.h>
 #include "base/vval_util.h"
+#include "base/json_vv.h"
 
 using namespace std;
 using namespace VVal;
@@ -134,8 +135,8 @@ class HTTP_SRV_Handler : public Poco::Net::HTTPRequestHandler
                 response.setStatusAndReason(
                     (Poco::Net::HTTPResponse::HTTPStatus) 200);
                 response.setContentType("application/json");
-                string body = as_json(resp->_("data"));
-                response.sendBuffer(body.c_str(), body.length());
+                response.setChunkedTransferEncoding(true);
+                json_vv::write_json(response.send(), resp->_("data"));
             }
             else if (resp->_s("action") == "error")
             {
@@ -0,0 +1,1079 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "json_vv.h"
+#include "numconv.h"
+#include "simd.h"
+#include "utf8.h"
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(_MSC_VER)
+#   include <io.h>
+#else
+#   include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace VVal
+{
+namespace json_vv
+{
+//---------------------------------------------------------------------------
+
+/// Returns the mask of the characters in the block, that are escaped
+/// by a backslash. Runs of backslashes are handled by looking at the
+/// parity of their start position. prev_escaped carries the state of
+/// a run that crosses the block boundary.
+static inline uint64_t find_escaped(uint64_t backslash, uint64_t &prev_escaped)
+{
+    const uint64_t even_bits = 0x5555555555555555ULL;
+
+    backslash &= ~prev_escaped;
+    uint64_t follows_escape = (backslash << 1) | prev_escaped;
+    uint64_t odd_starts     = backslash & ~even_bits & ~follows_escape;
+    uint64_t seq_on_even    = odd_starts + backslash;
+
+    prev_escaped = seq_on_even < odd_starts ? 1 : 0;
+
+    uint64_t invert_mask = seq_on_even << 1;
+    return (even_bits ^ invert_mask) & follows_escape;
+}
+//---------------------------------------------------------------------------
+
+/// Stage 1: Collects the offsets of all structural characters
+/// ({}[]:, outside of strings and the opening quote of every string).
+/// Returns false if the input ends inside of a string.
+static bool find_structurals(const char *buf, size_t len, vector<uint32_t> &idx)
+{
+    uint64_t prev_escaped   = 0;
+    uint64_t prev_in_string = 0;
+    char     tail[64];
+
+    idx.reserve(len / 8 + 16);
+
+    for (size_t pos = 0; pos < len; pos += 64)
+    {
+        const char *block = buf + pos;
+        uint64_t    valid = ~(uint64_t) 0;
+        if (len - pos < 64)
+        {
+            valid = simd::load_tail(tail, block, len - pos, ' ');
+            block = tail;
+        }
+
+        uint64_t escaped   = find_escaped(simd::eq_mask64(block, '\\'), prev_escaped);
+        uint64_t quotes    = simd::eq_mask64(block, '"') & ~escaped;
+        uint64_t in_string = simd::prefix_xor(quotes) ^ prev_in_string;
+        prev_in_string     = (uint64_t) (((int64_t) in_string) >> 63);
+
+        uint64_t ops = simd::oneof_mask64(block, "{}[]:,");
+        uint64_t s   = ((ops & ~in_string) | (quotes & in_string)) & valid;
+
+        while (s)
+        {
+            idx.push_back((uint32_t) (pos + simd::trailing_zeros(s)));
+            s &= s - 1;
+        }
+    }
+
+    return prev_in_string == 0;
+}
+//---------------------------------------------------------------------------
+
+static void append_utf8(string &out, uint32_t cp)
+{
+    if (cp < 0x80)
+        out += (char) cp;
+    else if (cp < 0x800)
+    {
+        out += (char) (0xC0 | (cp >> 6));
+        out += (char) (0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        out += (char) (0xE0 | (cp >> 12));
+        out += (char) (0x80 | ((cp >> 6) & 0x3F));
+        out += (char) (0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        out += (char) (0xF0 | (cp >> 18));
+        out += (char) (0x80 | ((cp >> 12) & 0x3F));
+        out += (char) (0x80 | ((cp >> 6) & 0x3F));
+        out += (char) (0x80 | (cp & 0x3F));
+    }
+}
+//---------------------------------------------------------------------------
+
+static bool parse_hex4(const char *p, const char *end, uint32_t &out)
+{
+    if (end - p < 4) return false;
+    out = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char c = p[i];
+        out <<= 4;
+        if      (c >= '0' && c <= '9') out |= c - '0';
+        else if (c >= 'a' && c <= 'f') out |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') out |= c - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+//---------------------------------------------------------------------------
+
+/// Stage 2: Walks the structural index and builds the VV tree.
+class VVBuilder
+{
+    private:
+        struct Frame
+        {
+            VV          container;
+            bool        is_map;
+            std::string key;
+
+            Frame(bool map)
+                : container(map ? vv_map() : vv_list()), is_map(map)
+            { }
+        };
+
+        const char          *m_buf;
+        const char          *m_end;
+        const char          *m_pos;
+        vector<uint32_t>     m_idx;
+        size_t               m_i;
+        string               m_error;
+
+        bool fail(const char *msg)
+        {
+            if (m_error.empty())
+                m_error = string(msg) + " (at offset "
+                          + to_string(m_pos - m_buf) + ")";
+            return false;
+        }
+
+        void skip_ws()
+        {
+            while (m_pos < m_end
+                   && (   *m_pos == ' '  || *m_pos == '\n'
+                       || *m_pos == '\r' || *m_pos == '\t'))
+                m_pos++;
+        }
+
+        bool at_structural() const
+        {
+            return m_i < m_idx.size() && m_buf + m_idx[m_i] == m_pos;
+        }
+
+        bool next_token(char &c)
+        {
+            skip_ws();
+            if (m_pos >= m_end) return fail("json: unexpected end of input");
+            if (!at_structural()) return fail("json: unexpected character");
+            c = *m_pos++;
+            m_i++;
+            return true;
+        }
+
+        bool parse_string(string &out);
+        bool parse_scalar(VV &out);
+
+    public:
+        VVBuilder(const char *data, size_t len)
+            : m_buf(data), m_end(data + len), m_pos(data), m_i(0)
+        { }
+
+        const string &error() const { return m_error; }
+
+        /// Parses a complete document. Unless any_value is set, it has
+        /// to be an object or array. Only whitespace may follow it.
+        VV run(bool any_value);
+};
+//---------------------------------------------------------------------------
+
+/// Decodes the string starting behind the opening quote at m_pos.
+bool VVBuilder::parse_string(string &out)
+{
+    out.clear();
+
+    for (;;)
+    {
+        const char *q = simd::find_special(m_pos, m_end, '"', '\\', 0x00);
+        if (!utf8::valid(m_pos, q)) return fail("string: UTF-8 Encoding Error");
+        out.append(m_pos, q - m_pos);
+        m_pos = q;
+
+        if (q >= m_end) return fail("string: unterminated string");
+        if (*q == '"')
+        {
+            m_pos++;
+            return true;
+        }
+        if (*q != '\\')
+        {
+            // raw control characters were always accepted, keep it that way
+            out += *q;
+            m_pos++;
+            continue;
+        }
+
+        if (q + 1 >= m_end) return fail("string: unterminated string");
+        m_pos = q + 2;
+        switch (q[1])
+        {
+            case '"':  out += '"';  break;
+            case '\\': out += '\\'; break;
+            case '/':  out += '/';  break;
+            case 'b':  out += '\b'; break;
+            case 'f':  out += '\f'; break;
+            case 'n':  out += '\n'; break;
+            case 'r':  out += '\r'; break;
+            case 't':  out += '\t'; break;
+            case 'u':
+            {
+                uint32_t cp = 0;
+                if (!parse_hex4(m_pos, m_end, cp))
+                    return fail("string: bad \\u escape");
+                m_pos += 4;
+
+                if (cp >= 0xD800 && cp <= 0xDBFF)
+                {
+                    uint32_t lo = 0;
+                    if (   m_end - m_pos < 6
+                        || m_pos[0] != '\\' || m_pos[1] != 'u'
+                        || !parse_hex4(m_pos + 2, m_end, lo)
+                        || lo < 0xDC00 || lo > 0xDFFF)
+                        return fail("string: expected low surrogate");
+                    m_pos += 6;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                }
+
+                append_utf8(out, cp);
+                break;
+            }
+            default:
+                return fail("string: bad escape sequence");
+        }
+    }
+}
+//---------------------------------------------------------------------------
+
+bool VVBuilder::parse_scalar(VV &out)
+{
+    if (m_pos >= m_end) return fail("json: unexpected end of input");
+
+    switch (*m_pos)
+    {
+        case 't':
+            if (m_end - m_pos < 4 || memcmp(m_pos, "true", 4) != 0)
+                return fail("json: expected 'true'");
+            m_pos += 4;
+            out = vv_bool(true);
+            return true;
+
+        case 'f':
+            if (m_end - m_pos < 5 || memcmp(m_pos, "false", 5) != 0)
+                return fail("json: expected 'false'");
+            m_pos += 5;
+            out = vv_bool(false);
+            return true;
+
+        case 'n':
+            if (m_end - m_pos < 4 || memcmp(m_pos, "null", 4) != 0)
+                return fail("json: expected 'null'");
+            m_pos += 4;
+            out = vv_undef();
+            return true;
+
+        default:
+        {
+            bool    is_double = false;
+            int64_t i         = 0;
+            double  d         = 0;
+            const char *p =
+                numconv::parse_json_number(m_pos, m_end, is_double, i, d);
+            if (!p) return fail("number: bad number syntax");
+            m_pos = p;
+            out = is_double ? vv(d) : vv(i);
+            return true;
+        }
+    }
+}
+//---------------------------------------------------------------------------
+
+VV VVBuilder::run(bool any_value)
+{
+    if ((uint64_t) (m_end - m_buf) > (uint64_t) UINT32_MAX)
+    {
+        fail("json: input too large");
+        return vv_undef();
+    }
+
+    if (!find_structurals(m_buf, m_end - m_buf, m_idx))
+    {
+        m_pos = m_end;
+        fail("string: unterminated string");
+        return vv_undef();
+    }
+
+    enum { S_OPEN, S_MEMBER, S_ELEMENT, S_DONE } state = S_ELEMENT;
+
+    vector<Frame> stack;
+    char c = 0;
+
+    if (!any_value)
+    {
+        if (!next_token(c)) return vv_undef();
+        if (c != '{' && c != '[')
+        {
+            fail("json: unexpected character. expected JSON object or array");
+            return vv_undef();
+        }
+        stack.emplace_back(c == '{');
+        state = S_OPEN;
+    }
+
+    VV value;
+
+    for (;;)
+    {
+        switch (state)
+        {
+            case S_OPEN:
+            {
+                skip_ws();
+                bool is_map = stack.back().is_map;
+                if (at_structural() && *m_pos == (is_map ? '}' : ']'))
+                {
+                    next_token(c);
+                    value = stack.back().container;
+                    stack.pop_back();
+                    state = S_DONE;
+                }
+                else
+                    state = is_map ? S_MEMBER : S_ELEMENT;
+                break;
+            }
+
+            case S_MEMBER:
+            {
+                if (!next_token(c)) return vv_undef();
+                if (c != '"')
+                {
+                    fail("object: expected '\"'");
+                    return vv_undef();
+                }
+                if (!parse_string(stack.back().key)) return vv_undef();
+                if (!next_token(c)) return vv_undef();
+                if (c != ':')
+                {
+                    fail("object: expected ':'");
+                    return vv_undef();
+                }
+                state = S_ELEMENT;
+                break;
+            }
+
+            case S_ELEMENT:
+            {
+                skip_ws();
+                if (!at_structural())
+                {
+                    if (!parse_scalar(value)) return vv_undef();
+                    state = S_DONE;
+                    break;
+                }
+
+                next_token(c);
+                if (c == '{' || c == '[')
+                {
+                    stack.emplace_back(c == '{');
+                    state = S_OPEN;
+                }
+                else if (c == '"')
+                {
+                    string s;
+                    if (!parse_string(s)) return vv_undef();
+                    value = vv(s);
+                    state = S_DONE;
+                }
+                else
+                {
+                    m_pos--;
+                    fail("json: unexpected character");
+                    return vv_undef();
+                }
+                break;
+            }
+
+            case S_DONE:
+            {
+                if (stack.empty())
+                {
+                    skip_ws();
+                    if (m_pos != m_end)
+                    {
+                        fail("json: unexpected data after value");
+                        return vv_undef();
+                    }
+                    return value;
+                }
+
+                Frame &f = stack.back();
+                if (f.is_map) f.container->set(f.key, value);
+                else          f.container->push(value);
+
+                if (!next_token(c)) return vv_undef();
+
+                if (c == ',')
+                    state = f.is_map ? S_MEMBER : S_ELEMENT;
+                else if (c == (f.is_map ? '}' : ']'))
+                {
+                    value = f.container;
+                    stack.pop_back();
+                }
+                else
+                {
+                    m_pos--;
+                    fail(f.is_map ? "object: expected ',' or '}'"
+                                  : "array: expected ',' or ']'");
+                    return vv_undef();
+                }
+                break;
+            }
+        }
+    }
+}
+//---------------------------------------------------------------------------
+
+VV parse(const char *data, size_t len, std::string *error)
+{
+    VVBuilder b(data, len);
+    VV v = b.run(false);
+    if (error) *error = b.error();
+    if (!b.error().empty()) return vv_undef();
+    return v;
+}
+//---------------------------------------------------------------------------
+
+VV parse_value(const char *data, size_t len, std::string *error)
+{
+    VVBuilder b(data, len);
+    VV v = b.run(true);
+    if (error) *error = b.error();
+    if (!b.error().empty()) return vv_undef();
+    return v;
+}
+//---------------------------------------------------------------------------
+
+static inline bool is_ws(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+//---------------------------------------------------------------------------
+
+StreamReader::StreamReader(bool ndjson, const std::string &path)
+    : m_ndjson(ndjson), m_finished(false), m_line(0),
+      m_pos(0), m_scan(0), m_state(W_VALUE),
+      m_val_keep(false), m_val_scalar(false), m_val_in_str(false),
+      m_val_esc(false), m_val_depth(0)
+{
+    size_t start = 0;
+    while (start < path.size())
+    {
+        size_t slash = path.find('/', start);
+        if (slash == string::npos) slash = path.size();
+        if (slash > start) m_path.push_back(path.substr(start, slash - start));
+        start = slash + 1;
+    }
+}
+//---------------------------------------------------------------------------
+
+bool StreamReader::fail(const std::string &msg)
+{
+    if (m_error.empty()) m_error = msg;
+    return false;
+}
+//---------------------------------------------------------------------------
+
+/// Drops the consumed data in front of the buffer. Done only if it is
+/// worth it, so that feeding small chunks doesn't move the data
+/// around all the time.
+void StreamReader::compact()
+{
+    if (m_pos == 0 || (m_pos < 64 * 1024 && m_pos * 2 < m_buf.size()))
+        return;
+    m_buf.erase(0, m_pos);
+    m_scan -= m_pos;
+    m_pos   = 0;
+}
+//---------------------------------------------------------------------------
+
+void StreamReader::feed(const char *data, size_t len)
+{
+    compact();
+    m_buf.append(data, len);
+}
+//---------------------------------------------------------------------------
+
+bool StreamReader::next(VV &out)
+{
+    for (;;)
+    {
+        if (!m_error.empty()) return false;
+
+        int st = m_ndjson ? scan_line(out) : scan_value(out);
+        if (st > 0) return true;
+        if (st < 0 || m_finished || !m_source) return false;
+
+        compact();
+        const size_t chunk = 64 * 1024;
+        size_t       old   = m_buf.size();
+        m_buf.resize(old + chunk);
+        size_t n = m_source(&m_buf[old], chunk);
+        m_buf.resize(old + n);
+        if (n == 0) finish();
+    }
+}
+//---------------------------------------------------------------------------
+
+/// NDJSON: Every line is a record, empty lines are skipped.
+int StreamReader::scan_line(VV &out)
+{
+    for (;;)
+    {
+        const char *b    = m_buf.data();
+        size_t      size = m_buf.size();
+
+        const void *nl =
+            m_scan < size ? memchr(b + m_scan, '\n', size - m_scan) : nullptr;
+
+        size_t end;
+        if (nl)
+            end = (const char *) nl - b;
+        else
+        {
+            m_scan = size;
+            if (!m_finished || m_pos == size) return 0;
+            end = size;
+        }
+
+        size_t start = m_pos;
+        m_pos = m_scan = nl ? end + 1 : end;
+        m_line++;
+
+        while (start < end && is_ws(b[start]))   start++;
+        while (end > start && is_ws(b[end - 1])) end--;
+        if (start == end) continue;
+
+        string err;
+        out = parse_value(b + start, end - start, &err);
+        if (!err.empty())
+        {
+            fail("line " + to_string(m_line) + ": " + err);
+            return -1;
+        }
+        return 1;
+    }
+}
+//---------------------------------------------------------------------------
+
+bool StreamReader::path_matches() const
+{
+    const Frame  &f = m_frames.back();
+    const string &p = m_path[m_frames.size() - 1];
+    if (p == "*") return true;
+    if (f.is_map) return f.key == p;
+    return p == to_string(f.index);
+}
+//---------------------------------------------------------------------------
+
+/// Decides what to do with the value starting with c at m_scan:
+/// Descend into it, if it's a container on the path, return it as
+/// record if it is at the path, or skip it otherwise.
+bool StreamReader::begin_value(char c)
+{
+    bool container = c == '{' || c == '[';
+    if (!container && c != '"' && c != '-' && !(c >= '0' && c <= '9')
+        && c != 't' && c != 'f' && c != 'n')
+        return fail("json: unexpected character '" + string(1, c) + "'");
+
+    bool match  = m_frames.empty() || path_matches();
+    bool record = match && m_frames.size() == m_path.size();
+
+    if (match && !record && container)
+    {
+        m_frames.emplace_back(c == '{');
+        m_scan++;
+        m_pos   = m_scan;
+        m_state = c == '{' ? W_KEY_OR_CLOSE : W_VALUE_OR_CLOSE;
+        return true;
+    }
+
+    m_val_keep   = record;
+    m_val_scalar = !container && c != '"';
+    m_val_in_str = false;
+    m_val_esc    = false;
+    m_val_depth  = 0;
+    m_state      = W_IN_VALUE;
+    return true;
+}
+//---------------------------------------------------------------------------
+
+int StreamReader::scan_value(VV &out)
+{
+    const char *b    = m_buf.data();
+    size_t      size = m_buf.size();
+
+    for (;;)
+    {
+        if (m_state == W_IN_VALUE)
+        {
+            size_t i    = m_scan;
+            bool   done = false;
+
+            if (m_val_scalar)
+            {
+                while (i < size && !is_ws(b[i]) && !strchr(",]}[{:\"", b[i]))
+                    i++;
+                done = i < size || m_finished;
+            }
+            else
+            {
+                while (i < size)
+                {
+                    if (m_val_esc)
+                    {
+                        m_val_esc = false;
+                        i++;
+                    }
+                    else if (m_val_in_str)
+                    {
+                        const char *q =
+                            simd::find_special(b + i, b + size, '"', '\\', 0x00);
+                        i = q - b;
+                        if (i >= size) break;
+                        i++;
+                        if (*q == '\\')
+                            m_val_esc = true;
+                        else if (*q == '"')
+                        {
+                            m_val_in_str = false;
+                            if (m_val_depth == 0) { done = true; break; }
+                        }
+                    }
+                    else
+                    {
+                        char c = b[i++];
+                        if (c == '"')
+                            m_val_in_str = true;
+                        else if (c == '{' || c == '[')
+                            m_val_depth++;
+                        else if ((c == '}' || c == ']') && --m_val_depth == 0)
+                        {
+                            done = true;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            m_scan = i;
+
+            if (!done)
+            {
+                if (m_finished)
+                {
+                    fail("json: unexpected end of input");
+                    return -1;
+                }
+                // skipped values don't need to stay in memory
+                if (!m_val_keep) m_pos = m_scan;
+                return 0;
+            }
+
+            m_state = W_AFTER;
+            if (m_val_keep)
+            {
+                string err;
+                out   = parse_value(b + m_pos, m_scan - m_pos, &err);
+                m_pos = m_scan;
+                if (!err.empty())
+                {
+                    fail(err);
+                    return -1;
+                }
+                return 1;
+            }
+            m_pos = m_scan;
+            continue;
+        }
+
+        if (m_state == W_IN_KEY)
+        {
+            size_t i = m_scan;
+            while (i < size)
+            {
+                if (m_val_esc)       { m_val_esc = false; i++; }
+                else if (b[i] == '\\') { m_val_esc = true;  i++; }
+                else if (b[i] == '"')  break;
+                else                   i++;
+            }
+            m_scan = i;
+            if (i >= size)
+            {
+                if (!m_finished) return 0;
+                fail("json: unexpected end of input");
+                return -1;
+            }
+
+            m_scan++;
+            string err;
+            VV key = parse_value(b + m_pos, m_scan - m_pos, &err);
+            if (!err.empty())
+            {
+                fail(err);
+                return -1;
+            }
+            m_frames.back().key = key->s();
+            m_pos   = m_scan;
+            m_state = W_COLON;
+            continue;
+        }
+
+        while (m_scan < size && is_ws(b[m_scan])) m_scan++;
+        m_pos = m_scan;
+
+        if (m_scan >= size)
+        {
+            if (!m_finished) return 0;
+            if (m_frames.empty() && (m_state == W_VALUE || m_state == W_AFTER))
+                return 0;
+            fail("json: unexpected end of input");
+            return -1;
+        }
+
+        char c = b[m_scan];
+        switch (m_state)
+        {
+            case W_VALUE_OR_CLOSE:
+                if (c == ']')
+                {
+                    m_frames.pop_back();
+                    m_state = W_AFTER;
+                    m_pos = ++m_scan;
+                    break;
+                }
+                if (!begin_value(c)) return -1;
+                break;
+
+            case W_VALUE:
+                if (!begin_value(c)) return -1;
+                break;
+
+            case W_KEY_OR_CLOSE:
+            case W_KEY:
+                if (c == '}' && m_state == W_KEY_OR_CLOSE)
+                {
+                    m_frames.pop_back();
+                    m_state = W_AFTER;
+                    m_pos = ++m_scan;
+                    break;
+                }
+                if (c != '"')
+                {
+                    fail("object: expected '\"'");
+                    return -1;
+                }
+                m_scan++;
+                m_val_esc = false;
+                m_state   = W_IN_KEY;
+                break;
+
+            case W_COLON:
+                if (c != ':')
+                {
+                    fail("object: expected ':'");
+                    return -1;
+                }
+                m_pos   = ++m_scan;
+                m_state = W_VALUE;
+                break;
+
+            case W_AFTER:
+            {
+                if (m_frames.empty())
+                {
+                    m_state = W_VALUE;
+                    break;
+                }
+
+                Frame &f = m_frames.back();
+                if (c == ',')
+                {
+                    m_pos = ++m_scan;
+                    if (f.is_map)
+                        m_state = W_KEY;
+                    else
+                    {
+                        f.index++;
+                        m_state = W_VALUE;
+                    }
+                }
+                else if (c == (f.is_map ? '}' : ']'))
+                {
+                    m_frames.pop_back();
+                    m_pos = ++m_scan;
+                }
+                else
+                {
+                    fail(f.is_map ? "object: expected ',' or '}'"
+                                  : "array: expected ',' or ']'");
+                    return -1;
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+}
+//---------------------------------------------------------------------------
+
+void Writer::newline(int depth)
+{
+    if (!m_indent) return;
+    m_buf += '\n';
+    m_buf.append(2 * depth, ' ');
+}
+//---------------------------------------------------------------------------
+
+void Writer::write_string(const char *s, size_t len)
+{
+    static const char *hex = "0123456789abcdef";
+
+    const char *end = s + len;
+    m_buf += '"';
+
+    while (s < end)
+    {
+        const char *q = simd::find_special(s, end, '"', '\\', 0x1F);
+        m_buf.append(s, q - s);
+        if (q >= end) break;
+
+        switch (*q)
+        {
+            case '"':  m_buf.append("\\\"", 2); break;
+            case '\\': m_buf.append("\\\\", 2); break;
+            case '\b': m_buf.append("\\b", 2);  break;
+            case '\f': m_buf.append("\\f", 2);  break;
+            case '\n': m_buf.append("\\n", 2);  break;
+            case '\r': m_buf.append("\\r", 2);  break;
+            case '\t': m_buf.append("\\t", 2);  break;
+            default:
+            {
+                char u[6] = { '\\', 'u', '0', '0', hex[(*q >> 4) & 0xF], hex[*q & 0xF] };
+                m_buf.append(u, 6);
+            }
+        }
+        s = q + 1;
+    }
+
+    m_buf += '"';
+    flush_if_full();
+}
+//---------------------------------------------------------------------------
+
+void Writer::hex_string(const VV &v)
+{
+    std::string h = v->s_hex();
+    write_string(h.data(), h.size());
+}
+//---------------------------------------------------------------------------
+
+void Writer::value(const VV &v, int depth)
+{
+    char num[numconv::FORMAT_BUF_SIZE];
+
+    if (!v || v->is_undef())
+        m_buf.append("null", 4);
+    else if (v->is_boolean())
+    {
+        if (v->is_true()) m_buf.append("true", 4);
+        else              m_buf.append("false", 5);
+    }
+    else if (v->is_int())
+        m_buf.append(num, numconv::format_int64(v->i(), num));
+    else if (v->is_double())
+    {
+        double d = v->d();
+        // JSON has no representation for NaN and infinity
+        if (std::isfinite(d)) m_buf.append(num, numconv::format_double(d, num));
+        else                  m_buf.append("null", 4);
+    }
+    else if (v->is_bytes())
+        hex_string(v);
+    else if (v->is_list())
+    {
+        m_buf += '[';
+        const ListValue *lv = dynamic_cast<const ListValue *>(v.get());
+        bool first = true;
+        if (lv)
+        {
+            for (auto &e : lv->items())
+            {
+                if (!first) m_buf += ',';
+                first = false;
+                newline(depth + 1);
+                value(e, depth + 1);
+            }
+        }
+        else
+        {
+            for (auto e : *v)
+            {
+                if (!first) m_buf += ',';
+                first = false;
+                newline(depth + 1);
+                value(e, depth + 1);
+            }
+        }
+        if (!first) newline(depth);
+        m_buf += ']';
+    }
+    else if (v->is_map())
+    {
+        m_buf += '{';
+        const MapValue *mv = dynamic_cast<const MapValue *>(v.get());
+        bool first = true;
+        auto member = [&](const std::string &key, const VV &val)
+        {
+            if (!first) m_buf += ',';
+            first = false;
+            newline(depth + 1);
+            write_string(key.data(), key.size());
+            m_buf += ':';
+            if (m_indent) m_buf += ' ';
+            value(val, depth + 1);
+        };
+        if (mv)
+        {
+            for (auto &kv : mv->entries())
+                member(kv.first, kv.second);
+        }
+        else
+        {
+            for (auto kv : *v)
+                member(kv->_s(0), kv->_(1));
+        }
+        if (!first) newline(depth);
+        m_buf += '}';
+    }
+    else
+    {
+        // strings, and also everything without a JSON representation
+        // (date times, closures, pointers) is written as string.
+        std::string s = v->s();
+        if (utf8::valid(s.data(), s.data() + s.size()))
+            write_string(s.data(), s.size());
+        else
+            hex_string(v);
+    }
+
+    flush_if_full();
+}
+//---------------------------------------------------------------------------
+
+void Writer::write(const VV &v)
+{
+    value(v, 0);
+    if (m_sink) flush();
+}
+//---------------------------------------------------------------------------
+
+void Writer::raw(const char *data, size_t len)
+{
+    m_buf.append(data, len);
+    flush_if_full();
+}
+//---------------------------------------------------------------------------
+
+void Writer::flush()
+{
+    if (!m_sink || m_buf.empty()) return;
+    m_sink(m_buf.data(), m_buf.size());
+    m_buf.clear();
+}
+//---------------------------------------------------------------------------
+
+std::string to_json(const VV &v, bool indent)
+{
+    Writer w(indent);
+    w.write(v);
+    return w.take();
+}
+//---------------------------------------------------------------------------
+
+void write_json(std::ostream &out, const VV &v, bool indent)
+{
+    Writer w([&out](const char *data, size_t len)
+    {
+        out.write(data, len);
+        if (!out)
+            throw VariantValueException(
+                vv_undef(), "json: writing to output stream failed");
+    }, indent);
+    w.write(v);
+}
+//---------------------------------------------------------------------------
+
+void write_json(int fd, const VV &v, bool indent)
+{
+    Writer w([fd](const char *data, size_t len)
+    {
+        while (len > 0)
+        {
+#if defined(_MSC_VER)
+            int n = _write(fd, data, (unsigned int) len);
+#else
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0 && errno == EINTR) continue;
+#endif
+            if (n <= 0)
+                throw VariantValueException(
+                    vv_undef(), "json: writing to file descriptor failed");
+            data += n;
+            len  -= (size_t) n;
+        }
+    }, indent);
+    w.write(v);
+}
+//---------------------------------------------------------------------------
+
+} // namespace json_vv
+} // namespace VVal
@@ -0,0 +1,201 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include "vval.h"
+#include <functional>
+#include <ostream>
+#include <vector>
+
+/* JSON <=> VV conversion without the intermediate callback layer of
+ * json::Parser. Parsing is done in two stages: First the whole input
+ * is scanned in 64 byte blocks with SIMD instructions (see simd.h) for
+ * the structural characters outside of strings. The second stage walks
+ * that index with an explicit stack and builds the ListValue/MapValue
+ * tree directly.
+ *
+ * Writing goes through the Writer, which escapes strings run by run and
+ * hands its buffer to a sink (std::ostream, file descriptor) whenever
+ * it grows beyond a few kilobytes, so big documents don't have to be
+ * held in memory as a whole.
+ *
+ * The StreamReader is fed with chunks of a possibly endless input and
+ * returns the records in it one by one. Only the bytes of the record
+ * currently being read are buffered. */
+
+namespace VVal
+{
+namespace json_vv
+{
+//---------------------------------------------------------------------------
+
+/// Parses the UTF-8 encoded JSON document in [data, data + len).
+/// The document has to be an object or array, only whitespace may
+/// follow it.
+/// Returns vv_undef() on error and stores the reason in *error if given.
+VV parse(const char *data, size_t len, std::string *error = nullptr);
+
+/// Like parse(), but accepts any JSON value (also strings, numbers, ...)
+/// and fails if there is anything but whitespace after it.
+VV parse_value(const char *data, size_t len, std::string *error = nullptr);
+
+//---------------------------------------------------------------------------
+
+/// Incremental reader for big or streamed JSON input.
+///
+/// In the default mode the input is a sequence of JSON values (usually
+/// just one). If a path is given, the values at that path are returned
+/// as records instead of the top level values. The path is a list of
+/// object keys or array indices separated by '/', '*' matches any
+/// member or element: "results/*" returns the elements of the array
+/// in the "results" member of the top level object one at a time.
+///
+/// In NDJSON mode every non empty line is one JSON value, the path is
+/// ignored.
+class StreamReader
+{
+    public:
+        /// Fills buf with up to len bytes, returns 0 at the end of input.
+        typedef std::function<size_t(char *buf, size_t len)> source_func;
+
+    private:
+        enum WState
+        {
+            W_VALUE,            // expecting a value
+            W_VALUE_OR_CLOSE,   // after '['
+            W_KEY_OR_CLOSE,     // after '{'
+            W_KEY,              // after ',' in an object
+            W_COLON,            // after an object key
+            W_AFTER,            // after a value
+            W_IN_KEY,           // inside of an object key string
+            W_IN_VALUE          // inside of a record or skipped value
+        };
+
+        struct Frame
+        {
+            bool        is_map;
+            int64_t     index;
+            std::string key;
+
+            Frame(bool map) : is_map(map), index(0) { }
+        };
+
+        bool                     m_ndjson;
+        std::vector<std::string> m_path;
+        source_func              m_source;
+        bool                     m_finished;
+        std::string              m_error;
+        int64_t                  m_line;
+
+        std::string              m_buf;
+        size_t                   m_pos;     // start of the unconsumed data
+        size_t                   m_scan;    // scanner position
+
+        WState                   m_state;
+        std::vector<Frame>       m_frames;
+
+        // state of the value scanner
+        bool                     m_val_keep;
+        bool                     m_val_scalar;
+        bool                     m_val_in_str;
+        bool                     m_val_esc;
+        int                      m_val_depth;
+
+        bool fail(const std::string &msg);
+        void compact();
+        bool path_matches() const;
+        bool begin_value(char c);
+        int  scan_value(VV &out);
+        int  scan_line(VV &out);
+
+    public:
+        StreamReader(bool ndjson = false, const std::string &path = "");
+
+        /// Installs a source, that next() pulls more input from on demand.
+        void set_source(const source_func &src) { m_source = src; }
+
+        void feed(const char *data, size_t len);
+        /// Marks the end of input.
+        void finish() { m_finished = true; }
+
+        /// Returns true and the next record in out if one is complete.
+        /// Returns false if more input is needed, at the end of input
+        /// or on an error (see error()).
+        bool next(VV &out);
+
+        const std::string &error() const  { return m_error; }
+        size_t             buffered() const { return m_buf.size() - m_pos; }
+};
+//---------------------------------------------------------------------------
+
+class Writer
+{
+    public:
+        typedef std::function<void(const char *data, size_t len)> sink_func;
+
+    private:
+        std::string     m_buf;
+        sink_func       m_sink;
+        bool            m_indent;
+
+        void flush_if_full()
+        {
+            if (m_sink && m_buf.size() >= 64 * 1024)
+                flush();
+        }
+
+        void newline(int depth);
+        void write_string(const char *s, size_t len);
+        void hex_string(const VV &v);
+        void value(const VV &v, int depth);
+
+    public:
+        /// Collects the output in memory, see str().
+        explicit Writer(bool indent = false) : m_indent(indent) { }
+        /// Passes the output in chunks to sink.
+        Writer(const sink_func &sink, bool indent = false)
+            : m_sink(sink), m_indent(indent)
+        { }
+
+        /// Appends v as JSON and flushes the output to the sink.
+        void write(const VV &v);
+        /// Appends raw text, like the record separator of NDJSON.
+        void raw(const char *data, size_t len);
+        void flush();
+
+        const std::string &str() const { return m_buf; }
+        std::string take() { std::string s; s.swap(m_buf); return s; }
+};
+//---------------------------------------------------------------------------
+
+std::string to_json(const VV &v, bool indent = false);
+/// Throws VariantValueException if the stream goes bad.
+void write_json(std::ostream &out, const VV &v, bool indent = false);
+/// Throws VariantValueException if writing to the descriptor fails.
+void write_json(int fd, const VV &v, bool indent = false);
+
+//---------------------------------------------------------------------------
+
+} // namespace json_vv
+} // namespace VVal
@@ -0,0 +1,117 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/* A small thread safe least recently used cache. Used for objects that
+ * are expensive to construct but immutable afterwards, like compiled
+ * regular expressions. Values are handed out by copy, so V is usually
+ * a std::shared_ptr<const T>, which stays valid when evicted. */
+
+template<class K, class V, class Hash = std::hash<K>>
+class LRUCache
+{
+    private:
+        typedef std::list<std::pair<K, V>>  list_t;
+
+        std::mutex                                                  m_mutex;
+        list_t                                                      m_items;    // most recently used first
+        std::unordered_map<K, typename list_t::iterator, Hash>      m_index;
+        size_t                                                      m_capacity;
+
+        void insert(const K &key, const V &val)
+        {
+            auto it = m_index.find(key);
+            if (it != m_index.end())
+            {
+                it->second->second = val;
+                m_items.splice(m_items.begin(), m_items, it->second);
+                return;
+            }
+
+            m_items.emplace_front(key, val);
+            m_index[key] = m_items.begin();
+
+            if (m_items.size() > m_capacity)
+            {
+                m_index.erase(m_items.back().first);
+                m_items.pop_back();
+            }
+        }
+
+    public:
+        explicit LRUCache(size_t capacity) : m_capacity(capacity ? capacity : 1) { }
+
+        /// Returns true and the value in out if key is cached.
+        bool get(const K &key, V &out)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_index.find(key);
+            if (it == m_index.end())
+                return false;
+            m_items.splice(m_items.begin(), m_items, it->second);
+            out = it->second->second;
+            return true;
+        }
+
+        void put(const K &key, const V &val)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            insert(key, val);
+        }
+
+        /// Returns the cached value or the one create() returns, which
+        /// is then cached. create() is called without holding the lock,
+        /// exceptions it throws are passed on and nothing is cached.
+        template<class F>
+        V get_or_create(const K &key, F create)
+        {
+            V v;
+            if (get(key, v))
+                return v;
+
+            v = create();
+            put(key, v);
+            return v;
+        }
+
+        size_t size()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_items.size();
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_items.clear();
+            m_index.clear();
+        }
+};
@@ -0,0 +1,270 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+
+#include "msgpack_vv.h"
+#include "../msgpack/msgpack.h"
+#include <vector>
+
+using namespace std;
+
+namespace VVal
+{
+namespace msgpack_vv
+{
+//---------------------------------------------------------------------------
+
+static void encode(msgpack::Serializer &ser, const VV &v)
+{
+    if (v->is_list())
+    {
+        ser.array((uint32_t) v->size());
+        if (auto lv = dynamic_cast<ListValue *>(v.get()))
+        {
+            for (auto &e : lv->items())
+                encode(ser, e ? e : vv_undef());
+        }
+        else
+            for (auto e : *v)
+                encode(ser, e);
+    }
+    else if (v->is_map())
+    {
+        ser.map((uint32_t) v->size());
+        if (auto mv = dynamic_cast<MapValue *>(v.get()))
+        {
+            for (auto &e : mv->entries())
+            {
+                ser.string(e.first);
+                encode(ser, e.second ? e.second : vv_undef());
+            }
+        }
+        else
+            for (auto e : *v)
+            {
+                ser.string(e->_s(0));
+                encode(ser, e->_(1));
+            }
+    }
+    else if (v->is_int())      ser.number(v->i());
+    else if (v->is_double())   ser.number(v->d());
+    else if (v->is_boolean())  ser.boolean(v->b());
+    else if (v->is_datetime()) ser.timestamp((int64_t) v->dt());
+    else if (v->is_bytes())    ser.string(v->s(), true);
+    else if (v->is_undef())    ser.nil();
+    else                       ser.string(v->s());
+}
+//---------------------------------------------------------------------------
+
+string to_msgpack(const VV &v)
+{
+    msgpack::Serializer ser;
+    encode(ser, v);
+    return ser.asString();
+}
+//---------------------------------------------------------------------------
+
+static uint64_t read_be(const char *p, int len)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < len; i++)
+        v = (v << 8) | (unsigned char) p[i];
+    return v;
+}
+//---------------------------------------------------------------------------
+
+/// Builds the VV tree from the callbacks of the Deserializer.
+class VVMsgpackBuilder : public msgpack::Deserializer
+{
+    private:
+        struct Frame
+        {
+            VV          container;
+            bool        is_map;
+            bool        want_key;
+            std::string key;
+
+            Frame(const VV &c, bool map)
+                : container(c), is_map(map), want_key(map)
+            { }
+        };
+
+        vector<Frame>   m_stack;
+        VV              m_result;
+        string          m_error;
+
+        // Set if strings may refer to the input.
+        shared_ptr<const string> m_shared;
+
+        void add(const VV &v)
+        {
+            if (m_stack.empty())
+            {
+                m_result = v;
+                return;
+            }
+
+            Frame &f = m_stack.back();
+            if (!f.is_map)
+                f.container << v;
+            else if (f.want_key)
+            {
+                if (v->is_list() || v->is_map())
+                    fail("map key is not a string or number");
+                f.key      = v->s();
+                f.want_key = false;
+            }
+            else
+            {
+                f.container->set(f.key, v);
+                f.want_key = true;
+            }
+        }
+
+        void fail(const char *msg)
+        {
+            if (m_error.empty())
+                m_error = string("msgpack: ") + msg;
+        }
+
+    public:
+        VVMsgpackBuilder(const shared_ptr<const string> &shared = nullptr)
+            : m_result(vv_undef()), m_shared(shared)
+        { }
+
+        const string &error() const { return m_error; }
+        VV result() const { return m_result; }
+
+        virtual void onValueBoolean(bool bValue) { add(vv_bool(bValue)); }
+        virtual void onValueNil()                { add(vv_undef()); }
+        virtual void onValueFloat(double fNum, bool bIsDouble)
+        {
+            (void) bIsDouble;
+            add(vv(fNum));
+        }
+        virtual void onValueUInt(uint64_t uiNum)
+        {
+            if (uiNum > (uint64_t) INT64_MAX) add(vv((double) uiNum));
+            else                              add(vv((int64_t) uiNum));
+        }
+        virtual void onValueInt(int64_t iNum) { add(vv(iNum)); }
+        virtual void onValueStringView(const char *data, size_t len, bool bIsBinary)
+        {
+            if (!m_stack.empty() && m_stack.back().want_key)
+            {
+                Frame &f = m_stack.back();
+                f.key.assign(data, len);
+                f.want_key = false;
+                return;
+            }
+
+            if (m_shared && len >= SLICE_MIN_LEN)
+                add(vv_slice(m_shared, data - m_shared->data(), len, bIsBinary));
+            else if (bIsBinary)
+                add(VV(new BytesValue(data, len)));
+            else
+                add(VV(new StringValue(data, len)));
+        }
+        virtual void onValueExtView(int8_t iType, const char *data, size_t len)
+        {
+            if (iType != -1)
+            {
+                add(vv_undef());
+                return;
+            }
+
+            int64_t secs = 0;
+            if (len == 4)
+                secs = (int64_t) read_be(data, 4);
+            else if (len == 8)
+                secs = (int64_t) (read_be(data, 8) & 0x3FFFFFFFFULL);
+            else if (len == 12)
+                secs = (int64_t) read_be(data + 4, 8);
+            else
+                fail("bad timestamp length");
+            add(vv_dt((std::time_t) secs));
+        }
+
+        virtual void onObjectStart(unsigned int iElemCnt)
+        {
+            (void) iElemCnt;
+            m_stack.emplace_back(vv_map(), true);
+        }
+        virtual void onArrayStart(unsigned int iElemCnt)
+        {
+            (void) iElemCnt;
+            m_stack.emplace_back(vv_list(), false);
+        }
+        virtual void onObjectEnd() { end_container(); }
+        virtual void onArrayEnd()  { end_container(); }
+
+        void end_container()
+        {
+            VV c = m_stack.back().container;
+            m_stack.pop_back();
+            add(c);
+        }
+
+        virtual void onError(UTF8Buffer *u8Buf, const char *csError)
+        {
+            (void) u8Buf;
+            fail(csError);
+        }
+};
+//---------------------------------------------------------------------------
+
+static VV decode(VVMsgpackBuilder &b, const char *data, size_t len, string *error)
+{
+    size_t consumed = 0;
+    bool ok = b.parse(data, len, consumed);
+    string err = b.error();
+    if (ok && err.empty() && consumed < len)
+        err = "msgpack: trailing data after value";
+    else if (!ok && err.empty())
+        err = "msgpack: invalid input";
+
+    if (!err.empty())
+    {
+        if (error) *error = err;
+        return vv_undef();
+    }
+    return b.result();
+}
+//---------------------------------------------------------------------------
+
+VV from_msgpack(const char *data, size_t len, string *error)
+{
+    VVMsgpackBuilder b;
+    return decode(b, data, len, error);
+}
+//---------------------------------------------------------------------------
+
+VV from_msgpack(const shared_ptr<const string> &input, string *error)
+{
+    VVMsgpackBuilder b(input);
+    return decode(b, input->data(), input->size(), error);
+}
+//---------------------------------------------------------------------------
+
+} // namespace msgpack_vv
+} // namespace VVal
@@ -0,0 +1,69 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+
+#pragma once
+
+#include "vval.h"
+#include <memory>
+
+/* VV <=> MessagePack conversion on top of msgpack::Serializer and
+ * msgpack::Deserializer. Unlike JSON, the types survive the round trip:
+ * integers stay 64 bit integers, bytes are written as bin, strings as
+ * str and date/time values as the msgpack timestamp extension type.
+ * Map keys are always read as strings, as MapValue only has those.
+ *
+ * Decoding walks the input in place. Strings are copied once into their
+ * VV, unless the input is passed as shared buffer: Then bigger strings
+ * and bytes become StringSliceValue, that point into that buffer. */
+
+namespace VVal
+{
+namespace msgpack_vv
+{
+//---------------------------------------------------------------------------
+
+std::string to_msgpack(const VV &v);
+
+/// Decodes the single msgpack value in [data, data + len).
+/// Returns vv_undef() on error and stores the reason in *error if given.
+VV from_msgpack(const char *data, size_t len, std::string *error = nullptr);
+
+inline VV from_msgpack(const std::string &data, std::string *error = nullptr)
+{
+    return from_msgpack(data.data(), data.size(), error);
+}
+
+/// Strings and bytes of at least this size are not copied by the
+/// shared buffer variant of from_msgpack().
+const size_t SLICE_MIN_LEN = 256;
+
+/// Like from_msgpack(), but strings and bytes of SLICE_MIN_LEN or more
+/// bytes refer to input instead of copying. Note that every such value
+/// keeps the whole input alive.
+VV from_msgpack(const std::shared_ptr<const std::string> &input, std::string *error = nullptr);
+
+//---------------------------------------------------------------------------
+
+} // namespace msgpack_vv
+} // namespace VVal
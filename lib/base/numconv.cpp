@@ -0,0 +1,732 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "numconv.h"
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#if __cplusplus >= 201703L && defined(__has_include)
+#   if __has_include(<charconv>)
+#       include <charconv>
+#       if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#           define LALRT_HAS_TO_CHARS 1
+#       endif
+#   endif
+#endif
+
+namespace numconv
+{
+//---------------------------------------------------------------------------
+
+static const double s_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+//---------------------------------------------------------------------------
+
+static char locale_decimal_point()
+{
+    const struct lconv *lc = localeconv();
+    if (lc && lc->decimal_point && lc->decimal_point[0])
+        return lc->decimal_point[0];
+    return '.';
+}
+//---------------------------------------------------------------------------
+
+/// Slow path for mantissas that don't fit into 53 bit or large exponents.
+/// strtod() is correctly rounded, but depends on the decimal point of
+/// the current C locale. So we just hand it the character it expects.
+static double strtod_any_locale(const char *p, const char *end)
+{
+    char dp = locale_decimal_point();
+
+    std::string tmp(p, end - p);
+    if (dp != '.')
+        for (auto &c : tmp)
+            if (c == '.') c = dp;
+
+    return std::strtod(tmp.c_str(), nullptr);
+}
+//---------------------------------------------------------------------------
+
+/// Converts (-)mant * 10^exp10 to a double, [start, end) is the text
+/// of the number for the slow path.
+static double decimal_to_double(bool neg, uint64_t mant, int exp10, bool truncated,
+                                const char *start, const char *end)
+{
+    if (mant == 0 && !truncated)
+        return neg ? -0.0 : 0.0;
+
+    // Clinger's fast path: both operands are exact doubles, so
+    // a single multiplication/division rounds correctly.
+    if (!truncated
+        && mant <= (((uint64_t) 1) << 53)
+        && exp10 >= -22 && exp10 <= 22)
+    {
+        double d = (double) mant;
+        if (exp10 < 0) d /= s_pow10[-exp10];
+        else           d *= s_pow10[exp10];
+        return neg ? -d : d;
+    }
+
+    return strtod_any_locale(start, end);
+}
+//---------------------------------------------------------------------------
+
+const char *parse_json_number(const char *p, const char *end,
+                              bool &is_double, int64_t &i_out, double &d_out)
+{
+    const char *start = p;
+    bool     neg       = false;
+    uint64_t mant      = 0;
+    int      digits    = 0;     // significant digits stored in mant
+    int      exp10     = 0;
+    bool     truncated = false; // dropped non zero digits
+
+    if (p < end && *p == '-')
+    {
+        neg = true;
+        p++;
+    }
+
+    if (p >= end) return nullptr;
+
+    if (*p == '0')
+        p++;
+    else if (*p >= '1' && *p <= '9')
+    {
+        for (; p < end && is_digit(*p); p++)
+        {
+            if (digits < 19)
+            {
+                mant = mant * 10 + (*p - '0');
+                digits++;
+            }
+            else
+            {
+                if (*p != '0') truncated = true;
+                exp10++;
+            }
+        }
+    }
+    else
+        return nullptr;
+
+    bool has_frac = false;
+    if (p < end && *p == '.')
+    {
+        has_frac = true;
+        p++;
+        if (p >= end || !is_digit(*p)) return nullptr;
+
+        for (; p < end && is_digit(*p); p++)
+        {
+            if (digits < 19)
+            {
+                mant = mant * 10 + (*p - '0');
+                if (mant) digits++;
+                exp10--;
+            }
+            else if (*p != '0')
+                truncated = true;
+        }
+    }
+
+    bool has_exp = false;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        has_exp = true;
+        p++;
+
+        bool exp_neg = false;
+        if (p < end && (*p == '+' || *p == '-'))
+        {
+            exp_neg = *p == '-';
+            p++;
+        }
+        if (p >= end || !is_digit(*p)) return nullptr;
+
+        int e = 0;
+        for (; p < end && is_digit(*p); p++)
+            if (e < 100000) e = e * 10 + (*p - '0');
+
+        exp10 += exp_neg ? -e : e;
+    }
+
+    if (!has_frac && !has_exp && !truncated && exp10 == 0)
+    {
+        if (!neg && mant <= (uint64_t) INT64_MAX)
+        {
+            is_double = false;
+            i_out     = (int64_t) mant;
+            return p;
+        }
+        else if (neg && mant <= ((uint64_t) INT64_MAX) + 1)
+        {
+            is_double = false;
+            i_out     = (int64_t) (((uint64_t) 0) - mant);
+            return p;
+        }
+    }
+
+    is_double = true;
+    d_out     = decimal_to_double(neg, mant, exp10, truncated, start, p);
+    return p;
+}
+//---------------------------------------------------------------------------
+
+const char *parse_int64(const char *p, const char *end, int64_t &out)
+{
+    bool neg = false;
+    if (p < end && *p == '-')
+    {
+        neg = true;
+        p++;
+    }
+    if (p >= end || !is_digit(*p))
+        return nullptr;
+
+    uint64_t limit = neg ? ((uint64_t) INT64_MAX) + 1 : (uint64_t) INT64_MAX;
+    uint64_t u     = 0;
+    for (; p < end && is_digit(*p); p++)
+    {
+        unsigned d = (unsigned) (*p - '0');
+        if (u > (limit - d) / 10)
+            return nullptr;
+        u = u * 10 + d;
+    }
+
+    out = neg ? (int64_t) (((uint64_t) 0) - u) : (int64_t) u;
+    return p;
+}
+//---------------------------------------------------------------------------
+
+/// Case insensitive comparison with the lower case word.
+static bool starts_with_word(const char *p, const char *end, const char *word)
+{
+    size_t len = std::strlen(word);
+    if ((size_t) (end - p) < len)
+        return false;
+    for (size_t i = 0; i < len; i++)
+        if ((p[i] | 0x20) != word[i])
+            return false;
+    return true;
+}
+//---------------------------------------------------------------------------
+
+const char *parse_double(const char *p, const char *end, double &out)
+{
+    const char *start     = p;
+    bool        neg       = false;
+    uint64_t    mant      = 0;
+    int         digits    = 0;
+    int         exp10     = 0;
+    bool        truncated = false;
+    bool        any       = false;
+
+    if (p < end && *p == '-')
+    {
+        neg = true;
+        p++;
+    }
+
+    if (p < end && !is_digit(*p) && *p != '.')
+    {
+        double d;
+        if (starts_with_word(p, end, "infinity"))  { d = HUGE_VAL; p += 8; }
+        else if (starts_with_word(p, end, "inf"))  { d = HUGE_VAL; p += 3; }
+        else if (starts_with_word(p, end, "nan"))  { d = std::nan(""); p += 3; }
+        else return nullptr;
+        out = neg ? -d : d;
+        return p;
+    }
+
+    for (; p < end && is_digit(*p); p++)
+    {
+        any = true;
+        if (digits < 19)
+        {
+            mant = mant * 10 + (*p - '0');
+            if (mant) digits++;
+        }
+        else
+        {
+            if (*p != '0') truncated = true;
+            exp10++;
+        }
+    }
+
+    if (p < end && *p == '.')
+    {
+        p++;
+        for (; p < end && is_digit(*p); p++)
+        {
+            any = true;
+            if (digits < 19)
+            {
+                mant = mant * 10 + (*p - '0');
+                if (mant) digits++;
+                exp10--;
+            }
+            else if (*p != '0')
+                truncated = true;
+        }
+    }
+
+    if (!any) return nullptr;
+
+    // the exponent only belongs to the number if it has digits
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q       = p + 1;
+        bool        exp_neg = false;
+        if (q < end && (*q == '+' || *q == '-'))
+        {
+            exp_neg = *q == '-';
+            q++;
+        }
+        if (q < end && is_digit(*q))
+        {
+            int e = 0;
+            for (; q < end && is_digit(*q); q++)
+                if (e < 100000) e = e * 10 + (*q - '0');
+            exp10 += exp_neg ? -e : e;
+            p = q;
+        }
+    }
+
+    double d = decimal_to_double(neg, mant, exp10, truncated, start, p);
+    if (std::isinf(d))
+        return nullptr;
+    out = d;
+    return p;
+}
+//---------------------------------------------------------------------------
+
+/// Skips what std::stoll()/std::stod() skip in front of a number.
+static const char *skip_lenient(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r')))
+        p++;
+    if (p + 1 < end && *p == '+' && p[1] != '-')
+        p++;
+    return p;
+}
+//---------------------------------------------------------------------------
+
+int64_t to_int64(const char *p, size_t len)
+{
+    const char *end = p + len;
+    int64_t     v   = 0;
+    if (!parse_int64(skip_lenient(p, end), end, v))
+        return 0;
+    return v;
+}
+//---------------------------------------------------------------------------
+
+double to_double(const char *p, size_t len)
+{
+    const char *end = p + len;
+    double      v   = 0.0;
+    if (!parse_double(skip_lenient(p, end), end, v))
+        return 0.0;
+    return v;
+}
+//---------------------------------------------------------------------------
+
+size_t format_int64(int64_t v, char *buf)
+{
+    char     tmp[FORMAT_BUF_SIZE];
+    char    *t = tmp + sizeof(tmp);
+    uint64_t u = v < 0 ? ((uint64_t) 0) - (uint64_t) v : (uint64_t) v;
+
+    do
+    {
+        *--t = (char) ('0' + (u % 10));
+        u /= 10;
+    }
+    while (u);
+
+    if (v < 0) *--t = '-';
+
+    size_t len = (tmp + sizeof(tmp)) - t;
+    std::memcpy(buf, t, len);
+    return len;
+}
+//---------------------------------------------------------------------------
+
+/* Shortest round trip digits with Grisu2 (Florian Loitsch, "Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers", 2010).
+ * The digits always parse back to the same double. For about 99.9% of
+ * all doubles they are also the shortest such digits, for the rest
+ * there is one digit more. With a C++17 library std::to_chars() is used
+ * instead, which is always shortest. */
+
+#if defined(LALRT_HAS_TO_CHARS)
+
+/// Writes the shortest digits of v > 0 to digits and returns their
+/// count. v is digits * 10^k.
+static int shortest_digits(double v, char *digits, int &k)
+{
+    char  tmp[FORMAT_BUF_SIZE];
+    char *e = std::to_chars(tmp, tmp + sizeof(tmp), v, std::chars_format::scientific).ptr;
+
+    // d[.ddd]e[+-]xx
+    int   len = 0;
+    char *p   = tmp;
+    for (; p < e && *p != 'e'; p++)
+        if (*p != '.') digits[len++] = *p;
+    int64_t x = 0;
+    parse_int64(p + (p[1] == '+' ? 2 : 1), e, x);
+    k = (int) x - (len - 1);
+    return len;
+}
+
+#else
+
+/// Unsigned 64 bit significand f with binary exponent e: f * 2^e.
+struct DiyFp
+{
+    uint64_t f;
+    int      e;
+
+    DiyFp(uint64_t f_, int e_) : f(f_), e(e_) { }
+
+    /// The upper 64 bits of the 128 bit product, rounded.
+    DiyFp operator*(const DiyFp &o) const
+    {
+        const uint64_t M32 = 0xFFFFFFFFULL;
+        uint64_t a = f >> 32, b = f & M32, c = o.f >> 32, d = o.f & M32;
+        uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+        uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+        tmp += 1ULL << 31;
+        return DiyFp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), e + o.e + 64);
+    }
+};
+
+static const uint64_t DP_HIDDEN_BIT = 0x0010000000000000ULL;
+
+/// 10^k for k = -348, -340, ..., 340, normalized to 64 bit.
+static const uint64_t s_cached_pow_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const int16_t s_cached_pow_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066,
+};
+
+static const uint32_t s_pow10_u32[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/// The cached power 10^-k, that brings a value with binary exponent e
+/// into the range 2^-60 .. 2^-32.
+static DiyFp cached_power(int e, int &k)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347; // 1 / log2(10)
+    int    ik = (int) dk;
+    if (dk - ik > 0.0) ik++;
+
+    unsigned idx = (unsigned) ((ik >> 3) + 1);
+    k = -(-348 + (int) idx * 8);
+    return DiyFp(s_cached_pow_f[idx], s_cached_pow_e[idx]);
+}
+
+/// Moves the last digit towards w, as long as it stays inside the
+/// safe interval.
+static void grisu_round(char *digits, int len, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa
+           && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        digits[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int shortest_digits(double v, char *digits, int &k)
+{
+    uint64_t bits = 0;
+    std::memcpy(&bits, &v, sizeof(bits));
+    int      be   = (int) ((bits >> 52) & 0x7FF);
+    uint64_t sig  = bits & (DP_HIDDEN_BIT - 1);
+    DiyFp    w    = be ? DiyFp(sig + DP_HIDDEN_BIT, be - 1075) : DiyFp(sig, -1074);
+
+    // the boundaries half way to the neighbouring doubles
+    DiyFp plus((w.f << 1) + 1, w.e - 1);
+    while (!(plus.f & (DP_HIDDEN_BIT << 1))) { plus.f <<= 1; plus.e--; }
+    plus.f <<= 10;
+    plus.e -= 10;
+    DiyFp minus = (w.f == DP_HIDDEN_BIT) ? DiyFp((w.f << 2) - 1, w.e - 2)
+                                         : DiyFp((w.f << 1) - 1, w.e - 1);
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    while (!(w.f & 0x8000000000000000ULL)) { w.f <<= 1; w.e--; }
+
+    DiyFp c  = cached_power(plus.e, k);
+    DiyFp W  = w * c;
+    DiyFp Wp = plus * c;
+    DiyFp Wm = minus * c;
+    Wm.f++;
+    Wp.f--;
+
+    // generate the digits of Wp, until they are inside of [Wm, Wp]
+    uint64_t delta = Wp.f - Wm.f;
+    uint64_t wp_w  = Wp.f - W.f;
+    int      shift = -Wp.e;
+    uint64_t one   = 1ULL << shift;
+    uint32_t p1    = (uint32_t) (Wp.f >> shift);
+    uint64_t p2    = Wp.f & (one - 1);
+
+    int kappa = 1;
+    while (kappa < 10 && p1 >= s_pow10_u32[kappa]) kappa++;
+
+    int len = 0;
+    while (kappa > 0)
+    {
+        uint32_t d = p1 / s_pow10_u32[kappa - 1];
+        p1 %= s_pow10_u32[kappa - 1];
+        if (d || len) digits[len++] = (char) ('0' + d);
+        kappa--;
+
+        uint64_t rest = (((uint64_t) p1) << shift) + p2;
+        if (rest <= delta)
+        {
+            k += kappa;
+            grisu_round(digits, len, delta, rest,
+                        ((uint64_t) s_pow10_u32[kappa]) << shift, wp_w);
+            return len;
+        }
+    }
+
+    for (;;)
+    {
+        p2    *= 10;
+        delta *= 10;
+        wp_w  *= 10;
+        char d = (char) (p2 >> shift);
+        if (d || len) digits[len++] = (char) ('0' + d);
+        p2 &= one - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+            k += kappa;
+            grisu_round(digits, len, delta, p2, one, wp_w);
+            return len;
+        }
+    }
+}
+
+#endif
+//---------------------------------------------------------------------------
+
+size_t format_double(double v, char *buf)
+{
+    char *b = buf;
+    if (std::signbit(v))
+        *b++ = '-';
+
+    if (!std::isfinite(v))
+    {
+        const char *s = std::isnan(v) ? "nan" : "inf";
+        std::memcpy(b, s, 4);
+        return (b + 3) - buf;
+    }
+    if (v == 0.0)
+    {
+        *b++ = '0';
+        *b   = '\0';
+        return b - buf;
+    }
+
+    char digits[FORMAT_BUF_SIZE];
+    int  k   = 0;
+    int  len = shortest_digits(std::fabs(v), digits, k);
+    while (len > 1 && digits[len - 1] == '0')
+    {
+        len--;
+        k++;
+    }
+
+    // laid out like printf("%.*g") with at least 15 digits precision,
+    // which is what the values looked like before
+    int x    = len + k - 1; // exponent of the first digit
+    int prec = len > 15 ? len : 15;
+    if (x < -4 || x >= prec)
+    {
+        *b++ = digits[0];
+        if (len > 1)
+        {
+            *b++ = '.';
+            std::memcpy(b, digits + 1, len - 1);
+            b += len - 1;
+        }
+        *b++ = 'e';
+        *b++ = x < 0 ? '-' : '+';
+        int ax = x < 0 ? -x : x;
+        if (ax >= 100) *b++ = (char) ('0' + ax / 100);
+        *b++ = (char) ('0' + (ax / 10) % 10);
+        *b++ = (char) ('0' + ax % 10);
+    }
+    else if (x < 0)
+    {
+        *b++ = '0';
+        *b++ = '.';
+        for (int i = -1; i > x; i--)
+            *b++ = '0';
+        std::memcpy(b, digits, len);
+        b += len;
+    }
+    else if (len <= x + 1)
+    {
+        std::memcpy(b, digits, len);
+        b += len;
+        for (int i = len; i <= x; i++)
+            *b++ = '0';
+    }
+    else
+    {
+        std::memcpy(b, digits, x + 1);
+        b += x + 1;
+        *b++ = '.';
+        std::memcpy(b, digits + x + 1, len - (x + 1));
+        b += len - (x + 1);
+    }
+
+    *b = '\0';
+    return b - buf;
+}
+//---------------------------------------------------------------------------
+
+std::string int64_string(int64_t v)
+{
+    char buf[FORMAT_BUF_SIZE];
+    return std::string(buf, format_int64(v, buf));
+}
+//---------------------------------------------------------------------------
+
+std::string double_string(double v)
+{
+    char buf[FORMAT_BUF_SIZE];
+    return std::string(buf, format_double(v, buf));
+}
+//---------------------------------------------------------------------------
+
+std::string fixed6_string(double v)
+{
+#if defined(__SIZEOF_INT128__)
+    // |v| = mant * 2^e exactly, then round |v| * 10^6 half to even
+    // like printf() does.
+    if (std::isfinite(v) && std::fabs(v) < 9.0e18)
+    {
+        typedef unsigned __int128 u128;
+
+        int      e    = 0;
+        double   m    = std::frexp(std::fabs(v), &e);
+        uint64_t mant = (uint64_t) std::ldexp(m, 53);
+        e -= 53;
+
+        u128 q;
+        if (e >= 0)
+            q = ((u128) (mant << e)) * 1000000;
+        else if (-e >= 128)
+            q = 0;
+        else
+        {
+            u128 x    = ((u128) mant) * 1000000;
+            u128 rem  = x & ((((u128) 1) << -e) - 1);
+            u128 half = ((u128) 1) << (-e - 1);
+            q = x >> -e;
+            if (rem > half || (rem == half && (q & 1)))
+                q++;
+        }
+
+        char     buf[FORMAT_BUF_SIZE + 8];
+        char    *b    = buf;
+        uint64_t frac = (uint64_t) (q % 1000000);
+        if (std::signbit(v)) *b++ = '-';
+        b += format_int64((int64_t) (uint64_t) (q / 1000000), b);
+        *b++ = '.';
+        for (int i = 5; i >= 0; i--)
+        {
+            b[i] = (char) ('0' + frac % 10);
+            frac /= 10;
+        }
+        return std::string(buf, (b + 6) - buf);
+    }
+#endif
+
+    // huge values, inf and nan
+    char buf[400];
+    int  len = std::snprintf(buf, sizeof(buf), "%f", v);
+    char dp  = locale_decimal_point();
+    if (dp != '.')
+        for (int i = 0; i < len; i++)
+            if (buf[i] == dp) buf[i] = '.';
+    return std::string(buf, len);
+}
+//---------------------------------------------------------------------------
+
+} // namespace numconv
@@ -0,0 +1,84 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include "compat_stdint.h"
+
+namespace numconv
+{
+//---------------------------------------------------------------------------
+
+/// Parses a number in strict JSON syntax from [p, end).
+/// Integers that fit into 64 bit are returned in i_out with
+/// is_double = false, everything else is returned in d_out.
+/// Returns the position behind the number or nullptr on a syntax error.
+/// The result does not depend on the current C locale.
+const char *parse_json_number(const char *p, const char *end,
+                              bool &is_double, int64_t &i_out, double &d_out);
+
+/// Parsers in the manner of std::from_chars(): [p, end) has to start
+/// with the number, there is no leading whitespace or '+' allowed.
+/// parse_double() reads decimal numbers with optional fraction and
+/// exponent, "inf", "infinity" and "nan". Both return the position
+/// behind the number, or nullptr if there is none or it is out of range.
+/// Nothing depends on the current C locale and nothing throws.
+const char *parse_int64(const char *p, const char *end, int64_t &out);
+const char *parse_double(const char *p, const char *end, double &out);
+
+/// Lenient conversions with the semantics of std::stoll()/std::stod(),
+/// as the string values in vval.h use them: Leading whitespace and a '+'
+/// are skipped, anything behind the number is ignored. Returns 0 if
+/// there is no number or it is out of range, instead of throwing.
+int64_t to_int64(const char *p, size_t len);
+double  to_double(const char *p, size_t len);
+
+//---------------------------------------------------------------------------
+
+/// Size of the buffer format_int64() and format_double() need.
+const size_t FORMAT_BUF_SIZE = 32;
+
+/// Writes the decimal representation of v into buf (not NUL terminated)
+/// and returns the number of bytes written.
+size_t format_int64(int64_t v, char *buf);
+
+/// Writes the shortest digits of v, that parse back to the same double,
+/// into buf (NUL terminated), laid out like printf("%.15g") (or more
+/// digits if needed). Always uses '.' as decimal point. Returns the length.
+size_t format_double(double v, char *buf);
+
+/// Formats like std::to_string(int64_t).
+std::string int64_string(int64_t v);
+
+/// Formats like std::to_string(double), which is printf("%f"): always
+/// 6 decimals, but with '.' as decimal point regardless of the locale.
+std::string fixed6_string(double v);
+
+/// The shortest round trip representation of format_double().
+std::string double_string(double v);
+
+//---------------------------------------------------------------------------
+
+} // namespace numconv
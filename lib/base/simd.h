@@ -0,0 +1,234 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include "compat_stdint.h"
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#   define LALRT_SIMD_AVX2 1
+#   define LALRT_SIMD_SSE2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define LALRT_SIMD_SSE2 1
+#endif
+
+/* Small set of byte scanning primitives, that are used by the parsers and
+ * serializers in lib/base. Every function works on blocks of 64 bytes and
+ * returns a bit mask, where bit N corresponds to byte N of the block.
+ * Depending on the compiler flags AVX2 (-mavx2), SSE2 (always available
+ * on x86-64) or a plain C++ fallback is used. */
+
+namespace simd
+{
+//---------------------------------------------------------------------------
+
+#if LALRT_SIMD_AVX2
+typedef __m256i vec_t;
+static const int VEC_SIZE = 32;
+
+inline vec_t    vload(const char *p)          { return _mm256_loadu_si256((const __m256i *) p); }
+inline vec_t    vsplat(char c)                { return _mm256_set1_epi8(c); }
+inline uint64_t vmask(vec_t v)                { return (uint32_t) _mm256_movemask_epi8(v); }
+inline vec_t    veq(vec_t a, vec_t b)         { return _mm256_cmpeq_epi8(a, b); }
+inline vec_t    vor(vec_t a, vec_t b)         { return _mm256_or_si256(a, b); }
+inline vec_t    vmax_u8(vec_t a, vec_t b)     { return _mm256_max_epu8(a, b); }
+#elif LALRT_SIMD_SSE2
+typedef __m128i vec_t;
+static const int VEC_SIZE = 16;
+
+inline vec_t    vload(const char *p)          { return _mm_loadu_si128((const __m128i *) p); }
+inline vec_t    vsplat(char c)                { return _mm_set1_epi8(c); }
+inline uint64_t vmask(vec_t v)                { return (uint32_t) _mm_movemask_epi8(v); }
+inline vec_t    veq(vec_t a, vec_t b)         { return _mm_cmpeq_epi8(a, b); }
+inline vec_t    vor(vec_t a, vec_t b)         { return _mm_or_si128(a, b); }
+inline vec_t    vmax_u8(vec_t a, vec_t b)     { return _mm_max_epu8(a, b); }
+#endif
+
+//---------------------------------------------------------------------------
+
+/// Bit mask of the bytes in the 64 byte block at p, that are equal to c.
+inline uint64_t eq_mask64(const char *p, char c)
+{
+#if LALRT_SIMD_SSE2
+    vec_t s = vsplat(c);
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i += VEC_SIZE)
+        m |= vmask(veq(vload(p + i), s)) << i;
+    return m;
+#else
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i++)
+        if (p[i] == c) m |= ((uint64_t) 1) << i;
+    return m;
+#endif
+}
+//---------------------------------------------------------------------------
+
+/// Bit mask of the bytes in the 64 byte block at p, that are one of
+/// the (up to 8) characters in the NUL terminated set.
+inline uint64_t oneof_mask64(const char *p, const char *set)
+{
+#if LALRT_SIMD_SSE2
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i += VEC_SIZE)
+    {
+        vec_t v   = vload(p + i);
+        vec_t acc = veq(v, vsplat(set[0]));
+        for (int j = 1; set[j]; j++)
+            acc = vor(acc, veq(v, vsplat(set[j])));
+        m |= vmask(acc) << i;
+    }
+    return m;
+#else
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i++)
+        if (p[i] && std::strchr(set, p[i])) m |= ((uint64_t) 1) << i;
+    return m;
+#endif
+}
+//---------------------------------------------------------------------------
+
+/// Bit mask of the bytes in the 64 byte block at p, that are (unsigned)
+/// less or equal to c. Used to find control characters.
+inline uint64_t le_mask64(const char *p, unsigned char c)
+{
+#if LALRT_SIMD_SSE2
+    vec_t s = vsplat((char) c);
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i += VEC_SIZE)
+        m |= vmask(veq(vmax_u8(vload(p + i), s), s)) << i;
+    return m;
+#else
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i++)
+        if ((unsigned char) p[i] <= c) m |= ((uint64_t) 1) << i;
+    return m;
+#endif
+}
+//---------------------------------------------------------------------------
+
+/// Bit mask of the non ASCII bytes (high bit set) in the 64 byte block at p.
+inline uint64_t high_mask64(const char *p)
+{
+#if LALRT_SIMD_SSE2
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i += VEC_SIZE)
+        m |= vmask(vload(p + i)) << i;
+    return m;
+#else
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i++)
+        if (p[i] & 0x80) m |= ((uint64_t) 1) << i;
+    return m;
+#endif
+}
+//---------------------------------------------------------------------------
+
+/// Computes the XOR of all bits below and including every bit.
+/// Turns a mask of quote characters into a mask of the quoted regions.
+inline uint64_t prefix_xor(uint64_t m)
+{
+    m ^= m << 1;
+    m ^= m << 2;
+    m ^= m << 4;
+    m ^= m << 8;
+    m ^= m << 16;
+    m ^= m << 32;
+    return m;
+}
+//---------------------------------------------------------------------------
+
+inline int trailing_zeros(uint64_t m)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(m);
+#else
+    int n = 0;
+    while (!(m & 1)) { m >>= 1; n++; }
+    return n;
+#endif
+}
+//---------------------------------------------------------------------------
+
+inline int popcount(uint64_t m)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(m);
+#else
+    int n = 0;
+    while (m) { m &= m - 1; n++; }
+    return n;
+#endif
+}
+//---------------------------------------------------------------------------
+
+/// Copies the rest of a buffer (less than 64 bytes) into a padded block,
+/// so that the *_mask64 functions can be used on it.
+/// Returns the mask of the bytes that are valid.
+inline uint64_t load_tail(char *block, const char *p, size_t len, char pad)
+{
+    std::memset(block, pad, 64);
+    std::memcpy(block, p, len);
+    return len >= 64 ? ~(uint64_t) 0 : ((((uint64_t) 1) << len) - 1);
+}
+//---------------------------------------------------------------------------
+
+/// Returns the position of the first byte in [p, end), that is equal
+/// to a or b. Returns end if none is found.
+inline const char *find_either(const char *p, const char *end, char a, char b)
+{
+    while (end - p >= 64)
+    {
+        uint64_t m = eq_mask64(p, a) | eq_mask64(p, b);
+        if (m) return p + trailing_zeros(m);
+        p += 64;
+    }
+    for (; p < end; p++)
+        if (*p == a || *p == b)
+            return p;
+    return end;
+}
+//---------------------------------------------------------------------------
+
+/// Returns the position of the first byte in [p, end) that is either
+/// equal to a or b or less or equal to ctrl. Returns end if none is found.
+inline const char *find_special(const char *p, const char *end, char a, char b, unsigned char ctrl)
+{
+    while (end - p >= 64)
+    {
+        uint64_t m = eq_mask64(p, a) | eq_mask64(p, b) | le_mask64(p, ctrl);
+        if (m) return p + trailing_zeros(m);
+        p += 64;
+    }
+    for (; p < end; p++)
+        if (*p == a || *p == b || ((unsigned char) *p) <= ctrl)
+            return p;
+    return end;
+}
+//---------------------------------------------------------------------------
+
+} // namespace simd
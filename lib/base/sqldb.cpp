@@ -2,6 +2,7 @@
 #include "rt/log.h"
 #include "sqlite3/sqlite3.h"
 #include "base/vval_util.h"
+#include "base/vv_table.h"
 
 using namespace std;
 using namespace VVal;
@@ -23,6 +24,22 @@ Session *Session::connect(const VVal::VV &options)
 }
 //---------------------------------------------------------------------------
 
+VVal::VV Session::table()
+{
+    table::TablePtr t = make_shared<table::Table>();
+    for (;;)
+    {
+        VV r = this->row();
+        if (!r->is_defined())
+            break;
+        t->push_row(r);
+        if (!this->next())
+            break;
+    }
+    return vv_table(t);
+}
+//---------------------------------------------------------------------------
+
 void SQLite3Session::init(const VVal::VV &options)
 {
     m_file = options->_s("file");
@@ -236,6 +253,72 @@ VVal::VV SQLite3Session::row()
 }
 //---------------------------------------------------------------------------
 
+VVal::VV SQLite3Session::table()
+{
+    table::TablePtr t = make_shared<table::Table>();
+    if (!m_stmt)
+        return vv_table(t);
+
+    int cc = sqlite3_column_count(m_stmt);
+    // nullptr for repeated names, row() keeps only one of them too
+    vector<table::Column *> cols;
+    for (int i = 0; i < cc; i++)
+    {
+        const char *cname = sqlite3_column_name(m_stmt, i);
+        string name = to_lower(string(cname, strlen(cname)));
+        if (t->column(name))
+        {
+            cols.push_back(nullptr);
+            continue;
+        }
+        cols.push_back(t->add_column(name, table::T_INT).get());
+    }
+
+    while (m_stmt)
+    {
+        for (int i = 0; i < cc; i++)
+        {
+            table::Column *c = cols[i];
+            if (!c) continue;
+
+            switch (sqlite3_column_type(m_stmt, i))
+            {
+                case SQLITE_INTEGER:
+                    c->accept(table::T_INT);
+                    c->push_int((int64_t) sqlite3_column_int64(m_stmt, i));
+                    break;
+                case SQLITE_FLOAT:
+                    c->accept(table::T_DOUBLE);
+                    c->push_double(sqlite3_column_double(m_stmt, i));
+                    break;
+                case SQLITE_NULL:
+                    c->push_null();
+                    break;
+                case SQLITE_BLOB:
+                {
+                    const void *b = sqlite3_column_blob(m_stmt, i);
+                    c->accept(table::T_STRING);
+                    c->push_string(b ? (const char *) b : "", (size_t) sqlite3_column_bytes(m_stmt, i));
+                    break;
+                }
+                case SQLITE_TEXT:
+                default:
+                {
+                    const unsigned char *s = sqlite3_column_text(m_stmt, i);
+                    c->accept(table::T_STRING);
+                    c->push_string((const char *) s, (size_t) sqlite3_column_bytes(m_stmt, i));
+                    break;
+                }
+            }
+        }
+        t->end_row();
+        this->next();
+    }
+
+    return vv_table(t);
+}
+//---------------------------------------------------------------------------
+
 bool SQLite3Session::next()
 {
     if (!m_stmt)
@@ -58,6 +58,10 @@ class Session
         virtual VVal::VV row() = 0;
         virtual bool next() = 0;
         virtual void close() = 0;
+        /// Fetches the current and all remaining rows into a columnar
+        /// table (see vv_table.h), with the lowercase column names.
+        /// The default implementation goes through row() and next().
+        virtual VVal::VV table();
 };
 //---------------------------------------------------------------------------
 
@@ -77,6 +81,7 @@ class SQLite3Session : public Session
         virtual VVal::VV row();
         virtual bool next();
         virtual void close();
+        virtual VVal::VV table();
 };
 //---------------------------------------------------------------------------
 
@@ -0,0 +1,127 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include "simd.h"
+
+/* UTF-8 scanning on whole buffers. The ASCII parts, which are the
+ * majority of most text, are skipped 64 bytes at a time with the SIMD
+ * primitives from simd.h. Only the multibyte sequences are looked at
+ * byte by byte. */
+
+namespace utf8
+{
+//---------------------------------------------------------------------------
+
+/// Returns the end of the run of ASCII bytes starting at p,
+/// which is either end or the first byte with the high bit set.
+inline const char *ascii_run_end(const char *p, const char *end)
+{
+    while (end - p >= 64)
+    {
+        uint64_t m = simd::high_mask64(p);
+        if (m) return p + simd::trailing_zeros(m);
+        p += 64;
+    }
+    for (; p < end; p++)
+        if (*p & 0x80)
+            return p;
+    return end;
+}
+//---------------------------------------------------------------------------
+
+/// Returns the length of the well formed multibyte sequence at p
+/// or 0 if it is malformed: bad lead or continuation byte, truncated,
+/// overlong, a surrogate or above U+10FFFF.
+inline int sequence_length(const char *p, const char *end)
+{
+    unsigned char c = (unsigned char) *p;
+
+    int      n;
+    uint32_t cp;
+    if      ((c & 0xE0) == 0xC0) { n = 1; cp = c & 0x1F; }
+    else if ((c & 0xF0) == 0xE0) { n = 2; cp = c & 0x0F; }
+    else if ((c & 0xF8) == 0xF0) { n = 3; cp = c & 0x07; }
+    else return 0;
+
+    if (end - p <= n) return 0;
+
+    for (int i = 1; i <= n; i++)
+    {
+        unsigned char cc = (unsigned char) p[i];
+        if ((cc & 0xC0) != 0x80) return 0;
+        cp = (cp << 6) | (cc & 0x3F);
+    }
+
+    if (   (n == 1 && cp < 0x80)
+        || (n == 2 && cp < 0x800)
+        || (n == 3 && (cp < 0x10000 || cp > 0x10FFFF))
+        || (cp >= 0xD800 && cp <= 0xDFFF))
+        return 0;
+
+    return n + 1;
+}
+//---------------------------------------------------------------------------
+
+/// Returns the offset of the first malformed sequence in the len bytes
+/// at p or len if all of it is valid UTF-8.
+inline size_t invalid_offset(const char *p, size_t len)
+{
+    const char *start = p;
+    const char *end   = p + len;
+    for (;;)
+    {
+        p = ascii_run_end(p, end);
+        if (p == end)
+            return len;
+
+        // multibyte characters tend to come in runs, so stay in the
+        // slow loop until the next ASCII byte
+        do
+        {
+            int n = sequence_length(p, end);
+            if (!n) return (size_t) (p - start);
+            p += n;
+        }
+        while (p < end && (*p & 0x80));
+    }
+}
+//---------------------------------------------------------------------------
+
+/// Returns the position of the first malformed sequence in [p, end)
+/// or end if all of it is valid UTF-8.
+inline const char *find_invalid(const char *p, const char *end)
+{
+    return p + invalid_offset(p, (size_t) (end - p));
+}
+//---------------------------------------------------------------------------
+
+inline bool valid(const char *p, const char *end)
+{
+    size_t len = (size_t) (end - p);
+    return invalid_offset(p, len) == len;
+}
+//---------------------------------------------------------------------------
+
+} // namespace utf8
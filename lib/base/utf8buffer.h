@@ -38,6 +38,7 @@ extern "C"
 }
 #include "compat_stdint.h"
 #include "compat_win.h"
+#include "utf8.h"
 
 //#define snprintf _snprintf
 
@@ -51,60 +52,112 @@ class UTF8Buffer_exception
 ///
 /// Er besitzt verschiedene Funktionen die hilfreich
 /// zum Parsen von div. Text-Formaten sind.
+///
+/// Up to INLINE_SIZE bytes are stored in the object itself, so small
+/// buffers (map keys, number literals, packet headers) don't allocate.
 class UTF8Buffer
 {
+    public:
+        enum { INLINE_SIZE = 32 };
+
     private:
         unsigned char *data;
         size_t len;
         size_t alloc;
         size_t offs;
+        unsigned char inline_data[INLINE_SIZE];
+
+        bool is_inline () const { return data == inline_data; }
+
+        void release ()
+        {
+            if (!is_inline ())
+                delete[] data;
+            data  = inline_data;
+            alloc = INLINE_SIZE;
+            len   = 0;
+            offs  = 0;
+        }
+
+        void init (const char *in, size_t l)
+        {
+            offs = 0;
+            len  = l;
+            if (l <= INLINE_SIZE)
+            {
+                data  = inline_data;
+                alloc = INLINE_SIZE;
+            }
+            else
+            {
+                alloc = l;
+                data  = new unsigned char[alloc];
+            }
+            if (l)
+                memcpy (data, in, l);
+        }
+
+        void take (UTF8Buffer &chb)
+        {
+            if (chb.is_inline ())
+            {
+                init (chb.buffer (), chb.length ());
+            }
+            else
+            {
+                data  = chb.data;
+                len   = chb.len;
+                alloc = chb.alloc;
+                offs  = chb.offs;
+                chb.data = chb.inline_data;
+            }
+            chb.alloc = INLINE_SIZE;
+            chb.len   = 0;
+            chb.offs  = 0;
+        }
 
     public:
         UTF8Buffer ()
-            : data (0), len (0), alloc (0), offs (0)
+            : data (inline_data), len (0), alloc (INLINE_SIZE), offs (0)
         {
-            alloc = 10;
-            data = new unsigned char[alloc];
-            len = 0;
-            offs = 0;
         }
 
         UTF8Buffer (const char *str)
         {
-            offs = 0;
-            len = alloc = strlen (str);
-            data = (unsigned char *) new char[alloc];
-            memcpy (data, str, len);
+            init (str, strlen (str));
         }
 
         UTF8Buffer (const char *in, size_t l)
         {
-            offs = 0;
-            len = alloc = l;
-            data = (unsigned char *) new char[alloc];
-            memcpy (data, in, len);
+            init (in, l);
         }
 
         UTF8Buffer (const UTF8Buffer &chb)
         {
-            offs = 0;
-            len = alloc = chb.length ();
-            data = (unsigned char *) new char[alloc];
-            memcpy (data, chb.buffer (), chb.length ());
+            init (chb.buffer (), chb.length ());
         }
 
+        UTF8Buffer (UTF8Buffer &&chb)
+        {
+            take (chb);
+        }
+
+        /// Empties the buffer and frees the heap memory.
         void reset()
         {
-            alloc = 10;
-            if (data) delete[] data;
-            data  = new unsigned char[alloc];
-            len   = 0;
-            offs  = 0;
+            release ();
+        }
+
+        /// Empties the buffer, but keeps the memory for reuse.
+        void clear()
+        {
+            len  = 0;
+            offs = 0;
         }
 
         virtual ~UTF8Buffer ()
         {
-            if (data)
+            if (!is_inline ())
                 delete [] data;
         }
 
@@ -113,11 +166,29 @@ class UTF8Buffer
             if (this == &chb)
                 return *this;
 
-            delete[] data;
-            offs = 0;
-            len = alloc = chb.length ();
-            data = (unsigned char *) new char[alloc];
-            memcpy (data, chb.buffer (), chb.length ());
+            if (chb.length () <= alloc)
+            {
+                // the source can't be part of our own memory here
+                offs = 0;
+                len  = chb.length ();
+                if (len)
+                    memcpy (data, chb.buffer (), len);
+                return *this;
+            }
+
+            release ();
+            init (chb.buffer (), chb.length ());
+
+            return *this;
+        }
+
+        UTF8Buffer& operator=(UTF8Buffer &&chb)
+        {
+            if (this == &chb)
+                return *this;
+
+            release ();
+            take (chb);
 
             return *this;
         }
@@ -156,6 +227,24 @@ class UTF8Buffer
 
         size_t read_offset () const { return offs; }
 
+        size_t capacity () const { return alloc; }
+
+        /// Makes sure, that l bytes fit without reallocation.
+        void reserve (size_t l)
+        {
+            if (alloc >= l)
+                return;
+
+            unsigned char *buf = new unsigned char[l];
+            if (len)
+                memcpy (buf, data + offs, len);
+            if (!is_inline ())
+                delete[] data;
+            data  = buf;
+            alloc = l;
+            offs  = 0;
+        }
+
         char *c_str () const
         {
             char *b = new char[this->length () + 1];
@@ -196,7 +285,7 @@ class UTF8Buffer
         {
             if (this->length() < 1)
                 return false;
-            iRes = *((uint8_t *) this->buffer());
+            iRes = (uint8_t) this->buffer()[0];
             if (bSkip)
                 this->skip_bytes(1);
             return true;
@@ -206,7 +295,7 @@ class UTF8Buffer
         {
             if (this->length() < 2)
                 return false;
-            iRes = *((uint16_t *) this->buffer());
+            memcpy(&iRes, this->buffer(), 2);
             endian::decode16Bit((char *) &iRes);
             if (bSkip)
                 this->skip_bytes(2);
@@ -217,7 +306,7 @@ class UTF8Buffer
         {
             if (this->length() < 4)
                 return false;
-            iRes = *((uint32_t *) this->buffer());
+            memcpy(&iRes, this->buffer(), 4);
             endian::decode32Bit((char *) &iRes);
             if (bSkip)
                 this->skip_bytes(4);
@@ -228,7 +317,7 @@ class UTF8Buffer
         {
             if (this->length() < 8)
                 return false;
-            iRes = *((uint64_t *) this->buffer());
+            memcpy(&iRes, this->buffer(), 8);
             endian::decode64Bit((char *) &iRes);
             if (bSkip)
                 this->skip_bytes(8);
@@ -239,7 +328,7 @@ class UTF8Buffer
         {
             if (this->length() < 4)
                 return false;
-            fRes = *((float *) this->buffer());
+            memcpy(&fRes, this->buffer(), 4);
             endian::decode32Bit((char *) &fRes);
             this->skip_bytes(4);
             return true;
@@ -249,7 +338,7 @@ class UTF8Buffer
         {
             if (this->length() < 8)
                 return false;
-            fRes = *((double *) this->buffer());
+            memcpy(&fRes, this->buffer(), 8);
             endian::decode64Bit((char *) &fRes);
             this->skip_bytes(8);
             return true;
@@ -267,33 +356,43 @@ class UTF8Buffer
 
         void append_bytes (const char *buffer, size_t ilen = 0)
         {
-            if (alloc < (len + ilen))
+            if (offs + len + ilen > alloc)
             {
-                if (len * 2 < (len + ilen))
-                    alloc = (len + ilen) * 2;
+                // Moving the unread data to the front is only worth it,
+                // if at least as much space is gained as is moved.
+                // Otherwise grow geometrically.
+                if (len + ilen <= alloc && offs >= len)
+                {
+                    memmove (data, data + offs, len);
+                    offs = 0;
+                }
                 else
-                    alloc = len * 2;
-
-                unsigned char *buf = (unsigned char *) new char[alloc];
-                if (data)
                 {
-                    memcpy (buf, data + offs, len);
-                    delete[] data;
+                    size_t a = alloc * 2;
+                    if (a < len + ilen)
+                        a = len + ilen;
+                    reserve (a);
                 }
-                data = buf;
-                offs = 0;
             }
 
-            if (offs > 0)
-            {
-                memmove (data, data + offs, len);
-                offs = 0;
-            }
-
-            memcpy (data + len, buffer, ilen);
+            memcpy (data + offs + len, buffer, ilen);
             len += ilen;
         }
 
+        /// Number of ASCII bytes at the start of the buffer.
+        size_t ascii_run_length () const
+        {
+            const char *b = this->buffer ();
+            return utf8::ascii_run_end (b, b + len) - b;
+        }
+
+        /// Checks the whole buffer for well formed UTF-8.
+        bool is_valid_utf8 () const
+        {
+            const char *b = this->buffer ();
+            return utf8::valid (b, b + len);
+        }
+
         bool first_is_ascii () const
         {
             if (len <= 0)
@@ -509,25 +608,11 @@ class UTF8Buffer
 
         void skip_any_ascii (const char *str)
         {
-            while (this->length () > 0 && this->first_is_ascii ())
-            {
-                bool match = false;
-                char cur = this->first_ascii ();
-
-                for (int i = 0; str[i]; i++)
-                {
-                    if (cur == str[i])
-                    {
-                        match = true;
-                        break;
-                    }
-                }
-
-                if (match)
-                    this->skip_first ();
-                else
-                    break;
-            }
+            const char *b = this->buffer ();
+            size_t i = 0;
+            while (i < len && b[i] && strchr (str, b[i]))
+                i++;
+            this->skip_bytes (i);
         }
 
         void skip_json_ws ()
@@ -541,48 +626,57 @@ class UTF8Buffer
             return this->first_ascii (skip);
         }
 
+        /// Throws UTF8Buffer_exception if the buffer is not valid UTF-8.
         void dump_as_json_string (UTF8Buffer &chb) const
         {
-            UTF8Buffer buf(*this);
+            const char *p   = this->buffer ();
+            const char *end = p + len;
 
+            if (!utf8::valid (p, end))
+                throw UTF8Buffer_exception ();
+
+            chb.reserve (chb.length () + len + 2);
             chb.append_ascii ('"');
 
-            while (buf.length () > 0)
+            // next '"', '\\' or control character
+            const char *special = 0;
+
+            while (p < end)
             {
-                if (buf.first_is_ascii ())
+                if (!special || special < p)
+                    special = simd::find_special (p, end, '"', '\\', 0x1F);
+
+                // copy everything up to the next character that needs
+                // escaping in one go, '/' is escaped too
+                const char *q = (const char *) memchr (p, '/', special - p);
+                if (!q) q = special;
+
+                chb.append_bytes (p, q - p);
+                if (q >= end)
+                    break;
+
+                unsigned char f = (unsigned char) *q;
+                char esc;
+                switch (f)
                 {
-                    unsigned char f = buf.first_ascii ();
-                    if (!((f >= 0x20 && f <= 0x21)
-                          || (f >= 0x23 && f <= 0x5B)
-                          || (f >= 0x5D && f <= 0x7F)))
-                    {
-                        chb.append_ascii ('\\');
-                        char esc;
-                        switch (f)
-                        {
-                            case '"' :
-                            case '\\':
-                            case '/' :
-                                esc = f; break;
-                            case '\x08': esc = 'b'; break;
-                            case '\x09': esc = 't'; break;
-                            case '\x0C': esc = 'f'; break;
-                            case '\x0A': esc = 'n'; break;
-                            case '\x0D': esc = 'r'; break;
-                            default:
-                                         chb.append_ascii ('u');
-                                         chb.append_ascii_as_hex (f);
-                                         buf.skip_first ();
-                                         continue;
-                        }
-                        chb.append_ascii (esc);
-                        buf.skip_first ();
+                    case '"' :
+                    case '\\':
+                    case '/' :
+                        esc = f; break;
+                    case '\x08': esc = 'b'; break;
+                    case '\x09': esc = 't'; break;
+                    case '\x0C': esc = 'f'; break;
+                    case '\x0A': esc = 'n'; break;
+                    case '\x0D': esc = 'r'; break;
+                    default:
+                        chb.append_bytes ("\\u", 2);
+                        chb.append_ascii_as_hex (f);
+                        p = q + 1;
                         continue;
-                    }
                 }
-
-                chb.append_first_of (buf);
-                buf.skip_first ();
+                chb.append_ascii ('\\');
+                chb.append_ascii (esc);
+                p = q + 1;
             }
 
             chb.append_ascii ('\x22');
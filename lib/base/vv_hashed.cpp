@@ -0,0 +1,351 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "vv_hashed.h"
+#include <algorithm>
+#include <unordered_set>
+
+namespace VVal
+{
+//---------------------------------------------------------------------------
+
+bool HashSetValue::add(const VV &k)
+{
+    HashedKey key(k);
+    if (!m_index.emplace(key, m_keys->size()).second)
+        return false;
+    m_keys->push_back(key.value);
+    return true;
+}
+//---------------------------------------------------------------------------
+
+bool HashSetValue::remove(const VV &k)
+{
+    auto it = m_index.find(HashedKey(k));
+    if (it == m_index.end())
+        return false;
+
+    size_t pos = it->second;
+    m_index.erase(it);
+    if (pos + 1 < m_keys->size())
+    {
+        (*m_keys)[pos]                     = m_keys->back();
+        m_index[HashedKey((*m_keys)[pos])] = pos;
+    }
+    m_keys->pop_back();
+    return true;
+}
+//---------------------------------------------------------------------------
+
+VV HashSetValue::clone() const
+{
+    HashSetValue *s = new HashSetValue;
+    *s->m_keys = *m_keys;
+    s->m_index = m_index;
+    return VV(s);
+}
+//---------------------------------------------------------------------------
+
+const VV *HashMapValue::find(const VV &k) const
+{
+    auto it = m_index.find(HashedKey(k));
+    if (it == m_index.end())
+        return nullptr;
+    return &(*m_values)[it->second];
+}
+//---------------------------------------------------------------------------
+
+void HashMapValue::put(const VV &k, const VV &v)
+{
+    HashedKey key(k);
+    auto r = m_index.emplace(key, m_keys->size());
+    if (r.second)
+    {
+        m_keys->push_back(key.value);
+        m_values->push_back(v);
+    }
+    else
+        (*m_values)[r.first->second] = v;
+}
+//---------------------------------------------------------------------------
+
+bool HashMapValue::remove(const VV &k)
+{
+    auto it = m_index.find(HashedKey(k));
+    if (it == m_index.end())
+        return false;
+
+    size_t pos = it->second;
+    m_index.erase(it);
+    if (pos + 1 < m_keys->size())
+    {
+        (*m_keys)[pos]                     = m_keys->back();
+        (*m_values)[pos]                   = m_values->back();
+        m_index[HashedKey((*m_keys)[pos])] = pos;
+    }
+    m_keys->pop_back();
+    m_values->pop_back();
+    return true;
+}
+//---------------------------------------------------------------------------
+
+VV HashMapValue::clone() const
+{
+    HashMapValue *m = new HashMapValue;
+    *m->m_keys   = *m_keys;
+    *m->m_values = *m_values;
+    m->m_index   = m_index;
+    return VV(m);
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator HashMapValue::begin() const
+{
+    VV_LIST keys = m_keys, values = m_values;
+    return VariantValueIterator([keys, values](int32_t i)
+    {
+        VV v = (*values)[i];
+        return vv_list() << (*keys)[i] << (v ? v : vv_undef());
+    }, 0);
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator HashMapValue::end() const
+{
+    return VariantValueIterator(std::function<VV(int32_t)>(), size());
+}
+//---------------------------------------------------------------------------
+
+VV vv_hset() { return VV(new HashSetValue); }
+VV vv_hmap() { return VV(new HashMapValue); }
+
+//---------------------------------------------------------------------------
+
+/// The key of a record for the internal indices: The values of the
+/// key fields (or the record itself) and their hash, without the list
+/// value around them, that vv_record_key() returns.
+struct FieldKey
+{
+    std::vector<VV> values;
+    size_t          hash;
+};
+
+struct FieldKeyHash
+{
+    size_t operator()(const FieldKey &k) const { return k.hash; }
+};
+
+struct FieldKeyEqual
+{
+    bool operator()(const FieldKey &a, const FieldKey &b) const
+    {
+        if (a.hash != b.hash || a.values.size() != b.values.size())
+            return false;
+        for (size_t i = 0; i < a.values.size(); i++)
+            if (!vv_equals(a.values[i], b.values[i]))
+                return false;
+        return true;
+    }
+};
+//---------------------------------------------------------------------------
+
+/// key_spec of vv_record_key(), parsed once for all records.
+class RecordKey
+{
+    private:
+        struct Field
+        {
+            bool        is_index;
+            int32_t     index;
+            std::string name;
+        };
+
+        bool               m_whole;
+        bool               m_composite;
+        std::vector<Field> m_fields;
+
+        void add_field(const VV &f)
+        {
+            Field fld;
+            fld.is_index = f->is_int();
+            fld.index    = fld.is_index ? (int32_t) f->i() : 0;
+            if (!fld.is_index) fld.name = f->s();
+            m_fields.push_back(fld);
+        }
+
+    public:
+        RecordKey(const VV &key_spec)
+            : m_whole(!key_spec || key_spec->is_undef()),
+              m_composite(!m_whole && key_spec->is_list())
+        {
+            if (m_composite)
+                for (auto f : *key_spec) add_field(f);
+            else if (!m_whole)
+                add_field(key_spec);
+        }
+
+        void fields(const VV &record, FieldKey &out) const
+        {
+            out.values.clear();
+            if (m_whole)
+                out.values.push_back(record);
+            for (auto &f : m_fields)
+                out.values.push_back(f.is_index ? record->_(f.index) : record->_(f.name));
+
+            out.hash = out.values.size();
+            for (auto &v : out.values)
+                out.hash = (out.hash ^ vv_hash(v)) * 0x100000001B3ULL;
+        }
+
+        /// The key as vv_record_key() returns it.
+        VV value(const FieldKey &k) const
+        {
+            if (!m_composite)
+                return k.values[0];
+            VV key(vv_list());
+            for (auto &v : k.values)
+                key->push(v);
+            return key;
+        }
+};
+//---------------------------------------------------------------------------
+
+VV vv_record_key(const VV &record, const VV &key_spec)
+{
+    RecordKey key_of(key_spec);
+    FieldKey  k;
+    key_of.fields(record, k);
+    return key_of.value(k);
+}
+//---------------------------------------------------------------------------
+
+VV vv_dedup(const VV &records, const VV &key_spec)
+{
+    RecordKey key_of(key_spec);
+    std::unordered_set<FieldKey, FieldKeyHash, FieldKeyEqual> seen;
+    seen.reserve(records->size());
+
+    VV       out(vv_list());
+    FieldKey k;
+    for (auto r : *records)
+    {
+        key_of.fields(r, k);
+        if (seen.insert(k).second)
+            out->push(r);
+    }
+    return out;
+}
+//---------------------------------------------------------------------------
+
+VV vv_group_by(const VV &records, const VV &key_spec)
+{
+    RecordKey key_of(key_spec);
+    std::unordered_map<FieldKey, VV, FieldKeyHash, FieldKeyEqual> index;
+    index.reserve(records->size() / 4);
+
+    // the HashMapValue only gets the new groups, for the insertion order
+    HashMapValue *groups = new HashMapValue;
+    VV ret(groups);
+
+    FieldKey k;
+    for (auto r : *records)
+    {
+        key_of.fields(r, k);
+        auto it = index.find(k);
+        if (it != index.end())
+        {
+            it->second->push(r);
+            continue;
+        }
+        VV group(vv_list() << r);
+        groups->put(key_of.value(k), group);
+        index.emplace(k, group);
+    }
+    return ret;
+}
+//---------------------------------------------------------------------------
+
+VV vv_hash_join(const VV &left, const VV &right,
+                const VV &left_key, const VV &right_key,
+                bool left_outer)
+{
+    RecordKey lkey_of(left_key), rkey_of(right_key);
+
+    // index the right side: key => records with that key
+    std::unordered_map<FieldKey, std::vector<VV>, FieldKeyHash, FieldKeyEqual> index;
+    index.reserve(right->size());
+    FieldKey k;
+    for (auto r : *right)
+    {
+        rkey_of.fields(r, k);
+        index[k].push_back(r);
+    }
+
+    VV out(vv_list());
+    for (auto l : *left)
+    {
+        lkey_of.fields(l, k);
+        auto it = index.find(k);
+        if (it != index.end())
+        {
+            for (auto &r : it->second)
+                out->push(vv_list() << l << r);
+        }
+        else if (left_outer)
+            out->push(vv_list() << l << vv_undef());
+    }
+    return out;
+}
+//---------------------------------------------------------------------------
+
+VV vv_sorted(const VV &records, const VV &key_spec)
+{
+    RecordKey key_of(key_spec);
+    std::vector<std::pair<FieldKey, VV>> keyed(records->size());
+    size_t n = 0;
+    for (auto r : *records)
+    {
+        key_of.fields(r, keyed[n].first);
+        keyed[n++].second = r;
+    }
+
+    // lexicographic, like vv_compare() of the lists vv_record_key() returns
+    std::stable_sort(keyed.begin(), keyed.end(),
+        [](const std::pair<FieldKey, VV> &a, const std::pair<FieldKey, VV> &b)
+        {
+            for (size_t i = 0; i < a.first.values.size(); i++)
+            {
+                int r = vv_compare(a.first.values[i], b.first.values[i]);
+                if (r) return r < 0;
+            }
+            return false;
+        });
+
+    VV out(vv_list());
+    for (auto &e : keyed)
+        out->push(e.second);
+    return out;
+}
+//---------------------------------------------------------------------------
+
+} // namespace VVal
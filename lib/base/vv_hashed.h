@@ -0,0 +1,180 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include "vval.h"
+#include <unordered_map>
+#include <vector>
+
+/* Hash set and hash map with arbitrary values as keys.
+ *
+ * Keys are hashed and compared structurally with vv_hash() and
+ * vv_equals() (see vval.h): A list like [1, "a"] is a composite key,
+ * that matches every other list with equal elements, and 1 and 1.0 are
+ * the same key. Keys must not be changed while they are in a set or
+ * map. Persistent values (see vv_persistent.h) make good keys, they
+ * compute their hash only once.
+ *
+ * Both keep their entries in insertion order. Removing an entry moves
+ * the last one into its place.
+ *
+ * The functions at the end build on them for the usual operations on
+ * lists of records: dedup, group-by and (hash) join in O(n). */
+
+namespace VVal
+{
+//---------------------------------------------------------------------------
+
+/// A key with its hash. The standard containers don't keep the hash
+/// of keys with custom hash functions, and hashing a list or map again
+/// on every rehash and bucket collision would cost too much.
+struct HashedKey
+{
+    VV     value;
+    size_t hash;
+
+    explicit HashedKey(const VV &v) : value(v ? v : vv_undef()), hash(vv_hash(value)) { }
+};
+
+struct HashedKeyHash
+{
+    size_t operator()(const HashedKey &k) const { return k.hash; }
+};
+
+struct HashedKeyEqual
+{
+    bool operator()(const HashedKey &a, const HashedKey &b) const
+    { return a.hash == b.hash && vv_equals(a.value, b.value); }
+};
+
+/// Key => position in the entry vectors.
+typedef std::unordered_map<HashedKey, size_t, HashedKeyHash, HashedKeyEqual> VV_INDEX;
+
+class HashSetValue : public VariantValue
+{
+    private:
+        VV_LIST  m_keys;
+        VV_INDEX m_index;
+
+    public:
+        HashSetValue() : m_keys(new std::vector<VV>) { }
+        virtual ~HashSetValue() { }
+
+        const std::vector<VV> &items() const { return *m_keys; }
+
+        bool contains(const VV &k) const { return m_index.find(HashedKey(k)) != m_index.end(); }
+        /// Returns false if an equal value was in the set already.
+        bool add(const VV &k);
+        /// Returns false if the value was not in the set.
+        bool remove(const VV &k);
+
+        virtual std::string s() const { return std::string("#<hset: ") + std::to_string((uint64_t) this) + ">"; }
+        virtual bool is_undef() const { return false; }
+        virtual bool is_set()   const { return true; }
+        virtual int32_t size()  const { return (int32_t) m_keys->size(); }
+        virtual VV clone() const;
+
+        /// The elements in insertion order.
+        virtual VV _(int32_t i) const
+        { return ((size_t) i) < m_keys->size() ? (*m_keys)[i] : vv_undef(); }
+        virtual VV _(const std::string &i) const
+        { int32_t idx = 0; return vv_index(i, idx) ? _(idx) : vv_undef(); }
+        /// Only push() (-1) adds v, see add().
+        virtual void set(int32_t i, const VV &v) { if (i == -1) add(v); }
+        virtual void set(const std::string &i, const VV &v) { UNUSED(i); UNUSED(v); }
+
+        virtual VariantValueIterator begin() const { return VariantValueIterator(m_keys, true); }
+        virtual VariantValueIterator end()   const { return VariantValueIterator(m_keys); }
+};
+//---------------------------------------------------------------------------
+
+class HashMapValue : public VariantValue
+{
+    private:
+        VV_LIST  m_keys;
+        VV_LIST  m_values;
+        VV_INDEX m_index;
+
+    public:
+        HashMapValue() : m_keys(new std::vector<VV>), m_values(new std::vector<VV>) { }
+        virtual ~HashMapValue() { }
+
+        const std::vector<VV> &keys()   const { return *m_keys; }
+        const std::vector<VV> &values() const { return *m_values; }
+
+        /// Pointer to the value or nullptr, valid until the map changes.
+        const VV *find(const VV &k) const;
+        VV        get(const VV &k) const { const VV *v = find(k); return v ? *v : vv_undef(); }
+        void      put(const VV &k, const VV &v);
+        /// Returns false if the key was not in the map.
+        bool      remove(const VV &k);
+
+        virtual std::string s() const { return std::string("#<hmap: ") + std::to_string((uint64_t) this) + ">"; }
+        virtual bool is_undef() const { return false; }
+        virtual bool is_map()   const { return true; }
+        virtual int32_t size()  const { return (int32_t) m_keys->size(); }
+        virtual VV clone() const;
+
+        /// String and integer keys, the other ones need get()/put().
+        virtual VV _(int32_t i)            const { return get(vv(i)); }
+        virtual VV _(const std::string &i) const { return get(vv(i)); }
+        virtual void set(int32_t i, const VV &v)            { put(vv(i), v); }
+        virtual void set(const std::string &i, const VV &v) { put(vv(i), v); }
+
+        /// [key, value] pairs in insertion order.
+        virtual VariantValueIterator begin() const;
+        virtual VariantValueIterator end()   const;
+};
+//---------------------------------------------------------------------------
+
+VV vv_hset();
+VV vv_hmap();
+
+/// The key of a record for the functions below: If key_spec is a list
+/// of field names (or indices for list records), the list of the values
+/// of these fields, otherwise the value of the field key_spec. An
+/// undefined key_spec selects the record itself.
+VV vv_record_key(const VV &record, const VV &key_spec);
+
+/// The records of the list without the ones, whose key is equal to
+/// the key of a record before them.
+VV vv_dedup(const VV &records, const VV &key_spec = VV());
+
+/// HashMapValue of the keys of the records to the lists of records
+/// with that key, in the order of their first occurrence.
+VV vv_group_by(const VV &records, const VV &key_spec);
+
+/// Hash join of two lists of records: Returns [l, r] for every pair
+/// of records with equal keys, in the order of the left list. A left
+/// outer join also returns [l, undef] for the left records without
+/// partner.
+VV vv_hash_join(const VV &left, const VV &right,
+                const VV &left_key, const VV &right_key,
+                bool left_outer = false);
+
+/// The elements of the list sorted by vv_compare() of their keys
+/// (stable).
+VV vv_sorted(const VV &records, const VV &key_spec = VV());
+
+} // namespace VVal
@@ -0,0 +1,683 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "vv_persistent.h"
+#include "simd.h"
+#include <functional>
+
+using namespace std;
+
+namespace VVal
+{
+namespace persistent
+{
+//---------------------------------------------------------------------------
+
+static const int HASH_BITS = (int) sizeof(size_t) * 8;
+
+/// An entry is either a key/value pair or, if child is set, a sub trie.
+struct MapEntry
+{
+    MapNodePtr  child;
+    size_t      hash;
+    std::string key;
+    VV          value;
+};
+
+/// A bitmap node has an entry for every bit set in bitmap. A collision
+/// node (below the last hash level) holds keys with the same hash.
+struct MapNode
+{
+    uint32_t              bitmap;
+    bool                  collision;
+    std::vector<MapEntry> entries;
+
+    MapNode() : bitmap(0), collision(false) { }
+};
+//---------------------------------------------------------------------------
+
+static inline uint32_t hash_bit(size_t hash, int shift)
+{
+    return ((uint32_t) 1) << ((hash >> shift) & 31);
+}
+//---------------------------------------------------------------------------
+
+static inline size_t entry_index(uint32_t bitmap, uint32_t bit)
+{
+    return (size_t) simd::popcount(bitmap & (bit - 1));
+}
+//---------------------------------------------------------------------------
+
+static const MapEntry *find_entry(const MapNode *n, size_t hash, const std::string &key)
+{
+    for (int shift = 0; n; shift += 5)
+    {
+        if (n->collision)
+        {
+            for (auto &e : n->entries)
+                if (e.key == key)
+                    return &e;
+            return nullptr;
+        }
+
+        uint32_t bit = hash_bit(hash, shift);
+        if (!(n->bitmap & bit))
+            return nullptr;
+
+        const MapEntry &e = n->entries[entry_index(n->bitmap, bit)];
+        if (!e.child)
+            return e.hash == hash && e.key == key ? &e : nullptr;
+        n = e.child.get();
+    }
+    return nullptr;
+}
+//---------------------------------------------------------------------------
+
+/// A node with the two leaf entries a and b, which differ in their keys.
+static MapNodePtr merge_leaves(const MapEntry &a, const MapEntry &b, int shift)
+{
+    auto n = make_shared<MapNode>();
+    if (shift >= HASH_BITS || a.hash == b.hash)
+    {
+        // Equal hashes would only split up to the last level, so store
+        // them right here.
+        n->collision = true;
+        n->entries.push_back(a);
+        n->entries.push_back(b);
+        return n;
+    }
+
+    uint32_t bit_a = hash_bit(a.hash, shift);
+    uint32_t bit_b = hash_bit(b.hash, shift);
+    if (bit_a == bit_b)
+    {
+        MapEntry sub;
+        sub.child = merge_leaves(a, b, shift + 5);
+        n->bitmap = bit_a;
+        n->entries.push_back(sub);
+    }
+    else
+    {
+        n->bitmap = bit_a | bit_b;
+        if (bit_a < bit_b) { n->entries.push_back(a); n->entries.push_back(b); }
+        else               { n->entries.push_back(b); n->entries.push_back(a); }
+    }
+    return n;
+}
+//---------------------------------------------------------------------------
+
+static MapNodePtr assoc_node(const MapNodePtr &n, int shift, const MapEntry &leaf, bool &added)
+{
+    if (!n)
+    {
+        auto r = make_shared<MapNode>();
+        r->bitmap = hash_bit(leaf.hash, shift);
+        r->entries.push_back(leaf);
+        added = true;
+        return r;
+    }
+
+    if (n->collision)
+    {
+        auto r = make_shared<MapNode>(*n);
+        for (auto &e : r->entries)
+            if (e.key == leaf.key)
+            {
+                e.value = leaf.value;
+                return r;
+            }
+        r->entries.push_back(leaf);
+        added = true;
+        return r;
+    }
+
+    uint32_t bit = hash_bit(leaf.hash, shift);
+    size_t   idx = entry_index(n->bitmap, bit);
+    if (!(n->bitmap & bit))
+    {
+        auto r = make_shared<MapNode>();
+        r->bitmap = n->bitmap | bit;
+        r->entries.reserve(n->entries.size() + 1);
+        r->entries.insert(r->entries.end(), n->entries.begin(), n->entries.begin() + idx);
+        r->entries.push_back(leaf);
+        r->entries.insert(r->entries.end(), n->entries.begin() + idx, n->entries.end());
+        added = true;
+        return r;
+    }
+
+    const MapEntry &e = n->entries[idx];
+    MapEntry        repl;
+    if (e.child)
+    {
+        repl.child = assoc_node(e.child, shift + 5, leaf, added);
+    }
+    else if (e.hash == leaf.hash && e.key == leaf.key)
+    {
+        if (e.value == leaf.value)
+            return n;
+        repl = leaf;
+    }
+    else
+    {
+        repl.child = merge_leaves(e, leaf, shift + 5);
+        added = true;
+    }
+
+    auto r = make_shared<MapNode>(*n);
+    r->entries[idx] = repl;
+    return r;
+}
+//---------------------------------------------------------------------------
+
+/// Returns n if the key isn't in it and nullptr for an empty node.
+static MapNodePtr dissoc_node(const MapNodePtr &n, int shift, size_t hash,
+                              const std::string &key, bool &removed)
+{
+    if (n->collision)
+    {
+        for (size_t i = 0; i < n->entries.size(); i++)
+        {
+            if (n->entries[i].key != key)
+                continue;
+            removed = true;
+            if (n->entries.size() == 1)
+                return MapNodePtr();
+            auto r = make_shared<MapNode>(*n);
+            r->entries.erase(r->entries.begin() + i);
+            return r;
+        }
+        return n;
+    }
+
+    uint32_t bit = hash_bit(hash, shift);
+    if (!(n->bitmap & bit))
+        return n;
+
+    size_t          idx = entry_index(n->bitmap, bit);
+    const MapEntry &e   = n->entries[idx];
+    if (e.child)
+    {
+        MapNodePtr c = dissoc_node(e.child, shift + 5, hash, key, removed);
+        if (c == e.child)
+            return n;
+
+        if (c)
+        {
+            auto r = make_shared<MapNode>(*n);
+            // a single leaf moves up, so that equal maps have equal tries
+            if (c->entries.size() == 1 && !c->entries[0].child)
+                r->entries[idx] = c->entries[0];
+            else
+                r->entries[idx].child = c;
+            return r;
+        }
+    }
+    else if (!(e.hash == hash && e.key == key))
+        return n;
+
+    removed = true;
+    if (n->entries.size() == 1)
+        return MapNodePtr();
+
+    auto r = make_shared<MapNode>();
+    r->bitmap  = n->bitmap & ~bit;
+    r->entries = n->entries;
+    r->entries.erase(r->entries.begin() + idx);
+    return r;
+}
+//---------------------------------------------------------------------------
+
+static void each_entry(const MapNode *n, const std::function<void(const std::string &, const VV &)> &f)
+{
+    for (auto &e : n->entries)
+    {
+        if (e.child) each_entry(e.child.get(), f);
+        else         f(e.key, e.value);
+    }
+}
+//---------------------------------------------------------------------------
+
+const VV *Map::find(const std::string &key) const
+{
+    const MapEntry *e = find_entry(m_root.get(), std::hash<std::string>()(key), key);
+    return e ? &e->value : nullptr;
+}
+//---------------------------------------------------------------------------
+
+VV Map::get(const std::string &key) const
+{
+    const VV *v = find(key);
+    return v && *v ? *v : vv_undef();
+}
+//---------------------------------------------------------------------------
+
+Map Map::assoc(const std::string &key, const VV &value) const
+{
+    MapEntry leaf;
+    leaf.hash  = std::hash<std::string>()(key);
+    leaf.key   = key;
+    leaf.value = value;
+
+    bool added = false;
+    MapNodePtr root = assoc_node(m_root, 0, leaf, added);
+    return Map(root, m_size + (added ? 1 : 0));
+}
+//---------------------------------------------------------------------------
+
+Map Map::dissoc(const std::string &key) const
+{
+    if (!m_root)
+        return *this;
+
+    bool removed = false;
+    MapNodePtr root =
+        dissoc_node(m_root, 0, std::hash<std::string>()(key), key, removed);
+    return Map(root, m_size - (removed ? 1 : 0));
+}
+//---------------------------------------------------------------------------
+
+void Map::each(const std::function<void(const std::string &, const VV &)> &f) const
+{
+    if (m_root)
+        each_entry(m_root.get(), f);
+}
+//---------------------------------------------------------------------------
+
+/// Inner nodes only use children, leaves only values.
+struct VectorNode
+{
+    std::vector<VectorNodePtr> children;
+    std::vector<VV>            values;
+};
+//---------------------------------------------------------------------------
+
+static std::shared_ptr<const std::vector<VV>> empty_tail()
+{
+    static const std::shared_ptr<const std::vector<VV>> e =
+        make_shared<const std::vector<VV>>();
+    return e;
+}
+//---------------------------------------------------------------------------
+
+Vector::Vector()
+    : m_size(0), m_shift(5), m_tail(empty_tail())
+{
+}
+//---------------------------------------------------------------------------
+
+const std::vector<VV> &Vector::leaf_for(size_t i) const
+{
+    if (i >= tail_offset())
+        return *m_tail;
+
+    const VectorNode *n = m_root.get();
+    for (int level = m_shift; level > 0; level -= 5)
+        n = n->children[(i >> level) & 31].get();
+    return n->values;
+}
+//---------------------------------------------------------------------------
+
+VV Vector::at(size_t i) const
+{
+    if (i >= m_size)
+        return vv_undef();
+    const VV &v = leaf_for(i)[i & 31];
+    return v ? v : vv_undef();
+}
+//---------------------------------------------------------------------------
+
+static VectorNodePtr new_path(int level, const VectorNodePtr &leaf)
+{
+    if (level == 0)
+        return leaf;
+    auto n = make_shared<VectorNode>();
+    n->children.push_back(new_path(level - 5, leaf));
+    return n;
+}
+//---------------------------------------------------------------------------
+
+/// Adds the full leaf for the elements from index size - 32 on.
+static VectorNodePtr push_tail(size_t size, int level, const VectorNodePtr &parent,
+                               const VectorNodePtr &leaf)
+{
+    size_t sub = ((size - 1) >> level) & 31;
+    auto   n   = parent ? make_shared<VectorNode>(*parent) : make_shared<VectorNode>();
+
+    VectorNodePtr ins;
+    if (level == 5)
+        ins = leaf;
+    else if (sub < n->children.size())
+        ins = push_tail(size, level - 5, n->children[sub], leaf);
+    else
+        ins = new_path(level - 5, leaf);
+
+    if (sub < n->children.size()) n->children[sub] = ins;
+    else                          n->children.push_back(ins);
+    return n;
+}
+//---------------------------------------------------------------------------
+
+Vector Vector::conj(const VV &v) const
+{
+    Vector r(*this);
+    r.m_size = m_size + 1;
+
+    if (m_size - tail_offset() < 32)
+    {
+        auto t = make_shared<std::vector<VV>>();
+        t->reserve(m_tail->size() + 1);
+        *t = *m_tail;
+        t->push_back(v);
+        r.m_tail = t;
+        return r;
+    }
+
+    // the tail is full, it moves into the trie
+    auto leaf = make_shared<VectorNode>();
+    leaf->values = *m_tail;
+
+    if ((m_size >> 5) > ((size_t) 1 << m_shift))
+    {
+        auto root = make_shared<VectorNode>();
+        root->children.push_back(m_root);
+        root->children.push_back(new_path(m_shift, leaf));
+        r.m_root  = root;
+        r.m_shift = m_shift + 5;
+    }
+    else
+        r.m_root = push_tail(m_size, m_shift, m_root, leaf);
+
+    r.m_tail = make_shared<const std::vector<VV>>(1, v);
+    return r;
+}
+//---------------------------------------------------------------------------
+
+static VectorNodePtr assoc_path(int level, const VectorNodePtr &n, size_t i, const VV &v)
+{
+    auto r = make_shared<VectorNode>(*n);
+    if (level == 0)
+        r->values[i & 31] = v;
+    else
+    {
+        size_t sub = (i >> level) & 31;
+        r->children[sub] = assoc_path(level - 5, n->children[sub], i, v);
+    }
+    return r;
+}
+//---------------------------------------------------------------------------
+
+Vector Vector::assoc(size_t i, const VV &v) const
+{
+    if (i == m_size)
+        return conj(v);
+    if (i > m_size)
+        throw VariantValueException(vv((int64_t) i), "pvector: index out of range");
+
+    Vector r(*this);
+    if (i >= tail_offset())
+    {
+        auto t = make_shared<std::vector<VV>>(*m_tail);
+        (*t)[i & 31] = v;
+        r.m_tail = t;
+    }
+    else
+        r.m_root = assoc_path(m_shift, m_root, i, v);
+    return r;
+}
+//---------------------------------------------------------------------------
+
+/// Removes the last leaf, that holds the elements from index size - 2
+/// downwards. Returns nullptr if nothing is left in n.
+static VectorNodePtr pop_tail(size_t size, int level, const VectorNodePtr &n)
+{
+    size_t sub = ((size - 2) >> level) & 31;
+    if (level > 5)
+    {
+        VectorNodePtr c = pop_tail(size, level - 5, n->children[sub]);
+        if (!c && sub == 0)
+            return VectorNodePtr();
+
+        auto r = make_shared<VectorNode>(*n);
+        if (c) r->children[sub] = c;
+        else   r->children.pop_back();
+        return r;
+    }
+    if (sub == 0)
+        return VectorNodePtr();
+
+    auto r = make_shared<VectorNode>(*n);
+    r->children.resize(sub);
+    return r;
+}
+//---------------------------------------------------------------------------
+
+Vector Vector::pop() const
+{
+    if (m_size <= 1)
+        return Vector();
+
+    Vector r(*this);
+    r.m_size = m_size - 1;
+
+    if (m_size - tail_offset() > 1)
+    {
+        r.m_tail = make_shared<const std::vector<VV>>(m_tail->begin(), m_tail->end() - 1);
+        return r;
+    }
+
+    // the tail becomes empty, the last leaf of the trie replaces it
+    r.m_tail = make_shared<const std::vector<VV>>(leaf_for(m_size - 2));
+
+    VectorNodePtr root = pop_tail(m_size, m_shift, m_root);
+    if (m_shift > 5 && root && root->children.size() == 1)
+    {
+        r.m_root  = root->children[0];
+        r.m_shift = m_shift - 5;
+    }
+    else
+        r.m_root = root;
+    return r;
+}
+//---------------------------------------------------------------------------
+
+} // namespace persistent
+
+//---------------------------------------------------------------------------
+
+void PMapValue::set(int32_t i, const VV &v)
+{
+    set(numconv::int64_string(i), v);
+}
+//---------------------------------------------------------------------------
+
+void PMapValue::set(const std::string &i, const VV &v)
+{
+    UNUSED(v);
+    throw VariantValueException(vv(i), "pmap is immutable, use assoc()");
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator PMapValue::begin() const
+{
+    // [key, value] pairs like MapValue, collected once per iteration
+    auto pairs = make_shared<std::vector<VV>>();
+    pairs->reserve(m_map.size());
+    m_map.each([&pairs](const std::string &k, const VV &v)
+    {
+        pairs->push_back(vv_list() << vv(k) << (v ? v : vv_undef()));
+    });
+    return VariantValueIterator([pairs](int32_t i) { return (*pairs)[i]; }, 0);
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator PMapValue::end() const
+{
+    return VariantValueIterator(std::function<VV(int32_t)>(), size());
+}
+//---------------------------------------------------------------------------
+
+void PVectorValue::set(int32_t i, const VV &v)
+{
+    UNUSED(v);
+    throw VariantValueException(vv(i), "pvector is immutable, use assoc() or conj()");
+}
+//---------------------------------------------------------------------------
+
+void PVectorValue::set(const std::string &i, const VV &v)
+{
+    UNUSED(v);
+    throw VariantValueException(vv(i), "pvector is immutable, use assoc() or conj()");
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator PVectorValue::begin() const
+{
+    persistent::Vector vec = m_vec;
+    return VariantValueIterator([vec](int32_t i) { return vec.at((size_t) i); }, 0);
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator PVectorValue::end() const
+{
+    return VariantValueIterator(std::function<VV(int32_t)>(), size());
+}
+//---------------------------------------------------------------------------
+
+void CowMapValue::set(const std::string &i, const VV &v)
+{
+    m_map = m_map.assoc(i, vv_to_persistent(v));
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator CowMapValue::begin() const
+{
+    // iterates over the version at the time of the call
+    return PMapValue(m_map).begin();
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator CowMapValue::end() const
+{
+    return VariantValueIterator(std::function<VV(int32_t)>(), size());
+}
+//---------------------------------------------------------------------------
+
+void CowListValue::set(int32_t i, const VV &v)
+{
+    if (i == -1)
+        m_vec = m_vec.conj(vv_to_persistent(v));
+    else if (i == -2 || i == -4)
+    {
+        // the vector can only grow and shrink at the end
+        persistent::Vector vec;
+        if (i == -2)
+            vec = vec.conj(vv_to_persistent(v));
+        for (size_t j = (i == -4 ? 1 : 0); j < m_vec.size(); j++)
+            vec = vec.conj(m_vec.at(j));
+        m_vec = vec;
+    }
+    else if (i == -3)
+    {
+        if (m_vec.size() > 0)
+            m_vec = m_vec.pop();
+    }
+    else if (i >= 0)
+    {
+        while (m_vec.size() < (size_t) i)
+            m_vec = m_vec.conj(VV());
+        m_vec = m_vec.assoc((size_t) i, vv_to_persistent(v));
+    }
+    // -5 (remove) is not supported by ListValue either
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator CowListValue::begin() const
+{
+    return PVectorValue(m_vec).begin();
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator CowListValue::end() const
+{
+    return VariantValueIterator(std::function<VV(int32_t)>(), size());
+}
+//---------------------------------------------------------------------------
+
+VV vv_pmap()                                 { return VV(new PMapValue(persistent::Map())); }
+VV vv_pmap(const persistent::Map &m)         { return VV(new PMapValue(m)); }
+VV vv_pvector()                              { return VV(new PVectorValue(persistent::Vector())); }
+VV vv_pvector(const persistent::Vector &v)   { return VV(new PVectorValue(v)); }
+VV vv_cow_map()                              { return VV(new CowMapValue(persistent::Map())); }
+VV vv_cow_list()                             { return VV(new CowListValue(persistent::Vector())); }
+
+//---------------------------------------------------------------------------
+
+VV vv_to_persistent(const VV &v)
+{
+    if (!v || v->is_persistent())
+        return v;
+
+    if (auto cm = dynamic_cast<const CowMapValue *>(v.get()))
+        return vv_pmap(cm->map());
+    if (auto cl = dynamic_cast<const CowListValue *>(v.get()))
+        return vv_pvector(cl->vector());
+
+    if (v->is_map())
+    {
+        persistent::Map m;
+        for (auto kv : *v)
+            m = m.assoc(kv->_s(0), vv_to_persistent(kv->_(1)));
+        return vv_pmap(m);
+    }
+    if (v->is_list())
+    {
+        persistent::Vector vec;
+        for (auto e : *v)
+            vec = vec.conj(vv_to_persistent(e));
+        return vv_pvector(vec);
+    }
+    return v;
+}
+//---------------------------------------------------------------------------
+
+VV vv_from_persistent(const VV &v)
+{
+    if (!v || !v->is_persistent())
+        return v;
+
+    if (v->is_map())
+    {
+        VV m(vv_map());
+        for (auto kv : *v)
+            m->set(kv->_s(0), vv_from_persistent(kv->_(1)));
+        return m;
+    }
+
+    VV l(vv_list());
+    for (auto e : *v)
+        l->push(vv_from_persistent(e));
+    return l;
+}
+//---------------------------------------------------------------------------
+
+} // namespace VVal
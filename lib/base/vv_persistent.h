@@ -0,0 +1,303 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include "vval.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Persistent (immutable) map and vector.
+ *
+ * Every update returns a new version and leaves the old one intact.
+ * Both versions share all nodes, except the O(log n) ones on the path
+ * to the change:
+ *
+ * - persistent::Map is a hash array mapped trie (HAMT): 32-way nodes,
+ *   that only store their present entries, indexed by 5 bits of the
+ *   key hash per level. Keys are strings, like in MapValue.
+ * - persistent::Vector is a 32-way trie of 32 element leaves with a
+ *   separate tail leaf, so that appending is amortized constant time.
+ *
+ * The nodes are never changed after construction, so versions can be
+ * read and updated by several threads at once without locks. The
+ * elements themselves are not copied, they should be treated as
+ * immutable as well.
+ *
+ * PMapValue and PVectorValue wrap them as VV (a map and a list), set()
+ * on them throws. They compute their hash() (see vv_hash()) only once.
+ * The Lua binding passes them as opaque handles instead of converting
+ * them to tables, see lib/rt/pdslib.cpp.
+ *
+ * CowMapValue and CowListValue (vv_cow_map(), vv_cow_list()) are the
+ * mutable counterparts: set(), push(), pop() and friends replace the
+ * current version, so clone() and vv_to_persistent() only have to copy
+ * a root pointer. To keep clones apart, the values they store are
+ * converted with vv_to_persistent(), nested lists and maps are read
+ * only and have to be replaced as a whole. */
+
+namespace VVal
+{
+namespace persistent
+{
+//---------------------------------------------------------------------------
+
+struct MapNode;
+typedef std::shared_ptr<const MapNode> MapNodePtr;
+
+class Map
+{
+    private:
+        MapNodePtr m_root;
+        size_t     m_size;
+
+        Map(const MapNodePtr &root, size_t size) : m_root(root), m_size(size) { }
+
+    public:
+        Map() : m_size(0) { }
+
+        size_t size() const { return m_size; }
+
+        /// Pointer to the value or nullptr, valid as long as this
+        /// version lives.
+        const VV *find(const std::string &key) const;
+        VV        get(const std::string &key) const;
+
+        Map assoc(const std::string &key, const VV &value) const;
+        Map dissoc(const std::string &key) const;
+
+        /// Calls f(key, value) for all entries, in no particular order.
+        void each(const std::function<void(const std::string &, const VV &)> &f) const;
+};
+//---------------------------------------------------------------------------
+
+struct VectorNode;
+typedef std::shared_ptr<const VectorNode> VectorNodePtr;
+
+class Vector
+{
+    private:
+        size_t                                  m_size;
+        int                                     m_shift;
+        VectorNodePtr                           m_root;
+        std::shared_ptr<const std::vector<VV>>  m_tail;
+
+        size_t tail_offset() const
+        { return m_size < 32 ? 0 : ((m_size - 1) >> 5) << 5; }
+        const std::vector<VV> &leaf_for(size_t i) const;
+
+    public:
+        Vector();
+
+        size_t size() const { return m_size; }
+
+        /// Undefined value if i is out of range.
+        VV at(size_t i) const;
+
+        Vector conj(const VV &v) const;
+        /// i == size() appends, throws VariantValueException if i > size().
+        Vector assoc(size_t i, const VV &v) const;
+        /// Without the last element.
+        Vector pop() const;
+};
+//---------------------------------------------------------------------------
+
+/// The hash of an immutable value, computed on first use.
+class HashCache
+{
+    private:
+        std::atomic<bool>   m_valid;
+        std::atomic<size_t> m_hash;
+
+    public:
+        HashCache() : m_valid(false), m_hash(0) { }
+        HashCache(const HashCache &o)
+            : m_valid(o.m_valid.load()), m_hash(o.m_hash.load())
+        { }
+
+        size_t get(const VariantValue *v)
+        {
+            if (m_valid.load(std::memory_order_acquire))
+                return m_hash.load(std::memory_order_relaxed);
+            size_t h = v->VariantValue::hash();
+            m_hash.store(h, std::memory_order_relaxed);
+            m_valid.store(true, std::memory_order_release);
+            return h;
+        }
+};
+//---------------------------------------------------------------------------
+
+} // namespace persistent
+
+//---------------------------------------------------------------------------
+
+class PMapValue : public VariantValue
+{
+    private:
+        persistent::Map               m_map;
+        mutable persistent::HashCache m_hash;
+
+    public:
+        PMapValue(const persistent::Map &m) : m_map(m) { }
+        PMapValue(const persistent::Map &m, const persistent::HashCache &h) : m_map(m), m_hash(h) { }
+        virtual ~PMapValue() { }
+
+        const persistent::Map &map() const { return m_map; }
+
+        virtual std::string s() const { return std::string("#<pmap: ") + std::to_string((uint64_t) this) + ">"; }
+        virtual bool is_undef()      const { return false; }
+        virtual bool is_map()        const { return true; }
+        virtual bool is_persistent() const { return true; }
+        virtual int32_t size() const { return (int32_t) m_map.size(); }
+        virtual VV clone() const { return VV(new PMapValue(m_map, m_hash)); }
+        virtual size_t hash() const { return m_hash.get(this); }
+
+        virtual VV _(int32_t i) const { return m_map.get(numconv::int64_string(i)); }
+        virtual VV _(const std::string &i) const { return m_map.get(i); }
+        virtual void set(int32_t i, const VV &v);
+        virtual void set(const std::string &i, const VV &v);
+
+        virtual VariantValueIterator begin() const;
+        virtual VariantValueIterator end()   const;
+};
+//---------------------------------------------------------------------------
+
+class PVectorValue : public VariantValue
+{
+    private:
+        persistent::Vector            m_vec;
+        mutable persistent::HashCache m_hash;
+
+    public:
+        PVectorValue(const persistent::Vector &v) : m_vec(v) { }
+        PVectorValue(const persistent::Vector &v, const persistent::HashCache &h) : m_vec(v), m_hash(h) { }
+        virtual ~PVectorValue() { }
+
+        const persistent::Vector &vector() const { return m_vec; }
+
+        virtual std::string s() const { return std::string("#<pvector: ") + std::to_string((uint64_t) this) + ">"; }
+        virtual bool is_undef()      const { return false; }
+        virtual bool is_list()       const { return true; }
+        virtual bool is_persistent() const { return true; }
+        virtual int32_t size() const { return (int32_t) m_vec.size(); }
+        virtual VV clone() const { return VV(new PVectorValue(m_vec, m_hash)); }
+        virtual size_t hash() const { return m_hash.get(this); }
+
+        virtual VV _(int32_t i) const { return i < 0 ? vv_undef() : m_vec.at((size_t) i); }
+        virtual VV _(const std::string &i) const { int32_t idx = 0; return vv_index(i, idx) ? _(idx) : vv_undef(); }
+        virtual void set(int32_t i, const VV &v);
+        virtual void set(const std::string &i, const VV &v);
+
+        virtual VariantValueIterator begin() const;
+        virtual VariantValueIterator end()   const;
+};
+//---------------------------------------------------------------------------
+
+class CowMapValue : public VariantValue
+{
+    private:
+        persistent::Map m_map;
+
+    public:
+        CowMapValue(const persistent::Map &m) : m_map(m) { }
+        virtual ~CowMapValue() { }
+
+        const persistent::Map &map() const { return m_map; }
+
+        virtual std::string s() const { return std::string("#<cowmap: ") + std::to_string((uint64_t) this) + ">"; }
+        virtual bool is_undef() const { return false; }
+        virtual bool is_map()   const { return true; }
+        virtual int32_t size() const { return (int32_t) m_map.size(); }
+        virtual VV clone() const { return VV(new CowMapValue(m_map)); }
+
+        virtual VV _(int32_t i) const { return _(numconv::int64_string(i)); }
+        virtual VV _(const std::string &i) const
+        {
+            const VV *v = m_map.find(i);
+            return v && *v ? *v : vv_undef();
+        }
+        virtual void set(int32_t i, const VV &v) { set(numconv::int64_string(i), v); }
+        virtual void set(const std::string &i, const VV &v);
+        virtual void remove(const std::string &i) { m_map = m_map.dissoc(i); }
+
+        virtual VariantValueIterator begin() const;
+        virtual VariantValueIterator end()   const;
+};
+//---------------------------------------------------------------------------
+
+class CowListValue : public VariantValue
+{
+    private:
+        persistent::Vector m_vec;
+
+    public:
+        CowListValue(const persistent::Vector &v) : m_vec(v) { }
+        virtual ~CowListValue() { }
+
+        const persistent::Vector &vector() const { return m_vec; }
+
+        virtual std::string s() const { return std::string("#<cowlist: ") + std::to_string((uint64_t) this) + ">"; }
+        virtual bool is_undef() const { return false; }
+        virtual bool is_list()  const { return true; }
+        virtual int32_t size() const { return (int32_t) m_vec.size(); }
+        virtual VV clone() const { return VV(new CowListValue(m_vec)); }
+
+        virtual VV _(int32_t i) const
+        {
+            if (i < 0) return vv_undef();
+            VV v = m_vec.at((size_t) i);
+            return v ? v : vv_undef();
+        }
+        virtual VV _(const std::string &i) const { int32_t idx = 0; return vv_index(i, idx) ? _(idx) : vv_undef(); }
+        /// The indices -1 to -5 like ListValue::set().
+        virtual void set(int32_t i, const VV &v);
+        virtual void set(const std::string &i, const VV &v)
+        {
+            int32_t idx = 0;
+            if (vv_index(i, idx))
+                set(idx, v);
+        }
+
+        virtual VariantValueIterator begin() const;
+        virtual VariantValueIterator end()   const;
+};
+//---------------------------------------------------------------------------
+
+VV vv_pmap();
+VV vv_pmap(const persistent::Map &m);
+VV vv_pvector();
+VV vv_pvector(const persistent::Vector &v);
+VV vv_cow_map();
+VV vv_cow_list();
+
+/// Persistent copies of the (nested) lists and maps in v, other values
+/// are shared. Persistent values are returned as they are, the current
+/// version of a CowMapValue or CowListValue in constant time.
+VV vv_to_persistent(const VV &v);
+/// The reverse: plain (mutable) lists and maps for the persistent
+/// values in v.
+VV vv_from_persistent(const VV &v);
+
+} // namespace VVal
@@ -0,0 +1,822 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "vv_table.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+using namespace std;
+
+namespace VVal
+{
+namespace table
+{
+//---------------------------------------------------------------------------
+
+const char *type_name(Type t)
+{
+    switch (t)
+    {
+        case T_INT:    return "int";
+        case T_DOUBLE: return "double";
+        case T_BOOL:   return "bool";
+        case T_STRING: return "string";
+    }
+    return "";
+}
+//---------------------------------------------------------------------------
+
+void Column::reserve(size_t n)
+{
+    switch (m_type)
+    {
+        case T_INT:    m_ints.reserve(n);  break;
+        case T_DOUBLE: m_dbls.reserve(n);  break;
+        case T_BOOL:   m_bools.reserve(n); break;
+        case T_STRING: m_codes.reserve(n); break;
+    }
+}
+//---------------------------------------------------------------------------
+
+void Column::mark_null(size_t row, bool null)
+{
+    if (m_nulls.empty())
+    {
+        if (!null) return;
+        m_nulls.assign(m_size, 0);
+    }
+    if (m_nulls.size() < m_size)
+        m_nulls.resize(m_size, 0);
+
+    if (m_nulls[row] != (uint8_t) null)
+    {
+        m_nulls[row] = (uint8_t) null;
+        if (null) m_null_count++;
+        else      m_null_count--;
+    }
+}
+//---------------------------------------------------------------------------
+
+uint32_t Column::intern(const char *data, size_t len)
+{
+    string s(data, len);
+    auto it = m_dict_index.find(s);
+    if (it != m_dict_index.end())
+        return it->second;
+
+    uint32_t code = (uint32_t) m_dict.size();
+    m_dict.push_back(s);
+    m_dict_index.emplace(std::move(s), code);
+    return code;
+}
+//---------------------------------------------------------------------------
+
+void Column::push_int(int64_t v)
+{
+    switch (m_type)
+    {
+        case T_INT:    m_ints.push_back(v);            break;
+        case T_DOUBLE: m_dbls.push_back((double) v);   break;
+        case T_BOOL:   m_bools.push_back(v != 0);      break;
+        case T_STRING:
+        {
+            char buf[numconv::FORMAT_BUF_SIZE];
+            m_codes.push_back(intern(buf, numconv::format_int64(v, buf)));
+            break;
+        }
+    }
+    m_size++;
+    if (!m_nulls.empty()) m_nulls.push_back(0);
+}
+//---------------------------------------------------------------------------
+
+void Column::push_double(double v)
+{
+    switch (m_type)
+    {
+        case T_INT:    m_ints.push_back((int64_t) v);  break;
+        case T_DOUBLE: m_dbls.push_back(v);            break;
+        case T_BOOL:   m_bools.push_back(v != 0.0);    break;
+        case T_STRING:
+        {
+            char buf[numconv::FORMAT_BUF_SIZE];
+            m_codes.push_back(intern(buf, numconv::format_double(v, buf)));
+            break;
+        }
+    }
+    m_size++;
+    if (!m_nulls.empty()) m_nulls.push_back(0);
+}
+//---------------------------------------------------------------------------
+
+void Column::push_bool(bool v)
+{
+    switch (m_type)
+    {
+        case T_INT:    m_ints.push_back(v ? 1 : 0);     break;
+        case T_DOUBLE: m_dbls.push_back(v ? 1.0 : 0.0); break;
+        case T_BOOL:   m_bools.push_back(v);            break;
+        case T_STRING: m_codes.push_back(v ? intern("1", 1) : intern("", 0)); break; // as BooleanValue::s()
+    }
+    m_size++;
+    if (!m_nulls.empty()) m_nulls.push_back(0);
+}
+//---------------------------------------------------------------------------
+
+void Column::push_string(const char *data, size_t len)
+{
+    switch (m_type)
+    {
+        case T_INT:    m_ints.push_back(numconv::to_int64(data, len));   break;
+        case T_DOUBLE: m_dbls.push_back(numconv::to_double(data, len));  break;
+        case T_BOOL:   m_bools.push_back(len > 0);                       break;
+        case T_STRING: m_codes.push_back(intern(data, len));             break;
+    }
+    m_size++;
+    if (!m_nulls.empty()) m_nulls.push_back(0);
+}
+//---------------------------------------------------------------------------
+
+void Column::push_null()
+{
+    switch (m_type)
+    {
+        case T_INT:    m_ints.push_back(0);            break;
+        case T_DOUBLE: m_dbls.push_back(0.0);          break;
+        case T_BOOL:   m_bools.push_back(0);           break;
+        case T_STRING: m_codes.push_back(intern("", 0)); break;
+    }
+    m_size++;
+    mark_null(m_size - 1, true);
+}
+//---------------------------------------------------------------------------
+
+Type Column::type_of(const VV &v)
+{
+    if (v->is_int() || v->is_datetime()) return T_INT;
+    if (v->is_double())                  return T_DOUBLE;
+    if (v->is_boolean())                 return T_BOOL;
+    return T_STRING;
+}
+//---------------------------------------------------------------------------
+
+void Column::push(const VV &v)
+{
+    if (!v || v->is_undef())
+        push_null();
+    else if (v->is_int() || v->is_datetime())
+        push_int(v->i());
+    else if (v->is_double())
+        push_double(v->d());
+    else if (v->is_boolean())
+        push_bool(v->b());
+    else
+    {
+        string s = v->s();
+        push_string(s.data(), s.size());
+    }
+}
+//---------------------------------------------------------------------------
+
+void Column::set(size_t row, const VV &v)
+{
+    while (m_size < row)
+        push_null();
+    if (row == m_size)
+    {
+        push(v);
+        return;
+    }
+
+    if (!v || v->is_undef())
+    {
+        mark_null(row, true);
+        return;
+    }
+
+    switch (m_type)
+    {
+        case T_INT:    m_ints[row]  = v->i();        break;
+        case T_DOUBLE: m_dbls[row]  = v->d();        break;
+        case T_BOOL:   m_bools[row] = v->b();        break;
+        case T_STRING:
+        {
+            string s = v->is_double() ? numconv::double_string(v->d()) : v->s();
+            m_codes[row] = intern(s.data(), s.size());
+            break;
+        }
+    }
+    mark_null(row, false);
+}
+//---------------------------------------------------------------------------
+
+VV Column::at(size_t row) const
+{
+    if (row >= m_size || is_null(row))
+        return vv_undef();
+
+    switch (m_type)
+    {
+        case T_INT:    return vv(m_ints[row]);
+        case T_DOUBLE: return vv(m_dbls[row]);
+        case T_BOOL:   return vv_bool(m_bools[row] != 0);
+        case T_STRING: return vv(m_dict[m_codes[row]]);
+    }
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+double Column::d(size_t row) const
+{
+    switch (m_type)
+    {
+        case T_INT:    return (double) m_ints[row];
+        case T_DOUBLE: return m_dbls[row];
+        case T_BOOL:   return m_bools[row] ? 1.0 : 0.0;
+        case T_STRING:
+        {
+            const string &s = m_dict[m_codes[row]];
+            return numconv::to_double(s.data(), s.size());
+        }
+    }
+    return 0.0;
+}
+//---------------------------------------------------------------------------
+
+void Column::convert(Type t)
+{
+    if (t == m_type)
+        return;
+
+    Column c(t);
+    c.reserve(m_size);
+    for (size_t i = 0; i < m_size; i++)
+    {
+        if (is_null(i))
+        {
+            c.push_null();
+            continue;
+        }
+
+        switch (m_type)
+        {
+            case T_INT:    c.push_int(m_ints[i]);       break;
+            case T_DOUBLE: c.push_double(m_dbls[i]);    break;
+            case T_BOOL:   c.push_bool(m_bools[i] != 0); break;
+            case T_STRING:
+            {
+                const string &s = m_dict[m_codes[i]];
+                c.push_string(s.data(), s.size());
+                break;
+            }
+        }
+    }
+    *this = std::move(c);
+}
+//---------------------------------------------------------------------------
+
+void Column::accept(Type t)
+{
+    if (t == m_type || m_type == T_STRING)
+        return;
+
+    if (m_null_count == m_size) // nothing to lose yet
+        convert(t);
+    else if (t == T_STRING)
+        convert(T_STRING);
+    else if (t == T_DOUBLE)
+        convert(T_DOUBLE);
+    else if (t == T_INT && m_type == T_BOOL)
+        convert(T_INT);
+}
+//---------------------------------------------------------------------------
+
+static bool add_overflows(int64_t a, int64_t b, int64_t &res)
+{
+#if defined(__GNUC__)
+    return __builtin_add_overflow(a, b, &res);
+#else
+    if ((b > 0 && a > std::numeric_limits<int64_t>::max() - b)
+        || (b < 0 && a < std::numeric_limits<int64_t>::min() - b))
+        return true;
+    res = a + b;
+    return false;
+#endif
+}
+//---------------------------------------------------------------------------
+
+/// Sum of an int column. If the int64 sum overflows, the rest is
+/// added up as double and the result is a double.
+static VV int_sum(const std::vector<int64_t> &vals, const std::vector<uint8_t> &nulls)
+{
+    int64_t s = 0;
+    size_t  n = vals.size();
+    size_t  i = 0;
+    for (; i < n; i++)
+    {
+        if (!nulls.empty() && nulls[i]) continue;
+        int64_t t;
+        if (add_overflows(s, vals[i], t))
+            break;
+        s = t;
+    }
+    if (i == n)
+        return vv(s);
+
+    double d = (double) s;
+    for (; i < n; i++)
+        if (nulls.empty() || !nulls[i])
+            d += (double) vals[i];
+    return vv(d);
+}
+//---------------------------------------------------------------------------
+
+template<typename T, typename A>
+static A sum_of(const std::vector<T> &vals, const std::vector<uint8_t> &nulls)
+{
+    A s = 0;
+    size_t n = vals.size();
+    if (nulls.empty())
+        for (size_t i = 0; i < n; i++) s += vals[i];
+    else
+        for (size_t i = 0; i < n; i++) s += nulls[i] ? 0 : vals[i];
+    return s;
+}
+//---------------------------------------------------------------------------
+
+/// Index of the smallest (or with max the largest) non null value,
+/// or -1. NaNs are skipped.
+template<typename T, typename Less>
+static int64_t extreme_of(const std::vector<T> &vals, const std::vector<uint8_t> &nulls,
+                          bool max, Less less)
+{
+    int64_t best = -1;
+    size_t n = vals.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!nulls.empty() && nulls[i]) continue;
+        if (!(vals[i] == vals[i])) continue; // NaN
+        if (best < 0
+            || (max ? less(vals[best], vals[i]) : less(vals[i], vals[best])))
+            best = (int64_t) i;
+    }
+    return best;
+}
+//---------------------------------------------------------------------------
+
+VV Column::sum() const
+{
+    switch (m_type)
+    {
+        case T_INT:    return int_sum(m_ints, m_nulls);
+        case T_DOUBLE: return vv(sum_of<double, double>(m_dbls, m_nulls));
+        case T_BOOL:   return vv(sum_of<uint8_t, int64_t>(m_bools, m_nulls));
+        case T_STRING: return vv_undef();
+    }
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV Column::extreme(bool max) const
+{
+    int64_t i = -1;
+    switch (m_type)
+    {
+        case T_INT:
+            i = extreme_of(m_ints, m_nulls, max, std::less<int64_t>());
+            break;
+        case T_DOUBLE:
+            i = extreme_of(m_dbls, m_nulls, max, std::less<double>());
+            break;
+        case T_BOOL:
+            i = extreme_of(m_bools, m_nulls, max, std::less<uint8_t>());
+            break;
+        case T_STRING:
+        {
+            const std::vector<string> &dict = m_dict;
+            i = extreme_of(m_codes, m_nulls, max,
+                           [&dict](uint32_t a, uint32_t b) { return dict[a] < dict[b]; });
+            break;
+        }
+    }
+    return i < 0 ? vv_undef() : at((size_t) i);
+}
+//---------------------------------------------------------------------------
+
+enum Op { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+
+static Op parse_op(const string &op)
+{
+    if (op == "==" || op == "=") return OP_EQ;
+    if (op == "!=")              return OP_NE;
+    if (op == "<")               return OP_LT;
+    if (op == "<=")              return OP_LE;
+    if (op == ">")               return OP_GT;
+    if (op == ">=")              return OP_GE;
+    throw VariantValueException(vv(op), "table: unknown comparison");
+}
+//---------------------------------------------------------------------------
+
+template<typename T, typename Pred>
+static void select_if(const std::vector<T> &vals, const std::vector<uint8_t> &nulls,
+                      Pred pred, std::vector<uint32_t> &out)
+{
+    size_t n = vals.size();
+    if (nulls.empty())
+    {
+        for (size_t i = 0; i < n; i++)
+            if (pred(vals[i])) out.push_back((uint32_t) i);
+    }
+    else
+    {
+        for (size_t i = 0; i < n; i++)
+            if (!nulls[i] && pred(vals[i])) out.push_back((uint32_t) i);
+    }
+}
+//---------------------------------------------------------------------------
+
+template<typename T, typename R>
+static void select_op(Op op, const std::vector<T> &vals, const std::vector<uint8_t> &nulls,
+                      const R &r, std::vector<uint32_t> &out)
+{
+    switch (op)
+    {
+        case OP_EQ: select_if(vals, nulls, [&r](const T &x) { return x == r; }, out); break;
+        case OP_NE: select_if(vals, nulls, [&r](const T &x) { return x != r; }, out); break;
+        case OP_LT: select_if(vals, nulls, [&r](const T &x) { return x <  r; }, out); break;
+        case OP_LE: select_if(vals, nulls, [&r](const T &x) { return x <= r; }, out); break;
+        case OP_GT: select_if(vals, nulls, [&r](const T &x) { return x >  r; }, out); break;
+        case OP_GE: select_if(vals, nulls, [&r](const T &x) { return x >= r; }, out); break;
+    }
+}
+//---------------------------------------------------------------------------
+
+std::vector<uint32_t> Column::select(const std::string &op_str, const VV &v) const
+{
+    Op op = parse_op(op_str);
+    std::vector<uint32_t> out;
+
+    switch (m_type)
+    {
+        case T_INT:
+            if (v->is_double())
+                select_op(op, m_ints, m_nulls, v->d(), out);
+            else
+                select_op(op, m_ints, m_nulls, v->i(), out);
+            break;
+        case T_DOUBLE:
+            select_op(op, m_dbls, m_nulls, v->d(), out);
+            break;
+        case T_BOOL:
+            select_op(op, m_bools, m_nulls, (uint8_t) (v->b() ? 1 : 0), out);
+            break;
+        case T_STRING:
+        {
+            // decide once per distinct string, then only compare codes
+            std::vector<uint32_t> hits;
+            select_op(op, m_dict, std::vector<uint8_t>(), v->s(), hits);
+            std::vector<uint8_t> match(m_dict.size(), 0);
+            for (auto c : hits) match[c] = 1;
+            select_if(m_codes, m_nulls, [&match](uint32_t c) { return match[c] != 0; }, out);
+            break;
+        }
+    }
+    return out;
+}
+//---------------------------------------------------------------------------
+
+template<typename T>
+static void sort_rows(std::vector<uint32_t> &rows, const std::vector<T> &vals,
+                      const std::vector<uint8_t> &nulls, bool descending)
+{
+    // nulls and NaNs go to the end
+    auto valid = std::stable_partition(rows.begin(), rows.end(),
+        [&](uint32_t r) { return (nulls.empty() || !nulls[r]) && vals[r] == vals[r]; });
+
+    if (descending)
+        std::stable_sort(rows.begin(), valid,
+            [&vals](uint32_t a, uint32_t b) { return vals[b] < vals[a]; });
+    else
+        std::stable_sort(rows.begin(), valid,
+            [&vals](uint32_t a, uint32_t b) { return vals[a] < vals[b]; });
+}
+//---------------------------------------------------------------------------
+
+std::vector<uint32_t> Column::order(bool descending) const
+{
+    std::vector<uint32_t> rows(m_size);
+    std::iota(rows.begin(), rows.end(), 0);
+
+    switch (m_type)
+    {
+        case T_INT:    sort_rows(rows, m_ints,  m_nulls, descending); break;
+        case T_DOUBLE: sort_rows(rows, m_dbls,  m_nulls, descending); break;
+        case T_BOOL:   sort_rows(rows, m_bools, m_nulls, descending); break;
+        case T_STRING:
+        {
+            // sort the dictionary, then the rows by the rank of their code
+            std::vector<uint32_t> by_str(m_dict.size());
+            std::iota(by_str.begin(), by_str.end(), 0);
+            std::sort(by_str.begin(), by_str.end(),
+                [this](uint32_t a, uint32_t b) { return m_dict[a] < m_dict[b]; });
+            std::vector<uint32_t> rank(m_dict.size());
+            for (uint32_t i = 0; i < (uint32_t) by_str.size(); i++)
+                rank[by_str[i]] = i;
+
+            std::vector<uint32_t> keys(m_size);
+            for (size_t i = 0; i < m_size; i++)
+                keys[i] = rank[m_codes[i]];
+            sort_rows(rows, keys, m_nulls, descending);
+            break;
+        }
+    }
+    return rows;
+}
+//---------------------------------------------------------------------------
+
+template<typename T>
+static void gather_into(std::vector<T> &out, const std::vector<T> &vals,
+                        const std::vector<uint32_t> &rows)
+{
+    out.resize(rows.size());
+    for (size_t i = 0; i < rows.size(); i++)
+        out[i] = vals[rows[i]];
+}
+//---------------------------------------------------------------------------
+
+ColumnPtr Column::gather(const std::vector<uint32_t> &rows) const
+{
+    ColumnPtr c = std::make_shared<Column>(m_type);
+    switch (m_type)
+    {
+        case T_INT:    gather_into(c->m_ints,  m_ints,  rows); break;
+        case T_DOUBLE: gather_into(c->m_dbls,  m_dbls,  rows); break;
+        case T_BOOL:   gather_into(c->m_bools, m_bools, rows); break;
+        case T_STRING:
+            gather_into(c->m_codes, m_codes, rows);
+            c->m_dict       = m_dict;
+            c->m_dict_index = m_dict_index;
+            break;
+    }
+    c->m_size = rows.size();
+
+    if (!m_nulls.empty())
+    {
+        gather_into(c->m_nulls, m_nulls, rows);
+        for (auto n : c->m_nulls)
+            c->m_null_count += n;
+        if (c->m_null_count == 0)
+            c->m_nulls.clear();
+    }
+    return c;
+}
+//---------------------------------------------------------------------------
+
+ColumnPtr Table::add_column(const std::string &name, Type t)
+{
+    auto it = m_index.find(name);
+    if (it != m_index.end())
+        return m_columns[it->second];
+
+    ColumnPtr c = std::make_shared<Column>(t);
+    c->reserve(m_rows);
+    for (size_t i = 0; i < m_rows; i++)
+        c->push_null();
+
+    m_index[name] = m_columns.size();
+    m_names.push_back(name);
+    m_columns.push_back(c);
+    return c;
+}
+//---------------------------------------------------------------------------
+
+ColumnPtr Table::column(const std::string &name) const
+{
+    auto it = m_index.find(name);
+    if (it == m_index.end())
+        return ColumnPtr();
+    return m_columns[it->second];
+}
+//---------------------------------------------------------------------------
+
+void Table::push_row(const VV &row)
+{
+    auto put = [](const ColumnPtr &c, const VV &v)
+    {
+        if (v && v->is_defined())
+            c->accept(Column::type_of(v));
+        c->push(v);
+    };
+
+    if (row->is_map())
+    {
+        for (auto kv : *row)
+        {
+            VV v = kv->_(1);
+            string name = kv->_s(0);
+            ColumnPtr c = column(name);
+            if (!c) c = add_column(name, v->is_defined() ? Column::type_of(v) : T_INT);
+            if (c->size() > m_rows) continue; // same name twice
+            put(c, v);
+        }
+    }
+    else
+    {
+        size_t i = 0;
+        for (auto v : *row)
+        {
+            ColumnPtr c =
+                i < m_columns.size()
+                ? m_columns[i]
+                : add_column(numconv::int64_string((int64_t) i),
+                             v->is_defined() ? Column::type_of(v) : T_INT);
+            put(c, v);
+            i++;
+        }
+    }
+
+    end_row();
+}
+//---------------------------------------------------------------------------
+
+void Table::end_row()
+{
+    m_rows++;
+    for (auto &c : m_columns)
+        while (c->size() < m_rows)
+            c->push_null();
+}
+//---------------------------------------------------------------------------
+
+VV Table::row(size_t i) const
+{
+    VV r(vv_map());
+    for (size_t c = 0; c < m_columns.size(); c++)
+        r->set(m_names[c], m_columns[c]->at(i));
+    return r;
+}
+//---------------------------------------------------------------------------
+
+const ColumnPtr &Table::need_column(const std::string &name) const
+{
+    auto it = m_index.find(name);
+    if (it == m_index.end())
+        throw VariantValueException(vv(name), "table: no such column");
+    return m_columns[it->second];
+}
+//---------------------------------------------------------------------------
+
+VV Table::sum(const std::string &col) const { return need_column(col)->sum(); }
+VV Table::min(const std::string &col) const { return need_column(col)->min(); }
+VV Table::max(const std::string &col) const { return need_column(col)->max(); }
+
+//---------------------------------------------------------------------------
+
+TablePtr Table::filter(const std::string &col, const std::string &op, const VV &v) const
+{
+    return take(need_column(col)->select(op, v));
+}
+//---------------------------------------------------------------------------
+
+TablePtr Table::sort_by(const std::string &col, bool descending) const
+{
+    return take(need_column(col)->order(descending));
+}
+//---------------------------------------------------------------------------
+
+TablePtr Table::take(const std::vector<uint32_t> &rows) const
+{
+    TablePtr t = std::make_shared<Table>();
+    for (size_t c = 0; c < m_columns.size(); c++)
+    {
+        t->m_index[m_names[c]] = c;
+        t->m_names.push_back(m_names[c]);
+        t->m_columns.push_back(m_columns[c]->gather(rows));
+    }
+    t->m_rows = rows.size();
+    return t;
+}
+//---------------------------------------------------------------------------
+
+TablePtr Table::clone() const
+{
+    TablePtr t = std::make_shared<Table>(*this);
+    for (auto &c : t->m_columns)
+        c = std::make_shared<Column>(*c);
+    return t;
+}
+//---------------------------------------------------------------------------
+
+} // namespace table
+
+//---------------------------------------------------------------------------
+
+VV ColumnValue::clone() const
+{
+    return vv_column(std::make_shared<table::Column>(*m_col));
+}
+//---------------------------------------------------------------------------
+
+VV ColumnValue::_(int32_t i) const
+{
+    if (i < 0) return vv_undef();
+    return m_col->at((size_t) i);
+}
+//---------------------------------------------------------------------------
+
+void ColumnValue::set(int32_t i, const VV &v)
+{
+    if (i == -1)     m_col->push(v);
+    else if (i >= 0) m_col->set((size_t) i, v);
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator ColumnValue::begin() const
+{
+    table::ColumnPtr c = m_col;
+    return VariantValueIterator([c](int32_t i) { return c->at((size_t) i); }, 0);
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator ColumnValue::end() const
+{
+    return VariantValueIterator(std::function<VV(int32_t)>(), size());
+}
+//---------------------------------------------------------------------------
+
+VV TableValue::clone() const
+{
+    return vv_table(m_table->clone());
+}
+//---------------------------------------------------------------------------
+
+VV TableValue::_(int32_t i) const
+{
+    if (i < 0 || (size_t) i >= m_table->rows())
+        return vv_undef();
+    return m_table->row((size_t) i);
+}
+//---------------------------------------------------------------------------
+
+VV TableValue::_(const std::string &i) const
+{
+    table::ColumnPtr c = m_table->column(i);
+    return c ? vv_column(c) : vv_undef();
+}
+//---------------------------------------------------------------------------
+
+void TableValue::set(int32_t i, const VV &v)
+{
+    if (i == -1)
+        m_table->push_row(v);
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator TableValue::begin() const
+{
+    table::TablePtr t = m_table;
+    return VariantValueIterator([t](int32_t i) { return t->row((size_t) i); }, 0);
+}
+//---------------------------------------------------------------------------
+
+VariantValueIterator TableValue::end() const
+{
+    return VariantValueIterator(std::function<VV(int32_t)>(), size());
+}
+//---------------------------------------------------------------------------
+
+VV vv_table()                           { return VV(new TableValue(std::make_shared<table::Table>())); }
+VV vv_table(const table::TablePtr &t)   { return VV(new TableValue(t)); }
+VV vv_column(table::Type t)             { return VV(new ColumnValue(std::make_shared<table::Column>(t))); }
+VV vv_column(const table::ColumnPtr &c) { return VV(new ColumnValue(c)); }
+
+table::TablePtr vv_to_table(const VV &v)
+{
+    const TableValue *tv = dynamic_cast<const TableValue *>(v.get());
+    return tv ? tv->table() : table::TablePtr();
+}
+//---------------------------------------------------------------------------
+
+} // namespace VVal
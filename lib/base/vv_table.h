@@ -0,0 +1,263 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#pragma once
+
+#include "vval.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Column oriented tables for big numeric data sets.
+ *
+ * A table of the usual kind (list of maps or lists) costs one heap
+ * object per cell, and every access goes through a virtual call. A
+ * table::Table instead stores each named column as one typed vector:
+ * int64, double, bool or dictionary encoded strings (each distinct
+ * string is stored once, the column holds 32 bit codes). Missing
+ * values (SQL NULL, empty CSV fields) are marked in a separate null
+ * vector, that only exists if there are any.
+ *
+ * The bulk operations (sum, min, max, filter, sort) run as loops over
+ * the typed vectors. TableValue and ColumnValue wrap a table or column
+ * as VV: they are lists, whose elements (rows as maps, cells as
+ * scalars) are boxed on access, so existing code that walks lists of
+ * rows keeps working. */
+
+namespace VVal
+{
+namespace table
+{
+//---------------------------------------------------------------------------
+
+enum Type { T_INT, T_DOUBLE, T_BOOL, T_STRING };
+
+const char *type_name(Type t);
+
+class Column
+{
+    private:
+        Type                                     m_type;
+        size_t                                   m_size;
+        std::vector<int64_t>                     m_ints;
+        std::vector<double>                      m_dbls;
+        std::vector<uint8_t>                     m_bools;
+        std::vector<uint32_t>                    m_codes;
+        std::vector<std::string>                 m_dict;
+        std::unordered_map<std::string, uint32_t> m_dict_index;
+        std::vector<uint8_t>                     m_nulls; // empty: no nulls
+        size_t                                   m_null_count;
+
+        void     mark_null(size_t row, bool null);
+        uint32_t intern(const char *data, size_t len);
+        VV       extreme(bool max) const;
+
+    public:
+        explicit Column(Type t) : m_type(t), m_size(0), m_null_count(0) { }
+
+        /// The column type, that stores v without loss.
+        static Type type_of(const VV &v);
+
+        Type   type() const { return m_type; }
+        size_t size() const { return m_size; }
+        void   reserve(size_t n);
+
+        bool has_nulls() const { return !m_nulls.empty(); }
+        bool is_null(size_t row) const
+        { return !m_nulls.empty() && m_nulls[row]; }
+
+        // Typed storage, for loops over the whole column.
+        const std::vector<int64_t>     &ints()  const { return m_ints; }
+        const std::vector<double>      &dbls()  const { return m_dbls; }
+        const std::vector<uint8_t>     &bools() const { return m_bools; }
+        const std::vector<uint32_t>    &codes() const { return m_codes; }
+        const std::vector<std::string> &dict()  const { return m_dict; }
+
+        void push_int(int64_t v);
+        void push_double(double v);
+        void push_bool(bool v);
+        void push_string(const char *data, size_t len);
+        void push_string(const std::string &s) { push_string(s.data(), s.size()); }
+        void push_null();
+        /// Converts v to the type of the column, undefined values are null.
+        void push(const VV &v);
+
+        /// Overwrites a cell, the column grows with nulls if needed.
+        void set(size_t row, const VV &v);
+        /// Boxes a cell, nulls become undefined values.
+        VV   at(size_t row) const;
+        double d(size_t row) const;
+
+        /// Changes the type of the column and converts all cells.
+        void convert(Type t);
+        /// Widens the column, so that it can hold values of type t:
+        /// bool < int < double < string. A column with only nulls
+        /// just takes the new type. Ints beyond +-2^53 are rounded to
+        /// the nearest double when an int column becomes a double one.
+        void accept(Type t);
+
+        /// Sum, minimum and maximum of the non null cells. Strings
+        /// compare lexicographically and have no sum. Undefined for
+        /// an empty column. The sum of an int or bool column is an
+        /// int, unless it overflows int64: then it is a double.
+        VV sum() const;
+        VV min() const { return extreme(false); }
+        VV max() const { return extreme(true); }
+
+        /// Row indices of the cells that satisfy "cell op v", op is
+        /// one of ==, !=, <, <=, >, >=. Nulls never match.
+        /// Throws VariantValueException on an unknown op.
+        std::vector<uint32_t> select(const std::string &op, const VV &v) const;
+
+        /// Row indices in the (stable) sort order of the column, nulls last.
+        std::vector<uint32_t> order(bool descending = false) const;
+
+        /// A new column with the rows in the given order.
+        std::shared_ptr<Column> gather(const std::vector<uint32_t> &rows) const;
+};
+//---------------------------------------------------------------------------
+
+typedef std::shared_ptr<Column> ColumnPtr;
+
+class Table
+{
+    private:
+        std::vector<std::string>                m_names;
+        std::vector<ColumnPtr>                  m_columns;
+        std::unordered_map<std::string, size_t> m_index;
+        size_t                                  m_rows;
+
+        /// Throws VariantValueException if there is no such column.
+        const ColumnPtr &need_column(const std::string &name) const;
+
+    public:
+        Table() : m_rows(0) { }
+
+        /// Adds an empty column or one with the rows so far, filled
+        /// with nulls. Returns the existing column if the name is taken.
+        ColumnPtr add_column(const std::string &name, Type t);
+
+        size_t rows()    const { return m_rows; }
+        size_t columns() const { return m_columns.size(); }
+        const std::string &name(size_t i) const { return m_names[i]; }
+        const ColumnPtr   &column(size_t i) const { return m_columns[i]; }
+        /// Null if there is no such column.
+        ColumnPtr column(const std::string &name) const;
+
+        /// Appends a row, given as map (by column name, new names add
+        /// columns) or as list (by position). Missing cells are null.
+        void push_row(const VV &row);
+        /// Call after pushing cells into the columns directly: pads the
+        /// shorter columns with nulls.
+        void end_row();
+
+        /// The row as map of column name to value.
+        VV row(size_t i) const;
+
+        VV sum(const std::string &col) const;
+        VV min(const std::string &col) const;
+        VV max(const std::string &col) const;
+
+        /// New tables with the rows, for which col satisfies op v,
+        /// sorted by col and with the given rows.
+        std::shared_ptr<Table> filter(const std::string &col, const std::string &op, const VV &v) const;
+        std::shared_ptr<Table> sort_by(const std::string &col, bool descending = false) const;
+        std::shared_ptr<Table> take(const std::vector<uint32_t> &rows) const;
+        /// Deep copy, the columns are not shared.
+        std::shared_ptr<Table> clone() const;
+};
+//---------------------------------------------------------------------------
+
+typedef std::shared_ptr<Table> TablePtr;
+
+} // namespace table
+
+//---------------------------------------------------------------------------
+
+class ColumnValue : public VariantValue
+{
+    private:
+        table::ColumnPtr m_col;
+
+    public:
+        ColumnValue(const table::ColumnPtr &c) : m_col(c) { }
+        virtual ~ColumnValue() { }
+
+        const table::ColumnPtr &column() const { return m_col; }
+
+        virtual std::string s() const { return std::string("#<column: ") + std::to_string((uint64_t) this) + ">"; }
+        virtual std::string type() const { return table::type_name(m_col->type()); }
+        virtual bool is_undef() const { return false; }
+        virtual bool is_list()  const { return true; }
+        virtual int32_t size() const { return (int32_t) m_col->size(); }
+        virtual VV clone() const;
+
+        virtual VV _(int32_t i) const;
+        virtual VV _(const std::string &i) const { int32_t idx = 0; return vv_index(i, idx) ? _(idx) : vv_undef(); }
+        virtual void set(int32_t i, const VV &v);
+        virtual void set(const std::string &i, const VV &v) { int32_t idx = 0; if (vv_index(i, idx)) set(idx, v); }
+
+        virtual VariantValueIterator begin() const;
+        virtual VariantValueIterator end()   const;
+};
+//---------------------------------------------------------------------------
+
+/// A table as list of rows. _("name") returns the column as
+/// ColumnValue, that shares the storage with the table.
+class TableValue : public VariantValue
+{
+    private:
+        table::TablePtr m_table;
+
+    public:
+        TableValue(const table::TablePtr &t) : m_table(t) { }
+        virtual ~TableValue() { }
+
+        const table::TablePtr &table() const { return m_table; }
+
+        virtual std::string s() const { return std::string("#<table: ") + std::to_string((uint64_t) this) + ">"; }
+        virtual bool is_undef() const { return false; }
+        virtual bool is_list()  const { return true; }
+        virtual int32_t size() const { return (int32_t) m_table->rows(); }
+        virtual VV clone() const;
+
+        virtual VV _(int32_t i) const;
+        virtual VV _(const std::string &i) const;
+        /// Only appending rows (push()) is supported.
+        virtual void set(int32_t i, const VV &v);
+
+        virtual VariantValueIterator begin() const;
+        virtual VariantValueIterator end()   const;
+};
+//---------------------------------------------------------------------------
+
+VV vv_table();
+VV vv_table(const table::TablePtr &t);
+VV vv_column(table::Type t);
+VV vv_column(const table::ColumnPtr &c);
+
+/// The table behind a TableValue, or null.
+table::TablePtr vv_to_table(const VV &v);
+
+} // namespace VVal
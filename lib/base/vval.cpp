@@ -25,6 +25,7 @@
 #include <string>
 #include <locale>
 #include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <sstream>
 
@@ -52,6 +53,16 @@ VV vv_list()             { return VV(new ListValue()); }
 VV vv_map()              { return VV(new MapValue()); }
 VV vv_bool(bool v)       { return VV(new BooleanValue(v)); }
 VV vv_bytes(const std::string &v) { return VV(new BytesValue(v)); }
+VV vv_slice(const std::shared_ptr<const std::string> &buf, size_t offs, size_t len, bool is_bytes)
+                        { return VV(new StringSliceValue(buf, offs, len, is_bytes)); }
+VV vv_atom(uint32_t atom_id)
+                        { return VV(new AtomValue(atom_id)); }
+VV vv_atom(const std::string &v)
+{
+    uint32_t id = atom::intern(v);
+    if (id) return VV(new AtomValue(id));
+    return vv(v);
+}
 VV vv_closure(VVCLSF func, const VV &obj)
                         { return VV(new ClosureValue(func, obj)); }
 VV vv_ptr(void *ptr, const std::string &type)
@@ -99,6 +110,7 @@ VV VariantValueIterator::operator*()
     VV v = vv_undef();
     if (m_is_single) v = m_single_val;
     if (m_is_list) v = *m_l_it;
+    if (m_is_indexed) v = m_at(m_idx);
     if (m_is_map)
     {
         VV pair(vv_list());
@@ -111,6 +123,368 @@ VV VariantValueIterator::operator*()
 }
 //---------------------------------------------------------------------------
 
+/* Structural hash, equality and order. Every value belongs to one kind,
+ * values of different kinds are never equal and are ordered by kind.
+ * Maps and sets are hashed independent of their iteration order and
+ * compared as their entries/elements in sorted order. */
+
+enum ValueKind
+{
+    K_UNDEF, K_BOOL, K_NUMBER, K_DATETIME, K_STRING, K_BYTES,
+    K_LIST, K_MAP, K_SET, K_POINTER, K_CLOSURE, K_OTHER
+};
+
+static ValueKind kind_of(const VariantValue &v)
+{
+    if (v.is_undef())                 return K_UNDEF;
+    if (v.is_boolean())               return K_BOOL;
+    if (v.is_int() || v.is_double())  return K_NUMBER;
+    if (v.is_datetime())              return K_DATETIME;
+    if (v.is_string())                return K_STRING;
+    if (v.is_bytes())                 return K_BYTES;
+    if (v.is_list())                  return K_LIST;
+    if (v.is_map())                   return K_MAP;
+    if (v.is_set())                   return K_SET;
+    if (v.is_pointer())               return K_POINTER;
+    if (v.is_closure())               return K_CLOSURE;
+    return K_OTHER;
+}
+//---------------------------------------------------------------------------
+
+static const uint64_t HASH_K = 0x9E3779B97F4A7C15ULL;
+
+// doubles in [INT64_LOW, INT64_HIGH) convert to int64_t exactly
+static const double INT64_LOW  = -9223372036854775808.0;
+static const double INT64_HIGH =  9223372036854775808.0;
+
+static inline uint64_t hash_fmix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t hash_step(uint64_t h, uint64_t w)
+{
+    h ^= w * 0x87C37B91114253D5ULL;
+    h  = (h << 31) | (h >> 33);
+    return h * HASH_K;
+}
+
+static inline uint64_t hash_seed(ValueKind k) { return (uint64_t) (k + 1) * HASH_K; }
+
+static uint64_t hash_bytes(const char *p, size_t len, ValueKind k)
+{
+    uint64_t h = hash_seed(k) ^ (len * HASH_K);
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        h = hash_step(h, w);
+    }
+    if (len)
+    {
+        uint64_t w = 0;
+        std::memcpy(&w, p, len);
+        h = hash_step(h, w);
+    }
+    return hash_fmix(h);
+}
+
+/// Fetches the contents of a string or bytes value, tmp holds the
+/// copy if it doesn't keep them in memory.
+static const char *string_data(const VariantValue &v, size_t &len, std::string &tmp)
+{
+    if (const char *p = v.s_data(len))
+        return p;
+    tmp = v.s();
+    len = tmp.size();
+    return tmp.data();
+}
+//---------------------------------------------------------------------------
+
+size_t VariantValue::hash() const
+{
+    ValueKind k = kind_of(*this);
+    uint64_t  h = hash_seed(k);
+
+    switch (k)
+    {
+        case K_UNDEF:
+            break;
+        case K_BOOL:
+            h ^= this->b() ? 1 : 0;
+            break;
+        case K_NUMBER:
+        {
+            uint64_t bits;
+            double   d = this->is_int() ? 0.0 : this->d();
+            if (this->is_int())
+                bits = (uint64_t) this->i();
+            else if (d != d)
+                bits = 0x7FF8000000000000ULL; // all NaNs are equal
+            else if (d >= INT64_LOW && d < INT64_HIGH && d == std::floor(d))
+                bits = (uint64_t) (int64_t) d; // like the equal integer
+            else
+                std::memcpy(&bits, &d, sizeof(bits));
+            h ^= bits;
+            break;
+        }
+        case K_DATETIME:
+            h ^= (uint64_t) this->dt();
+            break;
+        case K_STRING:
+        case K_BYTES:
+        {
+            std::string tmp;
+            size_t      len = 0;
+            const char *p   = string_data(*this, len, tmp);
+            return (size_t) hash_bytes(p, len, k);
+        }
+        case K_LIST:
+        {
+            int32_t n = this->size();
+            if (const ListValue *lv = dynamic_cast<const ListValue *>(this))
+            {
+                for (auto &e : lv->items())
+                    h = hash_step(h, vv_hash(e));
+            }
+            else
+            {
+                for (int32_t i = 0; i < n; i++)
+                    h = hash_step(h, vv_hash(this->_(i)));
+            }
+            h ^= (uint64_t) n;
+            break;
+        }
+        case K_MAP:
+        {
+            // the sum doesn't depend on the order of the entries
+            uint64_t sum = 0;
+            if (const MapValue *mv = dynamic_cast<const MapValue *>(this))
+            {
+                for (auto &e : mv->entries())
+                    sum += hash_fmix(hash_step(
+                        hash_bytes(e.first.data(), e.first.size(), K_STRING),
+                        vv_hash(e.second)));
+            }
+            else
+            {
+                for (auto pair : *this)
+                    sum += hash_fmix(hash_step(vv_hash(pair->_(0)), vv_hash(pair->_(1))));
+            }
+            h ^= sum;
+            break;
+        }
+        case K_SET:
+        {
+            uint64_t sum = 0;
+            for (auto e : *this)
+                sum += vv_hash(e);
+            h ^= sum;
+            break;
+        }
+        case K_POINTER:
+        {
+            std::string t = this->type();
+            h = hash_step(hash_bytes(t.data(), t.size(), k), (uint64_t) this->i());
+            break;
+        }
+        default:
+            h ^= (uint64_t) (uintptr_t) this;
+            break;
+    }
+
+    return (size_t) hash_fmix(h);
+}
+//---------------------------------------------------------------------------
+
+template<typename T>
+static inline int cmp3(T a, T b) { return a < b ? -1 : (b < a ? 1 : 0); }
+
+static int compare_values(const VV &a, const VV &b, bool eq_only);
+
+static int compare_numbers(const VariantValue &x, const VariantValue &y)
+{
+    if (x.is_int() && y.is_int())
+        return cmp3(x.i(), y.i());
+
+    double a = x.d(), b = y.d();
+    bool nan_a = a != a, nan_b = b != b;
+    if (nan_a || nan_b) // NaN is ordered behind all numbers
+        return (int) nan_a - (int) nan_b;
+    if (a != b)
+        return a < b ? -1 : 1;
+
+    // equal as doubles, but integers beyond 2^53 might differ. A double
+    // outside of the int64 range (2^63 rounded from INT64_MAX) is
+    // bigger or smaller than every integer.
+    if (x.is_int() == y.is_int())
+        return 0;
+    if (a >= INT64_HIGH)
+        return x.is_int() ? -1 : 1;
+    if (a < INT64_LOW)
+        return x.is_int() ? 1 : -1;
+    return cmp3(x.is_int() ? x.i() : (int64_t) a,
+                y.is_int() ? y.i() : (int64_t) b);
+}
+//---------------------------------------------------------------------------
+
+static int compare_strings(const VariantValue &x, const VariantValue &y)
+{
+    std::string tx, ty;
+    size_t      lx = 0, ly = 0;
+    const char *px = string_data(x, lx, tx);
+    const char *py = string_data(y, ly, ty);
+
+    int r = std::memcmp(px, py, std::min(lx, ly));
+    if (r) return r < 0 ? -1 : 1;
+    return cmp3(lx, ly);
+}
+//---------------------------------------------------------------------------
+
+static int compare_lists(const VariantValue &x, const VariantValue &y, bool eq_only)
+{
+    int32_t nx = x.size(), ny = y.size();
+    if (eq_only && nx != ny)
+        return 1;
+
+    const ListValue *lx = dynamic_cast<const ListValue *>(&x);
+    const ListValue *ly = dynamic_cast<const ListValue *>(&y);
+    for (int32_t i = 0; i < nx && i < ny; i++)
+    {
+        int r = compare_values(lx ? lx->items()[i] : x._(i),
+                               ly ? ly->items()[i] : y._(i), eq_only);
+        if (r) return r;
+    }
+    return cmp3(nx, ny);
+}
+//---------------------------------------------------------------------------
+
+typedef std::vector<std::pair<VV, VV>> SortedEntries;
+
+static void sorted_entries(const VariantValue &m, SortedEntries &out)
+{
+    out.reserve(m.size());
+    if (const MapValue *mv = dynamic_cast<const MapValue *>(&m))
+    {
+        for (auto &e : mv->entries())
+            out.emplace_back(vv(e.first), e.second);
+    }
+    else
+    {
+        for (auto pair : m)
+            out.emplace_back(pair->_(0), pair->_(1));
+    }
+    std::sort(out.begin(), out.end(),
+        [](const std::pair<VV, VV> &a, const std::pair<VV, VV> &b)
+        { return vv_compare(a.first, b.first) < 0; });
+}
+//---------------------------------------------------------------------------
+
+static int compare_maps(const VariantValue &x, const VariantValue &y, bool eq_only)
+{
+    if (eq_only)
+    {
+        if (x.size() != y.size())
+            return 1;
+
+        const MapValue *mx = dynamic_cast<const MapValue *>(&x);
+        const MapValue *my = dynamic_cast<const MapValue *>(&y);
+        if (mx && my)
+        {
+            auto &ey = my->entries();
+            for (auto &e : mx->entries())
+            {
+                auto it = ey.find(e.first);
+                if (it == ey.end() || !vv_equals(e.second, it->second))
+                    return 1;
+            }
+            return 0;
+        }
+    }
+
+    SortedEntries ex, ey;
+    sorted_entries(x, ex);
+    sorted_entries(y, ey);
+    for (size_t i = 0; i < ex.size() && i < ey.size(); i++)
+    {
+        int r = compare_values(ex[i].first, ey[i].first, eq_only);
+        if (r) return r;
+        r = compare_values(ex[i].second, ey[i].second, eq_only);
+        if (r) return r;
+    }
+    return cmp3(ex.size(), ey.size());
+}
+//---------------------------------------------------------------------------
+
+static int compare_sets(const VariantValue &x, const VariantValue &y, bool eq_only)
+{
+    if (eq_only && x.size() != y.size())
+        return 1;
+
+    std::vector<VV> ex, ey;
+    for (auto e : x) ex.push_back(e);
+    for (auto e : y) ey.push_back(e);
+    std::sort(ex.begin(), ex.end(), VVLess());
+    std::sort(ey.begin(), ey.end(), VVLess());
+    for (size_t i = 0; i < ex.size() && i < ey.size(); i++)
+    {
+        int r = compare_values(ex[i], ey[i], eq_only);
+        if (r) return r;
+    }
+    return cmp3(ex.size(), ey.size());
+}
+//---------------------------------------------------------------------------
+
+/// With eq_only the result is only meaningful as 0 or not 0,
+/// which allows some shortcuts.
+static int compare_values(const VV &a, const VV &b, bool eq_only)
+{
+    const VariantValue &x = a ? *a : *g_vv_undef;
+    const VariantValue &y = b ? *b : *g_vv_undef;
+    if (&x == &y)
+        return 0;
+
+    ValueKind kx = kind_of(x), ky = kind_of(y);
+    if (kx != ky)
+        return kx < ky ? -1 : 1;
+
+    // cached hashes rule out most unequal pairs cheaply
+    if (eq_only && x.is_persistent() && y.is_persistent() && x.hash() != y.hash())
+        return 1;
+
+    switch (kx)
+    {
+        case K_UNDEF:    return 0;
+        case K_BOOL:     return cmp3((int) x.b(), (int) y.b());
+        case K_NUMBER:   return compare_numbers(x, y);
+        case K_DATETIME: return cmp3(x.dt(), y.dt());
+        case K_STRING:
+        case K_BYTES:    return compare_strings(x, y);
+        case K_LIST:     return compare_lists(x, y, eq_only);
+        case K_MAP:      return compare_maps(x, y, eq_only);
+        case K_SET:      return compare_sets(x, y, eq_only);
+        case K_POINTER:
+        {
+            int r = x.type().compare(y.type());
+            if (r) return r < 0 ? -1 : 1;
+            return cmp3((uint64_t) x.i(), (uint64_t) y.i());
+        }
+        default:
+            return cmp3((uintptr_t) &x, (uintptr_t) &y);
+    }
+}
+//---------------------------------------------------------------------------
+
+size_t vv_hash(const VV &v)                   { return v ? v->hash() : g_vv_undef->hash(); }
+bool   vv_equals(const VV &a, const VV &b)    { return compare_values(a, b, true) == 0; }
+int    vv_compare(const VV &a, const VV &b)   { return compare_values(a, b, false); }
+//---------------------------------------------------------------------------
+
 VVPair vv_kv(const std::string &sKey, const VV &v)
 { return VVPair(sKey, v); }
 VVPair vv_kv(const std::string &sKey, const int &v)
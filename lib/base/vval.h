@@ -33,6 +33,8 @@
 #include <unordered_map>
 #include <functional>
 #include "utf8buffer.h"
+#include "atom.h"
+#include "numconv.h"
 #include <boost/format.hpp>
 #include "datetime.h"
 
@@ -82,11 +84,30 @@ VV vv_undef();
 VV vv_bool(bool v);
 VV vv_bytes(const std::string &v);
 VV vv_bytes_from_hex(const std::string &v);
+VV vv_slice(const std::shared_ptr<const std::string> &buf, size_t offs, size_t len, bool is_bytes = false);
+VV vv_atom(uint32_t atom_id);
+VV vv_atom(const std::string &v);
 VV vv_closure(VVCLSF func, const VV &obj);
 VV vv_ptr(void *ptr, const std::string &type);
 VV vv_ptr(void *ptr, const std::string &type, std::function<void(void *)> freeer, bool same_thread);
 VV vv_dt(std::time_t);
 
+/// Structural hash, equality and total order of values. Lists, maps
+/// and sets are compared by their contents, integers and doubles by
+/// their numeric value (1 equals 1.0, NaN equals itself), strings
+/// byte wise. vv_hash() is consistent with vv_equals().
+size_t vv_hash(const VV &v);
+bool   vv_equals(const VV &a, const VV &b);
+/// Returns < 0, 0 or > 0. Values of different kinds are ordered:
+/// undef < boolean < number < datetime < string < bytes < list < map
+/// < set < pointer < closure < others.
+int    vv_compare(const VV &a, const VV &b);
+
+/// Function objects for the standard containers.
+struct VVHash  { size_t operator()(const VV &v) const { return vv_hash(v); } };
+struct VVEqual { bool operator()(const VV &a, const VV &b) const { return vv_equals(a, b); } };
+struct VVLess  { bool operator()(const VV &a, const VV &b) const { return vv_compare(a, b) < 0; } };
+
 #define VV_CLOSURE_DECL(name) \
     extern const char *VVC_DOC_##name; \
     VVal::VV VVC_CLS_##name(const VVal::VV &vv_obj, const VVal::VV &vv_args); \
@@ -136,33 +157,42 @@ class VariantValueIterator
         bool                                                   m_is_single;
         bool                                                   m_is_list;
         bool                                                   m_is_map;
+        bool                                                   m_is_indexed;
         VV_LIST                                                m_p_list;
         VV_MAP                                                 m_p_map;
         std::vector<VV>::const_iterator                        m_l_it;
         std::unordered_map<std::string, VV>::const_iterator    m_m_it;
         VV                                                     m_single_val;
+        std::function<VV(int32_t)>                             m_at;
+        int32_t                                                m_idx;
 
     public:
         VariantValueIterator()
-            : m_is_list(false), m_is_map(false), m_is_single(false), m_p_list(0), m_p_map(0)
+            : m_is_single(false), m_is_list(false), m_is_map(false), m_is_indexed(false), m_p_list(0), m_p_map(0), m_idx(0)
         {
         }
         VariantValueIterator(const VV &v)
-            : m_is_list(false), m_is_map(false), m_is_single(true), m_single_val(v), m_p_list(0), m_p_map(0)
+            : m_is_single(true), m_is_list(false), m_is_map(false), m_is_indexed(false), m_p_list(0), m_p_map(0), m_single_val(v), m_idx(0)
         {
         }
         VariantValueIterator(const VV_MAP &v, bool is_begin = false)
-            : m_is_list(false), m_is_map(true), m_is_single(false), m_p_list(0), m_p_map(v)
+            : m_is_single(false), m_is_list(false), m_is_map(true), m_is_indexed(false), m_p_list(0), m_p_map(v), m_idx(0)
         {
             if (is_begin) m_m_it = v->begin();
             else          m_m_it = v->end();
         }
         VariantValueIterator(const VV_LIST &v, bool is_begin = false)
-            : m_is_list(true), m_is_map(false), m_is_single(false), m_p_list(v), m_p_map(0)
+            : m_is_single(false), m_is_list(true), m_is_map(false), m_is_indexed(false), m_p_list(v), m_p_map(0), m_idx(0)
         {
             if (is_begin) m_l_it = v->begin();
             else          m_l_it = v->end();
         }
+        /// Iterates over idx, idx + 1, ... of a container, that boxes its
+        /// elements on access. at has to keep the storage alive.
+        VariantValueIterator(const std::function<VV(int32_t)> &at, int32_t idx)
+            : m_is_single(false), m_is_list(false), m_is_map(false), m_is_indexed(true), m_p_list(0), m_p_map(0), m_at(at), m_idx(idx)
+        {
+        }
 
         VV operator*();
 
@@ -170,6 +200,7 @@ class VariantValueIterator
         {
             if (m_is_list)        return m_l_it != o.m_l_it;
             else if (m_is_map)    return m_m_it != o.m_m_it;
+            else if (m_is_indexed) return m_idx != o.m_idx;
             else if (m_is_single) return m_is_single != o.m_is_single;
             else                  return false;
         }
@@ -177,6 +208,7 @@ class VariantValueIterator
         {
             if (m_is_list) ++m_l_it;
             if (m_is_map)  ++m_m_it;
+            if (m_is_indexed) ++m_idx;
             if (m_is_single) m_is_single = false;
             return *this;
         }
@@ -211,6 +243,11 @@ class VariantValue
         }
         virtual std::string  s() const { return std::string(); }
         virtual std::string  s_hex() const;
+        /// The contents of string and bytes values, that keep them as
+        /// such, without the copy of s(). nullptr for the other values.
+        virtual const char  *s_data(size_t &len) const { UNUSED(len); return nullptr; }
+        /// The id of the atom (see atom.h) this string refers to, or 0.
+        virtual uint32_t     atom() const { return atom::NONE; }
         virtual std::time_t  dt() const
         {
             return parse_datetime(this->s(), "%Y-%m-%d %H:%M:%S");
@@ -230,6 +267,14 @@ class VariantValue
         virtual bool is_list()     const { return false; }
         virtual bool is_datetime() const { return false; }
         virtual bool is_closure()  const { return false; }
+        /// Immutable values, that can be shared between threads
+        /// (see vv_persistent.h).
+        virtual bool is_persistent() const { return false; }
+        /// Sets of values (see vv_hashed.h).
+        virtual bool is_set()        const { return false; }
+
+        /// Structural hash, see vv_hash(). Immutable values cache it.
+        virtual size_t hash() const;
 
         virtual std::string type() const { return ""; }
 
@@ -386,14 +431,13 @@ class IntegerValue : public VariantValue
         virtual void p_set(void *v, const std::string &t) { m_int = (int64_t) v; UNUSED(t); }
         virtual void s_set(const std::string &v)
         {
-            // TODO: TEST EXCEPTIONS!
-            try { m_int = std::stoll(v); } catch (const std::exception &) { m_int = 0; }
+            m_int = numconv::to_int64(v.data(), v.size());
         }
 
         virtual std::time_t dt() const    { return (std::time_t) m_int; }
         virtual int64_t i() const       { return m_int;   }
         virtual double  d() const       { return (double) m_int; }
-        virtual std::string  s() const  { return std::to_string(m_int); }
+        virtual std::string  s() const  { return numconv::int64_string(m_int); }
         virtual std::wstring  w() const { return std::to_wstring(m_int); }
         virtual bool b() const          { return m_int != 0; }
 
@@ -449,17 +493,24 @@ class DoubleValue : public VariantValue
         virtual void p_set(void *v, const std::string &t) { m_dbl = (double) (int64_t) v; UNUSED(t); }
         virtual void s_set(const std::string &v)
         {
-            try { m_dbl = std::stod(v); } catch (const std::exception &) { m_dbl = 0.0; }
+            m_dbl = numconv::to_double(v.data(), v.size());
         }
         virtual void s_set(const std::wstring &v)
         {
-            try { m_dbl = std::stod(v); } catch (const std::exception &) { m_dbl = 0.0; }
+            // numbers are plain ASCII
+            std::string n;
+            for (wchar_t c : v)
+            {
+                if (c <= 0 || c >= 0x80) break;
+                n += (char) c;
+            }
+            m_dbl = numconv::to_double(n.data(), n.size());
         }
 
         virtual std::time_t dt() const    { return (std::time_t) m_dbl; }
         virtual int64_t i() const { return (int64_t) m_dbl; }
         virtual double  d() const { return m_dbl; }
-        virtual std::string  s() const { return std::to_string(m_dbl); }
+        virtual std::string  s() const { return numconv::fixed6_string(m_dbl); }
         virtual bool b() const { return m_dbl != 0.0; }
 
         virtual bool is_undef()   const { return false; }
@@ -475,13 +526,14 @@ class StringValue : public VariantValue
         std::string m_str;
     public:
         StringValue(const std::string &s) : m_str(s) { }
+        StringValue(const char *data, size_t len) : m_str(data, len) { }
         virtual ~StringValue()
         {
 //            std::cout << "DESTRSTR[" << m_str << "]" << std::endl;
         }
 
-        virtual void i_set(int64_t v)                     { m_str = std::to_string(v); }
-        virtual void d_set(double v)                      { m_str = std::to_string(v); }
+        virtual void i_set(int64_t v)                     { m_str = numconv::int64_string(v); }
+        virtual void d_set(double v)                      { m_str = numconv::fixed6_string(v); }
         virtual void p_set(void *v, const std::string &t) { m_str = "#<" + t + ":" + std::to_string((uint64_t) v) + ">"; }
         virtual void s_set(const std::string &v)          { m_str = v; }
 
@@ -496,19 +548,10 @@ class StringValue : public VariantValue
             return buf;
         }
 
-        virtual int64_t i() const
-        {
-            int64_t iv;
-            try { iv = std::stoll(m_str); } catch (const std::exception &) { iv = 0; }
-            return iv;
-        }
-        virtual double d() const
-        {
-            double dv;
-            try { dv = std::stod(m_str); } catch (const std::exception &) { dv = 0.0; }
-            return dv;
-        }
+        virtual int64_t i() const { return numconv::to_int64(m_str.data(), m_str.size()); }
+        virtual double  d() const { return numconv::to_double(m_str.data(), m_str.size()); }
         virtual std::string s() const { return m_str; }
+        virtual const char *s_data(size_t &len) const { len = m_str.size(); return m_str.data(); }
 
         virtual VV clone() const { return VV(new StringValue(m_str)); }
 };
@@ -518,6 +561,7 @@ class BytesValue : public StringValue
 {
     public:
         BytesValue(const std::string &s) : StringValue(s) { }
+        BytesValue(const char *data, size_t len) : StringValue(data, len) { }
         virtual ~BytesValue() { }
 
         virtual bool is_undef()   const { return false; }
@@ -528,6 +572,114 @@ class BytesValue : public StringValue
 };
 //---------------------------------------------------------------------------
 
+/// String or bytes value, that refers to a part of a shared buffer
+/// instead of owning a copy. Used by decoders for big payloads, that
+/// are only passed on. Keeps the whole buffer alive as long as it lives.
+/// Setting a new value detaches it from the buffer.
+class StringSliceValue : public VariantValue
+{
+    private:
+        std::shared_ptr<const std::string> m_buf;
+        size_t                             m_offs;
+        size_t                             m_len;
+        bool                               m_is_bytes;
+
+        const char *data() const { return m_buf->data() + m_offs; }
+
+    public:
+        StringSliceValue(const std::shared_ptr<const std::string> &buf,
+                         size_t offs, size_t len, bool is_bytes)
+            : m_buf(buf), m_offs(offs), m_len(len), m_is_bytes(is_bytes)
+        { }
+        virtual ~StringSliceValue() { }
+
+        virtual void i_set(int64_t v)                     { s_set(numconv::int64_string(v)); }
+        virtual void d_set(double v)                      { s_set(numconv::fixed6_string(v)); }
+        virtual void p_set(void *v, const std::string &t) { s_set("#<" + t + ":" + std::to_string((uint64_t) v) + ">"); }
+        virtual void s_set(const std::string &v)
+        {
+            m_buf  = std::make_shared<const std::string>(v);
+            m_offs = 0;
+            m_len  = v.size();
+        }
+
+        virtual bool is_undef()   const { return false; }
+        virtual bool is_string()  const { return !m_is_bytes; }
+        virtual bool is_bytes()   const { return m_is_bytes; }
+
+        virtual char *s_buffer(size_t &len)
+        {
+            char *buf = new char[m_len];
+            len = m_len;
+            std::memcpy(buf, data(), m_len);
+            return buf;
+        }
+
+        virtual int64_t i() const { return numconv::to_int64(data(), m_len); }
+        virtual double  d() const { return numconv::to_double(data(), m_len); }
+        virtual std::string s() const { return std::string(data(), m_len); }
+        virtual const char *s_data(size_t &len) const { len = m_len; return data(); }
+
+        virtual VV clone() const { return VV(new StringSliceValue(m_buf, m_offs, m_len, m_is_bytes)); }
+};
+//---------------------------------------------------------------------------
+
+/// String value, that refers to an entry of the global atom table
+/// (see atom.h). Setting a new value detaches it from the atom.
+class AtomValue : public VariantValue
+{
+    private:
+        uint32_t    m_id;
+        std::string m_str; // only used after s_set()
+
+    public:
+        AtomValue(uint32_t id) : m_id(id) { }
+        virtual ~AtomValue() { }
+
+        virtual void i_set(int64_t v)                     { s_set(numconv::int64_string(v)); }
+        virtual void d_set(double v)                      { s_set(numconv::fixed6_string(v)); }
+        virtual void p_set(void *v, const std::string &t) { s_set("#<" + t + ":" + std::to_string((uint64_t) v) + ">"); }
+        virtual void s_set(const std::string &v)          { m_id = atom::NONE; m_str = v; }
+
+        virtual bool is_undef()   const { return false; }
+        virtual bool is_string()  const { return true; }
+
+        virtual char *s_buffer(size_t &len)
+        {
+            const std::string &s = m_id ? atom::str(m_id) : m_str;
+            char *buf = new char[s.size()];
+            len = s.size();
+            std::memcpy(buf, s.data(), s.size());
+            return buf;
+        }
+
+        virtual int64_t  i() const
+        {
+            const std::string &s = m_id ? atom::str(m_id) : m_str;
+            return numconv::to_int64(s.data(), s.size());
+        }
+        virtual double   d() const
+        {
+            const std::string &s = m_id ? atom::str(m_id) : m_str;
+            return numconv::to_double(s.data(), s.size());
+        }
+        virtual std::string s() const { return m_id ? atom::str(m_id) : m_str; }
+        virtual const char *s_data(size_t &len) const
+        {
+            const std::string &s = m_id ? atom::str(m_id) : m_str;
+            len = s.size();
+            return s.data();
+        }
+        virtual uint32_t atom() const { return m_id; }
+
+        virtual VV clone() const
+        {
+            if (m_id) return VV(new AtomValue(m_id));
+            return vv(m_str);
+        }
+};
+//---------------------------------------------------------------------------
+
 class ClosureValue : public VariantValue
 {
     private:
@@ -586,6 +738,25 @@ class ClosureValue : public VariantValue
 };
 //---------------------------------------------------------------------------
 
+/// Parses the string form of a list index like std::stoll(). Returns
+/// false if it doesn't fit into int32_t, no list has such an index.
+inline bool vv_index(const std::string &s, int32_t &idx)
+{
+    int64_t i = numconv::to_int64(s.data(), s.size());
+    if (i < INT32_MIN || i > INT32_MAX)
+        return false;
+    idx = (int32_t) i;
+    return true;
+}
+//---------------------------------------------------------------------------
+
+/* clone() of ListValue and MapValue is a deep copy. It can't share the
+ * storage until the first write: handles to nested lists and maps,
+ * taken before the clone, alias the same objects in both copies, and
+ * code relies on that aliasing when building up nested values. State
+ * that needs constant time clones belongs into vv_cow_list() and
+ * vv_cow_map() of vv_persistent.h, whose nested values are read only. */
+
 class ListValue : public VariantValue
 {
     friend class VariantValueIterator;
@@ -596,6 +767,8 @@ class ListValue : public VariantValue
         ListValue() : m_v(new std::vector<VV>) { }
         virtual ~ListValue() { }
 
+        const std::vector<VV> &items() const { return *m_v; }
+
         virtual std::string s() const { return std::string("#<list: ") + std::to_string((uint64_t) this) + ">"; }
         virtual bool is_undef() const { return false; }
         virtual bool is_list()  const { return true; }
@@ -605,16 +778,16 @@ class ListValue : public VariantValue
             ListValue *lv = new ListValue;
             VV v(lv);
             auto &vec = *(lv->m_v);
-            vec.reserve(vec.size());
-            for (auto i : *m_v)
+            vec.reserve(m_v->size());
+            for (auto &i : *m_v)
                 vec.push_back(i->clone());
             return v;
         }
         virtual void set(const std::string &i, const VV &v)
         {
             int32_t idx = 0;
-            try { idx = std::stoi(i); } catch (const std::exception &) { idx = 0; }
-            set(idx, v);
+            if (vv_index(i, idx))
+                set(idx, v);
         }
         virtual void set(int32_t i, const VV &v)
         {
@@ -647,14 +820,10 @@ class ListValue : public VariantValue
 
         virtual VV _(const std::string &i) const
         {
-            auto &vec = *m_v;
             int32_t idx = 0;
-            try { idx = std::stoi(i); } catch (const std::exception &) { idx = 0; }
-            if (((size_t) idx) >= vec.size())
+            if (!vv_index(i, idx))
                 return vv_undef();
-            if (!vec[idx])
-                return vv_undef();
-            return vec[idx];
+            return _(idx);
         }
 
         virtual VariantValueIterator begin() const { return VariantValueIterator(m_v, true); }
@@ -672,6 +841,8 @@ class MapValue : public VariantValue
         MapValue() : m_m(new std::unordered_map<std::string, VV>) { }
         virtual ~MapValue() { }
 
+        const std::unordered_map<std::string, VV> &entries() const { return *m_m; }
+
         virtual std::string s() const { return std::string("#<map: ") + std::to_string((uint64_t) this) + ">"; }
         virtual bool is_undef() const { return false; }
         virtual bool is_map()  const { return true; }
@@ -681,13 +852,14 @@ class MapValue : public VariantValue
             MapValue *mv = new MapValue;
             VV v(mv);
             auto &map = *(mv->m_m);
-            for (auto i : *m_m)
-                map[i.first] = i.second->clone();
+            map.reserve(m_m->size());
+            for (auto &i : *m_m)
+                map.emplace(i.first, i.second->clone());
             return v;
         }
         virtual void set(const std::string &i, const VV &v) { (*m_m)[i] = v; }
-        virtual void set(int32_t i, const VV &v) { set(std::to_string(i), v); }
-        virtual VV _(int32_t i) const { return _(std::to_string(i)); }
+        virtual void set(int32_t i, const VV &v) { set(numconv::int64_string(i), v); }
+        virtual VV _(int32_t i) const { return _(numconv::int64_string(i)); }
         virtual VV _(const std::string &i) const
         {
             auto it = m_m->find(i);
@@ -763,8 +935,7 @@ class PointerValue : public VariantValue
         virtual void p_set(void *v, const std::string &t) { m_pointer = v; m_type = t; }
         virtual void s_set(const std::string &v)
         {
-            try { m_pointer = (void *) std::stoll(v); }
-            catch (const std::exception &) { m_pointer = 0; }
+            m_pointer = (void *) numconv::to_int64(v.data(), v.size());
         }
 
         virtual int64_t i() const { return (int64_t) m_pointer;   }
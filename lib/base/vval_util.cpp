@@ -22,7 +22,7 @@
 ******************************************************************************/
 
 #include "vval_util.h"
-#include "JSON.h"
+#include "json_vv.h"
 #include <iostream>
 #include <algorithm>
 #include <string>
@@ -49,144 +49,15 @@ std::string VariantValue::s_hex() const
 }
 //---------------------------------------------------------------------------
 
-void as_json(const VV &value, json::Serializer &ser)
-{
-    if      (value->is_undef())     ser.null();
-    else if (value->is_boolean())   ser.boolean(value->is_true());
-    else if (value->is_int())       ser.number(value->i());
-    else if (value->is_double())    ser.number(value->d());
-    else if (value->is_string())
-    {
-        try
-        { ser.string(value->s()); }
-        catch (UTF8Buffer_exception &)
-        { ser.string(value->s_hex()); }
-    }
-    else if (value->is_bytes())
-    {
-        ser.string(value->s_hex());
-    }
-    else if (value->is_list())
-    {
-        ser.arrayStart();
-        for (auto i : *value)
-            as_json(i, ser);
-        ser.arrayEnd();
-    }
-    else if (value->is_map())
-    {
-        ser.objectStart();
-        for (auto i : *value)
-        {
-            ser.objectKey(i->_s(0));
-            as_json(i->_(1), ser);
-        }
-        ser.objectEnd();
-    }
-    else
-    {
-        ser.string(value->s());
-    }
-}
-//---------------------------------------------------------------------------
-
 string as_json(const VV &value, bool bIndent)
 {
-    json::Serializer ser(bIndent);
-    as_json(value, ser);
-    return ser.asString();
+    return json_vv::to_json(value, bIndent);
 }
 //---------------------------------------------------------------------------
 
-class VVJSONParser : public json::Parser
-{
-    private:
-        UTF8Buffer      *m_u8b;
-        VV               m_stack;
-        VV               m_obj_stack;
-        VV               m_obj_key_stack;
-        VV               m_cur_obj;
-        string           m_cur_key;
-
-    public:
-        string      m_error;
-
-        VVJSONParser(const string &json)
-        {
-            m_stack         = vv_list();
-            m_obj_stack     = vv_list();
-            m_obj_key_stack = vv_list();
-            m_cur_obj       = vv_undef();
-            m_u8b           = new UTF8Buffer(json.data(), json.size());
-        }
-
-        VV parseVV()
-        {
-            if (this->parse(m_u8b))
-            {
-                if (m_error != "") return vv_undef();
-                return m_stack->pop();
-            }
-            else return vv_undef();
-        }
-
-        virtual ~VVJSONParser()
-        {
-            delete m_u8b;
-        }
-
-        virtual void onObjectStart()
-        {
-            m_obj_stack->push(m_cur_obj);
-            m_obj_key_stack->push(vv(m_cur_key));
-            m_cur_obj = vv_map();
-        }
-        virtual void onObjectKey(const string &sOut) { m_cur_key = sOut; }
-        virtual void onObjectValueDone()
-        {
-            m_cur_obj << vv_kv(m_cur_key, m_stack->pop());
-        }
-        virtual void onObjectEnd()
-        {
-            m_stack->push(m_cur_obj);
-            m_cur_obj = m_obj_stack->pop();
-            m_cur_key = m_obj_key_stack->pop()->s();
-        }
-
-        virtual void onArrayStart()
-        {
-            m_obj_stack->push(m_cur_obj);
-            m_cur_obj = vv_list();
-        }
-        virtual void onArrayValueDone()
-        {
-            m_cur_obj->push(m_stack->pop());
-        }
-        virtual void onArrayEnd()
-        {
-            m_stack->push(m_cur_obj);
-            m_cur_obj = m_obj_stack->pop();
-        }
-        virtual void onError(UTF8Buffer *u8Buf, const char *csError)
-        { m_error = string(csError); }
-
-        virtual void onValueBoolean(bool bValue) { m_stack->push(vv_bool(bValue)); }
-        virtual void onValueNull() { m_stack->push(vv_undef()); }
-        virtual void onValueNumber(const char *csNumber, bool bIsFloat)
-        {
-            VV tmp(vv(string(csNumber)));
-            if (bIsFloat) m_stack->push(vv(tmp->d()));
-            else          m_stack->push(vv(tmp->i()));
-
-        }
-        virtual void onValueString(const string &sString) { m_stack->push(vv(sString)); }
-};
-//---------------------------------------------------------------------------
-
 VV from_json(const string &json)
 {
-    VVJSONParser p(json);
-    return p.parseVV();
+    return json_vv::parse(json.data(), json.size());
 }
 //---------------------------------------------------------------------------
 
@@ -0,0 +1,447 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "lua_bundle.h"
+#include "../../lua/src/lauxlib.h"
+#include "../../lua/src/lopcodes.h"
+#include "../../lua/src/lundump.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace Lua
+{
+//---------------------------------------------------------------------------
+
+static const char   MAGIC[8]    = { 'L', 'A', 'L', 'R', 'T', 'B', '2', '\0' };
+static const size_t HEADER_SIZE = 16;
+static const size_t ENTRY_SIZE  = 36;
+
+static void vm_tag(unsigned char *tag)
+{
+    tag[0] = LUAC_VERSION;
+    tag[1] = NUM_OPCODES;
+    tag[2] = sizeof(lua_Integer);
+    tag[3] = sizeof(lua_Number);
+}
+//---------------------------------------------------------------------------
+
+static void put_u32(std::string &out, uint32_t v)
+{
+    out += (char) (v & 0xFF);
+    out += (char) ((v >> 8) & 0xFF);
+    out += (char) ((v >> 16) & 0xFF);
+    out += (char) ((v >> 24) & 0xFF);
+}
+//---------------------------------------------------------------------------
+
+static void put_u64(std::string &out, uint64_t v)
+{
+    put_u32(out, (uint32_t) v);
+    put_u32(out, (uint32_t) (v >> 32));
+}
+//---------------------------------------------------------------------------
+
+/// Size and mtime of a file. Returns false if it doesn't exist.
+static bool source_stat(const std::string &path, uint64_t &size, uint64_t &mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    size  = (uint64_t) st.st_size;
+    mtime = (uint64_t) st.st_mtime;
+    return true;
+}
+//---------------------------------------------------------------------------
+
+/// FNV-1a over the contents of a file. Returns false if it can't be read.
+static bool source_hash(const std::string &path, uint64_t &hash)
+{
+    ifstream f(path.c_str(), ios::in | ios::binary);
+    if (!f)
+        return false;
+
+    hash = 14695981039346656037ULL;
+    char buf[16 * 1024];
+    while (f)
+    {
+        f.read(buf, sizeof(buf));
+        for (streamsize i = 0; i < f.gcount(); i++)
+            hash = (hash ^ (unsigned char) buf[i]) * 1099511628211ULL;
+    }
+    return f.eof();
+}
+//---------------------------------------------------------------------------
+
+Bundle::Bundle(const std::string &path)
+    : m_path(path), m_data(nullptr), m_size(0), m_count(0)
+#if defined(_WIN32)
+      , m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr)
+#endif
+{
+}
+//---------------------------------------------------------------------------
+
+Bundle::~Bundle()
+{
+#if defined(_WIN32)
+    if (m_data)                         UnmapViewOfFile(m_data);
+    if (m_mapping)                      CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+    if (m_data) munmap((void *) m_data, m_size);
+#endif
+}
+//---------------------------------------------------------------------------
+
+std::shared_ptr<Bundle> Bundle::open(const std::string &path)
+{
+    std::shared_ptr<Bundle> b(new Bundle(path));
+
+#if defined(_WIN32)
+    b->m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (b->m_file == INVALID_HANDLE_VALUE)
+        throw InstanceException("Can't open bundle: " + path);
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(b->m_file, &size))
+        throw InstanceException("Can't read size of bundle: " + path);
+    b->m_size = (size_t) size.QuadPart;
+    if (b->m_size >= HEADER_SIZE)
+    {
+        b->m_mapping = CreateFileMappingA(b->m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (b->m_mapping)
+            b->m_data = (const char *) MapViewOfFile(b->m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!b->m_data)
+            throw InstanceException("Can't map bundle: " + path);
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw InstanceException("Can't open bundle: " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        throw InstanceException("Can't read size of bundle: " + path);
+    }
+    b->m_size = (size_t) st.st_size;
+    if (b->m_size >= HEADER_SIZE)
+    {
+        void *p = mmap(nullptr, b->m_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            ::close(fd);
+            throw InstanceException("Can't map bundle: " + path);
+        }
+        b->m_data = (const char *) p;
+    }
+    ::close(fd);
+#endif
+
+    unsigned char tag[4];
+    vm_tag(tag);
+    if (b->m_size < HEADER_SIZE || memcmp(b->m_data, MAGIC, sizeof(MAGIC)) != 0)
+        throw InstanceException("Not a bundle: " + path);
+    if (memcmp(b->m_data + sizeof(MAGIC), tag, sizeof(tag)) != 0)
+        throw InstanceException("Bundle was written for a different Lua VM: " + path);
+
+    b->m_count = b->u32(12);
+    if ((b->m_size - HEADER_SIZE) / ENTRY_SIZE < b->m_count)
+        throw InstanceException("Damaged bundle: " + path);
+    for (uint32_t i = 0; i < b->m_count; i++)
+    {
+        size_t e = HEADER_SIZE + i * ENTRY_SIZE;
+        if ((uint64_t) b->u32(e)     + b->u32(e + 4)  > b->m_size
+            || (uint64_t) b->u32(e + 8) + b->u32(e + 12) > b->m_size)
+            throw InstanceException("Damaged bundle: " + path);
+    }
+
+    b->m_checked.reset(new std::atomic<uint8_t>[b->m_count]);
+    for (uint32_t i = 0; i < b->m_count; i++)
+        b->m_checked[i].store(0, std::memory_order_relaxed);
+
+    return b;
+}
+//---------------------------------------------------------------------------
+
+uint32_t Bundle::u32(size_t offs) const
+{
+    const unsigned char *p = (const unsigned char *) m_data + offs;
+    return  (uint32_t) p[0]
+         | ((uint32_t) p[1] << 8)
+         | ((uint32_t) p[2] << 16)
+         | ((uint32_t) p[3] << 24);
+}
+//---------------------------------------------------------------------------
+
+uint64_t Bundle::u64(size_t offs) const
+{
+    return (uint64_t) u32(offs) | ((uint64_t) u32(offs + 4) << 32);
+}
+//---------------------------------------------------------------------------
+
+const char *Bundle::name(uint32_t i, size_t &len) const
+{
+    size_t e = HEADER_SIZE + i * ENTRY_SIZE;
+    len = u32(e + 4);
+    return m_data + u32(e);
+}
+//---------------------------------------------------------------------------
+
+int64_t Bundle::lookup(const char *module) const
+{
+    size_t mlen = strlen(module);
+
+    // binary search on the sorted index
+    uint32_t lo = 0, hi = m_count;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        size_t   nlen;
+        const char *n = name(mid, nlen);
+
+        int c = memcmp(n, module, std::min(nlen, mlen));
+        if (c == 0)
+            c = nlen < mlen ? -1 : (nlen > mlen ? 1 : 0);
+
+        if (c == 0)     return mid;
+        else if (c < 0) lo = mid + 1;
+        else            hi = mid;
+    }
+    return -1;
+}
+//---------------------------------------------------------------------------
+
+const char *Bundle::chunk(uint32_t i, size_t &len) const
+{
+    size_t e = HEADER_SIZE + i * ENTRY_SIZE;
+    len = u32(e + 12);
+    return m_data + u32(e + 8);
+}
+//---------------------------------------------------------------------------
+
+bool Bundle::find(const char *module, const char *&chunk, size_t &len) const
+{
+    int64_t i = lookup(module);
+    if (i < 0)
+        return false;
+
+    chunk = this->chunk((uint32_t) i, len);
+    return true;
+}
+//---------------------------------------------------------------------------
+
+bool Bundle::source_matches(lua_State *L, uint32_t i, const char *module) const
+{
+    uint8_t checked = m_checked[i].load(std::memory_order_relaxed);
+    if (checked != 0)
+        return checked == 1;
+
+    // the file the Lua file searcher would load
+    std::string path;
+    lua_getglobal(L, "package");
+    if (lua_getfield(L, -1, "searchpath") == LUA_TFUNCTION)
+    {
+        lua_pushstring(L, module);
+        lua_getfield(L, -3, "path");
+        if (lua_pcall(L, 2, 1, 0) == LUA_OK && lua_type(L, -1) == LUA_TSTRING)
+            path = lua_tostring(L, -1);
+    }
+    lua_pop(L, 2);
+
+    size_t   e       = HEADER_SIZE + i * ENTRY_SIZE;
+    bool     matches = true;
+    uint64_t size    = 0;
+    uint64_t mtime   = 0;
+    uint64_t hash    = 0;
+    if (!path.empty() && source_stat(path, size, mtime))
+    {
+        if (size != u32(e + 16))
+            matches = false;
+        else if (mtime != u64(e + 20))
+            matches = source_hash(path, hash) && hash == u64(e + 28);
+    }
+
+    m_checked[i].store(matches ? 1 : 2, std::memory_order_relaxed);
+    return matches;
+}
+//---------------------------------------------------------------------------
+
+int Bundle::searcher(lua_State *L)
+{
+    Bundle *b = (Bundle *) lua_touserdata(L, lua_upvalueindex(1));
+    const char *module = luaL_checkstring(L, 1);
+
+    int64_t i = b->lookup(module);
+    if (i < 0)
+    {
+        lua_pushfstring(L, "\n\tno module '%s' in bundle '%s'",
+                        module, b->m_path.c_str());
+        return 1;
+    }
+
+    if (!b->source_matches(L, (uint32_t) i, module))
+    {
+        lua_pushfstring(L, "\n\tmodule '%s' in bundle '%s' differs from its source",
+                        module, b->m_path.c_str());
+        return 1;
+    }
+
+    size_t      len   = 0;
+    const char *chunk = b->chunk((uint32_t) i, len);
+    string chunkname = "=" + b->m_path + ":" + module;
+    if (luaL_loadbufferx(L, chunk, len, chunkname.c_str(), "b") != LUA_OK)
+        return luaL_error(L, "error loading module '%s' from bundle '%s':\n\t%s",
+                          module, b->m_path.c_str(), lua_tostring(L, -1));
+
+    // like the file searcher: the loader gets the module name and origin
+    lua_pushstring(L, chunkname.c_str() + 1);
+    return 2;
+}
+//---------------------------------------------------------------------------
+
+void Bundle::install(lua_State *L)
+{
+    lua_getglobal(L, "package");
+    if (lua_getfield(L, -1, "searchers") != LUA_TTABLE)
+    {
+        lua_pop(L, 2);
+        throw InstanceException("package.searchers missing, can't install bundle " + m_path);
+    }
+
+    lua_Integer n = (lua_Integer) lua_rawlen(L, -1);
+    for (lua_Integer i = n; i >= 2; i--)
+    {
+        lua_rawgeti(L, -1, i);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushlightuserdata(L, this);
+    lua_pushcclosure(L, &Bundle::searcher, 1);
+    lua_rawseti(L, -2, 2);
+
+    lua_pop(L, 2);
+}
+//---------------------------------------------------------------------------
+
+BundleWriter::BundleWriter(bool strip)
+    : m_L(luaL_newstate()), m_strip(strip)
+{
+    if (!m_L)
+        throw InstanceException("Can't create Lua state");
+}
+//---------------------------------------------------------------------------
+
+BundleWriter::~BundleWriter()
+{
+    lua_close(m_L);
+}
+//---------------------------------------------------------------------------
+
+static int dump_writer(lua_State *, const void *p, size_t sz, void *ud)
+{
+    ((std::string *) ud)->append((const char *) p, sz);
+    return 0;
+}
+//---------------------------------------------------------------------------
+
+void BundleWriter::add(const std::string &module, const std::string &filename)
+{
+    if (luaL_loadfilex(m_L, filename.c_str(), "t") != LUA_OK)
+    {
+        string err = lua_tostring(m_L, -1);
+        lua_pop(m_L, 1);
+        throw InstanceException(err);
+    }
+
+    Module m;
+    m.name = module;
+
+    uint64_t size = 0;
+    if (!source_stat(filename, size, m.src_mtime)
+        || !source_hash(filename, m.src_hash))
+    {
+        lua_pop(m_L, 1);
+        throw InstanceException("Can't read " + filename);
+    }
+    m.src_size = (uint32_t) size;
+
+    lua_dump(m_L, dump_writer, &m.chunk, m_strip ? 1 : 0);
+    lua_pop(m_L, 1);
+    m_modules.push_back(std::move(m));
+}
+//---------------------------------------------------------------------------
+
+void BundleWriter::write(const std::string &path)
+{
+    sort(m_modules.begin(), m_modules.end(),
+         [](const Module &a, const Module &b) { return a.name < b.name; });
+    for (size_t i = 1; i < m_modules.size(); i++)
+        if (m_modules[i].name == m_modules[i - 1].name)
+            throw InstanceException("Module in bundle twice: " + m_modules[i].name);
+
+    string out(MAGIC, sizeof(MAGIC));
+    unsigned char tag[4];
+    vm_tag(tag);
+    out.append((const char *) tag, sizeof(tag));
+    put_u32(out, (uint32_t) m_modules.size());
+
+    size_t offs = HEADER_SIZE + m_modules.size() * ENTRY_SIZE;
+    size_t names_offs = offs;
+    for (auto &m : m_modules) offs += m.name.size();
+    size_t chunks_offs = offs;
+    for (auto &m : m_modules)
+    {
+        put_u32(out, (uint32_t) names_offs);
+        put_u32(out, (uint32_t) m.name.size());
+        put_u32(out, (uint32_t) chunks_offs);
+        put_u32(out, (uint32_t) m.chunk.size());
+        put_u32(out, m.src_size);
+        put_u64(out, m.src_mtime);
+        put_u64(out, m.src_hash);
+        names_offs  += m.name.size();
+        chunks_offs += m.chunk.size();
+    }
+    for (auto &m : m_modules) out += m.name;
+    for (auto &m : m_modules) out += m.chunk;
+
+    ofstream f(path.c_str(), ios::out | ios::binary | ios::trunc);
+    f.write(out.data(), out.size());
+    f.close();
+    if (!f)
+        throw InstanceException("Can't write bundle " + path);
+}
+//---------------------------------------------------------------------------
+
+} // namespace Lua
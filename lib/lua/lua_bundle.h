@@ -0,0 +1,144 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#ifndef LALRT_LUA_BUNDLE_H
+#define LALRT_LUA_BUNDLE_H
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "lua_instance.h"
+
+namespace Lua
+{
+//---------------------------------------------------------------------------
+
+/* A bundle is a single file with the precompiled bytecode of many Lua
+ * modules, written by the lalrt_bundle tool (see lalrt_bundle.cpp).
+ * It is memory mapped once per process and shared by the Lua states of
+ * all processes. install() puts a searcher for it in front of the Lua
+ * file searcher in package.searchers, so require() finds the bundled
+ * modules without parsing them.
+ *
+ * Layout (all integers are 32 bit little endian):
+ *
+ *     magic      "LALRTB2\0"
+ *     vm tag     LUAC_VERSION, NUM_OPCODES, sizeof(lua_Integer),
+ *                sizeof(lua_Number) (one byte each)
+ *     count      number of modules
+ *     index      count * (name offset, name length,
+ *                         chunk offset, chunk length,
+ *                         source size, source mtime (64 bit),
+ *                         source hash (64 bit FNV-1a)), sorted by name
+ *     names, chunks
+ *
+ * The bytecode contains the superinstructions of this VM, so the vm tag
+ * is checked on open() and a bundle from another build is rejected.
+ *
+ * A bundled module is only used if the source file, that the file
+ * searcher would load instead (package.searchpath), is missing or still
+ * the one it was compiled from: same size and mtime, or if the mtime
+ * differs, same content. Otherwise require() falls back to the source.
+ * Each module is checked once per process. */
+class Bundle
+{
+    private:
+        std::string      m_path;
+        const char      *m_data;
+        size_t           m_size;
+        uint32_t         m_count;
+        // per module: 0 not checked yet, 1 source matches, 2 stale
+        std::unique_ptr<std::atomic<uint8_t>[]> m_checked;
+#if defined(_WIN32)
+        void            *m_file;
+        void            *m_mapping;
+#endif
+
+        explicit Bundle(const std::string &path);
+
+        uint32_t u32(size_t offs) const;
+        uint64_t u64(size_t offs) const;
+        const char *name(uint32_t i, size_t &len) const;
+        const char *chunk(uint32_t i, size_t &len) const;
+        /// Index of the module or -1.
+        int64_t lookup(const char *module) const;
+        /// Does the source that L would load for module i match?
+        bool source_matches(lua_State *L, uint32_t i, const char *module) const;
+
+        static int searcher(lua_State *L);
+
+    public:
+        ~Bundle();
+
+        /// Maps the bundle file at path. Throws InstanceException if it
+        /// can't be read, is damaged or was written by a different VM.
+        static std::shared_ptr<Bundle> open(const std::string &path);
+
+        /// Looks up the bytecode of a module ("lal.lang.compiler").
+        bool find(const char *module, const char *&chunk, size_t &len) const;
+
+        /// Inserts the searcher as second entry of package.searchers,
+        /// after the preload searcher. The bundle has to outlive L.
+        void install(lua_State *L);
+
+        const std::string &path() const  { return m_path; }
+        size_t             count() const { return m_count; }
+};
+//---------------------------------------------------------------------------
+
+/// Compiles Lua files and writes them into a bundle file.
+class BundleWriter
+{
+    private:
+        struct Module
+        {
+            std::string name;
+            std::string chunk;
+            uint32_t    src_size;
+            uint64_t    src_mtime;
+            uint64_t    src_hash;
+        };
+
+        lua_State            *m_L;
+        bool                  m_strip;
+        std::vector<Module>   m_modules;
+
+    public:
+        /// With strip the debug information (line numbers, local names)
+        /// is left out. Tracebacks and the profiler need it.
+        explicit BundleWriter(bool strip = false);
+        ~BundleWriter();
+
+        /// Compiles the file, its name ends up in the debug information.
+        /// Throws InstanceException on a syntax or I/O error.
+        void add(const std::string &module, const std::string &filename);
+        /// Throws InstanceException on a duplicate module or an I/O error.
+        void write(const std::string &path);
+
+        size_t count() const { return m_modules.size(); }
+};
+//---------------------------------------------------------------------------
+
+} // namespace Lua
+
+#endif // LALRT_LUA_BUNDLE_H
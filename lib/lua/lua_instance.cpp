@@ -22,14 +22,23 @@
 ******************************************************************************/
 
 #include "rt/log.h"
+#include "base/util.h"
+#include "base/vv_hashed.h"
 #include "lua_instance.h"
+#include "lua_profiler.h"
+#include "lua_bundle.h"
 #include "../../lua/src/lauxlib.h"
 #include "../../lua/src/lualib.h"
 #include "../../lua/src/lobject.h"
 #include "../../lua/src/lstate.h"
+#include "../../lua/src/lapi.h"
+#include "../../lua/src/lgc.h"
 #include "../../lua/src/lua_embed_helper.h"
 #include <iostream>
+#include <new>
 #include <sstream>
+#include <unordered_map>
+#include <vector>
 #include <boost/format.hpp>
 
 using namespace std;
@@ -140,6 +149,141 @@ VV call_lua_fun_on_stack(lua_State *L, const VV &vv_args,
 }
 //---------------------------------------------------------------------------
 
+/* The atoms (see base/atom.h) a Lua state has seen. The string of each
+ * atom is anchored in a table in the registry, so it is never collected
+ * and its address identifies the atom when it is read back from the state.
+ * The cache is found through the extra space of the lua_State, which
+ * coroutines inherit from the main thread. */
+struct AtomCache
+{
+    int                                         anchor_ref;
+    std::vector<TString *>                      by_id;
+    std::unordered_map<const char *, uint32_t>  by_str;
+
+    AtomCache(lua_State *L)
+    {
+        lua_newtable(L);
+        anchor_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        for (uint32_t id = 1; id < atom::PREDEFINED_END; id++)
+            anchor(L, id);
+    }
+
+    TString *anchor(lua_State *L, uint32_t id)
+    {
+        const std::string &s = atom::str(id);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, anchor_ref);
+        lua_pushlstring(L, s.data(), s.size());
+        TString *ts = tsvalue(L->top - 1);
+        lua_rawseti(L, -2, (lua_Integer) id);
+        lua_pop(L, 1);
+
+        if (by_id.size() <= id)
+            by_id.resize(id + 1, nullptr);
+        by_id[id] = ts;
+        by_str[getstr(ts)] = id;
+        return ts;
+    }
+};
+//---------------------------------------------------------------------------
+
+static AtomCache *atom_cache(lua_State *L)
+{
+    return *(AtomCache **) lua_getextraspace(L);
+}
+//---------------------------------------------------------------------------
+
+static bool push_atom(lua_State *L, uint32_t id)
+{
+    AtomCache *ac = atom_cache(L);
+    if (!ac || id == atom::NONE)
+        return false;
+
+    TString *ts = id < ac->by_id.size() ? ac->by_id[id] : nullptr;
+    if (!ts)
+        ts = ac->anchor(L, id);
+
+    setsvalue2s(L, L->top, ts);
+    api_incr_top(L);
+    return true;
+}
+//---------------------------------------------------------------------------
+
+/// Returns the atom id of the Lua string s (as returned by lua_tolstring)
+/// if the state has seen that atom already.
+static uint32_t lua_string_atom(lua_State *L, const char *s, size_t len)
+{
+    AtomCache *ac = atom_cache(L);
+    if (!ac || len > atom::MAX_LEN)
+        return atom::NONE;
+    auto it = ac->by_str.find(s);
+    return it != ac->by_str.end() ? it->second : atom::NONE;
+}
+//---------------------------------------------------------------------------
+
+/// If the string table key at index is an atom, that the state has not
+/// seen yet, adds it to the cache, so that the next message with the same
+/// key doesn't need to hash it anymore. Keys are never made atoms here,
+/// only the atoms declared by the runtime are used: data keys would fill
+/// the global table, which is never cleaned up.
+static void learn_key_atom(lua_State *L, int index)
+{
+    AtomCache *ac = atom_cache(L);
+    size_t len = 0;
+    const char *s = lua_tolstring(L, index, &len);
+    if (!ac || len > atom::MAX_LEN || ac->by_str.count(s))
+        return;
+
+    uint32_t id = atom::find(s, len);
+    if (id != atom::NONE)
+        ac->anchor(L, id);
+}
+//---------------------------------------------------------------------------
+
+static void push_key(lua_State *L, const std::string &key)
+{
+    if (!push_atom(L, atom::find(key)))
+        lua_pushlstring(L, key.data(), key.size());
+}
+//---------------------------------------------------------------------------
+
+/* Persistent values (see base/vv_persistent.h) go into Lua as full
+ * userdata, that holds a reference to the VV, instead of being copied
+ * into tables. Passing them on (to C++ or in messages to other threads)
+ * hands over the same immutable value. The hashed sets and maps of
+ * base/vv_hashed.h are passed the same way, as tables can't represent
+ * their keys. */
+static const char *VV_BOX_META = "VVal::VV";
+
+static int vv_box_gc(lua_State *L)
+{
+    VV *box = (VV *) luaL_checkudata(L, 1, VV_BOX_META);
+    box->~VV();
+    return 0;
+}
+//---------------------------------------------------------------------------
+
+static int vv_box_len(lua_State *L)
+{
+    VV *box = (VV *) luaL_checkudata(L, 1, VV_BOX_META);
+    lua_pushinteger(L, (*box)->size());
+    return 1;
+}
+//---------------------------------------------------------------------------
+
+static void push_vv_box(lua_State *L, const VV &vv)
+{
+    new (lua_newuserdata(L, sizeof(VV))) VV(vv);
+    if (luaL_newmetatable(L, VV_BOX_META))
+    {
+        lua_pushcfunction(L, vv_box_gc);
+        lua_setfield(L, -2, "__gc");
+        lua_pushcfunction(L, vv_box_len);
+        lua_setfield(L, -2, "__len");
+    }
+    lua_setmetatable(L, -2);
+}
+//---------------------------------------------------------------------------
+
 void push_vv_to_lua(lua_State *L, const VV &vv)
 {
     if      (vv->is_int()
@@ -148,8 +292,11 @@ void push_vv_to_lua(lua_State *L, const VV &vv)
     else if (vv->is_boolean())      lua_pushboolean(L, vv->b());
     else if (vv->is_string())
     {
-        string tmp = vv->s();
-        lua_pushlstring(L, tmp.data(), tmp.size());
+        if (!push_atom(L, vv->atom()))
+        {
+            string tmp = vv->s();
+            lua_pushlstring(L, tmp.data(), tmp.size());
+        }
     }
     else if (vv->is_bytes())
     {
@@ -172,14 +319,30 @@ void push_vv_to_lua(lua_State *L, const VV &vv)
             lua_setuservalue(L, -2);
         }
     }
+    else if (vv->is_persistent()
+             || vv->is_set()
+             || dynamic_cast<const HashMapValue *>(vv.get()))
+        push_vv_box(L, vv);
     else if (vv->is_map())
     {
         lua_createtable(L, 0, vv->size());
-        for (auto i : *vv)
+        if (const MapValue *mv = dynamic_cast<const MapValue *>(vv.get()))
         {
-            push_vv_to_lua(L, i->_(0));
-            push_vv_to_lua(L, i->_(1));
-            lua_rawset(L, -3);
+            for (auto &i : mv->entries())
+            {
+                push_key(L, i.first);
+                push_vv_to_lua(L, i.second);
+                lua_rawset(L, -3);
+            }
+        }
+        else
+        {
+            for (auto i : *vv)
+            {
+                push_vv_to_lua(L, i->_(0));
+                push_vv_to_lua(L, i->_(1));
+                lua_rawset(L, -3);
+            }
         }
     }
     else if (vv->is_list())
@@ -238,8 +401,11 @@ VV lua_to_vv(lua_State *L, int index)
             int            l = (int) lua_rawlen(L, index);
             if (l > 0 && cstr[0] == '\xFF')
                 return vv_bytes(std::string(cstr + 1, l - 1));
-            else
-                return vv(std::string(cstr, l));
+
+            uint32_t id = lua_string_atom(L, cstr, l);
+            if (id != atom::NONE)
+                return vv_atom(id);
+            return vv(std::string(cstr, l));
         }
         case LUA_TLIGHTUSERDATA:
         {
@@ -247,6 +413,9 @@ VV lua_to_vv(lua_State *L, int index)
         }
         case LUA_TUSERDATA:
         {
+            if (VV *box = (VV *) luaL_testudata(L, index, VV_BOX_META))
+                return *box;
+
             void **ptr = (void **) lua_touserdata(L, index);
 
             lua_getuservalue(L, index);
@@ -283,7 +452,11 @@ VV lua_to_vv(lua_State *L, int index)
                 if (lua_type(L, -1) == LUA_TNUMBER)
                     table_data->set((int32_t) lua_tonumber(L, -1) - 1, v);
                 else
+                {
+                    if (lua_type(L, -1) == LUA_TSTRING)
+                        learn_key_atom(L, -1);
                     table_data->set(lua_to_string(L, -1), v);
+                }
             }
             lua_pop(L, 1); // pop table
 
@@ -354,12 +527,16 @@ void Instance::init_output_interface()
 
 Instance::Instance() : m_L(luaL_newstate())
 {
+    m_atoms.reset(new AtomCache(m_L));
+    *(AtomCache **) lua_getextraspace(m_L) = m_atoms.get();
     luaL_openlibs(m_L);
 }
 //---------------------------------------------------------------------------
 
 Instance::~Instance()
 {
+    m_profiler.reset();
+
     if (m_L->embedOutput)
         delete m_L->embedOutput;
     if (m_L) lua_close(m_L);
@@ -369,6 +546,42 @@ Instance::~Instance()
 }
 //---------------------------------------------------------------------------
 
+Profiler &Instance::profiler()
+{
+    if (!m_profiler)
+        m_profiler.reset(new Profiler(m_L));
+    return *m_profiler;
+}
+//---------------------------------------------------------------------------
+
+void Instance::gc_configure(const VVal::VV &opts)
+{
+    std::string mode = strip_lal_kw(opts->_s("gc-mode"));
+    if (mode == "generational")
+        lua_gc(m_L, LUA_GCGEN, 0);
+    else if (mode == "incremental")
+        lua_gc(m_L, LUA_GCINC, 0);
+    else if (!mode.empty())
+        throw InstanceException("Unknown gc-mode: " + mode);
+
+    if (!opts->_("gc-pause")->is_undef())
+        lua_gc(m_L, LUA_GCSETPAUSE,     (int) opts->_i("gc-pause"));
+    if (!opts->_("gc-stepmul")->is_undef())
+        lua_gc(m_L, LUA_GCSETSTEPMUL,   (int) opts->_i("gc-stepmul"));
+    if (!opts->_("gc-minor-mul")->is_undef())
+        lua_gc(m_L, LUA_GCSETMINORMUL,  (int) opts->_i("gc-minor-mul"));
+    if (!opts->_("gc-major-mul")->is_undef())
+        lua_gc(m_L, LUA_GCSETMAJORMUL,  (int) opts->_i("gc-major-mul"));
+}
+//---------------------------------------------------------------------------
+
+void Instance::use_bundle(const std::shared_ptr<Bundle> &bundle)
+{
+    bundle->install(m_L);
+    m_bundle = bundle;
+}
+//---------------------------------------------------------------------------
+
 void Instance::error(const std::string &place, const std::string &error)
 {
     luaL_error(m_L, "Error in %s: %s\n", place.c_str(), error.c_str());
@@ -23,6 +23,7 @@
 
 #ifndef LALRT_LUA_INSTANCE_H
 #define LALRT_LUA_INSTANCE_H
+#include <memory>
 #include <mutex>
 #include <string>
 #include "base/vval.h"
@@ -57,10 +58,17 @@ class InstanceException : public std::exception
 };
 //---------------------------------------------------------------------------
 
+class Profiler;
+class Bundle;
+struct AtomCache;
+
 class Instance
 {
 	private:
 		std::list<VVal::VV *> m_leaking_refs;
+        std::unique_ptr<Profiler> m_profiler;
+        std::unique_ptr<AtomCache> m_atoms;
+        std::shared_ptr<Bundle>   m_bundle;
 
         VVal::VV eval(const std::string &lua_code, const VVal::VV &vv_args, bool is_file = false, std::string code_name = "");
 
@@ -81,6 +89,19 @@ class Instance
 
         VVal::VV get_lua_debug_info();
 
+        /// The sampling profiler of this instance, created on first use.
+        Profiler &profiler();
+
+        /// Applies the garbage collector settings in the map opts:
+        /// gc-mode (incremental: or generational:), gc-pause, gc-stepmul,
+        /// gc-minor-mul and gc-major-mul. Missing keys keep their defaults.
+        /// Throws InstanceException on an unknown mode.
+        void gc_configure(const VVal::VV &opts);
+
+        /// Lets require() look up modules in the precompiled bundle
+        /// before searching package.path. See lua_bundle.h.
+        void use_bundle(const std::shared_ptr<Bundle> &bundle);
+
         VVal::VV call(const char *csMethod, const VVal::VV &vv_args);
         VVal::VV eval_code(const std::string &lua_code, const std::string &name = "") { return this->eval(lua_code, VVal::VV(), false, name); }
         VVal::VV eval_file(const std::string &filename) { return this->eval(filename, VVal::VV(), true, filename); }
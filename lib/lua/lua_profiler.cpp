@@ -0,0 +1,306 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "lua_profiler.h"
+#include "../../lua/src/lauxlib.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+namespace Lua
+{
+//---------------------------------------------------------------------------
+
+static char s_registry_key;         // address used as registry key
+static const int MAX_DEPTH = 128;   // deeper stacks are cut at the root
+
+//---------------------------------------------------------------------------
+
+Profiler::Profiler(lua_State *L)
+    : m_L(L), m_stop(false), m_running(false), m_interval_us(10000),
+      m_samples(0)
+{
+    lua_pushlightuserdata(m_L, this);
+    lua_rawsetp(m_L, LUA_REGISTRYINDEX, &s_registry_key);
+}
+//---------------------------------------------------------------------------
+
+Profiler::~Profiler()
+{
+    stop();
+    lua_pushnil(m_L);
+    lua_rawsetp(m_L, LUA_REGISTRYINDEX, &s_registry_key);
+}
+//---------------------------------------------------------------------------
+
+void Profiler::start(int interval_us)
+{
+    stop();
+
+    m_stacks.clear();
+    m_samples     = 0;
+    m_interval_us = std::max(interval_us, 100);
+    m_stop        = false;
+    m_running     = true;
+
+    // Install the hook disarmed, the sampler thread only sets the mask.
+    // Don't replace a debugger's hook.
+    if (!lua_gethook(m_L))
+    {
+        lua_sethook(m_L, &Profiler::hook, LUA_MASKCOUNT, 1);
+        lua_sethookmask(m_L, &Profiler::hook, 0);
+    }
+
+    m_thread      = std::thread(&Profiler::sampler, this);
+}
+//---------------------------------------------------------------------------
+
+void Profiler::stop()
+{
+    if (!m_running)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+    m_running = false;
+
+    if (lua_gethook(m_L) == &Profiler::hook)
+        lua_sethook(m_L, nullptr, 0, 0);
+}
+//---------------------------------------------------------------------------
+
+void Profiler::sampler()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    auto next = std::chrono::steady_clock::now();
+    while (!m_stop)
+    {
+        next += std::chrono::microseconds(m_interval_us);
+        auto now = std::chrono::steady_clock::now();
+        if (next < now)
+            next = now; // don't burst after being descheduled
+
+        if (m_cond.wait_until(lock, next, [this]() { return m_stop; }))
+            break;
+
+        lua_sethookmask(m_L, &Profiler::hook, LUA_MASKCOUNT);
+    }
+}
+//---------------------------------------------------------------------------
+
+void Profiler::hook(lua_State *L, lua_Debug *)
+{
+    // One sample per arming. The hook stays installed with its count
+    // of 1, so arming it again only has to set the mask.
+    lua_sethookmask(L, &Profiler::hook, 0);
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &s_registry_key);
+    Profiler *self = (Profiler *) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    if (self && self->m_running)
+        self->sample(L);
+}
+//---------------------------------------------------------------------------
+
+void Profiler::sample(lua_State *L)
+{
+    lua_Debug ar;
+    std::vector<std::string> frames;
+
+    int level = 0;
+    for (; level < MAX_DEPTH && lua_getstack(L, level, &ar); level++)
+    {
+        lua_getinfo(L, "Sln", &ar);
+        frames.push_back(frame_name(ar));
+    }
+    if (level == MAX_DEPTH)
+        frames.push_back("...");
+
+    std::string stack;
+    for (auto it = frames.rbegin(); it != frames.rend(); it++)
+    {
+        if (!stack.empty()) stack += ';';
+        stack += *it;
+    }
+
+    m_stacks[stack]++;
+    m_samples++;
+}
+//---------------------------------------------------------------------------
+
+std::string Profiler::frame_name(lua_Debug &ar)
+{
+    std::string name;
+
+    if (*ar.what == 'C')
+    {
+        name = std::string("[C] ") + (ar.name ? ar.name : "?");
+    }
+    else
+    {
+        const SourceMap &sm = source_map(ar.source);
+        const std::string *file = nullptr;
+        int line = 0;
+
+        if (*ar.what == 'm')
+            name = "main chunk";
+        else if (ar.name)
+            name = ar.name;
+        else if (sm.map(ar.linedefined, file, line))
+            name = "function <" + *file + ":" + to_string(line) + ">";
+        else
+            name = std::string("function <") + ar.short_src + ":"
+                   + to_string(ar.linedefined) + ">";
+
+        if (sm.map(ar.currentline, file, line))
+            name += " (" + *file + ":" + to_string(line) + ")";
+        else
+            name += std::string(" (") + ar.short_src + ":"
+                    + to_string(ar.currentline) + ")";
+    }
+
+    // ';' separates the frames of folded stacks
+    std::replace(name.begin(), name.end(), ';', ',');
+    return name;
+}
+//---------------------------------------------------------------------------
+
+bool Profiler::SourceMap::map(int lua_line, const std::string *&file, int &lal_line) const
+{
+    if (lua_line <= 0 || lua_line >= (int) line_file.size())
+        return false;
+
+    int idx = line_file[lua_line];
+    if (idx < 0)
+        return false;
+
+    file     = &files[idx];
+    lal_line = line_lal[lua_line];
+    return true;
+}
+//---------------------------------------------------------------------------
+
+/* The source of a function is either "@filename", "=name" or the code
+ * itself (if a chunk was loaded without a name). The line map is built
+ * from the file or the code once and cached by the address of the
+ * source string, which is shared by all functions of a chunk. */
+const Profiler::SourceMap &Profiler::source_map(const char *source)
+{
+    const size_t PREFIX = 64;
+
+    auto it = m_sources.find(source);
+    if (it != m_sources.end()
+        && std::strncmp(it->second.source.c_str(), source, PREFIX) == 0)
+        return it->second;
+
+    if (m_sources.size() > 1024)
+        m_sources.clear();
+
+    SourceMap &sm = m_sources[source];
+    sm = SourceMap();
+    sm.source.assign(source, strnlen(source, PREFIX));
+
+    std::string text;
+    if (source[0] == '@')
+    {
+        std::ifstream in(source + 1, std::ios::binary);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        text = ss.str();
+    }
+    else if (source[0] != '=')
+        text = source;
+
+    // Lines of LAL output are preceded by --[[file.lal:N]] markers.
+    int cur_file = -1;
+    int cur_line = 0;
+    sm.line_file.push_back(-1); // Lua lines start at 1
+    sm.line_lal.push_back(0);
+
+    size_t pos = 0;
+    while (pos <= text.size())
+    {
+        size_t eol = text.find('\n', pos);
+        if (eol == std::string::npos) eol = text.size();
+
+        size_t m = text.find("--[[", pos);
+        while (m != std::string::npos && m < eol)
+        {
+            size_t close = text.find("]]", m + 4);
+            if (close == std::string::npos || close > eol)
+                break;
+
+            size_t colon = text.rfind(':', close);
+            if (colon != std::string::npos && colon > m + 4
+                && colon + 1 < close
+                && std::all_of(text.begin() + colon + 1, text.begin() + close,
+                               [](char c) { return c >= '0' && c <= '9'; }))
+            {
+                std::string file = text.substr(m + 4, colon - (m + 4));
+                auto f = std::find(sm.files.begin(), sm.files.end(), file);
+                cur_file = (int) (f - sm.files.begin());
+                if (f == sm.files.end())
+                    sm.files.push_back(file);
+                cur_line = std::atoi(text.c_str() + colon + 1);
+            }
+            m = text.find("--[[", close + 2);
+        }
+
+        sm.line_file.push_back(cur_file);
+        sm.line_lal.push_back(cur_line);
+        pos = eol + 1;
+    }
+
+    return sm;
+}
+//---------------------------------------------------------------------------
+
+std::string Profiler::folded() const
+{
+    std::vector<std::pair<std::string, uint64_t>> stacks(
+        m_stacks.begin(), m_stacks.end());
+    std::sort(stacks.begin(), stacks.end());
+
+    std::string out;
+    for (auto &s : stacks)
+    {
+        out += s.first;
+        out += ' ';
+        out += to_string(s.second);
+        out += '\n';
+    }
+    return out;
+}
+//---------------------------------------------------------------------------
+
+} // namespace Lua
@@ -0,0 +1,114 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#ifndef LALRT_LUA_PROFILER_H
+#define LALRT_LUA_PROFILER_H
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../../lua/src/lua.h"
+
+namespace Lua
+{
+//---------------------------------------------------------------------------
+
+/* Sampling profiler for the Lua state of an Instance.
+ *
+ * start() installs a count hook with a count of 1 but an empty mask,
+ * so the VM never calls it. A sampler thread wakes up every interval
+ * and only sets the mask with lua_sethookmask() (the way lua.c
+ * interrupts a script on SIGINT). The hook then fires before the next
+ * VM instruction, records the call stack and clears the mask again, so
+ * between samples the interpreter runs without any hook overhead.
+ * A hook that was installed before, e.g. by debug.sethook, is left
+ * alone and nothing is sampled.
+ *
+ * Stack frames are aggregated by function and current line. Lines of
+ * code generated by the LAL compiler are mapped back to the .lal file
+ * and line with the --[[file.lal:N]] markers the compiler writes.
+ * Time spent blocked in C functions (like mp-wait) is not sampled, the
+ * hook only fires when Lua code runs. Only the main Lua thread is
+ * armed, time spent in coroutines shows up in the sample taken when
+ * they yield back to it.
+ *
+ * start(), stop() and folded() must be called from the thread that
+ * runs the Lua state, the sampler thread touches nothing but the hook
+ * mask. */
+class Profiler
+{
+    private:
+        struct SourceMap
+        {
+            std::string               source;    // prefix, for validation
+            size_t                    len;
+            std::vector<std::string>  files;
+            std::vector<int>          line_file; // Lua line => index in files
+            std::vector<int>          line_lal;  // Lua line => .lal line
+
+            bool map(int lua_line, const std::string *&file, int &lal_line) const;
+        };
+
+        lua_State                       *m_L;
+
+        std::thread                      m_thread;
+        std::mutex                       m_mutex;
+        std::condition_variable          m_cond;
+        bool                             m_stop;
+        std::atomic<bool>                m_running;
+        int                              m_interval_us;
+
+        uint64_t                         m_samples;
+        std::unordered_map<std::string, uint64_t> m_stacks;
+        std::unordered_map<const void *, SourceMap> m_sources;
+
+        static void hook(lua_State *L, lua_Debug *ar);
+        void sampler();
+        void sample(lua_State *L);
+        const SourceMap &source_map(const char *source);
+        std::string frame_name(lua_Debug &ar);
+
+    public:
+        explicit Profiler(lua_State *L);
+        ~Profiler();
+
+        /// Discards old samples and starts sampling every interval_us
+        /// microseconds.
+        void start(int interval_us = 10000);
+        void stop();
+        bool running() const { return m_running; }
+
+        uint64_t samples() const { return m_samples; }
+
+        /// Returns the samples as folded stacks, one "root;...;leaf count"
+        /// line per distinct stack, as flamegraph.pl and speedscope read them.
+        std::string folded() const;
+};
+//---------------------------------------------------------------------------
+
+} // namespace Lua
+
+#endif // LALRT_LUA_PROFILER_H
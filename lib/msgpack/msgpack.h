@@ -23,7 +23,9 @@
 
 #ifndef QLMsgPackH
 #define QLMsgPackH 1
-#include "utf8buffer.h"
+#include "../base/utf8buffer.h"
+#include <cstring>
+#include <string>
 
 namespace msgpack
 {
@@ -35,7 +37,7 @@ class Serializer
         UTF8Buffer m_u8Buf;
 
     public:
-        void reset() { m_u8Buf.reset(); }
+        void reset() { m_u8Buf.clear(); }
 
 
         void nil() { m_u8Buf.append_byte((char) 0xc0); }
@@ -196,32 +198,86 @@ class Serializer
 
         void string(const std::string &s, bool bIsBinary = false)
         {
-            if (!bIsBinary && s.size() <= 0x1F)
+            string(s.data(), s.size(), bIsBinary);
+        }
+
+        void string(const char *data, size_t len, bool bIsBinary = false)
+        {
+            if (!bIsBinary && len <= 0x1F)
             {
-                m_u8Buf.append_byte((char) (0xa0 | (uint8_t) s.size()));
-                m_u8Buf.append_bytes(s.data(), s.size());
+                m_u8Buf.append_byte((char) (0xa0 | (uint8_t) len));
+                m_u8Buf.append_bytes(data, len);
             }
-            else if (s.size() <= 0xFF)
+            else if (len <= 0xFF)
             {
                 m_u8Buf.append_byte((char) (bIsBinary ? 0xc4 : 0xd9));
-                m_u8Buf.append_uint8((uint8_t) s.size());
-                m_u8Buf.append_bytes(s.data(), s.size());
+                m_u8Buf.append_uint8((uint8_t) len);
+                m_u8Buf.append_bytes(data, len);
             }
-            else if (s.size() <= 0xFFFF)
+            else if (len <= 0xFFFF)
             {
                 m_u8Buf.append_byte((char) (bIsBinary ? 0xc5 : 0xda));
-                m_u8Buf.append_uint16((uint16_t) s.size());
-                m_u8Buf.append_bytes(s.data(), s.size());
+                m_u8Buf.append_uint16((uint16_t) len);
+                m_u8Buf.append_bytes(data, len);
             }
             else
             {
                 m_u8Buf.append_byte((char) (bIsBinary ? 0xc6 : 0xdb));
-                m_u8Buf.append_uint32((uint32_t) s.size());
+                m_u8Buf.append_uint32((uint32_t) len);
                 // XXX: will trim string to 2^32 bytes:
-                m_u8Buf.append_bytes(s.data(), s.size());
+                m_u8Buf.append_bytes(data, len);
             }
         }
 
+        void ext(int8_t iType, const char *data, size_t len)
+        {
+            switch (len)
+            {
+                case 1:  m_u8Buf.append_byte((char) 0xd4); break;
+                case 2:  m_u8Buf.append_byte((char) 0xd5); break;
+                case 4:  m_u8Buf.append_byte((char) 0xd6); break;
+                case 8:  m_u8Buf.append_byte((char) 0xd7); break;
+                case 16: m_u8Buf.append_byte((char) 0xd8); break;
+                default:
+                    if (len <= 0xFF)
+                    {
+                        m_u8Buf.append_byte((char) 0xc7);
+                        m_u8Buf.append_uint8((uint8_t) len);
+                    }
+                    else if (len <= 0xFFFF)
+                    {
+                        m_u8Buf.append_byte((char) 0xc8);
+                        m_u8Buf.append_uint16((uint16_t) len);
+                    }
+                    else
+                    {
+                        m_u8Buf.append_byte((char) 0xc9);
+                        m_u8Buf.append_uint32((uint32_t) len);
+                    }
+            }
+            m_u8Buf.append_byte((char) iType);
+            m_u8Buf.append_bytes(data, len);
+        }
+
+        /// Writes the timestamp extension type (-1) with whole seconds.
+        void timestamp(int64_t iSecs)
+        {
+            if (iSecs >= 0 && iSecs <= (int64_t) UINT32_MAX)
+            {
+                m_u8Buf.append_byte((char) 0xd6);
+                m_u8Buf.append_byte((char) -1);
+                m_u8Buf.append_uint32((uint32_t) iSecs);
+                return;
+            }
+
+            // timestamp 96: 32 bit nanoseconds, 64 bit seconds
+            m_u8Buf.append_byte((char) 0xc7);
+            m_u8Buf.append_uint8(12);
+            m_u8Buf.append_byte((char) -1);
+            m_u8Buf.append_uint32(0);
+            m_u8Buf.append_uint64((uint64_t) iSecs);
+        }
+
         void array(uint32_t iElemCnt)
         {
             if (iElemCnt <= 0x0F)
@@ -258,13 +314,46 @@ class Serializer
 };
 //---------------------------------------------------------------------------
 
+/// Callback based msgpack decoder.
+///
+/// The input is walked as a plain (data, len) view with bounds checks.
+/// Strings, binaries and extension data are passed to the *View callbacks
+/// as pointers into the input, so a subclass can use them without copying.
+/// By default they are forwarded to onValueString()/onValueExt() as
+/// std::string.
 class Deserializer
 {
     private:
         UTF8Buffer *m_u8Buf;
+        const char *m_pBegin;
+        const char *m_pPos;
+        const char *m_pEnd;
+        int         m_iDepth;
+
+        static const int MAX_DEPTH = 1000;
+
+        bool fail(const char *csError)
+        {
+            this->onError(m_u8Buf, csError);
+            return false;
+        }
+
+        bool readBE(int iBytes, uint64_t &iOut, const char *csError)
+        {
+            if (m_pEnd - m_pPos < iBytes)
+                return this->fail(csError);
+
+            iOut = 0;
+            for (int i = 0; i < iBytes; i++)
+                iOut = (iOut << 8) | (unsigned char) m_pPos[i];
+            m_pPos += iBytes;
+            return true;
+        }
 
     public:
-        Deserializer() : m_u8Buf(0) { }
+        Deserializer()
+            : m_u8Buf(0), m_pBegin(0), m_pPos(0), m_pEnd(0), m_iDepth(0)
+        { }
         virtual ~Deserializer() { }
 
         virtual void onValueBoolean(bool bValue)    { (void) bValue; }
@@ -273,6 +362,14 @@ class Deserializer
         virtual void onValueUInt(uint64_t uiNum)    { (void) uiNum; }
         virtual void onValueInt(int64_t iNum)       { (void) iNum; }
         virtual void onValueString(const std::string &sString, bool bIsBinary) { (void) sString; (void) bIsBinary; }
+        /// Extension types are reported as nil, unless this is overridden.
+        virtual void onValueExt(int8_t iType, const std::string &sData) { (void) iType; (void) sData; this->onValueNil(); }
+
+        /// data points into the input and is only valid during the call.
+        virtual void onValueStringView(const char *data, size_t len, bool bIsBinary)
+        { this->onValueString(std::string(data, len), bIsBinary); }
+        virtual void onValueExtView(int8_t iType, const char *data, size_t len)
+        { this->onValueExt(iType, std::string(data, len)); }
 
         virtual void onObjectStart(unsigned int iElemCnt) { (void) iElemCnt; }
         virtual void onObjectEnd()                        { }
@@ -280,89 +377,49 @@ class Deserializer
         virtual void onArrayStart(unsigned int iElemCnt)  { (void) iElemCnt; }
         virtual void onArrayEnd()                         { }
 
+        /// u8Buf is only set if the UTF8Buffer variant of parse() is used.
         virtual void onError(UTF8Buffer *u8Buf, const char *csError) { (void) u8Buf; (void) csError; }
 
+        /// Offset of the current read position in the input.
+        size_t offset() const { return (size_t) (m_pPos - m_pBegin); }
+
+    private:
         bool parseFloat(bool bIsDouble)
         {
-            m_u8Buf->skip_bytes(1);
+            m_pPos++;
+            uint64_t i = 0;
             if (bIsDouble)
             {
-                double d = 0.0;
-                if (!m_u8Buf->read_double(d))
-                {
-                    this->onError(m_u8Buf, "EOF while reading double");
-                    return false;
-                }
+                if (!this->readBE(8, i, "EOF while reading double")) return false;
+                double d;
+                std::memcpy(&d, &i, 8);
                 this->onValueFloat(d, true);
-                return true;
             }
             else
             {
-                float f = 0.0;
-                if (!m_u8Buf->read_float(f))
-                {
-                    this->onError(m_u8Buf, "EOF while reading float");
-                    return false;
-                }
+                if (!this->readBE(4, i, "EOF while reading float")) return false;
+                uint32_t i32 = (uint32_t) i;
+                float f;
+                std::memcpy(&f, &i32, 4);
                 this->onValueFloat((double) f, false);
-                return true;
             }
+            return true;
         }
 
         bool parseLength(int iLenBytes, uint64_t &iLen, uint8_t iLen0Mask = 0xFF)
         {
+            uint8_t c = (uint8_t) *m_pPos++;
             if (iLenBytes == 0)
             {
-                uint8_t i = m_u8Buf->first_byte(true);
-                iLen = i & ~iLen0Mask;
-            }
-            else if (iLenBytes == 1)
-            {
-                m_u8Buf->skip_bytes(1);
-                uint8_t i;
-                if (!m_u8Buf->read_uint8(i))
-                {
-                    this->onError(m_u8Buf, "EOF while reading uint8");
-                    return false;
-                }
-
-                iLen = i;
-            }
-            else if (iLenBytes == 2)
-            {
-                m_u8Buf->skip_bytes(1);
-                uint16_t i;
-                if (!m_u8Buf->read_uint16(i))
-                {
-                    this->onError(m_u8Buf, "EOF while reading uint16");
-                    return false;
-                }
-
-                iLen = i;
-            }
-            else if (iLenBytes == 4)
-            {
-                m_u8Buf->skip_bytes(1);
-                uint32_t i;
-                if (!m_u8Buf->read_uint32(i))
-                {
-                    this->onError(m_u8Buf, "EOF while reading uint32");
-                    return false;
-                }
-
-                iLen = i;
-            }
-            else if (iLenBytes == 8)
-            {
-                m_u8Buf->skip_bytes(1);
-                if (!m_u8Buf->read_uint64(iLen))
-                {
-                    this->onError(m_u8Buf, "EOF while reading uint64");
-                    return false;
-                }
+                iLen = c & ~iLen0Mask;
+                return true;
             }
 
-            return true;
+            static const char *csErrors[] = {
+                "", "EOF while reading uint8", "EOF while reading uint16", "",
+                "EOF while reading uint32", "", "", "", "EOF while reading uint64"
+            };
+            return this->readBE(iLenBytes, iLen, csErrors[iLenBytes]);
         }
 
         bool parseUInt(int iLenBytes)
@@ -375,71 +432,28 @@ class Deserializer
 
         bool parseInt(int iLenBytes)
         {
-            uint64_t iOut = 0;
-
-            if (iLenBytes == 1)
-            {
-                m_u8Buf->skip_bytes(1);
-                uint8_t i;
-                if (!m_u8Buf->read_uint8(i))
-                {
-                    this->onError(m_u8Buf, "EOF while reading int8");
-                    return false;
-                }
-
-                iOut = (int8_t) i;
-            }
-            else if (iLenBytes == 2)
-            {
-                m_u8Buf->skip_bytes(1);
-                uint16_t i;
-                if (!m_u8Buf->read_uint16(i))
-                {
-                    this->onError(m_u8Buf, "EOF while reading int16");
-                    return false;
-                }
-
-                iOut = (int16_t) i;
-            }
-            else if (iLenBytes == 4)
-            {
-                m_u8Buf->skip_bytes(1);
-                uint32_t i;
-                if (!m_u8Buf->read_uint32(i))
-                {
-                    this->onError(m_u8Buf, "EOF while reading int32");
-                    return false;
-                }
+            m_pPos++;
+            uint64_t i = 0;
+            if (!this->readBE(iLenBytes, i, "EOF while reading int")) return false;
 
-                iOut = (int32_t) i;
-            }
-            else if (iLenBytes == 8)
+            switch (iLenBytes)
             {
-                m_u8Buf->skip_bytes(1);
-                if (!m_u8Buf->read_uint64(iOut))
-                {
-                    this->onError(m_u8Buf, "EOF while reading int64");
-                    return false;
-                }
+                case 1:  this->onValueInt((int8_t)  i); break;
+                case 2:  this->onValueInt((int16_t) i); break;
+                case 4:  this->onValueInt((int32_t) i); break;
+                default: this->onValueInt((int64_t) i); break;
             }
-
-            this->onValueInt(iOut);
             return true;
         }
 
         bool parseFixInt(bool bIsNegative)
         {
-            uint8_t i = m_u8Buf->first_byte(true);
+            uint8_t i = (uint8_t) *m_pPos++;
             if (bIsNegative)
-            {
                 this->onValueInt((int8_t) i);
-                return true;
-            }
             else
-            {
                 this->onValueUInt(i);
-                return true;
-            }
+            return true;
         }
 
         bool parseString(int iLenBytes, bool bIsBinary)
@@ -447,44 +461,38 @@ class Deserializer
             uint64_t iLen = 0;
             if (!this->parseLength(iLenBytes, iLen, 0xa0)) return false;
 
-            if (m_u8Buf->length() < iLen)
-            {
-                this->onError(m_u8Buf, "EOF while reading string");
-                return false;
-            }
-
-            std::string s(m_u8Buf->buffer(), iLen);
-            this->onValueString(s, bIsBinary);
-            m_u8Buf->skip_bytes(iLen);
+            if ((uint64_t) (m_pEnd - m_pPos) < iLen)
+                return this->fail("EOF while reading string");
 
+            const char *p = m_pPos;
+            m_pPos += iLen;
+            this->onValueStringView(p, (size_t) iLen, bIsBinary);
             return true;
         }
 
-        bool skipFixExt(int iLen)
+        bool parseExtData(uint64_t iLen)
         {
-            m_u8Buf->skip_bytes(iLen + 1);
+            if ((uint64_t) (m_pEnd - m_pPos) < iLen + 1) // + 1 type byte
+                return this->fail("EOF while reading ext");
 
-            this->onValueNil();
+            int8_t iType = (int8_t) *m_pPos;
+            const char *p = m_pPos + 1;
+            m_pPos += iLen + 1;
+            this->onValueExtView(iType, p, (size_t) iLen);
             return true;
         }
 
-        bool skipExt(int iLenBytes)
+        bool parseFixExt(int iLen)
+        {
+            m_pPos++;
+            return this->parseExtData((uint64_t) iLen);
+        }
+
+        bool parseExt(int iLenBytes)
         {
             uint64_t iLen = 0;
             if (!this->parseLength(iLenBytes, iLen)) return false;
-
-            iLen++; // + 1 type byte
-
-            if (m_u8Buf->length() < iLen)
-            {
-                this->onError(m_u8Buf, "EOF while reading string");
-                return false;
-            }
-
-            m_u8Buf->skip_bytes(iLen);
-
-            this->onValueNil();
-            return true;
+            return this->parseExtData(iLen);
         }
 
         bool parseArray(int iLenBytes)
@@ -492,16 +500,17 @@ class Deserializer
             uint64_t iLen = 0;
             if (!this->parseLength(iLenBytes, iLen, 0x90)) return false;
 
+            if (++m_iDepth > MAX_DEPTH)
+                return this->fail("Nesting too deep.");
+
             this->onArrayStart((unsigned int) iLen);
             for (uint64_t i = 0; i < iLen; i++)
             {
-                if (!this->parse(0))
-                {
-                    this->onError(m_u8Buf, "Couldn't parse array element.");
-                    return false;
-                }
+                if (!this->parseValue())
+                    return this->fail("Couldn't parse array element.");
             }
             this->onArrayEnd();
+            m_iDepth--;
             return true;
         }
 
@@ -510,45 +519,40 @@ class Deserializer
             uint64_t iLen = 0;
             if (!this->parseLength(iLenBytes, iLen, 0x80)) return false;
 
+            if (++m_iDepth > MAX_DEPTH)
+                return this->fail("Nesting too deep.");
+
             this->onObjectStart((unsigned int) iLen);
             for (uint64_t i = 0; i < iLen; i++)
             {
-                if (!this->parse(0))
-                {
-                    this->onError(m_u8Buf, "Couldn't parse object key.");
-                    return false;
-                }
+                if (!this->parseValue())
+                    return this->fail("Couldn't parse object key.");
 
-                if (!this->parse(0))
-                {
-                    this->onError(m_u8Buf, "Couldn't parse object value.");
-                    return false;
-                }
+                if (!this->parseValue())
+                    return this->fail("Couldn't parse object value.");
             }
             this->onObjectEnd();
+            m_iDepth--;
             return true;
         }
 
-        bool parse(UTF8Buffer *u8Buf)
+        bool parseValue()
         {
-            if (u8Buf)
-                m_u8Buf = u8Buf;
+            if (m_pPos >= m_pEnd)
+                return this->fail("EOF while reading value");
 
-            if (!m_u8Buf)
-                return false;
-
-            unsigned char c = m_u8Buf->first_byte();
+            unsigned char c = (unsigned char) *m_pPos;
             switch (c)
             {
-                case 0xc0: m_u8Buf->skip_bytes(1); this->onValueNil();          return true;
-                case 0xc2: m_u8Buf->skip_bytes(1); this->onValueBoolean(false); return true;
-                case 0xc3: m_u8Buf->skip_bytes(1); this->onValueBoolean(true);  return true;
+                case 0xc0: m_pPos++; this->onValueNil();          return true;
+                case 0xc2: m_pPos++; this->onValueBoolean(false); return true;
+                case 0xc3: m_pPos++; this->onValueBoolean(true);  return true;
                 case 0xc4: return this->parseString(1, true);
                 case 0xc5: return this->parseString(2, true);
                 case 0xc6: return this->parseString(4, true);
-                case 0xc7: return this->skipExt(1);
-                case 0xc8: return this->skipExt(2);
-                case 0xc9: return this->skipExt(4);
+                case 0xc7: return this->parseExt(1);
+                case 0xc8: return this->parseExt(2);
+                case 0xc9: return this->parseExt(4);
                 case 0xca: return this->parseFloat(false);
                 case 0xcb: return this->parseFloat(true);
                 case 0xcc: return this->parseUInt(1);
@@ -559,11 +563,11 @@ class Deserializer
                 case 0xd1: return this->parseInt(2);
                 case 0xd2: return this->parseInt(4);
                 case 0xd3: return this->parseInt(8);
-                case 0xd4: return this->skipFixExt(1);
-                case 0xd5: return this->skipFixExt(2);
-                case 0xd6: return this->skipFixExt(4);
-                case 0xd7: return this->skipFixExt(8);
-                case 0xd8: return this->skipFixExt(16);
+                case 0xd4: return this->parseFixExt(1);
+                case 0xd5: return this->parseFixExt(2);
+                case 0xd6: return this->parseFixExt(4);
+                case 0xd7: return this->parseFixExt(8);
+                case 0xd8: return this->parseFixExt(16);
                 case 0xda: return this->parseString(2, false);
                 case 0xd9: return this->parseString(1, false);
                 case 0xdb: return this->parseString(4, false);
@@ -579,10 +583,44 @@ class Deserializer
             else if (c >= 0xa0 && c <= 0xbf) return this->parseString(0, false);
             else if (c >= 0xe0)              return this->parseFixInt(true);
             else
-            {
-                this->onError(m_u8Buf, "invalid format specifier found");
+                return this->fail("invalid format specifier found");
+        }
+
+        bool run(const char *data, size_t len, size_t &iConsumed)
+        {
+            m_pBegin = m_pPos = data;
+            m_pEnd   = data + len;
+            m_iDepth = 0;
+
+            bool bOk = this->parseValue();
+            iConsumed = bOk ? this->offset() : 0;
+            return bOk;
+        }
+
+    public:
+        /// Decodes one value from [data, data + len). On success
+        /// iConsumed is set to the number of bytes it took.
+        bool parse(const char *data, size_t len, size_t &iConsumed)
+        {
+            m_u8Buf = 0;
+            return this->run(data, len, iConsumed);
+        }
+
+        /// Decodes one value from the start of u8Buf and removes it
+        /// from the buffer. If u8Buf is null, the last buffer is used again.
+        bool parse(UTF8Buffer *u8Buf)
+        {
+            if (u8Buf)
+                m_u8Buf = u8Buf;
+
+            if (!m_u8Buf)
                 return false;
-            }
+
+            size_t iConsumed = 0;
+            bool bOk = this->run(m_u8Buf->buffer(), m_u8Buf->length(), iConsumed);
+            if (bOk)
+                m_u8Buf->skip_bytes(iConsumed);
+            return bOk;
         }
 };
 //---------------------------------------------------------------------------
@@ -24,7 +24,8 @@
 #ifndef PROTO_FRAMING_H
 #define PROTO_FRAMING_H
 
-#include "utf8buffer.h"
+#include "../base/utf8buffer.h"
+#include <string>
 
 namespace msgpack
 {
@@ -32,17 +33,98 @@ namespace msgpack
 class ProtoFraming
 {
     private:
-        UTF8Buffer m_u8RecvBuffer;
+        // Received bytes that don't form a complete packet yet. Packets
+        // in bigger chunks are passed on in place, without a copy.
+        UTF8Buffer  m_u8Partial;
         UTF8Buffer *m_u8SendBuffer;
 
+        // The length prefix comes from the peer, so the size of a
+        // packet and of the unsent data are limited.
+        size_t      m_iMaxPacketLen;
+        size_t      m_iMaxSendBuffer;
+        bool        m_bFailed;
+
+        static const size_t HEADER_LEN      = 6;
+        // Chunks up to this size are appended to m_u8Partial as a whole
+        static const size_t SMALL_CHUNK_LEN = 256;
+
+        // header: 32 bit length, 16 bit type, both big endian
+        static void decode_header(const char *csHeader,
+                                  uint32_t &iPktLen, uint16_t &iPktType)
+        {
+            const unsigned char *h = (const unsigned char *) csHeader;
+            iPktLen  =   ((uint32_t) h[0] << 24) | ((uint32_t) h[1] << 16)
+                       | ((uint32_t) h[2] << 8)  |  (uint32_t) h[3];
+            iPktType = (uint16_t) ((h[4] << 8) | h[5]);
+        }
+
+        /// Marks the stream as broken after a packet exceeded the limit.
+        void fail(uint32_t iPktLen)
+        {
+            m_bFailed = true;
+            m_u8Partial.reset();
+            this->handle_frame_error(
+                "packet of " + std::to_string(iPktLen)
+                + " bytes exceeds limit of "
+                + std::to_string(m_iMaxPacketLen));
+        }
+
+        /// Passes all complete packets in [csData, csData + iLen) to
+        /// handle_recv_msg() and returns the number of bytes used.
+        size_t dispatch_direct(const char *csData, size_t iLen)
+        {
+            size_t iPos = 0;
+            while (iLen - iPos >= HEADER_LEN)
+            {
+                uint32_t iPktLen;
+                uint16_t iPktType;
+                decode_header(csData + iPos, iPktLen, iPktType);
+
+                if ((size_t) iPktLen > m_iMaxPacketLen)
+                {
+                    fail(iPktLen);
+                    return iLen;
+                }
+
+                if (iLen - iPos - HEADER_LEN < (size_t) iPktLen)
+                    break;
+
+                this->handle_recv_msg(csData + iPos + HEADER_LEN,
+                                      iPktLen, iPktType);
+                iPos += HEADER_LEN + iPktLen;
+            }
+            return iPos;
+        }
+
     public:
+        static const size_t DEFAULT_MAX_PACKET_LEN  = 16 * 1024 * 1024;
+        static const size_t DEFAULT_MAX_SEND_BUFFER = 64 * 1024 * 1024;
+
         ProtoFraming(UTF8Buffer *u8SendBuffer = 0)
-            : m_u8SendBuffer(u8SendBuffer)
+            : m_u8SendBuffer(u8SendBuffer),
+              m_iMaxPacketLen(DEFAULT_MAX_PACKET_LEN),
+              m_iMaxSendBuffer(DEFAULT_MAX_SEND_BUFFER),
+              m_bFailed(false)
         { }
         virtual ~ProtoFraming() { }
 
-        void send_msg(const char *csData, size_t iLen, uint16_t iType)
+        /// Largest packet payload that is sent or accepted.
+        void set_max_packet_len(size_t iLen) { m_iMaxPacketLen = iLen; }
+        /// Largest amount of framed data in the send buffer.
+        void set_max_send_buffer(size_t iLen) { m_iMaxSendBuffer = iLen; }
+
+        /// True after a received packet exceeded the size limit,
+        /// all further received data is ignored.
+        bool failed() const { return m_bFailed; }
+
+        /// Frames a packet into the send buffer. Returns false and
+        /// sends nothing if the packet or the send buffer would
+        /// exceed their limits.
+        bool send_msg(const char *csData, size_t iLen, uint16_t iType)
         {
+            if (iLen > m_iMaxPacketLen)
+                return false;
+
             if (!m_u8SendBuffer)
             {
                 UTF8Buffer u8Tmp;
@@ -50,41 +132,89 @@ class ProtoFraming
                 u8Tmp.append_uint16(iType);
                 u8Tmp.append_bytes(csData, iLen);
                 this->handle_recv(u8Tmp.buffer(), u8Tmp.length());
-                return;
+                return true;
             }
 
+            if (m_u8SendBuffer->length() + HEADER_LEN + iLen > m_iMaxSendBuffer)
+                return false;
+
             m_u8SendBuffer->append_uint32((uint32_t) iLen);
             m_u8SendBuffer->append_uint16(iType);
             m_u8SendBuffer->append_bytes(csData, iLen);
+            return true;
         }
 
+        /// Feeds received bytes. Complete packets are passed to
+        /// handle_recv_msg(), the data pointer is only valid during
+        /// that call.
         void handle_recv(const char *csData, size_t iLen)
         {
-            m_u8RecvBuffer.append_bytes(csData, iLen);
+            if (m_bFailed)
+                return;
 
-            uint32_t iPktLen = 0;
-            uint16_t iPktType = 0;
-            bool bCompletedPacket = true;
+            if (m_u8Partial.length() > 0 && iLen <= SMALL_CHUNK_LEN)
+            {
+                // Splitting a small chunk between the partial packet
+                // and the direct path costs more than copying it. The
+                // buffer only moves its unread rest to the front when
+                // that gains at least as much space as is moved.
+                m_u8Partial.append_bytes(csData, iLen);
+                size_t iUsed = dispatch_direct(m_u8Partial.buffer(),
+                                               m_u8Partial.length());
+                if (!m_bFailed)
+                    m_u8Partial.skip_bytes(iUsed);
+                return;
+            }
 
-            while (bCompletedPacket)
+            // First complete the packet left over from the last chunk,
+            // copying only the bytes that belong to it.
+            if (m_u8Partial.length() > 0)
             {
-                bCompletedPacket = false;
-                if (!m_u8RecvBuffer.read_uint32(iPktLen, false))
+                if (m_u8Partial.length() < HEADER_LEN)
+                {
+                    size_t iTake = HEADER_LEN - m_u8Partial.length();
+                    if (iTake > iLen) iTake = iLen;
+                    m_u8Partial.append_bytes(csData, iTake);
+                    csData += iTake;
+                    iLen   -= iTake;
+
+                    if (m_u8Partial.length() < HEADER_LEN)
+                        return;
+                }
+
+                uint32_t iPktLen;
+                uint16_t iPktType;
+                decode_header(m_u8Partial.buffer(), iPktLen, iPktType);
+
+                if ((size_t) iPktLen > m_iMaxPacketLen)
+                {
+                    fail(iPktLen);
                     return;
+                }
 
-                if (!m_u8RecvBuffer.read_uint16(iPktType, false))
-                    return;
+                size_t iNeed = HEADER_LEN + iPktLen - m_u8Partial.length();
+                size_t iTake = iNeed < iLen ? iNeed : iLen;
+                m_u8Partial.append_bytes(csData, iTake);
+                csData += iTake;
+                iLen   -= iTake;
 
-                if (m_u8RecvBuffer.length () < iPktLen)
+                if (iTake < iNeed)
                     return;
 
-                m_u8RecvBuffer.skip_bytes(6);
-                this->handle_recv_msg(m_u8RecvBuffer.buffer(), iPktLen, iPktType);
-                m_u8RecvBuffer.skip_bytes(iPktLen);
-                bCompletedPacket = true;
+                this->handle_recv_msg(m_u8Partial.buffer() + HEADER_LEN,
+                                      iPktLen, iPktType);
+                m_u8Partial.clear();
             }
+
+            size_t iUsed = dispatch_direct(csData, iLen);
+            if (m_bFailed)
+                return;
+            m_u8Partial.append_bytes(csData + iUsed, iLen - iUsed);
         }
 
+        /// Number of received bytes that don't form a complete packet yet.
+        size_t buffered() const { return m_u8Partial.length(); }
+
         virtual void handle_recv_msg(const char *csPacketData, size_t iLen, uint16_t iType)
         {
             (void) csPacketData;
@@ -92,6 +222,14 @@ class ProtoFraming
             (void) iType;
             // subclass!
         }
+
+        /// Called once when a received packet exceeds the size limit.
+        /// The stream can't be resynchronized, the connection should
+        /// be closed.
+        virtual void handle_frame_error(const std::string &sError)
+        {
+            (void) sError;
+        }
 };
 
 } // namespace msgpack
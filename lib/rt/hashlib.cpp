@@ -0,0 +1,374 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+
+#include "rt/hashlib.h"
+#include "rt/lua_thread.h"
+#include "rt/lua_thread_helper.h"
+#include "base/vv_hashed.h"
+
+using namespace VVal;
+using namespace std;
+
+namespace lal_rt
+{
+//---------------------------------------------------------------------------
+
+static HashSetValue *as_hset(const VV &v)
+{
+    return dynamic_cast<HashSetValue *>(v.get());
+}
+//---------------------------------------------------------------------------
+
+static HashMapValue *as_hmap(const VV &v)
+{
+    return dynamic_cast<HashMapValue *>(v.get());
+}
+//---------------------------------------------------------------------------
+
+static void not_a_collection(const char *func, const VV &v)
+{
+    throw LuaThreadException(
+        string(func) + ": expected a hash set or hash map, got: " + v->s());
+}
+//---------------------------------------------------------------------------
+
+static void expect_list(const char *func, const VV &v)
+{
+    if (!v->is_list())
+        throw LuaThreadException(
+            string(func) + ": expected a list, got: " + v->s());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_set,
+"@hash procedure (hash-set)\n"
+"@hash procedure (hash-set _list_)\n\n"
+"Returns a new hash set with the elements of _list_.\n"
+"Unlike the keys of maps, the elements of a hash set can be any value.\n"
+"They are compared by contents: `[1 \"a\"]` is equal to every other list\n"
+"with the same elements, and `1` is equal to `1.0`.\n"
+"Hash sets and maps are passed as reference and are mutable, they should\n"
+"not be sent to other processes. Use `hash-to-data` for that.\n"
+"\n"
+"    (let ((s (hash-set [[1 2] [1 2] [2 1]])))\n"
+"      (hash-count s))\n"
+"    ;=> 2\n"
+)
+{
+    HashSetValue *s = new HashSetValue;
+    VV ret(s);
+    VV data = vv_args->_(0);
+    if (data->is_undef())
+        return ret;
+    expect_list("hash-set", data);
+    for (auto e : *data)
+        s->add(e);
+    return ret;
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_map,
+"@hash procedure (hash-map)\n"
+"@hash procedure (hash-map _pairs_)\n\n"
+"Returns a new hash map. It is filled with the entries of _pairs_,\n"
+"which is either a map or a list of `[key value]` pairs.\n"
+"Keys can be any value, see `hash-set`.\n"
+"\n"
+"    (hash-get (hash-map [[[1 :a] 10] [[2 :b] 20]]) [2 :b])\n"
+"    ;=> 20\n"
+)
+{
+    HashMapValue *m = new HashMapValue;
+    VV ret(m);
+    VV data = vv_args->_(0);
+    if (data->is_undef())
+        return ret;
+    if (!data->is_map() && !data->is_list())
+        throw LuaThreadException("hash-map: expected a map or list, got: " + data->s());
+    for (auto pair : *data)
+        m->put(pair->_(0), pair->_(1));
+    return ret;
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_add_M,
+"@hash procedure (hash-add! _hset_ _value_)\n\n"
+"Adds _value_ to _hset_. Returns `#true` if it was not in the set before.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (HashSetValue *s = as_hset(coll))
+        return vv_bool(s->add(vv_args->_(1)));
+    throw LuaThreadException("hash-add!: expected a hash set, got: " + coll->s());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_put_M,
+"@hash procedure (hash-put! _hmap_ _key_ _value_)\n\n"
+"Sets _key_ in _hmap_ to _value_ and returns _hmap_.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (HashMapValue *m = as_hmap(coll))
+    {
+        m->put(vv_args->_(1), vv_args->_(2));
+        return coll;
+    }
+    throw LuaThreadException("hash-put!: expected a hash map, got: " + coll->s());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_get,
+"@hash procedure (hash-get _hmap_ _key_)\n"
+"@hash procedure (hash-get _hmap_ _key_ _default_)\n\n"
+"Returns the value for _key_ in _hmap_, or _default_ if there is none.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (HashMapValue *m = as_hmap(coll))
+    {
+        const VV *v = m->find(vv_args->_(1));
+        return v ? *v : vv_args->_(2);
+    }
+    throw LuaThreadException("hash-get: expected a hash map, got: " + coll->s());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_contains_Q,
+"@hash procedure (hash-contains? _coll_ _key_)\n\n"
+"Returns `#true` if the hash set _coll_ has the element _key_, or if the\n"
+"hash map _coll_ has the key _key_.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (HashSetValue *s = as_hset(coll))
+        return vv_bool(s->contains(vv_args->_(1)));
+    if (HashMapValue *m = as_hmap(coll))
+        return vv_bool(m->find(vv_args->_(1)) != nullptr);
+    not_a_collection("hash-contains?", coll);
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_remove_M,
+"@hash procedure (hash-remove! _coll_ _key_)\n\n"
+"Removes the element or key _key_ from the hash set or map _coll_.\n"
+"Returns `#true` if it was there. The last entry takes the place of\n"
+"the removed one in the iteration order.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (HashSetValue *s = as_hset(coll))
+        return vv_bool(s->remove(vv_args->_(1)));
+    if (HashMapValue *m = as_hmap(coll))
+        return vv_bool(m->remove(vv_args->_(1)));
+    not_a_collection("hash-remove!", coll);
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_count,
+"@hash procedure (hash-count _coll_)\n\n"
+"Returns the number of entries in the hash set or map _coll_.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (!as_hset(coll) && !as_hmap(coll))
+        not_a_collection("hash-count", coll);
+    return vv((int64_t) coll->size());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_to_data,
+"@hash procedure (hash-to-data _coll_)\n\n"
+"Returns the elements of the hash set _coll_ as list, or the entries of\n"
+"the hash map _coll_ as list of `[key value]` pairs. Both in the order\n"
+"they were added.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (HashSetValue *s = as_hset(coll))
+    {
+        VV out(vv_list());
+        for (auto &e : s->items())
+            out->push(e);
+        return out;
+    }
+    if (as_hmap(coll))
+    {
+        VV out(vv_list());
+        for (auto pair : *coll)
+            out->push(pair);
+        return out;
+    }
+    not_a_collection("hash-to-data", coll);
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_code,
+"@hash procedure (hash-code _value_)\n\n"
+"Returns an integer hash of the contents of _value_. Values, that are\n"
+"equal by `hash-equal?`, have the same hash code. The hash codes are\n"
+"not stable between program runs or versions.\n"
+)
+{
+    return vv((int64_t) vv_hash(vv_args->_(0)));
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_equal_Q,
+"@hash procedure (hash-equal? _a_ _b_)\n\n"
+"Returns `#true` if _a_ and _b_ have equal contents: Lists and maps are\n"
+"compared element by element, numbers by their value.\n"
+"\n"
+"    (hash-equal? { :a [1 2] } { :a [1.0 2] })\n"
+"    ;=> #true\n"
+)
+{
+    return vv_bool(vv_equals(vv_args->_(0), vv_args->_(1)));
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_compare,
+"@hash procedure (hash-compare _a_ _b_)\n\n"
+"Returns -1, 0 or 1 if _a_ is less than, equal to or greater than _b_.\n"
+"This is a total order of all values: Values of different types are\n"
+"ordered by type (nil < boolean < number < string < list < map < others),\n"
+"lists element by element, maps by their sorted entries.\n"
+)
+{
+    int r = vv_compare(vv_args->_(0), vv_args->_(1));
+    return vv((int64_t) (r < 0 ? -1 : (r > 0 ? 1 : 0)));
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_sort,
+"@hash procedure (hash-sort _list_)\n"
+"@hash procedure (hash-sort _list_ _key_)\n\n"
+"Returns the elements of _list_ sorted by `hash-compare`. If _key_ is\n"
+"given, the elements are records (maps or lists) and sorted by the\n"
+"field _key_, or by a list of fields. The sort is stable.\n"
+"\n"
+"    (hash-sort [{ :n 2 } { :n 1 }] :n)\n"
+"    ;=> [{ :n 1 } { :n 2 }]\n"
+)
+{
+    expect_list("hash-sort", vv_args->_(0));
+    return vv_sorted(vv_args->_(0), vv_args->_(1));
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_dedup,
+"@hash procedure (hash-dedup _list_)\n"
+"@hash procedure (hash-dedup _list_ _key_)\n\n"
+"Returns the elements of _list_ without duplicates, in the order of\n"
+"their first occurrence. With _key_ records are duplicates, if their\n"
+"field _key_ (or the fields in the list _key_) are equal.\n"
+"\n"
+"    (hash-dedup [{ :a 1 :b 2 } { :a 1 :b 3 } { :a 2 :b 2 }] [:a])\n"
+"    ;=> [{ :a 1 :b 2 } { :a 2 :b 2 }]\n"
+)
+{
+    expect_list("hash-dedup", vv_args->_(0));
+    return vv_dedup(vv_args->_(0), vv_args->_(1));
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_group_by,
+"@hash procedure (hash-group-by _list_ _key_)\n\n"
+"Groups the records in _list_ by their field _key_, or by the list of\n"
+"the fields in _key_. Returns a hash map of the keys to the lists of\n"
+"records with that key.\n"
+"\n"
+"    (hash-to-data (hash-group-by [[1 :a] [2 :b] [1 :c]] 0))\n"
+"    ;=> [[1 [[1 :a] [1 :c]]] [2 [[2 :b]]]]\n"
+)
+{
+    expect_list("hash-group-by", vv_args->_(0));
+    return vv_group_by(vv_args->_(0), vv_args->_(1));
+}
+//---------------------------------------------------------------------------
+
+static VV join(const char *func, const VV &args, bool left_outer)
+{
+    expect_list(func, args->_(0));
+    expect_list(func, args->_(1));
+    VV lkey = args->_(2);
+    VV rkey = args->_(3)->is_undef() ? lkey : args->_(3);
+    return vv_hash_join(args->_(0), args->_(1), lkey, rkey, left_outer);
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_join,
+"@hash procedure (hash-join _left_ _right_ _key_)\n"
+"@hash procedure (hash-join _left_ _right_ _left-key_ _right-key_)\n\n"
+"Joins the records of the lists _left_ and _right_ by their key fields\n"
+"(see `hash-group-by`). Returns a list of `[l r]` pairs for all records\n"
+"with equal keys, in the order of _left_. The right records are put\n"
+"into a hash table, so this takes linear time.\n"
+"\n"
+"    (hash-join [{ :id 1 :n \"x\" }] [{ :uid 1 :v 10 } { :uid 1 :v 20 }] :id :uid)\n"
+"    ;=> [[{ :id 1 :n \"x\" } { :uid 1 :v 10 }] [{ :id 1 :n \"x\" } { :uid 1 :v 20 }]]\n"
+)
+{
+    return join("hash-join", vv_args, false);
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(hash_left_join,
+"@hash procedure (hash-left-join _left_ _right_ _key_)\n"
+"@hash procedure (hash-left-join _left_ _right_ _left-key_ _right-key_)\n\n"
+"Like `hash-join`, but also returns `[l nil]` for the left records\n"
+"without a partner in _right_.\n"
+)
+{
+    return join("hash-left-join", vv_args, true);
+}
+//---------------------------------------------------------------------------
+
+void init_hashlib(LuaThread *t, Lua::Instance &lua)
+{
+    VV obj(vv_list() << vv_ptr(t, "LuaThread"));
+
+    LUA_REG(lua, "hash", "set",       obj, hash_set);
+    LUA_REG(lua, "hash", "map",       obj, hash_map);
+    LUA_REG(lua, "hash", "addM",      obj, hash_add_M);
+    LUA_REG(lua, "hash", "putM",      obj, hash_put_M);
+    LUA_REG(lua, "hash", "get",       obj, hash_get);
+    LUA_REG(lua, "hash", "containsQ", obj, hash_contains_Q);
+    LUA_REG(lua, "hash", "removeM",   obj, hash_remove_M);
+    LUA_REG(lua, "hash", "count",     obj, hash_count);
+    LUA_REG(lua, "hash", "toData",    obj, hash_to_data);
+    LUA_REG(lua, "hash", "code",      obj, hash_code);
+    LUA_REG(lua, "hash", "equalQ",    obj, hash_equal_Q);
+    LUA_REG(lua, "hash", "compare",   obj, hash_compare);
+    LUA_REG(lua, "hash", "sort",      obj, hash_sort);
+    LUA_REG(lua, "hash", "dedup",     obj, hash_dedup);
+    LUA_REG(lua, "hash", "groupBy",   obj, hash_group_by);
+    LUA_REG(lua, "hash", "join",      obj, hash_join);
+    LUA_REG(lua, "hash", "leftJoin",  obj, hash_left_join);
+}
+
+} // namespace lal_rt
@@ -26,6 +26,14 @@
 #include "log.h"
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <cerrno>
+#if !defined(_WIN32)
+#   include <fcntl.h>
+#   include <sys/stat.h>
+#   include <sys/uio.h>
+#   include <unistd.h>
+#endif
 #include <boost/log/support/date_time.hpp>
 #include <boost/log/support/exception.hpp>
 #include <boost/log/attributes/named_scope.hpp>
@@ -56,42 +64,379 @@ BOOST_LOG_GLOBAL_LOGGER_DEFAULT(lal_rt::g_log, src::severity_logger_mt<boost::lo
 
 //---------------------------------------------------------------------------
 
-lalrt_logfile_backend::lalrt_logfile_backend(const std::string &filepath)
-    : m_filepath(filepath), m_filehandle(0)
+log_writer::log_writer(const std::string &filepath, const log_options &opts)
+    : m_head(nullptr),
+      m_pending_bytes(0),
+      m_wakeup(false),
+      m_flush_req(0),
+      m_flushed(0),
+      m_stop(false),
+      m_filepath(filepath),
+      m_opts(opts),
+      m_fd(-1),
+      m_file(nullptr),
+      m_file_size(0),
+      m_opened_at(0),
+      m_open_failed(false)
 {
+    m_thread = std::thread(&log_writer::run, this);
 }
 //---------------------------------------------------------------------------
 
-void lalrt_logfile_backend::consume(boost::log::record_view const &rec,
-                                     const std::string &msg)
+log_writer::log_writer(int fd, const log_options &opts)
+    : m_head(nullptr),
+      m_pending_bytes(0),
+      m_wakeup(false),
+      m_flush_req(0),
+      m_flushed(0),
+      m_stop(false),
+      m_opts(opts),
+      m_fd(fd),
+      m_file(nullptr),
+      m_file_size(0),
+      m_opened_at(0),
+      m_open_failed(false)
+{
+    m_thread = std::thread(&log_writer::run, this);
+}
+//---------------------------------------------------------------------------
+
+log_writer::~log_writer()
+{
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+
+    if (!m_filepath.empty())
+        close_file();
+}
+//---------------------------------------------------------------------------
+
+void log_writer::push(const std::string &line, bool urgent)
+{
+    record *r = new record;
+    r->line = line;
+    r->next = m_head.load(std::memory_order_relaxed);
+    while (!m_head.compare_exchange_weak(
+                r->next, r, std::memory_order_release, std::memory_order_relaxed))
+        ;
+
+    size_t pending =
+        m_pending_bytes.fetch_add(line.size(), std::memory_order_relaxed)
+        + line.size();
+
+    if (urgent || pending >= 64 * 1024)
+    {
+        // A missed wakeup only delays the write until the flush interval.
+        if (!m_wakeup.exchange(true))
+            m_cv.notify_one();
+    }
+}
+//---------------------------------------------------------------------------
+
+void log_writer::flush()
 {
-    if (!m_filehandle)
-        m_filehandle = fopen(m_filepath.c_str(), "a+");
+    std::unique_lock<std::mutex> lk(m_mutex);
+    if (m_stop)
+        return;
+    uint64_t req = ++m_flush_req;
+    m_wakeup = true;
+    m_cv.notify_one();
+    m_flushed_cv.wait(lk, [&]() { return m_flushed >= req || m_stop; });
+}
+//---------------------------------------------------------------------------
 
-    if (!m_filehandle)
+void log_writer::run()
+{
+    for (;;)
     {
-        std::cerr << "Konnte logfile nicht öffnen: " << m_filepath << std::endl;
+        uint64_t req  = 0;
+        bool     stop = false;
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_cv.wait_for(
+                lk, std::chrono::milliseconds(m_opts.flush_interval_ms),
+                [this]() { return m_stop || m_wakeup.load(); });
+            m_wakeup = false;
+            req      = m_flush_req;
+            stop     = m_stop;
+        }
+
+        write_batch();
+
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            m_flushed = req;
+        }
+        m_flushed_cv.notify_all();
+
+        if (stop)
+            break;
+    }
+}
+//---------------------------------------------------------------------------
+
+void log_writer::write_batch()
+{
+    record *r = m_head.exchange(nullptr, std::memory_order_acquire);
+    if (!r)
         return;
+
+    // The list is newest first, reverse it into the logging order:
+    record *first = nullptr;
+    size_t  bytes = 0;
+    while (r)
+    {
+        record *next = r->next;
+        r->next = first;
+        first   = r;
+        bytes  += r->line.size();
+        r       = next;
+    }
+    m_pending_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+
+    if (!m_filepath.empty())
+    {
+        time_t now = time(nullptr);
+        if (m_opened_at
+            && ((m_opts.max_file_size
+                 && m_file_size > 0
+                 && m_file_size + bytes > m_opts.max_file_size)
+                || (m_opts.rotation_interval_s > 0
+                    && now - m_opened_at >= m_opts.rotation_interval_s)))
+        {
+            rotate();
+        }
+
+        if (!open_file())
+            bytes = 0;
+    }
+
+    if (bytes)
+        write_out(first, bytes);
+
+    while (first)
+    {
+        record *next = first->next;
+        delete first;
+        first = next;
+    }
+}
+//---------------------------------------------------------------------------
+
+bool log_writer::open_file()
+{
+#if defined(_WIN32)
+    if (m_file)
+        return true;
+    m_file = fopen(m_filepath.c_str(), "ab");
+    bool ok = m_file != nullptr;
+    if (ok)
+    {
+        fseek(m_file, 0, SEEK_END);
+        m_file_size = (size_t) ftell(m_file);
     }
+#else
+    if (m_fd >= 0)
+        return true;
+    m_fd = open(m_filepath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    bool ok = m_fd >= 0;
+    if (ok)
+    {
+        struct stat st;
+        m_file_size = fstat(m_fd, &st) == 0 ? (size_t) st.st_size : 0;
+    }
+#endif
 
-    std::stringstream s;
-    s << msg << std::endl;
-    std::string record_string = s.str();
-    fwrite(record_string.c_str(), sizeof(char), record_string.size(), m_filehandle);
-    fflush(m_filehandle);
-    fclose(m_filehandle);
-    m_filehandle = NULL;
+    if (!ok)
+    {
+        // complain only once, not for every batch:
+        if (!m_open_failed)
+            std::cerr << "Konnte logfile nicht öffnen: " << m_filepath << std::endl;
+        m_open_failed = true;
+        return false;
+    }
+
+    m_open_failed = false;
+    m_opened_at   = time(nullptr);
+    return true;
+}
+//---------------------------------------------------------------------------
+
+void log_writer::close_file()
+{
+#if defined(_WIN32)
+    if (m_file)
+        fclose(m_file);
+    m_file = nullptr;
+#else
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+#endif
+}
+//---------------------------------------------------------------------------
+
+void log_writer::rotate()
+{
+    close_file();
+
+    char stamp[32];
+    time_t now = time(nullptr);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+
+    std::string target = m_filepath + "." + stamp;
+    for (int i = 1; ; i++)
+    {
+        FILE *f = fopen(target.c_str(), "r");
+        if (!f)
+            break;
+        fclose(f);
+        target = m_filepath + "." + stamp + "-" + std::to_string(i);
+    }
+
+    if (std::rename(m_filepath.c_str(), target.c_str()) != 0)
+        std::cerr << "Konnte logfile nicht rotieren: " << m_filepath << std::endl;
+}
+//---------------------------------------------------------------------------
+
+void log_writer::write_out(record *first, size_t bytes)
+{
+#if defined(_WIN32)
+    std::string buf;
+    buf.reserve(bytes);
+    for (record *r = first; r; r = r->next)
+        buf += r->line;
+
+    FILE *out = m_file ? m_file : (m_fd == 2 ? stderr : stdout);
+    fwrite(buf.data(), 1, buf.size(), out);
+    fflush(out);
+#else
+    const int MAX_IOV = 512;
+    struct iovec iov[MAX_IOV];
+
+    record *r = first;
+    while (r)
+    {
+        int n = 0;
+        for (; r && n < MAX_IOV; r = r->next)
+        {
+            if (r->line.empty())
+                continue;
+            iov[n].iov_base = (void *) r->line.data();
+            iov[n].iov_len  = r->line.size();
+            n++;
+        }
+
+        struct iovec *cur = iov;
+        while (n > 0)
+        {
+            ssize_t w = writev(m_fd, cur, n);
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+
+            // skip what was written, continue with a partial write:
+            size_t done = (size_t) w;
+            while (n > 0 && done >= cur->iov_len)
+            {
+                done -= cur->iov_len;
+                cur++;
+                n--;
+            }
+            if (n > 0)
+            {
+                cur->iov_base = (char *) cur->iov_base + done;
+                cur->iov_len -= done;
+            }
+        }
+    }
+#endif
+
+    m_file_size += bytes;
+}
+//---------------------------------------------------------------------------
+
+lalrt_logfile_backend::lalrt_logfile_backend(const std::string &filepath,
+                                             const log_options &opts)
+    : m_writer(new log_writer(filepath, opts)),
+      m_urgent_level(logging::trivial::warning)
+{
+}
+//---------------------------------------------------------------------------
+
+lalrt_logfile_backend::lalrt_logfile_backend(int fd, const log_options &opts)
+    : m_writer(new log_writer(fd, opts)),
+      m_urgent_level(logging::trivial::trace)
+{
+}
+//---------------------------------------------------------------------------
+
+void lalrt_logfile_backend::consume(boost::log::record_view const &rec,
+                                     const std::string &msg)
+{
+    bool urgent = true;
+    auto sev = rec[logging::trivial::severity];
+    if (sev)
+        urgent = sev.get() >= m_urgent_level;
+
+    std::string line;
+    line.reserve(msg.size() + 1);
+    line += msg;
+    line += '\n';
+    m_writer->push(line, urgent);
 }
 //---------------------------------------------------------------------------
 
 void lalrt_logfile_backend::flush()
 {
-    if (m_filehandle)
-        fclose(m_filehandle);
+    m_writer->flush();
 }
 //---------------------------------------------------------------------------
 
-void start_logging(const std::string &logfile)
+typedef sinks::unlocked_sink<lalrt_logfile_backend> sink_t;
+
+static std::mutex                                               g_sinks_mutex;
+static std::vector<boost::shared_ptr<sink_t>>                   g_sinks;
+static std::atomic<int>                                         g_level(logging::trivial::trace);
+
+void set_log_level(logging::trivial::severity_level level)
+{
+    g_level = (int) level;
+    logging::core::get()->set_filter(logging::trivial::severity >= level);
+}
+//---------------------------------------------------------------------------
+
+logging::trivial::severity_level get_log_level()
+{
+    return (logging::trivial::severity_level) g_level.load();
+}
+//---------------------------------------------------------------------------
+
+bool parse_log_level(const std::string &name, logging::trivial::severity_level &level)
+{
+    static const char *names[] =
+        { "trace", "debug", "info", "warning", "error", "fatal" };
+
+    for (int i = 0; i < 6; i++)
+    {
+        if (name == names[i])
+        {
+            level = (logging::trivial::severity_level) i;
+            return true;
+        }
+    }
+    return false;
+}
+//---------------------------------------------------------------------------
+
+void start_logging(const std::string &logfile, const log_options &opts)
 {
     using namespace std;
 
@@ -128,26 +473,25 @@ void start_logging(const std::string &logfile)
         << "| "
         << expr::smessage;
 
-    logging::add_console_log
-    (
-        cerr,
-        keywords::auto_flush = true,
-        keywords::format     = fmt
-    );
-
     {
-        typedef sinks::synchronous_sink<lalrt_logfile_backend> sink_t;
-        boost::shared_ptr<lalrt_logfile_backend> backend(
-            new lalrt_logfile_backend(logfile));
-        boost::shared_ptr<sink_t> sink(new sink_t(backend));
-        sink->set_formatter(fmt);
-        logging::core::get()->add_sink(sink);
+        std::lock_guard<std::mutex> lg(g_sinks_mutex);
+
+        // stderr and the log file, both written by their own thread:
+        boost::shared_ptr<lalrt_logfile_backend> console(
+            new lalrt_logfile_backend(2, opts));
+        boost::shared_ptr<lalrt_logfile_backend> file(
+            new lalrt_logfile_backend(logfile, opts));
+
+        for (auto backend : { console, file })
+        {
+            boost::shared_ptr<sink_t> sink(new sink_t(backend));
+            sink->set_formatter(fmt);
+            logging::core::get()->add_sink(sink);
+            g_sinks.push_back(sink);
+        }
     }
 
-    logging::core::get()->set_filter
-    (
-        logging::trivial::severity >= logging::trivial::trace
-    );
+    set_log_level(opts.level);
 
     logging::add_common_attributes();
     logging::core::get()->add_global_attribute("Scopes", attrs::named_scope());
@@ -160,4 +504,16 @@ void start_logging(const std::string &logfile)
 }
 //---------------------------------------------------------------------------
 
+void stop_logging()
+{
+    std::lock_guard<std::mutex> lg(g_sinks_mutex);
+    for (auto &sink : g_sinks)
+    {
+        logging::core::get()->remove_sink(sink);
+        sink->flush();
+    }
+    g_sinks.clear();
+}
+//---------------------------------------------------------------------------
+
 } // namespace lal_rt
@@ -26,12 +26,20 @@
 #include <boost/log/core.hpp>
 #include <boost/log/trivial.hpp>
 #include <boost/log/sinks/basic_sink_backend.hpp>
-#include <boost/log/sinks/sync_frontend.hpp>
+#include <boost/log/sinks/unlocked_frontend.hpp>
 #include <boost/log/sinks/frontend_requirements.hpp>
 #include <boost/log/attributes/named_scope.hpp>
 #include <boost/log/sources/severity_logger.hpp>
 #include <boost/log/sources/record_ostream.hpp>
 #include <boost/log/sources/global_logger_storage.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 
 #define L_ERROR  BOOST_LOG_FUNCTION(); BOOST_LOG_SEV(lal_rt::g_log::get(), boost::log::trivial::error)
 #define L_FATAL  BOOST_LOG_FUNCTION(); BOOST_LOG_SEV(lal_rt::g_log::get(), boost::log::trivial::fatal)
@@ -47,29 +55,111 @@ BOOST_LOG_GLOBAL_LOGGER(g_log, boost::log::sources::severity_logger_mt<boost::lo
 
 //---------------------------------------------------------------------------
 
-void start_logging(const std::string &logfile);
+struct log_options
+{
+    /// Records below this severity are dropped, see set_log_level().
+    boost::log::trivial::severity_level level = boost::log::trivial::trace;
+    /// The log file is rotated when it would grow beyond this size,
+    /// 0 disables size based rotation.
+    size_t  max_file_size       = 0;
+    /// The log file is rotated after this many seconds, 0 disables it.
+    int     rotation_interval_s = 0;
+    /// The writer thread writes at least this often.
+    int     flush_interval_ms   = 200;
+};
+
+void start_logging(const std::string &logfile,
+                   const log_options &opts = log_options());
+/// Writes all buffered records and removes the sinks.
+void stop_logging();
+
+/// Changes the severity threshold at runtime.
+void set_log_level(boost::log::trivial::severity_level level);
+boost::log::trivial::severity_level get_log_level();
+/// Parses "trace", "debug", "info", "warning", "error" or "fatal".
+bool parse_log_level(const std::string &name,
+                     boost::log::trivial::severity_level &level);
+
+//---------------------------------------------------------------------------
+
+/// Writes the log records of all threads from a background thread.
+/// Records are pushed onto a lock free list and written in batches
+/// with a single writev() whenever the flush interval elapsed, enough
+/// bytes piled up or an urgent record arrived.
+class log_writer
+{
+private:
+    struct record
+    {
+        record      *next;
+        std::string  line;
+    };
 
+    std::atomic<record *>   m_head;
+    std::atomic<size_t>     m_pending_bytes;
+    std::atomic<bool>       m_wakeup;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_cv;
+    std::condition_variable m_flushed_cv;
+    uint64_t                m_flush_req;
+    uint64_t                m_flushed;
+    bool                    m_stop;
+    std::thread             m_thread;
+
+    std::string             m_filepath;     // empty if writing to m_fd only
+    log_options             m_opts;
+    int                     m_fd;
+    FILE                   *m_file;         // used instead of m_fd on Windows
+    size_t                  m_file_size;
+    time_t                  m_opened_at;
+    bool                    m_open_failed;
+
+    void run();
+    void write_batch();
+    bool open_file();
+    void close_file();
+    void rotate();
+    void write_out(record *first, size_t bytes);
+
+public:
+    /// Writes to the file at filepath.
+    log_writer(const std::string &filepath, const log_options &opts);
+    /// Writes to the already open descriptor fd (not closed).
+    log_writer(int fd, const log_options &opts);
+    ~log_writer();
+
+    /// Queues one line, urgent wakes the writer thread immediately.
+    void push(const std::string &line, bool urgent);
+    /// Returns after everything pushed so far was written.
+    void flush();
+};
 //---------------------------------------------------------------------------
 
 class lalrt_logfile_backend :
     public boost::log::sinks::basic_formatted_sink_backend<
+        char,
         boost::log::sinks::combine_requirements<
-            boost::log::sinks::synchronized_feeding,
+            boost::log::sinks::concurrent_feeding,
             boost::log::sinks::formatted_records,
             boost::log::sinks::flushing
         >::type
     >
 {
 private:
-    std::string         m_filepath;
-    FILE               *m_filehandle;
+    std::unique_ptr<log_writer>         m_writer;
+    boost::log::trivial::severity_level m_urgent_level;
 
 public:
     typedef char                             char_type;              // Character type.
     typedef std::string                      string_type;            // Formatted string type.
 //    typedef base_type::frontend_requirements frontend_requirements;  // Frontend requirements.
 
-    explicit lalrt_logfile_backend(const std::string &filepath);
+    explicit lalrt_logfile_backend(const std::string &filepath,
+                                   const log_options &opts = log_options());
+    /// Writes to the descriptor fd, every record is urgent.
+    explicit lalrt_logfile_backend(int fd,
+                                   const log_options &opts = log_options());
 
     void consume(boost::log::record_view const& rec, const std::string &msg);
     void flush();
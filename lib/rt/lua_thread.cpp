@@ -23,10 +23,18 @@
 
 #include "rt/lua_thread.h"
 #include "rt/lua_thread_helper.h"
+#include "base/util.h"
 #include "rt/syslib.h"
 #include "rt/httplib.h"
 #include "rt/utillib.h"
 #include "rt/sqldblib.h"
+#include "rt/pdslib.h"
+#include "rt/hashlib.h"
+#include "rt/node.h"
+#include "lua/lua_profiler.h"
+#include "lua/lua_bundle.h"
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include "rt/log.h"
 #if HAS_QT5
@@ -109,37 +117,120 @@ VV_CLOSURE_DOC(proc_terminated_Q,
 //---------------------------------------------------------------------------
 
 VV_CLOSURE_DOC(proc_spawn,
-"@proc:rt-proc procecdure (proc-spawn _init-program-text_ [_args-data_])\n\n"
+"@proc:rt-proc procecdure (proc-spawn _init-program-text_ [_args-data_ [_options_]])\n\n"
 "Creates a new process with the init program text _init-program-text_.\n"
 "The started init programm is _args-data_ passed as arguments.\n"
 "Returns the `pid` of the newly created process.\n"
+"The map _options_ configures the garbage collector of the new process:\n"
+"\n"
+"    :gc-mode        incremental: (default) or generational:\n"
+"    :gc-pause       incremental: percent of heap growth that starts\n"
+"                    the next cycle (default 200)\n"
+"    :gc-stepmul     incremental: collector speed relative to the\n"
+"                    allocation speed, in percent (default 200)\n"
+"    :gc-minor-mul   generational: percent of heap growth that starts\n"
+"                    a young collection (default 20)\n"
+"    :gc-major-mul   generational: percent of heap growth since the last\n"
+"                    major collection that starts a major one (default 100)\n"
+"\n"
+"The generational mode suits processes with a big long lived heap\n"
+"and many short lived messages: young collections don't touch the old\n"
+"objects, so their pauses only depend on the amount of new data.\n"
 "\n"
 "    (let ((p (proc-spawn \"(mp-send [foobar:])\")))\n"
 "      (mp-wait-infinite foobar:))\n"
+"\n"
+"    (proc-spawn code [] { :gc-mode generational: :gc-minor-mul 50 })\n"
 )
 {
+    VV gc_opts = vv_args->_(2);
+    std::string gc_mode = strip_lal_kw(gc_opts->_s("gc-mode"));
+    if (!gc_mode.empty() && gc_mode != "incremental" && gc_mode != "generational")
+        throw LuaThreadException("proc-spawn: unknown gc-mode: " + gc_mode);
+
     auto child_lt = new LuaThread(true);
     child_lt->m_port.m_parent_emitter.connect(
         std::bind(&Port::handle, &LT->m_port, std::placeholders::_1));
-    child_lt->start(vv_args->_s(0), vv_args->_(1));
+    child_lt->start(vv_args->_s(0), vv_args->_(1), gc_opts);
     return vv(child_lt->m_port.pid());
 }
 //---------------------------------------------------------------------------
 
+VV_CLOSURE_DOC(proc_profile_start,
+"@proc:rt-proc procedure (proc-profile-start [_interval-ms_])\n\n"
+"Starts the sampling profiler of the current process and discards the\n"
+"samples of a previous run. Every _interval-ms_ milliseconds (default 10,\n"
+"fractions are allowed) the call stack of the running LAL code is\n"
+"recorded. Lines of compiled LAL code are reported as .lal file and line.\n"
+"Time spent waiting in builtins like `mp-wait` is not sampled.\n"
+"See also `proc-profile-dump`.\n"
+"\n"
+"    (proc-profile-start 1)\n"
+"    (run-my-stuff)\n"
+"    (proc-profile-dump \"stuff.folded\")\n"
+)
+{
+    double ms = vv_args->_(0)->is_undef() ? 10.0 : vv_args->_d(0);
+    LT->lua().profiler().start((int) (ms * 1000.0));
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(proc_profile_stop,
+"@proc:rt-proc procedure (proc-profile-stop)\n\n"
+"Stops the sampling profiler. The samples are kept for `proc-profile-dump`.\n"
+"Returns the number of samples taken.\n"
+)
+{
+    Lua::Profiler &prof = LT->lua().profiler();
+    prof.stop();
+    return vv((int64_t) prof.samples());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(proc_profile_dump,
+"@proc:rt-proc procedure (proc-profile-dump [_filename_])\n\n"
+"Returns the samples of the profiler as folded stacks (one line\n"
+"\"root;caller;...;function count\" per distinct stack), which can be\n"
+"turned into a flamegraph with flamegraph.pl or loaded into speedscope.\n"
+"If _filename_ is given, the stacks are written into that file instead\n"
+"and the number of samples is returned.\n"
+"The profiler keeps running, if it was not stopped.\n"
+)
+{
+    Lua::Profiler &prof = LT->lua().profiler();
+    if (vv_args->_(0)->is_undef())
+        return vv(prof.folded());
+
+    std::ofstream out(vv_args->_s(0), std::ios::binary);
+    out << prof.folded();
+    if (!out)
+        throw LuaThreadException(
+            "proc-profile-dump: Can't write " + vv_args->_s(0));
+    return vv((int64_t) prof.samples());
+}
+//---------------------------------------------------------------------------
+
 VV_CLOSURE_DOC(mp_send,
 "@mp:rt-mp procedure (mp-send _pid-number_ _message-data_)\n"
+"@mp procedure (mp-send _global-pid-string_ _message-data_)\n"
 "@mp procedure (mp-send _message-data_)\n\n"
 "Sends the _message-data_ to the process with _pid-number_ and\n"
 "returns the unique token of the message (see also `mp-wait`).\n"
 "If _pid-number_ is omitted, the message is directly emitted to\n"
 "the parent process.\n"
+"A _global-pid-string_ of the form \"node:pid\" sends the message to\n"
+"a process on another node (see `mp-node-start` and `mp-node-connect`).\n"
+"The receiver gets the global pid of the sender as source pid.\n"
 "\n"
 "    (let ((f (mp-send 0 [ping:]))\n"
 "          (r (mp-wait-infinite f)))\n"
 "      (assert (eq? (.result r) pong:)))\n"
 )
 {
-    if (vv_args->size() == 2)
+    if (vv_args->size() == 2 && vv_args->_(0)->is_string())
+        return vv(LT->m_port.emit_message(vv_args->_(1), vv_args->_s(0)));
+    else if (vv_args->size() == 2)
         return vv(LT->m_port.emit_message(vv_args->_(1), (int) vv_args->_i(0)));
     else
         return vv(LT->m_port.emit_message(vv_args->_(0)));
@@ -266,6 +357,81 @@ VV_CLOSURE_DOC(mp_token,
 }
 //---------------------------------------------------------------------------
 
+VV_CLOSURE_DOC(mp_node_start,
+"@mp:rt-mp procedure (mp-node-start _node-name_ [_port-number_ [_host-string_]])\n\n"
+"Sets the name of this node, which is the first part of the global pids\n"
+"\"node:pid\" of all processes. If a _port-number_ is given, links from\n"
+"other nodes are accepted on that TCP port. Port 0 selects a free port.\n"
+"_host-string_ defaults to \"127.0.0.1\", pass \"0.0.0.0\" to accept\n"
+"links from other hosts. Listening requires a secret set with\n"
+"`mp-node-secret`, peers that don't know it are disconnected.\n"
+"Returns the port number or `nil` if none was given.\n"
+"\n"
+"    (mp-node-secret \"s3cr3t\")\n"
+"    (mp-node-start \"worker1\" 5050)\n"
+)
+{
+    Node::global().set_name(vv_args->_s(0));
+
+    if (vv_args->_(1)->is_undef())
+        return vv_undef();
+
+    std::string host = vv_args->_(2)->is_undef() ? "127.0.0.1" : vv_args->_s(2);
+    try
+    {
+        return vv(Node::global().listen((int) vv_args->_i(1), host));
+    }
+    catch (const std::runtime_error &e)
+    {
+        throw LuaThreadException(std::string("mp-node-start: ") + e.what());
+    }
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(mp_node_secret,
+"@mp:rt-mp procedure (mp-node-secret _secret-string_)\n\n"
+"Sets the secret that this node and all nodes linking to it share.\n"
+"Links are only used after the peer proved that it knows the secret.\n"
+"Must be called before `mp-node-start` with a port or `mp-node-connect`.\n"
+)
+{
+    Node::global().set_secret(vv_args->_s(0));
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(mp_node_connect,
+"@mp:rt-mp procedure (mp-node-connect _node-name_ _host-string_ _port-number_)\n\n"
+"Opens a link to the node that listens on _host-string_ and _port-number_.\n"
+"Afterwards messages can be sent to \"node-name:pid\" with `mp-send`.\n"
+"Both nodes must have the same secret set with `mp-node-secret`.\n"
+"\n"
+"    (mp-node-connect \"worker1\" \"10.0.0.5\" 5050)\n"
+"    (mp-send \"worker1:0\" [ping:])\n"
+)
+{
+    try
+    {
+        Node::global().connect(
+            vv_args->_s(0), vv_args->_s(1), (int) vv_args->_i(2));
+    }
+    catch (const std::runtime_error &e)
+    {
+        throw LuaThreadException(std::string("mp-node-connect: ") + e.what());
+    }
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(mp_global_pid,
+"@mp:rt-mp procedure (mp-global-pid)\n\n"
+"Returns the global pid \"node:pid\" of the current process.\n"
+)
+{
+    return vv(LT->m_port.global_pid());
+}
+//---------------------------------------------------------------------------
+
 VV_CLOSURE_DOC(lal_dump,
 "@lal:rt-lal procedure (lal-dump _data_)\n\n"
 "Returns a serialized form of _data_ as LAL-Datastructure.\n"
@@ -284,6 +450,9 @@ void LuaThread::init_rt_lib(Lua::Instance &lua)
     LUA_REG(lua, "proc", "terminatedQ",         obj, proc_terminated_Q);
     LUA_REG(lua, "proc", "pid",                 obj, proc_pid);
     LUA_REG(lua, "proc", "spawn",               obj, proc_spawn);
+    LUA_REG(lua, "proc", "profileStart",        obj, proc_profile_start);
+    LUA_REG(lua, "proc", "profileStop",         obj, proc_profile_stop);
+    LUA_REG(lua, "proc", "profileDump",         obj, proc_profile_dump);
 
     LUA_REG(lua, "mp",   "addDefaultHandler",   obj, mp_add_default_handler);
     LUA_REG(lua, "mp",   "removeDefaultHandler",obj, mp_remove_default_handler);
@@ -293,6 +462,10 @@ void LuaThread::init_rt_lib(Lua::Instance &lua)
     LUA_REG(lua, "mp",   "send",                obj, mp_send);
     LUA_REG(lua, "mp",   "setDebugLogging",     obj, mp_set_debug_logging);
     LUA_REG(lua, "mp",   "token",               obj, mp_token);
+    LUA_REG(lua, "mp",   "nodeStart",           obj, mp_node_start);
+    LUA_REG(lua, "mp",   "nodeConnect",         obj, mp_node_connect);
+    LUA_REG(lua, "mp",   "nodeSecret",          obj, mp_node_secret);
+    LUA_REG(lua, "mp",   "globalPid",           obj, mp_global_pid);
 
     LUA_REG(lua, "lal",  "dump",                obj, lal_dump);
 
@@ -300,6 +473,8 @@ void LuaThread::init_rt_lib(Lua::Instance &lua)
     init_sqldblib(this, lua);
     init_httplib(this, lua);
     init_utillib(this, lua);
+    init_pdslib(this, lua);
+    init_hashlib(this, lua);
 
 #if HAS_QT5
     init_qtlib(this, lua);
@@ -437,6 +612,46 @@ void LuaThread::notify_msg_arrived_async()
 }
 //---------------------------------------------------------------------------
 
+static std::shared_ptr<Lua::Bundle> open_lalrtlib_bundle()
+{
+    std::string path;
+    const char *env = std::getenv("LALRT_BUNDLE");
+    if (env)
+    {
+        path = env;
+        if (path.empty()) // LALRT_BUNDLE= disables the bundle
+            return std::shared_ptr<Lua::Bundle>();
+    }
+    else
+    {
+        const char *lib = std::getenv("LALRT_LIB");
+        path = std::string(lib ? lib : "./lalrtlib/") + "/lalrtlib.bundle";
+        if (!std::ifstream(path.c_str()))
+            return std::shared_ptr<Lua::Bundle>();
+    }
+
+    try
+    {
+        std::shared_ptr<Lua::Bundle> b = Lua::Bundle::open(path);
+        L_INFO << "Using bundle " << path << " (" << b->count() << " modules)";
+        return b;
+    }
+    catch (const std::exception &e)
+    {
+        L_WARN << "Ignoring bundle: " << e.what();
+        return std::shared_ptr<Lua::Bundle>();
+    }
+}
+//---------------------------------------------------------------------------
+
+std::shared_ptr<Lua::Bundle> LuaThread::bundle()
+{
+    // opened on first use, all processes share the mapping
+    static std::shared_ptr<Lua::Bundle> b = open_lalrtlib_bundle();
+    return b;
+}
+//---------------------------------------------------------------------------
+
 VVal::VV LuaThread::check_available(const VVal::VV &tokens)
 {
     VVal::VV msg = m_msg_handler.check_arrived_msgs(tokens);
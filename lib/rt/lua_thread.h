@@ -177,6 +177,7 @@ class LuaThread : public Process
         static std::string               m_prelude;
         static std::string               m_prelude_end;
         std::string                      m_lua_init_code;
+        VVal::VV                         m_gc_opts;
         Lua::Instance                   *m_lua;
 
         LuaThreadMessageHandler          m_msg_handler;
@@ -212,12 +213,22 @@ class LuaThread : public Process
         void check_resource(const VVal::VV &v, const std::string &type)
         { m_rm.check_resource(v, type); }
 
-        void start(const std::string &lua_code, const VVal::VV &args)
+        Lua::Instance &lua() { return *m_lua; }
+
+        /// The bundle of precompiled lalrtlib modules: $LALRT_BUNDLE or
+        /// lalrtlib.bundle in the lalrtlib directory. Null if there is none.
+        static std::shared_ptr<Lua::Bundle> bundle();
+
+        /// gc_opts are passed to Lua::Instance::gc_configure() before
+        /// the init code runs.
+        void start(const std::string &lua_code, const VVal::VV &args,
+                   const VVal::VV &gc_opts = VVal::g_vv_undef)
         {
             m_lua_init_code = m_prelude
                             + "\n------------------------------\n"
                             + lua_code
                             + m_prelude_end;
+            m_gc_opts = gc_opts;
             this->Process::start(args);
         }
 
@@ -248,6 +259,9 @@ class LuaThread : public Process
             {
                 Lua::Instance *lua = new Lua::Instance;
                 m_lua = lua;
+                m_lua->gc_configure(m_gc_opts);
+                if (std::shared_ptr<Lua::Bundle> b = bundle())
+                    m_lua->use_bundle(b);
                 m_lua->init_output_interface();
                 this->init_rt_lib(*m_lua);
                 std::string code_name = (format("prelude(pid %1%)") % this->m_port.pid()).str();
@@ -0,0 +1,623 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+
+#include "rt/node.h"
+#include "rt/process.h"
+#include "rt/log.h"
+#include "base/msgpack_vv.h"
+#include <Poco/HMACEngine.h>
+#include <Poco/SHA1Engine.h>
+#include <functional>
+#include <random>
+#include <stdexcept>
+
+using namespace VVal;
+using boost::asio::ip::tcp;
+
+namespace lal_rt
+{
+//---------------------------------------------------------------------------
+
+bool parse_global_pid(const std::string &address, std::string &node, int &pid)
+{
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 >= address.size())
+        return false;
+
+    for (size_t i = colon + 1; i < address.size(); i++)
+        if (address[i] < '0' || address[i] > '9')
+            return false;
+
+    node = address.substr(0, colon);
+    try { pid = std::stoi(address.substr(colon + 1)); }
+    catch (const std::exception &) { return false; }
+    return true;
+}
+//---------------------------------------------------------------------------
+
+static std::string random_nonce()
+{
+    std::random_device rd;
+    std::string nonce;
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t r = rd();
+        nonce.append((const char *) &r, sizeof(r));
+    }
+    return nonce;
+}
+//---------------------------------------------------------------------------
+
+static bool digest_equal(const std::string &a, const std::string &b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    unsigned char diff = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        diff |= (unsigned char) (a[i] ^ b[i]);
+    return diff == 0;
+}
+//---------------------------------------------------------------------------
+
+NodeLink::NodeLink(Node &node, boost::asio::io_service &io, const std::string &dialed)
+    : msgpack::ProtoFraming(&m_pending),
+      m_node(node),
+      m_io(io),
+      m_socket(io),
+      m_peer(dialed),
+      m_dialed(!dialed.empty()),
+      m_authenticated(false),
+      m_writing(false),
+      m_closed(false),
+      m_held_bytes(0)
+{
+}
+//---------------------------------------------------------------------------
+
+void NodeLink::start()
+{
+    auto self = shared_from_this();
+    m_io.post([self]()
+    {
+        boost::system::error_code ec;
+        self->m_socket.set_option(tcp::no_delay(true), ec);
+
+        if (!self->m_dialed)
+        {
+            self->m_accept_nonce = random_nonce();
+            self->queue_packet(
+                msgpack_vv::to_msgpack(vv(self->m_accept_nonce)), PKT_CHALLENGE);
+        }
+        self->start_read();
+    });
+}
+//---------------------------------------------------------------------------
+
+void NodeLink::close()
+{
+    {
+        std::lock_guard<std::mutex> lg(m_send_mutex);
+        if (m_closed) return;
+        m_closed = true;
+    }
+
+    boost::system::error_code ec;
+    m_socket.shutdown(tcp::socket::shutdown_both, ec);
+    m_socket.close(ec);
+    m_node.link_closed(this);
+}
+//---------------------------------------------------------------------------
+
+bool NodeLink::send(int pid, const VV &msg)
+{
+    std::string payload = msgpack_vv::to_msgpack(vv_list() << vv(pid) << msg);
+
+    {
+        std::lock_guard<std::mutex> lg(m_send_mutex);
+        if (m_closed) return false;
+
+        // the peer drops the link on messages before the handshake,
+        // and we don't talk to a peer that didn't authenticate
+        if (!m_authenticated)
+        {
+            if (m_held_bytes + payload.size() > DEFAULT_MAX_SEND_BUFFER)
+                return false;
+            m_held_bytes += payload.size();
+            m_held.push_back(payload);
+            return true;
+        }
+    }
+
+    return queue_packet(payload, PKT_MSG);
+}
+//---------------------------------------------------------------------------
+
+bool NodeLink::queue_packet(const std::string &payload, uint16_t type)
+{
+    bool kick = false;
+    {
+        std::lock_guard<std::mutex> lg(m_send_mutex);
+        if (!this->send_msg(payload.data(), payload.size(), type))
+        {
+            L_WARN << "node link to '" << m_peer << "': packet of "
+                   << payload.size() << " bytes exceeds the send limit, closing";
+            m_io.post(std::bind(&NodeLink::close, shared_from_this()));
+            return false;
+        }
+        kick      = !m_writing;
+        m_writing = true;
+    }
+
+    if (kick)
+        m_io.post(std::bind(&NodeLink::start_write, shared_from_this()));
+    return true;
+}
+//---------------------------------------------------------------------------
+
+void NodeLink::authenticated()
+{
+    bool kick = false;
+    bool ok   = true;
+    {
+        std::lock_guard<std::mutex> lg(m_send_mutex);
+        m_authenticated = true;
+
+        // under the same lock, so later messages can't overtake them
+        for (auto &payload : m_held)
+        {
+            ok = this->send_msg(payload.data(), payload.size(), PKT_MSG);
+            if (!ok) break;
+        }
+        m_held.clear();
+        m_held_bytes = 0;
+
+        kick      = ok && !m_writing;
+        m_writing = m_writing || kick;
+    }
+
+    if (!ok)
+    {
+        L_WARN << "node link to '" << m_peer
+               << "': held messages exceed the send limit, closing";
+        close();
+    }
+    else if (kick)
+        m_io.post(std::bind(&NodeLink::start_write, shared_from_this()));
+}
+//---------------------------------------------------------------------------
+
+void NodeLink::auth_failed(const char *what)
+{
+    L_WARN << "node link " << (m_dialed ? "to" : "from")
+           << " '" << m_peer << "': " << what << ", closing";
+    close();
+}
+//---------------------------------------------------------------------------
+
+void NodeLink::start_write()
+{
+    {
+        std::lock_guard<std::mutex> lg(m_send_mutex);
+        if (m_closed || m_pending.length() == 0)
+        {
+            m_writing = false;
+            return;
+        }
+
+        // everything queued up to now goes out with this write
+        m_out.assign(m_pending.buffer(), m_pending.length());
+        m_pending.skip_bytes(m_pending.length());
+    }
+
+    auto self = shared_from_this();
+    boost::asio::async_write(m_socket, boost::asio::buffer(m_out),
+        [self](const boost::system::error_code &ec, size_t)
+        {
+            if (ec)
+            {
+                L_WARN << "node link to '" << self->m_peer
+                       << "': write failed: " << ec.message();
+                self->close();
+                return;
+            }
+            self->start_write();
+        });
+}
+//---------------------------------------------------------------------------
+
+void NodeLink::start_read()
+{
+    auto self = shared_from_this();
+    m_socket.async_read_some(
+        boost::asio::buffer(m_recv_buf, sizeof(m_recv_buf)),
+        [self](const boost::system::error_code &ec, size_t len)
+        {
+            if (ec)
+            {
+                if (ec != boost::asio::error::operation_aborted)
+                {
+                    L_DEBUG << "node link to '" << self->m_peer
+                            << "' closed: " << ec.message();
+                }
+                self->close();
+                return;
+            }
+
+            self->handle_recv(self->m_recv_buf, len);
+            self->start_read();
+        });
+}
+//---------------------------------------------------------------------------
+
+void NodeLink::handle_recv_msg(const char *data, size_t len, uint16_t type)
+{
+    std::string err;
+    VV v = msgpack_vv::from_msgpack(data, len, &err);
+    if (!err.empty())
+    {
+        L_WARN << "node link to '" << m_peer << "': bad packet: " << err;
+        return;
+    }
+
+    switch (type)
+    {
+        // the handshake, see node.h
+        case PKT_CHALLENGE:
+        {
+            if (!m_dialed || !m_accept_nonce.empty() || v->s().empty())
+            {
+                auth_failed("unexpected challenge");
+                return;
+            }
+
+            std::string name = m_node.name();
+            m_accept_nonce   = v->s();
+            m_dial_nonce     = random_nonce();
+            queue_packet(
+                msgpack_vv::to_msgpack(
+                    vv_list() << vv(name) << vv(m_dial_nonce)
+                              << vv(m_node.auth_digest(
+                                        "dial", m_accept_nonce, m_dial_nonce,
+                                        name, m_peer))),
+                PKT_HELLO);
+            break;
+        }
+
+        case PKT_HELLO:
+        {
+            if (m_dialed || m_authenticated)
+            {
+                auth_failed("unexpected hello");
+                return;
+            }
+
+            std::string name  = v->_s(0);
+            std::string nonce = v->_s(1);
+            std::string own   = m_node.name();
+            if (nonce.empty()
+                || !digest_equal(v->_s(2),
+                                 m_node.auth_digest(
+                                     "dial", m_accept_nonce, nonce, name, own)))
+            {
+                m_peer = name;
+                auth_failed("authentication failed");
+                return;
+            }
+
+            m_dial_nonce = nonce;
+            m_peer       = name;
+            queue_packet(
+                msgpack_vv::to_msgpack(
+                    vv(m_node.auth_digest(
+                        "accept", m_accept_nonce, m_dial_nonce, own, name))),
+                PKT_WELCOME);
+            authenticated();
+            m_node.link_named(m_peer, shared_from_this());
+            break;
+        }
+
+        case PKT_WELCOME:
+            if (!m_dialed || m_authenticated || m_dial_nonce.empty())
+            {
+                auth_failed("unexpected welcome");
+                return;
+            }
+
+            if (!digest_equal(v->s(),
+                              m_node.auth_digest(
+                                  "accept", m_accept_nonce, m_dial_nonce,
+                                  m_peer, m_node.name())))
+            {
+                auth_failed("authentication failed");
+                return;
+            }
+
+            authenticated();
+            break;
+
+        case PKT_MSG:
+            if (!m_authenticated)
+            {
+                L_WARN << "node link: message before authentication, closing";
+                close();
+                return;
+            }
+
+            if (!Port::deliver((int) v->_i(0), v->_(1)))
+            {
+                L_WARN << "node link to '" << m_peer
+                       << "': no port with pid " << v->_i(0);
+            }
+            break;
+
+        default:
+            L_WARN << "node link to '" << m_peer
+                   << "': unknown packet type " << type;
+    }
+}
+//---------------------------------------------------------------------------
+
+void NodeLink::handle_frame_error(const std::string &err)
+{
+    L_WARN << "node link to '" << m_peer << "': " << err << ", closing";
+    close();
+}
+//---------------------------------------------------------------------------
+
+Node::Node() : m_acceptor(m_io)
+{
+}
+//---------------------------------------------------------------------------
+
+Node::~Node()
+{
+    stop();
+}
+//---------------------------------------------------------------------------
+
+Node &Node::global()
+{
+    static Node node;
+    return node;
+}
+//---------------------------------------------------------------------------
+
+void Node::set_name(const std::string &name)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    m_name = name;
+}
+//---------------------------------------------------------------------------
+
+std::string Node::name()
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    return m_name;
+}
+//---------------------------------------------------------------------------
+
+void Node::set_secret(const std::string &secret)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    m_secret = secret;
+}
+//---------------------------------------------------------------------------
+
+std::string Node::auth_digest(const std::string &role,
+                              const std::string &accept_nonce,
+                              const std::string &dial_nonce,
+                              const std::string &from,
+                              const std::string &to)
+{
+    std::string secret;
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        secret = m_secret;
+    }
+
+    // msgpack keeps the fields apart, "ab" + "c" differs from "a" + "bc"
+    Poco::HMACEngine<Poco::SHA1Engine> hmac(secret);
+    hmac.update(msgpack_vv::to_msgpack(
+        vv_list() << vv(role) << vv(accept_nonce) << vv(dial_nonce)
+                  << vv(from) << vv(to)));
+    const Poco::DigestEngine::Digest &d = hmac.digest();
+    return std::string(d.begin(), d.end());
+}
+//---------------------------------------------------------------------------
+
+void Node::ensure_running()
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    if (m_thread.joinable())
+        return;
+
+    m_io.reset();
+    m_work.reset(new boost::asio::io_service::work(m_io));
+    m_thread = std::thread([this]()
+    {
+        for (;;)
+        {
+            try
+            {
+                m_io.run();
+                break;
+            }
+            catch (const std::exception &e)
+            {
+                L_ERROR << "node I/O thread: " << e.what();
+            }
+        }
+    });
+}
+//---------------------------------------------------------------------------
+
+int Node::listen(int port, const std::string &host)
+{
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        if (m_secret.empty())
+            throw std::runtime_error("node listen: no secret set");
+    }
+
+    tcp::endpoint ep(boost::asio::ip::address::from_string(host),
+                     (unsigned short) port);
+
+    m_acceptor.open(ep.protocol());
+    m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+    m_acceptor.bind(ep);
+    m_acceptor.listen();
+    int bound_port = m_acceptor.local_endpoint().port();
+
+    ensure_running();
+    m_io.post(std::bind(&Node::start_accept, this));
+    return bound_port;
+}
+//---------------------------------------------------------------------------
+
+void Node::start_accept()
+{
+    auto link = std::make_shared<NodeLink>(*this, m_io);
+    m_acceptor.async_accept(link->socket(),
+        [this, link](const boost::system::error_code &ec)
+        {
+            if (ec == boost::asio::error::operation_aborted)
+                return;
+
+            if (ec)
+            {
+                L_WARN << "node accept failed: " << ec.message();
+            }
+            else
+            {
+                {
+                    std::lock_guard<std::mutex> lg(m_mutex);
+                    m_all_links.insert(link);
+                }
+                link->start();
+            }
+
+            if (m_acceptor.is_open())
+                start_accept();
+        });
+}
+//---------------------------------------------------------------------------
+
+void Node::connect(const std::string &node, const std::string &host, int port)
+{
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        if (m_secret.empty())
+            throw std::runtime_error("node connect: no secret set");
+    }
+
+    ensure_running();
+
+    auto link = std::make_shared<NodeLink>(*this, m_io, node);
+
+    tcp::resolver resolver(m_io);
+    boost::asio::connect(
+        link->socket(),
+        resolver.resolve(tcp::resolver::query(host, std::to_string(port))));
+
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        m_links[node] = link;
+        m_all_links.insert(link);
+    }
+    link->start();
+}
+//---------------------------------------------------------------------------
+
+bool Node::send(const std::string &node, int pid, const VV &msg)
+{
+    std::shared_ptr<NodeLink> link;
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        auto it = m_links.find(node);
+        if (it == m_links.end())
+            return false;
+        link = it->second;
+    }
+
+    return link->send(pid, msg);
+}
+//---------------------------------------------------------------------------
+
+void Node::link_named(const std::string &node, const std::shared_ptr<NodeLink> &link)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    // If both sides connected to each other, keep the first link
+    // for sending. Both are still used for receiving.
+    if (m_links.find(node) == m_links.end())
+        m_links[node] = link;
+}
+//---------------------------------------------------------------------------
+
+void Node::link_closed(NodeLink *link)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+
+    for (auto it = m_links.begin(); it != m_links.end(); )
+    {
+        if (it->second.get() == link) it = m_links.erase(it);
+        else                          ++it;
+    }
+
+    for (auto it = m_all_links.begin(); it != m_all_links.end(); ++it)
+    {
+        if (it->get() == link)
+        {
+            m_all_links.erase(it);
+            break;
+        }
+    }
+}
+//---------------------------------------------------------------------------
+
+void Node::stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    m_io.post([this]()
+    {
+        boost::system::error_code ec;
+        m_acceptor.close(ec);
+
+        std::vector<std::shared_ptr<NodeLink>> links;
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            links.assign(m_all_links.begin(), m_all_links.end());
+        }
+        for (auto &l : links)
+            l->close();
+    });
+
+    m_work.reset();
+    m_thread.join();
+}
+//---------------------------------------------------------------------------
+
+} // namespace lal_rt
@@ -0,0 +1,202 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+
+#pragma once
+
+#include "base/vval.h"
+#include "msgpack/protoframing.h"
+#include <boost/asio.hpp>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/* Transport of port messages between lalrt instances ("nodes").
+ *
+ * Every node has a name and a port is globally addressed as "node:pid".
+ * Messages for pids on other nodes are encoded with msgpack and sent as
+ * ProtoFraming packets over one persistent TCP link per peer node.
+ *
+ * The links are driven by one I/O thread per Node. Messages are
+ * appended to the pending buffer of the link and written as soon as
+ * the previous write completed. Everything that was queued in the mean
+ * time goes out with a single write, so small messages are batched
+ * under load without ever waiting for more data (TCP_NODELAY is set).
+ *
+ * Links are authenticated with a shared secret that must be set on
+ * both nodes. The accepting side sends a random nonce, the dialing
+ * side answers with its name, a nonce of its own and an HMAC, and the
+ * accepting side proves itself with an HMAC as well:
+ *
+ *   accept -> dial:   CHALLENGE  Na
+ *   dial   -> accept: HELLO      name, Nd, HMAC("dial", Na, Nd, name, accepting node)
+ *   accept -> dial:   WELCOME    HMAC("accept", Na, Nd, accepting node, name)
+ *
+ * Only the dialing side answers a challenge, and only for the node it
+ * dialed. Both nonces and the role are part of each HMAC, so neither
+ * answer can be replayed on another link or reflected back in the other
+ * direction. Messages are only sent and routed once the peer proved
+ * knowledge of the secret, any other packet closes the link. The
+ * messages themselves are neither signed nor encrypted, links over
+ * untrusted networks belong into a VPN or SSH tunnel. */
+
+namespace lal_rt
+{
+//---------------------------------------------------------------------------
+
+/// Splits a global pid "node:pid" into its parts.
+/// Returns false if address is not in that form.
+bool parse_global_pid(const std::string &address, std::string &node, int &pid);
+
+//---------------------------------------------------------------------------
+
+class Node;
+
+/// One TCP connection to another node.
+class NodeLink : public msgpack::ProtoFraming,
+                 public std::enable_shared_from_this<NodeLink>
+{
+    public:
+        enum PacketType
+        {
+            PKT_HELLO     = 1,  // payload: [node name, nonce, HMAC]
+            PKT_MSG       = 2,  // payload: [destination pid, message]
+            PKT_CHALLENGE = 3,  // payload: random nonce
+            PKT_WELCOME   = 4   // payload: HMAC
+        };
+
+    private:
+        Node                           &m_node;
+        boost::asio::io_service        &m_io;
+        boost::asio::ip::tcp::socket    m_socket;
+        std::string                     m_peer;
+        bool                            m_dialed;        // by connect()
+        std::string                     m_accept_nonce;  // CHALLENGE
+        std::string                     m_dial_nonce;    // HELLO
+        bool                            m_authenticated; // under m_send_mutex
+
+        std::mutex                      m_send_mutex;
+        UTF8Buffer                      m_pending;  // framed, not yet written
+        std::string                     m_out;      // being written
+        bool                            m_writing;
+        bool                            m_closed;
+        std::vector<std::string>        m_held;     // PKT_MSG before auth
+        size_t                          m_held_bytes;
+
+        char                            m_recv_buf[64 * 1024];
+
+        bool queue_packet(const std::string &payload, uint16_t type);
+        void start_write();
+        void start_read();
+        void authenticated();
+        void auth_failed(const char *what);
+
+    public:
+        /// dialed is the name of the node connect() dialed,
+        /// empty for accepted links.
+        NodeLink(Node &node, boost::asio::io_service &io,
+                 const std::string &dialed = std::string());
+        virtual ~NodeLink() { }
+
+        boost::asio::ip::tcp::socket &socket() { return m_socket; }
+
+        /// Starts the handshake and reading.
+        void start();
+        /// Closes the connection, must be called in the I/O thread.
+        void close();
+
+        /// Queues msg for the port pid on the peer node.
+        /// Returns false if the link is already closed or the peer
+        /// does not keep up and the link was closed for that.
+        bool send(int pid, const VVal::VV &msg);
+
+        virtual void handle_recv_msg(const char *data, size_t len, uint16_t type);
+        virtual void handle_frame_error(const std::string &err);
+};
+//---------------------------------------------------------------------------
+
+class Node
+{
+    private:
+        std::string                                     m_name;
+        std::string                                     m_secret;
+        boost::asio::io_service                         m_io;
+        std::unique_ptr<boost::asio::io_service::work>  m_work;
+        boost::asio::ip::tcp::acceptor                  m_acceptor;
+        std::thread                                     m_thread;
+
+        std::mutex                                      m_mutex;
+        std::unordered_map<std::string, std::shared_ptr<NodeLink>> m_links;
+        std::unordered_set<std::shared_ptr<NodeLink>>   m_all_links;
+
+        void ensure_running();
+        void start_accept();
+
+    public:
+        Node();
+        ~Node();
+
+        /// The node of this lalrt instance.
+        static Node &global();
+
+        void        set_name(const std::string &name);
+        std::string name();
+
+        /// Sets the secret shared by all nodes that may link to this one.
+        void set_secret(const std::string &secret);
+
+        /// HMAC of one handshake step (role "dial" or "accept") sent
+        /// by node from to node to, see above.
+        std::string auth_digest(const std::string &role,
+                                const std::string &accept_nonce,
+                                const std::string &dial_nonce,
+                                const std::string &from,
+                                const std::string &to);
+
+        /// Accepts links from other nodes. Port 0 picks a free port.
+        /// Returns the port number.
+        /// Throws std::runtime_error if no secret was set.
+        int listen(int port, const std::string &host = "127.0.0.1");
+
+        /// Opens a link to the node with the given name.
+        /// Throws std::runtime_error if no secret was set and
+        /// boost::system::system_error if connecting fails.
+        void connect(const std::string &node, const std::string &host, int port);
+
+        /// Sends msg to the port pid on node.
+        /// Returns false if there is no link to that node.
+        bool send(const std::string &node, int pid, const VVal::VV &msg);
+
+        /// Closes all links and stops the I/O thread.
+        void stop();
+
+        // called by NodeLink in the I/O thread:
+        void link_named(const std::string &node, const std::shared_ptr<NodeLink> &link);
+        void link_closed(NodeLink *link);
+};
+//---------------------------------------------------------------------------
+
+} // namespace lal_rt
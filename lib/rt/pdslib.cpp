@@ -0,0 +1,249 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "rt/pdslib.h"
+#include "rt/lua_thread.h"
+#include "rt/lua_thread_helper.h"
+#include "base/vv_persistent.h"
+
+using namespace VVal;
+using namespace std;
+
+namespace lal_rt
+{
+//---------------------------------------------------------------------------
+
+static const PMapValue *as_pmap(const VV &v)
+{
+    return dynamic_cast<const PMapValue *>(v.get());
+}
+//---------------------------------------------------------------------------
+
+static const PVectorValue *as_pvector(const VV &v)
+{
+    return dynamic_cast<const PVectorValue *>(v.get());
+}
+//---------------------------------------------------------------------------
+
+static void not_a_collection(const char *func, const VV &v)
+{
+    throw LuaThreadException(
+        string(func) + ": expected a pmap or pvector, got: " + v->s());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(pds_map,
+"@pds procedure (pds-map)\n"
+"@pds procedure (pds-map _map_)\n\n"
+"Returns a persistent map with the entries of _map_, or an empty one.\n"
+"Persistent maps and vectors are immutable: `pds-assoc`, `pds-dissoc`\n"
+"and the like return a new version, that shares most of its memory\n"
+"with the old one. That makes them cheap to keep as actor state and\n"
+"to send as snapshot to other processes, they are passed as reference\n"
+"and not copied.\n"
+"Nested lists and maps are converted to persistent vectors and maps.\n"
+"\n"
+"    (let ((s  (pds-map { :count 0 }))\n"
+"          (s2 (pds-assoc s :count 1)))\n"
+"      (display [(pds-get s :count) (pds-get s2 :count)]))\n"
+"    ;=> [0 1]\n"
+)
+{
+    VV data = vv_args->_(0);
+    if (data->is_undef() || (data->is_list() && data->size() == 0))
+        return vv_pmap();
+    if (!data->is_map())
+        throw LuaThreadException("pds-map: expected a map, got: " + data->s());
+    return vv_to_persistent(data);
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(pds_vector,
+"@pds procedure (pds-vector)\n"
+"@pds procedure (pds-vector _list_)\n\n"
+"Returns a persistent vector with the elements of _list_, or an empty one.\n"
+"Indices are 0 based. See also `pds-map`.\n"
+"\n"
+"    (pds-count (pds-conj (pds-vector [1 2]) 3))\n"
+"    ;=> 3\n"
+)
+{
+    VV data = vv_args->_(0);
+    if (data->is_undef())
+        return vv_pvector();
+    if (!data->is_list())
+        throw LuaThreadException("pds-vector: expected a list, got: " + data->s());
+    return vv_to_persistent(data);
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(pds_assoc,
+"@pds procedure (pds-assoc _coll_ _key_ _value_)\n\n"
+"Returns a new version of the persistent map or vector _coll_, in which\n"
+"_key_ is set to _value_. For vectors _key_ is the index, which may be\n"
+"the count to append.\n"
+)
+{
+    VV coll  = vv_args->_(0);
+    VV value = vv_to_persistent(vv_args->_(2));
+    if (auto m = as_pmap(coll))
+        return vv_pmap(m->map().assoc(vv_args->_s(1), value));
+    if (auto v = as_pvector(coll))
+    {
+        int64_t i = vv_args->_i(1);
+        if (i < 0 || i > (int64_t) v->vector().size())
+            throw LuaThreadException("pds-assoc: index out of range: " + vv_args->_s(1));
+        return vv_pvector(v->vector().assoc((size_t) i, value));
+    }
+    not_a_collection("pds-assoc", coll);
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(pds_dissoc,
+"@pds procedure (pds-dissoc _pmap_ _key_)\n\n"
+"Returns a new version of _pmap_ without _key_.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (auto m = as_pmap(coll))
+        return vv_pmap(m->map().dissoc(vv_args->_s(1)));
+    throw LuaThreadException("pds-dissoc: expected a pmap, got: " + coll->s());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(pds_conj,
+"@pds procedure (pds-conj _coll_ _value_)\n\n"
+"Returns a new version of _coll_ with _value_ added: Vectors get it\n"
+"appended, to maps _value_ is a `[key value]` pair.\n"
+)
+{
+    VV coll  = vv_args->_(0);
+    VV value = vv_args->_(1);
+    if (auto v = as_pvector(coll))
+        return vv_pvector(v->vector().conj(vv_to_persistent(value)));
+    if (auto m = as_pmap(coll))
+        return vv_pmap(m->map().assoc(value->_s(0), vv_to_persistent(value->_(1))));
+    not_a_collection("pds-conj", coll);
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(pds_pop,
+"@pds procedure (pds-pop _pvector_)\n\n"
+"Returns a new version of _pvector_ without the last element.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (auto v = as_pvector(coll))
+        return vv_pvector(v->vector().pop());
+    throw LuaThreadException("pds-pop: expected a pvector, got: " + coll->s());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(pds_get,
+"@pds procedure (pds-get _coll_ _key_)\n"
+"@pds procedure (pds-get _coll_ _key_ _default_)\n\n"
+"Returns the value for _key_ (or index) in the persistent map or\n"
+"vector _coll_, or _default_ if there is none.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (auto m = as_pmap(coll))
+    {
+        const VV *v = m->map().find(vv_args->_s(1));
+        return v ? *v : vv_args->_(2);
+    }
+    if (auto v = as_pvector(coll))
+    {
+        int64_t i = vv_args->_i(1);
+        if (i < 0 || i >= (int64_t) v->vector().size())
+            return vv_args->_(2);
+        return v->vector().at((size_t) i);
+    }
+    not_a_collection("pds-get", coll);
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(pds_contains_Q,
+"@pds procedure (pds-contains? _coll_ _key_)\n\n"
+"Returns `#true` if the persistent map _coll_ has _key_, or if the index\n"
+"_key_ is in the range of the persistent vector _coll_.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (auto m = as_pmap(coll))
+        return vv_bool(m->map().find(vv_args->_s(1)) != nullptr);
+    if (auto v = as_pvector(coll))
+    {
+        int64_t i = vv_args->_i(1);
+        return vv_bool(i >= 0 && i < (int64_t) v->vector().size());
+    }
+    not_a_collection("pds-contains?", coll);
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(pds_count,
+"@pds procedure (pds-count _coll_)\n\n"
+"Returns the number of entries of the persistent map or vector _coll_.\n"
+)
+{
+    VV coll = vv_args->_(0);
+    if (!coll->is_persistent())
+        not_a_collection("pds-count", coll);
+    return vv((int64_t) coll->size());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(pds_to_data,
+"@pds procedure (pds-to-data _coll_)\n\n"
+"Returns the contents of the persistent map or vector _coll_ as plain\n"
+"(mutable) map or list, nested persistent values are converted too.\n"
+"\n"
+"    (pds-to-data (pds-assoc (pds-map) :a [1 2]))\n"
+"    ;=> {:a [1 2]}\n"
+)
+{
+    return vv_from_persistent(vv_args->_(0));
+}
+//---------------------------------------------------------------------------
+
+void init_pdslib(LuaThread *t, Lua::Instance &lua)
+{
+    VV obj(vv_list() << vv_ptr(t, "LuaThread"));
+
+    LUA_REG(lua, "pds", "map",       obj, pds_map);
+    LUA_REG(lua, "pds", "vector",    obj, pds_vector);
+    LUA_REG(lua, "pds", "assoc",     obj, pds_assoc);
+    LUA_REG(lua, "pds", "dissoc",    obj, pds_dissoc);
+    LUA_REG(lua, "pds", "conj",      obj, pds_conj);
+    LUA_REG(lua, "pds", "pop",       obj, pds_pop);
+    LUA_REG(lua, "pds", "get",       obj, pds_get);
+    LUA_REG(lua, "pds", "containsQ", obj, pds_contains_Q);
+    LUA_REG(lua, "pds", "count",     obj, pds_count);
+    LUA_REG(lua, "pds", "toData",    obj, pds_to_data);
+}
+
+} // namespace lal_rt
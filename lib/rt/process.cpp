@@ -23,6 +23,9 @@
 
 #include "rt/process.h"
 #include "rt/log.h"
+#include "rt/node.h"
+#include "rt/subprocess.h"
+#include <stdexcept>
 
 using namespace VVal;
 
@@ -44,24 +47,27 @@ void start_process(Process *p, const VV &args)
     {
         v_ret = p->execute(args);
 
-        p->m_port.emit_message(vv_list() << "process::exit" << "ok" << v_ret);
+        p->m_port.emit_message(vv_list() << vv_atom(atom::PROCESS_EXIT) << vv_atom(atom::OK) << v_ret);
     }
     catch (std::exception &ex)
     {
         L_ERROR << "*PROCESS EXCEPTION* (" << p->m_port.pid() << "): " << ex.what();
-        p->m_port.emit_message(vv_list() << "process::exit" << "exception" << ex.what());
+        p->m_port.emit_message(vv_list() << vv_atom(atom::PROCESS_EXIT) << vv_atom(atom::EXCEPTION) << ex.what());
     }
     catch (std::string &ex)
     {
         L_ERROR << "*PROCESS EXCEPTION* (" << p->m_port.pid() << "): " << ex;
-        p->m_port.emit_message(vv_list() << "process::exit" << "exception" << ex);
+        p->m_port.emit_message(vv_list() << vv_atom(atom::PROCESS_EXIT) << vv_atom(atom::EXCEPTION) << ex);
     }
     catch (...)
     {
         L_ERROR << "*PROCESS EXCEPTION* (" << p->m_port.pid() << ") UNKNOWN";
-        p->m_port.emit_message(vv_list() << "process::exit" << "exception");
+        p->m_port.emit_message(vv_list() << vv_atom(atom::PROCESS_EXIT) << vv_atom(atom::EXCEPTION));
     }
 
+    // children started with sys-exec! async: must not outlive us
+    SubprocessManager::global().kill_owned_by(p->m_port.pid());
+
     L_TRACE << "*PROCESS END* " << p->m_port.pid();
 
     if (p->should_delete_on_exit())
@@ -83,4 +89,35 @@ void PortList::unreg(Port *p)
 }
 //---------------------------------------------------------------------------
 
+std::string Port::global_pid()
+{
+    return Node::global().name() + ":" + std::to_string(m_pid);
+}
+//---------------------------------------------------------------------------
+
+int64_t Port::emit_message(const VV &base_msg, const std::string &address)
+{
+    std::string node;
+    int         pid = -1;
+    if (!parse_global_pid(address, node, pid))
+        throw std::runtime_error("Bad global pid: '" + address + "'");
+
+    if (node == Node::global().name())
+        return emit_message(base_msg, pid);
+
+    int64_t token = new_token();
+    VV msg = make_message(base_msg, vv(global_pid()), token);
+
+    if (m_msg_logging)
+    {
+        L_TRACE << "(" << m_pid << ") emit(->" << address << "): " << msg;
+    }
+
+    if (!Node::global().send(node, pid, msg))
+        throw std::runtime_error("No link to node '" + node + "'");
+
+    return token;
+}
+//---------------------------------------------------------------------------
+
 } // namespace lal_rt
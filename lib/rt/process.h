@@ -73,6 +73,33 @@ class Port
 
         std::function<bool(const VVal::VV &msg)> m_handler_interception;
 
+        VVal::VV make_message(const VVal::VV &base_msg,
+                              const VVal::VV &src_pid,
+                              int64_t token)
+        {
+            VVal::VV msg;
+
+            if (base_msg->is_list())
+            {
+                msg = VVal::vv_list() << src_pid << token;
+                for (auto i : *base_msg)
+                    msg << i;
+            }
+            else if (base_msg->is_map())
+            {
+                base_msg->set("pid",   src_pid);
+                base_msg->set("token", VVal::vv(token));
+                msg = base_msg;
+            }
+            else
+            {
+                msg = VVal::vv_list() << src_pid << token;
+                msg << base_msg;
+            }
+
+            return msg;
+        }
+
     public:
         boost::signals2::signal<void(const VVal::VV &)> m_parent_emitter;
         boost::signals2::signal<void()>                 m_unsafe_msg_arrived;
@@ -104,6 +131,19 @@ class Port
 
         int pid() { return m_pid; }
 
+        /// The pid as "node:pid", see Node.
+        std::string global_pid();
+
+        /// Passes msg to the port with the given pid.
+        /// Returns false if there is no such port.
+        static bool deliver(int pid, const VVal::VV &msg)
+        {
+            Port *dest = m_port_list.get(pid);
+            if (!dest) return false;
+            dest->handle(msg);
+            return true;
+        }
+
         int64_t new_token() { return m_token_counter++; }
 
         void notify_msg_arrived_async() { m_unsafe_msg_arrived(); }
@@ -112,26 +152,8 @@ class Port
 
         int64_t emit_message(const VVal::VV &base_msg, int pid = -1)
         {
-            VVal::VV msg;
             int64_t token = new_token();
-
-            if (base_msg->is_list())
-            {
-                msg = VVal::vv_list() << m_pid << token;
-                for (auto i : *base_msg)
-                    msg << i;
-            }
-            else if (base_msg->is_map())
-            {
-                base_msg->set("pid",   VVal::vv(m_pid));
-                base_msg->set("token", VVal::vv(token));
-                msg = base_msg;
-            }
-            else
-            {
-                msg = VVal::vv_list() << m_pid << token;
-                msg << base_msg;
-            }
+            VVal::VV msg = make_message(base_msg, VVal::vv(m_pid), token);
 
             if (m_msg_logging)
             {
@@ -151,6 +173,12 @@ class Port
             return token;
         }
 
+        /// Sends base_msg to the global pid "node:pid". Messages for
+        /// other nodes carry the global pid of this port as sender.
+        /// Throws std::runtime_error if the address is malformed
+        /// or there is no link to the node.
+        int64_t emit_message(const VVal::VV &base_msg, const std::string &address);
+
         virtual void handle(const VVal::VV &msg)
         {
             if (m_msg_logging)
@@ -0,0 +1,604 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+
+#include "rt/subprocess.h"
+#include "rt/process.h"
+#include "rt/log.h"
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#   include <cerrno>
+#   include <cstring>
+#   include <csignal>
+#   include <fcntl.h>
+#   include <spawn.h>
+#   include <sys/wait.h>
+#   include <unistd.h>
+extern char **environ;
+#endif
+
+using namespace VVal;
+
+namespace lal_rt
+{
+//---------------------------------------------------------------------------
+
+#if !defined(_WIN32)
+
+static void make_pipe(int fds[2])
+{
+#if defined(__linux__)
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        throw std::runtime_error(std::string("pipe failed: ") + strerror(errno));
+#else
+    if (pipe(fds) != 0)
+        throw std::runtime_error(std::string("pipe failed: ") + strerror(errno));
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+}
+//---------------------------------------------------------------------------
+
+/// One child process, all members are only used in the I/O thread.
+class Subprocess : public std::enable_shared_from_this<Subprocess>
+{
+    private:
+        typedef boost::asio::posix::stream_descriptor descriptor;
+
+        SubprocessManager          &m_mgr;
+        int64_t                     m_id;
+        int                         m_reply_pid;
+        pid_t                       m_os_pid;
+        int                         m_fds[3];   // stdin, stdout, stderr
+        int64_t                     m_timeout_ms;
+
+        descriptor                  m_stdin;
+        descriptor                  m_stdout;
+        descriptor                  m_stderr;
+        boost::asio::steady_timer   m_timer;
+
+        std::string                 m_in_pending;
+        std::string                 m_in_writing;
+        bool                        m_writing;
+        bool                        m_close_stdin;
+
+        char                        m_out_buf[16 * 1024];
+        char                        m_err_buf[16 * 1024];
+        int                         m_open_outputs;
+
+        bool                        m_exited;
+        bool                        m_timed_out;
+        bool                        m_done;
+        int                         m_status;
+
+        void start_write();
+        void start_read(descriptor &d, char *buf, size_t len, const char *cmd);
+        void check_finished();
+        void emit(const char *cmd, const VV &data);
+
+    public:
+        Subprocess(SubprocessManager &mgr, int64_t id, int reply_pid,
+                   pid_t os_pid, int fds[3], int64_t timeout_ms)
+            : m_mgr(mgr),
+              m_id(id),
+              m_reply_pid(reply_pid),
+              m_os_pid(os_pid),
+              m_timeout_ms(timeout_ms),
+              m_stdin(mgr.io()),
+              m_stdout(mgr.io()),
+              m_stderr(mgr.io()),
+              m_timer(mgr.io()),
+              m_writing(false),
+              m_close_stdin(false),
+              m_open_outputs(2),
+              m_exited(false),
+              m_timed_out(false),
+              m_done(false),
+              m_status(0)
+        {
+            for (int i = 0; i < 3; i++)
+                m_fds[i] = fds[i];
+        }
+
+        /// The pid of the port that started the child.
+        int owner() const { return m_reply_pid; }
+
+        void start();
+        void write_stdin(const std::string &data);
+        void close_stdin();
+        void kill(int sig);
+        void check_exit();
+        /// Kills and reaps the child without sending the exit message.
+        void abort();
+};
+//---------------------------------------------------------------------------
+
+void Subprocess::start()
+{
+    m_stdin.assign(m_fds[0]);
+    m_stdout.assign(m_fds[1]);
+    m_stderr.assign(m_fds[2]);
+    m_stdin.non_blocking(true);
+    m_stdout.non_blocking(true);
+    m_stderr.non_blocking(true);
+
+    start_read(m_stdout, m_out_buf, sizeof(m_out_buf), "sys::exec-stdout");
+    start_read(m_stderr, m_err_buf, sizeof(m_err_buf), "sys::exec-stderr");
+
+    if (m_timeout_ms > 0)
+    {
+        auto self = shared_from_this();
+        m_timer.expires_from_now(std::chrono::milliseconds(m_timeout_ms));
+        m_timer.async_wait([self](const boost::system::error_code &ec)
+        {
+            if (ec || self->m_done)
+                return;
+
+            self->m_timed_out = true;
+            if (!self->m_exited)
+                ::kill(self->m_os_pid, SIGKILL);
+
+            // The child is gone, but something else might still hold
+            // the output pipes open:
+            boost::system::error_code cec;
+            self->m_stdout.close(cec);
+            self->m_stderr.close(cec);
+        });
+    }
+
+    // the SIGCHLD might have come before we were registered:
+    check_exit();
+    start_write();
+}
+//---------------------------------------------------------------------------
+
+void Subprocess::emit(const char *cmd, const VV &data)
+{
+    VV msg(vv_list());
+    msg << vv(m_reply_pid) << vv(m_mgr.new_token()) << vv_atom(cmd) << vv(m_id) << data;
+
+    if (!Port::deliver(m_reply_pid, msg) && !m_exited)
+    {
+        L_WARN << "sys-exec: port " << m_reply_pid
+               << " is gone, killing child " << m_os_pid;
+        ::kill(m_os_pid, SIGKILL);
+    }
+}
+//---------------------------------------------------------------------------
+
+void Subprocess::start_read(descriptor &d, char *buf, size_t len, const char *cmd)
+{
+    auto self = shared_from_this();
+    d.async_read_some(boost::asio::buffer(buf, len),
+        [self, &d, buf, len, cmd](const boost::system::error_code &ec, size_t n)
+        {
+            if (ec)
+            {
+                boost::system::error_code cec;
+                d.close(cec);
+                self->m_open_outputs--;
+                self->check_finished();
+                return;
+            }
+
+            self->emit(cmd, vv(std::string(buf, n)));
+            self->start_read(d, buf, len, cmd);
+        });
+}
+//---------------------------------------------------------------------------
+
+void Subprocess::start_write()
+{
+    if (m_writing || m_done)
+        return;
+
+    if (m_in_pending.empty())
+    {
+        if (m_close_stdin)
+        {
+            boost::system::error_code ec;
+            m_stdin.close(ec);
+        }
+        return;
+    }
+
+    m_in_writing.swap(m_in_pending);
+    m_in_pending.clear();
+    m_writing = true;
+
+    auto self = shared_from_this();
+    boost::asio::async_write(m_stdin, boost::asio::buffer(m_in_writing),
+        [self](const boost::system::error_code &ec, size_t)
+        {
+            self->m_writing = false;
+            if (ec)
+            {
+                // child closed its stdin, drop the rest
+                self->m_in_pending.clear();
+                self->m_close_stdin = true;
+            }
+            self->start_write();
+        });
+}
+//---------------------------------------------------------------------------
+
+void Subprocess::write_stdin(const std::string &data)
+{
+    if (m_close_stdin)
+        return;
+    m_in_pending += data;
+    start_write();
+}
+//---------------------------------------------------------------------------
+
+void Subprocess::close_stdin()
+{
+    m_close_stdin = true;
+    start_write();
+}
+//---------------------------------------------------------------------------
+
+void Subprocess::kill(int sig)
+{
+    if (!m_exited)
+        ::kill(m_os_pid, sig);
+}
+//---------------------------------------------------------------------------
+
+void Subprocess::check_exit()
+{
+    if (m_exited)
+        return;
+
+    int status = 0;
+    if (waitpid(m_os_pid, &status, WNOHANG) != m_os_pid)
+        return;
+
+    m_exited = true;
+    m_status = status;
+    check_finished();
+}
+//---------------------------------------------------------------------------
+
+void Subprocess::check_finished()
+{
+    if (m_done || !m_exited || m_open_outputs > 0)
+        return;
+    m_done = true;
+
+    boost::system::error_code ec;
+    m_timer.cancel(ec);
+    m_stdin.close(ec);
+
+    VV info(vv_map());
+    if (WIFEXITED(m_status))
+    {
+        info->set("exit-code", vv(WEXITSTATUS(m_status)));
+        info->set("signal",    vv_undef());
+    }
+    else
+    {
+        info->set("exit-code", vv_undef());
+        info->set("signal",    vv(WIFSIGNALED(m_status) ? WTERMSIG(m_status) : 0));
+    }
+    info->set("timed-out", vv_bool(m_timed_out));
+
+    emit("sys::exec-exit", info);
+    m_mgr.finished(m_id);
+}
+//---------------------------------------------------------------------------
+
+void Subprocess::abort()
+{
+    m_done = true;
+    if (!m_exited)
+    {
+        ::kill(m_os_pid, SIGKILL);
+        int status = 0;
+        waitpid(m_os_pid, &status, 0);
+        m_exited = true;
+    }
+
+    boost::system::error_code ec;
+    m_timer.cancel(ec);
+    m_stdin.close(ec);
+    m_stdout.close(ec);
+    m_stderr.close(ec);
+}
+//---------------------------------------------------------------------------
+
+#else // _WIN32
+
+class Subprocess
+{
+    public:
+        int owner() const { return -1; }
+        void write_stdin(const std::string &) { }
+        void close_stdin() { }
+        void kill(int) { }
+        void check_exit() { }
+        void abort() { }
+};
+
+#endif
+//---------------------------------------------------------------------------
+
+SubprocessManager::SubprocessManager()
+    : m_next_id(1),
+      m_next_token(0)
+{
+}
+//---------------------------------------------------------------------------
+
+SubprocessManager::~SubprocessManager()
+{
+    stop();
+}
+//---------------------------------------------------------------------------
+
+SubprocessManager &SubprocessManager::global()
+{
+    static SubprocessManager mgr;
+    return mgr;
+}
+//---------------------------------------------------------------------------
+
+void SubprocessManager::ensure_running()
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    if (m_thread.joinable())
+        return;
+
+#if !defined(_WIN32)
+    // Writing to the stdin of a dead child must not kill us:
+    signal(SIGPIPE, SIG_IGN);
+
+    m_io.reset();
+    m_work.reset(new boost::asio::io_service::work(m_io));
+    m_sigchld.reset(new boost::asio::signal_set(m_io, SIGCHLD));
+    wait_sigchld();
+#endif
+
+    m_thread = std::thread([this]()
+    {
+        for (;;)
+        {
+            try
+            {
+                m_io.run();
+                break;
+            }
+            catch (const std::exception &e)
+            {
+                L_ERROR << "subprocess I/O thread exception: " << e.what();
+            }
+        }
+    });
+}
+//---------------------------------------------------------------------------
+
+void SubprocessManager::wait_sigchld()
+{
+    m_sigchld->async_wait([this](const boost::system::error_code &ec, int)
+    {
+        if (ec)
+            return;
+
+        // SIGCHLDs of several children may have been merged into one:
+        std::vector<std::shared_ptr<Subprocess>> procs;
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            for (auto &p : m_procs)
+                procs.push_back(p.second);
+        }
+        for (auto &p : procs)
+            p->check_exit();
+
+        wait_sigchld();
+    });
+}
+//---------------------------------------------------------------------------
+
+std::shared_ptr<Subprocess> SubprocessManager::get(int64_t id, int owner_pid)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    auto it = m_procs.find(id);
+    if (it == m_procs.end() || it->second->owner() != owner_pid)
+        return std::shared_ptr<Subprocess>();
+    return it->second;
+}
+//---------------------------------------------------------------------------
+
+int64_t SubprocessManager::start(int reply_pid,
+                                 const std::string &prog,
+                                 const std::vector<std::string> &args,
+                                 const std::string &stdin_data,
+                                 bool keep_stdin,
+                                 int64_t timeout_ms)
+{
+#if defined(_WIN32)
+    (void) reply_pid; (void) prog; (void) args;
+    (void) stdin_data; (void) keep_stdin; (void) timeout_ms;
+    throw std::runtime_error("asynchronous subprocesses are not supported on Windows");
+#else
+    ensure_running();
+
+    int in[2], out[2], err[2];
+    make_pipe(in);
+    try { make_pipe(out); }
+    catch (...) { close(in[0]); close(in[1]); throw; }
+    try { make_pipe(err); }
+    catch (...) { close(in[0]); close(in[1]); close(out[0]); close(out[1]); throw; }
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, in[0],  0);
+    posix_spawn_file_actions_adddup2(&fa, out[1], 1);
+    posix_spawn_file_actions_adddup2(&fa, err[1], 2);
+
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>(prog.c_str()));
+    for (auto &a : args)
+        argv.push_back(const_cast<char *>(a.c_str()));
+    argv.push_back(nullptr);
+
+    pid_t os_pid = 0;
+    int rc = posix_spawnp(&os_pid, prog.c_str(), &fa, nullptr, &argv[0], environ);
+    posix_spawn_file_actions_destroy(&fa);
+
+    close(in[0]);
+    close(out[1]);
+    close(err[1]);
+
+    if (rc != 0)
+    {
+        close(in[1]);
+        close(out[0]);
+        close(err[0]);
+        throw std::runtime_error(
+            "can't start '" + prog + "': " + strerror(rc));
+    }
+
+    int fds[3] = { in[1], out[0], err[0] };
+    std::shared_ptr<Subprocess> p;
+    int64_t id = 0;
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        id = m_next_id++;
+        p = std::make_shared<Subprocess>(*this, id, reply_pid, os_pid, fds, timeout_ms);
+        m_procs[id] = p;
+    }
+
+    m_io.post([p, stdin_data, keep_stdin]()
+    {
+        p->start();
+        if (!stdin_data.empty())
+            p->write_stdin(stdin_data);
+        if (!keep_stdin)
+            p->close_stdin();
+    });
+
+    return id;
+#endif
+}
+//---------------------------------------------------------------------------
+
+bool SubprocessManager::write_stdin(int64_t id, int owner_pid, const std::string &data)
+{
+    auto p = get(id, owner_pid);
+    if (!p) return false;
+    m_io.post([p, data]() { p->write_stdin(data); });
+    return true;
+}
+//---------------------------------------------------------------------------
+
+bool SubprocessManager::close_stdin(int64_t id, int owner_pid)
+{
+    auto p = get(id, owner_pid);
+    if (!p) return false;
+    m_io.post([p]() { p->close_stdin(); });
+    return true;
+}
+//---------------------------------------------------------------------------
+
+bool SubprocessManager::kill(int64_t id, int owner_pid, int sig)
+{
+    auto p = get(id, owner_pid);
+    if (!p) return false;
+    m_io.post([p, sig]() { p->kill(sig); });
+    return true;
+}
+//---------------------------------------------------------------------------
+
+void SubprocessManager::kill_owned_by(int owner_pid)
+{
+    std::vector<std::shared_ptr<Subprocess>> procs;
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        for (auto it = m_procs.begin(); it != m_procs.end(); )
+        {
+            if (it->second->owner() == owner_pid)
+            {
+                procs.push_back(it->second);
+                it = m_procs.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+
+    for (auto &p : procs)
+        m_io.post([p]() { p->abort(); });
+}
+//---------------------------------------------------------------------------
+
+size_t SubprocessManager::running()
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    return m_procs.size();
+}
+//---------------------------------------------------------------------------
+
+int64_t SubprocessManager::new_token()
+{
+    return m_next_token++;
+}
+//---------------------------------------------------------------------------
+
+void SubprocessManager::finished(int64_t id)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+    m_procs.erase(id);
+}
+//---------------------------------------------------------------------------
+
+void SubprocessManager::stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    m_io.post([this]()
+    {
+        std::vector<std::shared_ptr<Subprocess>> procs;
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            for (auto &p : m_procs)
+                procs.push_back(p.second);
+            m_procs.clear();
+        }
+        for (auto &p : procs)
+            p->abort();
+
+        boost::system::error_code ec;
+        if (m_sigchld)
+            m_sigchld->cancel(ec);
+    });
+
+    m_work.reset();
+    m_thread.join();
+    m_sigchld.reset();
+}
+//---------------------------------------------------------------------------
+
+} // namespace lal_rt
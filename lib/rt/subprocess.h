@@ -0,0 +1,124 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+
+#pragma once
+
+#include "base/vval.h"
+#include <boost/asio.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/* Asynchronous child processes for LuaThreads.
+ *
+ * Children are started with posix_spawn and their stdin, stdout and
+ * stderr pipes are driven by one I/O thread (epoll/kqueue via asio), so
+ * the calling LuaThread never blocks on them. The output chunks and the
+ * exit status are delivered as messages to the port of the caller:
+ *
+ *    (<pid> <token> "sys::exec-stdout" <exec-id> <data-string>)
+ *    (<pid> <token> "sys::exec-stderr" <exec-id> <data-string>)
+ *    (<pid> <token> "sys::exec-exit"   <exec-id> { :exit-code <n> :signal <n>
+ *                                                  :timed-out <bool> })
+ *
+ * The exit message is always the last message of a child, it is sent
+ * after the child has terminated and both output pipes are closed.
+ *
+ * A child belongs to the port that started it, only that port may write
+ * to it or kill it. When the process of the port ends, its children are
+ * killed and reaped (see kill_owned_by()). */
+
+namespace lal_rt
+{
+//---------------------------------------------------------------------------
+
+class Subprocess;
+
+class SubprocessManager
+{
+    private:
+        boost::asio::io_service                         m_io;
+        std::unique_ptr<boost::asio::io_service::work>  m_work;
+        std::unique_ptr<boost::asio::signal_set>        m_sigchld;
+        std::thread                                     m_thread;
+
+        std::mutex                                      m_mutex;
+        std::unordered_map<int64_t, std::shared_ptr<Subprocess>> m_procs;
+        int64_t                                         m_next_id;
+        int64_t                                         m_next_token;
+
+        void ensure_running();
+        void wait_sigchld();
+        std::shared_ptr<Subprocess> get(int64_t id, int owner_pid);
+
+    public:
+        SubprocessManager();
+        ~SubprocessManager();
+
+        /// The manager of this lalrt instance.
+        static SubprocessManager &global();
+
+        /// Starts prog (searched in PATH) with args. The messages of the
+        /// child go to the port reply_pid. stdin_data is written to the
+        /// child, after that stdin is closed unless keep_stdin is set.
+        /// A timeout_ms > 0 kills the child after that time.
+        /// Returns the exec id of the child.
+        /// Throws std::runtime_error if the child can't be started.
+        int64_t start(int reply_pid,
+                      const std::string &prog,
+                      const std::vector<std::string> &args,
+                      const std::string &stdin_data,
+                      bool keep_stdin,
+                      int64_t timeout_ms);
+
+        /// Appends data to the stdin of the child.
+        /// These return false if there is no running child with that
+        /// id, that was started by the port owner_pid.
+        bool write_stdin(int64_t id, int owner_pid, const std::string &data);
+        /// Closes stdin after all pending data was written.
+        bool close_stdin(int64_t id, int owner_pid);
+        /// Sends the signal sig to the child.
+        bool kill(int64_t id, int owner_pid, int sig);
+
+        /// Kills and reaps all children started by the port owner_pid,
+        /// without sending their exit messages.
+        void kill_owned_by(int owner_pid);
+
+        /// Number of children that did not finish yet.
+        size_t running();
+
+        /// Kills all children and stops the I/O thread.
+        void stop();
+
+        // called by Subprocess in the I/O thread:
+        int64_t new_token();
+        void    finished(int64_t id);
+        boost::asio::io_service &io() { return m_io; }
+};
+//---------------------------------------------------------------------------
+
+} // namespace lal_rt
@@ -25,11 +25,16 @@
 #include "rt/syslib.h"
 #include "rt/lua_thread.h"
 #include "rt/lua_thread_helper.h"
+#include "rt/subprocess.h"
 #include <boost/filesystem.hpp>
 #include <Poco/Process.h>
 #include <Poco/Pipe.h>
 #include <Poco/PipeStream.h>
+#include <future>
 #include <regex>
+#include "base/dfa_regex.h"
+#include "base/lru_cache.h"
+#include "base/dir_walker.h"
 #include "rt/log.h"
 #include <boost/filesystem/detail/utf8_codecvt_facet.hpp>
 
@@ -62,119 +67,154 @@ VV_CLOSURE_DOC(file_exists_Q,
 }
 //---------------------------------------------------------------------------
 
-static VVal::VV extract_directory_entry(const std::string &flags, const directory_entry &e)
+/// A compiled regex of sys-find, either std::regex or (flag "l")
+/// the linear time dfa_regex.
+struct path_regex
 {
-    VVal::VV ent(vv_map());
+    std::shared_ptr<const std::regex>       m_re;
+    std::shared_ptr<const dfa_regex::Regex> m_dfa;
 
-    path p = e.path();
+    bool matches(const std::string &s) const
+    {
+        if (m_dfa)
+        {
+            dfa_regex::Match m;
+            return m_dfa->match(s, m);
+        }
+        return std::regex_match(s, *m_re);
+    }
+};
 
-    boost::system::error_code ec;
+/// Compiled regexes are shared between the calls of sys-find,
+/// keyed by the flags "i" and "l" + pattern.
+static LRUCache<std::string, path_regex> g_find_regex_cache(64);
+//---------------------------------------------------------------------------
 
-    if (flags.find_first_of("a") != std::string::npos)
-        ent->set("abs_path", vv(absolute(p).generic_string()));
-    if (flags.find_first_of("c") != std::string::npos)
-        ent->set("canonical_path", vv(canonical(p).generic_string()));
-    if (flags.find_first_of("r") != std::string::npos)
-        ent->set("relative_path", vv(relative(p).generic_string()));
-    ent->set("path", vv(p.generic_string()));
+static void make_regex_list_from_vv(const std::string &flags,
+                                    VV relist,
+                                    std::list<path_regex> &rl)
+{
+    bool case_insens = flags.find_first_of("i") != std::string::npos;
+    bool linear      = flags.find_first_of("l") != std::string::npos;
 
-    switch (e.status(ec).type())
-    {
-        case boost::filesystem::file_type::status_error:
-            ent->set("type", vv("error")); break;
-        case boost::filesystem::file_type::file_not_found:
-            ent->set("type", vv("not_found")); break;
-        case boost::filesystem::file_type::regular_file:
-            ent->set("type", vv("regular")); break;
-        case boost::filesystem::file_type::directory_file:
-            ent->set("type", vv("directory")); break;
-        case boost::filesystem::file_type::symlink_file:
-            ent->set("type", vv("symlink")); break;
-        case boost::filesystem::file_type::block_file:
-            ent->set("type", vv("block")); break;
-        case boost::filesystem::file_type::character_file:
-            ent->set("type", vv("char")); break;
-        case boost::filesystem::file_type::fifo_file:
-            ent->set("type", vv("fifo")); break;
-        case boost::filesystem::file_type::socket_file:
-            ent->set("type", vv("socket")); break;
-        case boost::filesystem::file_type::type_unknown:
-        default:
-            ent->set("type", vv("unknown")); break;
-    }
+    if (relist->is_undef())
+        return;
 
-    ent->set("size",  vv((int64_t) file_size(p, ec)));
-    ent->set("perms", vv(e.status(ec).permissions()));
-    ent->set("mtime", vv_dt(last_write_time(e.path(), ec)));
+    std::string key_prefix =
+        std::string(case_insens ? "i" : "") + (linear ? "l" : "") + ":";
 
-    return ent;
+    for (auto r : *relist)
+    {
+        std::string re = r->s();
+        rl.push_back(g_find_regex_cache.get_or_create(key_prefix + re, [&]()
+        {
+            path_regex pr;
+            if (linear)
+                pr.m_dfa = std::make_shared<const dfa_regex::Regex>(re, case_insens);
+            else if (case_insens)
+                pr.m_re = std::make_shared<const std::regex>(re, std::regex_constants::icase);
+            else
+                pr.m_re = std::make_shared<const std::regex>(re);
+            return pr;
+        }));
+    }
 }
 //---------------------------------------------------------------------------
 
-static void process_entry(const std::list<std::regex> &regexes,
-                          const std::string &flags,
-                          const directory_entry &e,
-                          const VV &list)
+/// Turns the entries of the directory walker into the results of
+/// sys-find. Runs in the walker threads.
+struct FindConverter
 {
-    path p = e.path();
-
-    if (flags.find_first_of("d") != std::string::npos)
-        if (!is_directory(p)) return;
-    if (flags.find_first_of("D") != std::string::npos)
-        if (is_directory(p)) return;
-    if (flags.find_first_of("f") != std::string::npos)
-        if (!is_regular_file(p)) return;
-    if (flags.find_first_of("F") != std::string::npos)
-        if (is_regular_file(p)) return;
-
-    std::string ps;
-    if (flags.find_first_of("a") != std::string::npos)
-        ps = absolute(p).generic_string();
-    else if (flags.find_first_of("c") != std::string::npos)
-        ps = canonical(p).generic_string();
-    else if (flags.find_first_of("r") != std::string::npos)
-        ps = relative(p).generic_string();
-    else // "g"
-        ps = p.generic_string();
-
-    bool match = regexes.empty();
-    for (auto r : regexes)
+    std::string           m_flags;
+    std::list<path_regex> m_regexes;
+    bool                  m_only_dirs, m_no_dirs;
+    bool                  m_only_files, m_no_files;
+    bool                  m_info;
+
+    FindConverter(const std::string &flags, const VV &regexes)
+        : m_flags(flags)
     {
-        if (std::regex_match(ps, r))
-        {
-            match = true;
-            break;
-        }
+        make_regex_list_from_vv(flags, regexes, m_regexes);
+        m_only_dirs  = has_flag('d');
+        m_no_dirs    = has_flag('D');
+        m_only_files = has_flag('f');
+        m_no_files   = has_flag('F');
+        m_info       = has_flag('Y');
+    }
+
+    bool has_flag(char c) const
+    {
+        return m_flags.find_first_of(c) != std::string::npos;
     }
 
-    if (match)
+    VV info(const dir_walker::Entry &e) const
     {
-        if (flags.find_first_of("Y") != std::string::npos)
+        VV ent(vv_map());
+        path p(e.path);
+
+        if (has_flag('a'))
+            ent->set("abs_path", vv(absolute(p).generic_string()));
+        if (has_flag('c'))
+            ent->set("canonical_path", vv(canonical(p).generic_string()));
+        if (has_flag('r'))
+            ent->set("relative_path", vv(relative(p).generic_string()));
+        ent->set("path",  vv(e.path));
+        ent->set("type",  vv(dir_walker::file_type_name(e.type)));
+        ent->set("size",  vv(e.size));
+        ent->set("perms", vv((int64_t) e.perms));
+        ent->set("mtime", vv_dt(e.mtime));
+
+        return ent;
+    }
+
+    VV operator()(const dir_walker::Entry &e) const
+    {
+        bool is_dir  = e.type == dir_walker::T_DIRECTORY;
+        bool is_file = e.type == dir_walker::T_REGULAR;
+        if ((m_only_dirs && !is_dir) || (m_no_dirs && is_dir)
+            || (m_only_files && !is_file) || (m_no_files && is_file))
+            return vv_undef();
+
+        std::string ps;
+        if (has_flag('a'))
+            ps = absolute(path(e.path)).generic_string();
+        else if (has_flag('c'))
+            ps = canonical(path(e.path)).generic_string();
+        else if (has_flag('r'))
+            ps = relative(path(e.path)).generic_string();
+        else // "g"
+            ps = e.path;
+
+        bool match = m_regexes.empty();
+        for (auto &r : m_regexes)
         {
-            list << extract_directory_entry(flags, e);
+            if (r.matches(ps))
+            {
+                match = true;
+                break;
+            }
         }
-        else
-            list << vv(ps);
+        if (!match)
+            return vv_undef();
+
+        return m_info ? info(e) : vv(ps);
     }
-}
+};
 //---------------------------------------------------------------------------
 
-static void make_regex_list_from_vv(const std::string &flags,
-                                    VV relist,
-                                    std::list<std::regex> &rl)
+static dir_walker::Options find_options(const std::string &flags,
+                                        const VV &regexes,
+                                        const VV &opts)
 {
-    bool case_insens = flags.find_first_of("i") != std::string::npos;
-
-    if (relist->is_undef())
-        return;
-
-    for (auto r : *relist)
-    {
-        if (case_insens)
-            rl.push_back(std::regex(r->s(), std::regex_constants::icase));
-        else
-            rl.push_back(std::regex(r->s()));
-    }
+    dir_walker::Options o;
+    o.recursive = flags.find_first_of("R") != std::string::npos;
+    o.need_stat = flags.find_first_of("Y") != std::string::npos;
+    o.convert   = FindConverter(flags, regexes);
+    if (opts->_("threads")->is_defined())
+        o.threads = (int) opts->_i("threads");
+    if (opts->_("batch-size")->is_defined())
+        o.batch_size = (size_t) opts->_i("batch-size");
+    return o;
 }
 //---------------------------------------------------------------------------
 
@@ -186,6 +226,7 @@ VV_CLOSURE_DOC(find,
 "_flags-string_ may contain one of the following mode chars:\n"
 "   \"R\"       - Search recursively.\n"
 "   \"i\"       - Regex matching is done case insensitive.\n"
+"   \"l\"       - Use the linear time regex matcher (see `util-re`).\n"
 "   \"d\"       - Only directories.\n"
 "   \"D\"       - Only non-directories.\n"
 "   \"f\"       - Only regular files.\n"
@@ -202,49 +243,132 @@ VV_CLOSURE_DOC(find,
 "_regex-or-regex-list_ may contain one or more regexes that the files may match.\n"
 "Matching one is enough\n"
 "\n"
+"Recursive searches read the directories with multiple threads, the\n"
+"order of the returned entries is not specified. Directories that\n"
+"can't be read are skipped. See also `sys-find-start` for big\n"
+"directory trees.\n"
+"\n"
 "   (sys-find \".\" \"iR\" \"(.*)\\.exe\")\n"
 )
 {
     std::string flags = vv_args->_s(1);
     path p(g_path(vv_args->_(0)));
 
-    if (exists(p))
-    {
-        if (!is_directory(p))
-            return vv_undef();
+    if (!exists(p) || !is_directory(p))
+        return vv_undef();
 
-        std::list<std::regex> rl;
-        make_regex_list_from_vv(flags, vv_args->_(2), rl);
+    dir_walker::Walker walker(
+        p.generic_string(), find_options(flags, vv_args->_(2), vv_undef()));
 
-        VV list(vv_list());
-        if (flags.find_first_of("R") != std::string::npos)
-        {
-            for (directory_entry &x : recursive_directory_iterator(p))
-                process_entry(rl, flags, x, list);
-        }
-        else
-        {
-            for (directory_entry &x : directory_iterator(p))
-                process_entry(rl, flags, x, list);
-        }
+    VV list(vv_list());
+    for (VV batch = walker.next_batch(); batch->is_defined(); batch = walker.next_batch())
+        for (auto e : *batch)
+            list << e;
 
-        return list;
-    }
-    else
+    return list;
+}
+//---------------------------------------------------------------------------
+
+typedef dir_walker::Walker DirWalker;
+
+VV_CLOSURE_DOC(find_start,
+"@sys:rt-sys procedure (sys-find-start _path-string_ _flags-string_ _regex-or-regex-list_ _options_)\n"
+"\n"
+"Like `sys-find`, but returns a handle instead of waiting for the\n"
+"whole directory tree. The results are fetched in batches with\n"
+"`sys-find-next` while the walk goes on in the background.\n"
+"Returns `nil` if _path-string_ is not a directory.\n"
+"_options_ is an optional map with the keys:\n"
+"\n"
+"- `:threads` Number of threads reading directories, default is the\n"
+"number of CPUs, but at least 4. With 1 thread or without the \"R\" flag\n"
+"the directories are read by `sys-find-next` itself.\n"
+"- `:batch-size` Maximum number of entries per batch, default 1000.\n"
+"\n"
+"    (let ((f (sys-find-start \"/data\" \"Rf\" \".*\\\\.log\" { :threads 16 })))\n"
+"      (do ((b (sys-find-next f) (sys-find-next f)))\n"
+"          ((nil? b) (sys-find-destroy f))\n"
+"        (for-each displayln b)))\n"
+)
+{
+    std::string flags = vv_args->_s(1);
+    path p(g_path(vv_args->_(0)));
+
+    if (!exists(p) || !is_directory(p))
         return vv_undef();
+
+    DirWalker *w =
+        new DirWalker(
+            p.generic_string(),
+            find_options(flags, vv_args->_(2), vv_args->_(3)));
+
+    LT->register_resource(w);
+    return vv_ptr((void *) w, "DirWalker");
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(find_next,
+"@sys:rt-sys procedure (sys-find-next _find-handle_)\n\n"
+"Returns the next batch of results (a list) of the handle from\n"
+"`sys-find-start`. Waits until a batch is complete. Returns `nil`,\n"
+"when the walk is finished.\n"
+"From Lua it can be used as iterator: `for batch in sys.findNext, f do ... end`\n"
+)
+{
+    LTRES(w, 0, DirWalker);
+    return w->next_batch();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(find_destroy,
+"@sys:rt-sys procedure (sys-find-destroy _find-handle_)\n\n"
+"Stops the walk of the handle and destroys it.\n"
+"Any further usage of it is an error!\n"
+)
+{
+    LTRES(w, 0, DirWalker);
+    LT->delete_resource((void *) w);
+    delete w;
+    return vv_undef();
 }
 //---------------------------------------------------------------------------
 
 VV_CLOSURE_DOC(exec_M,
-"@sys procedure (sys-exec! _mode-string-or-keyword_ _prog-path_ _arg-list_)\n\n"
+"@sys procedure (sys-exec! _mode-string-or-keyword_ _prog-path_ _arg-list_ [_options_])\n\n"
 "Starts the executable _prog-path_ with the arguments _arg-list_.\n"
-"The _mode_ decides, what is returned. Currently only the `simple:` mode\n"
-"is implemented. And it returns a data structure, that contains the exit code,\n"
-"and the complete output of the stderr and stdout streams.\n"
+"The _mode_ decides, what is returned.\n"
+"\n"
+"The `simple:` mode waits for the program and returns a data structure,\n"
+"that contains the exit code, and the complete output of the stderr and\n"
+"stdout streams.\n"
 "If an error occured, it will be logged and `exit-status` will be `nil`.\n"
 "\n"
 "    (sys-exec! simple: \"./foo.exe\" [])\n"
 "    ;=> { exit-status: 0 stderr: \"...\" stdout: \"...\" }\n"
+"\n"
+"The `async:` mode returns immediately with the _exec-id_ of the\n"
+"started program. Its output and exit status arrive as messages\n"
+"at the current process:\n"
+"\n"
+"    (<pid> <token> \"sys::exec-stdout\" <exec-id> <data-string>)\n"
+"    (<pid> <token> \"sys::exec-stderr\" <exec-id> <data-string>)\n"
+"    (<pid> <token> \"sys::exec-exit\"   <exec-id> { :exit-code <n> :signal <n> :timed-out <bool> })\n"
+"\n"
+"The exit message is the last message of the program. The _options_\n"
+"map of the `async:` mode can contain:\n"
+"\n"
+"- `:stdin` String that is written to the stdin of the program.\n"
+"- `:stdin-open` If true, stdin stays open for `sys-exec-write` until\n"
+"`sys-exec-close-stdin`. Otherwise it's closed after `:stdin` was written.\n"
+"- `:timeout-ms` Kills the program after that many milliseconds.\n"
+"\n"
+"The programs belong to the current process: only it can use\n"
+"`sys-exec-write`, `sys-exec-close-stdin` and `sys-exec-kill` on them,\n"
+"and they are killed when it terminates.\n"
+"The `async:` mode is not available on Windows.\n"
+"\n"
+"    (let ((id (sys-exec! async: \"sort\" [] { :stdin \"b\\na\\n\" })))\n"
+"      (mp-wait-infinite \"sys::exec-exit\"))\n"
 )
 {
     if (strip_lal_kw(vv_args->_s(0)) == "simple")
@@ -265,8 +389,13 @@ VV_CLOSURE_DOC(exec_M,
             PipeInputStream io_str(stdout_pipe);
             PipeInputStream ie_str(stderr_pipe);
 
+            // Read stderr concurrently, a child that fills the stderr
+            // pipe would block forever while we wait for stdout.
+            std::future<std::string> err_f =
+                std::async(std::launch::async, [&ie_str]() { return read_all(ie_str); });
+
             std::string out = read_all(io_str);
-            std::string err = read_all(ie_str);
+            std::string err = err_f.get();
 
             int rc = ph.wait();
 
@@ -281,10 +410,100 @@ VV_CLOSURE_DOC(exec_M,
             return vv_map() << vv_kv("error", e.what());
         }
     }
+    else if (strip_lal_kw(vv_args->_s(0)) == "async")
+    {
+        std::vector<std::string> args;
+        for (auto a : *(vv_args->_(2)))
+            args.push_back(a->s());
+
+        VV opts = vv_args->_(3);
+        try
+        {
+            return vv(SubprocessManager::global().start(
+                LT->m_port.pid(),
+                g_path(vv_args->_(1)),
+                args,
+                opts->_s("stdin"),
+                opts->_b("stdin-open"),
+                opts->_i("timeout-ms")));
+        }
+        catch (const std::exception &e)
+        {
+            throw LuaThreadException(
+                std::string("sys-exec! async: ") + e.what());
+        }
+    }
     else
         return vv_undef();
 }
 //---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(exec_write,
+"@sys procedure (sys-exec-write _exec-id_ _string_)\n\n"
+"Writes _string_ to the stdin of a program started with `sys-exec! async:`\n"
+"and `:stdin-open`. Returns `#false` if the program already finished\n"
+"or was not started by the current process.\n"
+)
+{
+    return vv_bool(
+        SubprocessManager::global().write_stdin(
+            vv_args->_i(0), LT->m_port.pid(), vv_args->_s(1)));
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(exec_close_stdin,
+"@sys procedure (sys-exec-close-stdin _exec-id_)\n\n"
+"Closes the stdin of a program started with `sys-exec! async:`, after\n"
+"everything written with `sys-exec-write` was passed to it.\n"
+"Returns `#false` if the program already finished or was not started\n"
+"by the current process.\n"
+)
+{
+    return vv_bool(
+        SubprocessManager::global().close_stdin(vv_args->_i(0), LT->m_port.pid()));
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(exec_kill,
+"@sys procedure (sys-exec-kill _exec-id_ [_signal-number_])\n\n"
+"Sends the signal _signal-number_ (default 9, SIGKILL) to a program\n"
+"started with `sys-exec! async:`. The `sys::exec-exit` message follows\n"
+"as usual. Returns `#false` if the program already finished or was\n"
+"not started by the current process.\n"
+)
+{
+    int sig = vv_args->_(1)->is_undef() ? 9 : (int) vv_args->_i(1);
+    return vv_bool(
+        SubprocessManager::global().kill(vv_args->_i(0), LT->m_port.pid(), sig));
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(log_level,
+"@sys procedure (sys-set-log-level _level-string-or-keyword_)\n\n"
+"Log records below the severity _level_ are dropped from now on.\n"
+"The levels are `trace:`, `debug:`, `info:`, `warning:`, `error:` and `fatal:`.\n"
+"Returns the previous level. Without argument only the current level\n"
+"is returned.\n"
+"\n"
+"    (sys-set-log-level info:) ;=> \"trace\"\n"
+)
+{
+    static const char *names[] =
+        { "trace", "debug", "info", "warning", "error", "fatal" };
+
+    VV prev = vv(names[(int) get_log_level()]);
+    if (vv_args->_(0)->is_undef())
+        return prev;
+
+    boost::log::trivial::severity_level level;
+    if (!parse_log_level(strip_lal_kw(vv_args->_s(0)), level))
+        throw LuaThreadException(
+            "sys-set-log-level: unknown level '" + vv_args->_s(0) + "'");
+
+    set_log_level(level);
+    return prev;
+}
+//---------------------------------------------------------------------------
 //---------------------------------------------------------------------------
 
 void init_syslib(LuaThread *t, Lua::Instance &lua)
@@ -299,7 +518,14 @@ void init_syslib(LuaThread *t, Lua::Instance &lua)
 
     LUA_REG(lua, "sys", "fileExistsQ", obj, file_exists_Q);
     LUA_REG(lua, "sys", "execM",       obj, exec_M);
+    LUA_REG(lua, "sys", "execWrite",   obj, exec_write);
+    LUA_REG(lua, "sys", "execCloseStdin", obj, exec_close_stdin);
+    LUA_REG(lua, "sys", "execKill",    obj, exec_kill);
+    LUA_REG(lua, "sys", "setLogLevel", obj, log_level);
     LUA_REG(lua, "sys", "find",        obj, find);
+    LUA_REG(lua, "sys", "findStart",   obj, find_start);
+    LUA_REG(lua, "sys", "findNext",    obj, find_next);
+    LUA_REG(lua, "sys", "findDestroy", obj, find_destroy);
 }
 //---------------------------------------------------------------------------
 
@@ -34,6 +34,12 @@
 #   define RE_PREFIX boost
 #endif
 #include "base/vval_util.h"
+#include "base/json_vv.h"
+#include "base/msgpack_vv.h"
+#include "base/dfa_regex.h"
+#include "base/lru_cache.h"
+#include <algorithm>
+#include <cstdio>
 
 using namespace VVal;
 using namespace std;
@@ -85,6 +91,219 @@ VV_CLOSURE_DOC(util_to_csv,
 }
 //---------------------------------------------------------------------------
 
+/// Resource behind the handles of util-csv-reader.
+struct CSVReader
+{
+    VVal::csv::Reader reader;
+    FILE             *file;
+
+    CSVReader(char sep, const string &row_sep)
+        : reader(sep, row_sep), file(nullptr)
+    { }
+    ~CSVReader() { if (file) fclose(file); }
+};
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_csv_reader,
+"@util procedure (util-csv-reader _options_)\n\n"
+"Returns a handle for reading big CSV inputs row by row.\n"
+"_options_ is a map with the following optional keys:\n"
+"\n"
+"- `:sep` The field separator, default is `,`.\n"
+"- `:row-sep` The row separator, default is `\"\\r\\n\"`.\n"
+"- `:file` Reads the input from this file. Otherwise the input has to\n"
+"be passed with `util-csv-reader-feed`.\n"
+"\n"
+"    (let ((r (util-csv-reader { :file \"big.csv\" :sep \";\" })))\n"
+"      (do ((row (util-csv-reader-next r) (util-csv-reader-next r)))\n"
+"          ((nil? row) (util-csv-reader-destroy r))\n"
+"        (display row)))\n"
+)
+{
+    VV     opts    = vv_args->_(0);
+    string sep     = opts->_s("sep");
+    string row_sep = opts->_s("row-sep");
+    if (sep.empty())     sep     = ",";
+    if (row_sep.empty()) row_sep = "\r\n";
+
+    CSVReader *r = new CSVReader(sep[0], row_sep);
+
+    if (opts->_("file")->is_defined())
+    {
+        r->file = fopen(opts->_s("file").c_str(), "rb");
+        if (!r->file)
+        {
+            delete r;
+            throw LuaThreadException(
+                "util-csv-reader: Can't open file: " + opts->_s("file"));
+        }
+        FILE *fh = r->file;
+        r->reader.set_source([fh](char *buf, size_t len)
+        {
+            return fread(buf, 1, len, fh);
+        });
+    }
+
+    LT->register_resource(r);
+    return vv_ptr((void *) r, "CSVReader");
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_csv_reader_feed,
+"@util procedure (util-csv-reader-feed _reader-handle_ _string_)\n"
+"@util procedure (util-csv-reader-feed _reader-handle_)\n\n"
+"Appends the chunk _string_ to the input of the reader. Without\n"
+"_string_ the end of the input is signalled.\n"
+)
+{
+    LTRES(r, 0, CSVReader);
+    if (vv_args->_(1)->is_undef())
+        r->reader.finish();
+    else
+    {
+        string chunk = vv_args->_s(1);
+        r->reader.feed(chunk.data(), chunk.size());
+    }
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_csv_reader_next,
+"@util procedure (util-csv-reader-next _reader-handle_)\n\n"
+"Returns the next row as list of strings or `nil` if the input ended\n"
+"or more input has to be fed.\n"
+"From Lua it can be used as iterator: `for row in util.csvReaderNext, r do ... end`\n"
+)
+{
+    LTRES(r, 0, CSVReader);
+    VV row;
+    if (r->reader.next(row))
+        return row;
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_csv_reader_destroy,
+"@util procedure (util-csv-reader-destroy _reader-handle_)\n\n"
+"Destroys the reader handle and closes its file.\n"
+"Any further usage of it is an error!\n"
+)
+{
+    LTRES(r, 0, CSVReader);
+    LT->delete_resource((void *) r);
+    delete r;
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+/// Resource behind the handles of util-csv-writer.
+struct CSVWriter
+{
+    VVal::csv::Writer writer;
+    FILE             *file;
+
+    CSVWriter(char sep, const string &row_sep)
+        : writer(sep, row_sep), file(nullptr)
+    { }
+    CSVWriter(FILE *fh, char sep, const string &row_sep)
+        : writer([fh](const char *data, size_t len)
+                 {
+                     if (fwrite(data, 1, len, fh) != len)
+                         throw LuaThreadException(
+                             "util-csv-writer: Can't write to file");
+                 }, sep, row_sep),
+          file(fh)
+    { }
+    ~CSVWriter() { if (file) fclose(file); }
+};
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_csv_writer,
+"@util procedure (util-csv-writer _options_)\n\n"
+"Returns a handle for writing CSV row by row, without holding the\n"
+"whole table in memory.\n"
+"_options_ is a map with the following optional keys:\n"
+"\n"
+"- `:sep` The field separator, default is `,`.\n"
+"- `:row-sep` The row separator, default is `\"\\r\\n\"`.\n"
+"- `:file` Writes the output to this file. Otherwise the output is\n"
+"collected and can be fetched with `util-csv-writer-take`.\n"
+"\n"
+"    (let ((w (util-csv-writer { :file \"out.csv\" :sep \";\" })))\n"
+"      (util-csv-writer-row w [1 2 \"x y\"])\n"
+"      (util-csv-writer-destroy w))\n"
+)
+{
+    VV     opts    = vv_args->_(0);
+    string sep     = opts->_s("sep");
+    string row_sep = opts->_s("row-sep");
+    if (sep.empty())     sep     = ",";
+    if (row_sep.empty()) row_sep = "\r\n";
+
+    CSVWriter *w = nullptr;
+    if (opts->_("file")->is_defined())
+    {
+        FILE *fh = fopen(opts->_s("file").c_str(), "wb");
+        if (!fh)
+            throw LuaThreadException(
+                "util-csv-writer: Can't open file: " + opts->_s("file"));
+        w = new CSVWriter(fh, sep[0], row_sep);
+    }
+    else
+        w = new CSVWriter(sep[0], row_sep);
+
+    LT->register_resource(w);
+    return vv_ptr((void *) w, "CSVWriter");
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_csv_writer_row,
+"@util procedure (util-csv-writer-row _writer-handle_ _row_)\n\n"
+"Appends the list _row_ as one row. Output to a file is written\n"
+"in chunks of a few kilobytes.\n"
+)
+{
+    LTRES(w, 0, CSVWriter);
+    w->writer.row(vv_args->_(1));
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_csv_writer_take,
+"@util procedure (util-csv-writer-take _writer-handle_)\n\n"
+"Returns the output collected since the last call and clears it.\n"
+"For writers with a `:file` this flushes the output to the file\n"
+"and returns an empty string.\n"
+)
+{
+    LTRES(w, 0, CSVWriter);
+    w->writer.flush();
+    return vv(w->writer.take());
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_csv_writer_destroy,
+"@util procedure (util-csv-writer-destroy _writer-handle_)\n\n"
+"Flushes the remaining output, destroys the writer handle and closes\n"
+"its file. Any further usage of it is an error!\n"
+)
+{
+    LTRES(w, 0, CSVWriter);
+    LT->delete_resource((void *) w);
+    try
+    {
+        w->writer.flush();
+    }
+    catch (...)
+    {
+        delete w;
+        throw;
+    }
+    delete w;
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
 VV_CLOSURE_DOC(util_to_json,
 "@util procedure (util-to-json _data_ _do-indent-bool_)\n"
 "@util procedure (util-to-json _data_)\n\n"
@@ -105,6 +324,140 @@ VV_CLOSURE_DOC(util_from_json,
 }
 //---------------------------------------------------------------------------
 
+VV_CLOSURE_DOC(util_to_msgpack,
+"@util procedure (util-to-msgpack _data_)\n\n"
+"Returns the _data_ structure encoded as MessagePack (as bytes).\n"
+"Other than JSON this keeps integers, bytes and date/time values\n"
+"apart from strings and doubles.\n"
+)
+{
+    return vv_bytes(VVal::msgpack_vv::to_msgpack(vv_args->_(0)));
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_from_msgpack,
+"@util procedure (util-from-msgpack _bytes_)\n\n"
+"Decodes the MessagePack encoded _bytes_. Raises an error if\n"
+"_bytes_ is not a single valid MessagePack value.\n"
+)
+{
+    // Big strings and bytes in the result refer to this buffer.
+    auto data = std::make_shared<const string>(vv_args->_s(0));
+
+    string err;
+    VV v = VVal::msgpack_vv::from_msgpack(data, &err);
+    if (!err.empty())
+        throw LuaThreadException("util-from-msgpack: " + err);
+    return v;
+}
+//---------------------------------------------------------------------------
+
+/// Resource behind the handles of util-json-reader.
+struct JSONReader
+{
+    VVal::json_vv::StreamReader reader;
+    FILE                       *file;
+
+    JSONReader(bool ndjson, const string &path)
+        : reader(ndjson, path), file(nullptr)
+    { }
+    ~JSONReader() { if (file) fclose(file); }
+};
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_json_reader,
+"@util procedure (util-json-reader _options_)\n\n"
+"Returns a handle for reading big JSON inputs record by record,\n"
+"without holding more than the current record in memory.\n"
+"_options_ is a map with the following optional keys:\n"
+"\n"
+"- `:ndjson` If true, every line of the input is a JSON value.\n"
+"- `:path` Returns the values at this path as records instead of the\n"
+"top level values. Keys and indices are separated by `/`, `*` matches\n"
+"every member or element. `\"results/*\"` returns the elements of the\n"
+"array in the `results` member.\n"
+"- `:file` Reads the input from this file. Otherwise the input has to\n"
+"be passed with `util-json-reader-feed`.\n"
+"\n"
+"    (let ((r (util-json-reader { :file \"big.json\" :path \"results/*\" })))\n"
+"      (do ((rec (util-json-reader-next r) (util-json-reader-next r)))\n"
+"          ((nil? rec) (util-json-reader-destroy r))\n"
+"        (display rec)))\n"
+)
+{
+    VV opts = vv_args->_(0);
+    JSONReader *r = new JSONReader(opts->_b("ndjson"), opts->_s("path"));
+
+    if (opts->_("file")->is_defined())
+    {
+        r->file = fopen(opts->_s("file").c_str(), "rb");
+        if (!r->file)
+        {
+            delete r;
+            throw LuaThreadException(
+                "util-json-reader: Can't open file: " + opts->_s("file"));
+        }
+        FILE *fh = r->file;
+        r->reader.set_source([fh](char *buf, size_t len)
+        {
+            return fread(buf, 1, len, fh);
+        });
+    }
+
+    LT->register_resource(r);
+    return vv_ptr((void *) r, "JSONReader");
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_json_reader_feed,
+"@util procedure (util-json-reader-feed _reader-handle_ _string_)\n"
+"@util procedure (util-json-reader-feed _reader-handle_)\n\n"
+"Appends the chunk _string_ to the input of the reader. Without\n"
+"_string_ the end of the input is signalled.\n"
+)
+{
+    LTRES(r, 0, JSONReader);
+    if (vv_args->_(1)->is_undef())
+        r->reader.finish();
+    else
+    {
+        string chunk = vv_args->_s(1);
+        r->reader.feed(chunk.data(), chunk.size());
+    }
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_json_reader_next,
+"@util procedure (util-json-reader-next _reader-handle_)\n\n"
+"Returns the next complete record or `nil` if the input ended or\n"
+"more input has to be fed. Throws an exception on syntax errors.\n"
+"From Lua it can be used as iterator: `for rec in util.jsonReaderNext, r do ... end`\n"
+)
+{
+    LTRES(r, 0, JSONReader);
+    VV rec;
+    if (r->reader.next(rec))
+        return rec;
+    if (!r->reader.error().empty())
+        throw LuaThreadException("util-json-reader: " + r->reader.error());
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
+VV_CLOSURE_DOC(util_json_reader_destroy,
+"@util procedure (util-json-reader-destroy _reader-handle_)\n\n"
+"Destroys the reader handle and closes its file.\n"
+"Any further usage of it is an error!\n"
+)
+{
+    LTRES(r, 0, JSONReader);
+    LT->delete_resource((void *) r);
+    delete r;
+    return vv_undef();
+}
+//---------------------------------------------------------------------------
+
 VV_CLOSURE_DOC(util_to_utf8,
 "@util procedure (util-to-utf8 _string-or-bytes_ _source-encoding-name_)\n\n"
 "Reencodes the character set of _string-or-bytes_ by interpreting it as\n"
@@ -140,10 +493,24 @@ VV_CLOSURE_DOC(util_from_utf8,
 }
 //---------------------------------------------------------------------------
 
+typedef std::shared_ptr<const RE_PREFIX::regex> regex_ptr;
+typedef std::shared_ptr<const dfa_regex::Regex> dfa_regex_ptr;
+
+/* Compiled regexes are shared by all threads, util-re is usually called
+ * in loops with the same few patterns. The key is the flags + pattern. */
+static LRUCache<std::string, regex_ptr>     g_regex_cache(256);
+static LRUCache<std::string, dfa_regex_ptr> g_dfa_regex_cache(256);
+
+typedef std::shared_ptr<const dfa_regex::RegexSet> regex_set_ptr;
+static LRUCache<std::string, regex_set_ptr> g_regex_set_cache(32);
+//---------------------------------------------------------------------------
+
 struct regex_matcher
 {
-    std::string m_str;
-    RE_PREFIX::regex *m_r;
+    std::string   m_str;
+    regex_ptr     m_r;
+    dfa_regex_ptr m_dfa;
+    bool        m_icase;
     bool        m_keep_first_submatch;
     bool        m_match_whole_string;
     bool        m_global_match;
@@ -151,30 +518,73 @@ struct regex_matcher
     std::string m_token;
     bool        m_split;
     regex_matcher()
-        : m_r(nullptr),
+        : m_icase(false),
           m_keep_first_submatch(false),
           m_match_whole_string(false),
           m_global_match(false),
           m_with_token(false),
           m_split(false) {}
 
-    ~regex_matcher()
+    void new_regex(const std::string &s, RE_PREFIX::regex::flag_type flags)
     {
-        if (m_r) delete m_r;
+        m_str = s;
+        m_r = g_regex_cache.get_or_create(
+            std::to_string((unsigned long) flags) + ":" + s,
+            [&]() { return std::make_shared<const RE_PREFIX::regex>(s, flags); });
     }
 
-    void new_regex(const std::string &s, RE_PREFIX::regex::flag_type flags)
+    void new_dfa_regex(const std::string &s, bool icase)
     {
         m_str = s;
-        m_r = new RE_PREFIX::regex(m_str, flags);
+        m_dfa = g_dfa_regex_cache.get_or_create(
+            (icase ? "i:" : ":") + s,
+            [&]() { return std::make_shared<const dfa_regex::Regex>(s, icase); });
+    }
+
+    size_t mark_count() const
+    {
+        return m_dfa ? m_dfa->mark_count() : m_r->mark_count();
     }
 
+    /// Appends the submatches of m to list (std or dfa_regex match).
+    template<class M>
+    VV submatch_list(const M &m, const VV &list)
+    {
+        size_t start_idx = (m_keep_first_submatch ? 0 : 1);
+        for (size_t i = start_idx; i < m.size(); i++)
+            list << vv(m.str(i));
+        return list;
+    }
+
+    template<class M>
+    VV global_result(const M &m)
+    {
+        if (flat_submatch_result())
+            return vv(m.str(m_keep_first_submatch ? 0 : 1));
+        return submatch_list(m, vv_list());
+    }
+
+    template<class M>
+    void match_result(const M &m, VV &results)
+    {
+        if (!m_with_token && flat_submatch_result())
+        {
+            results = vv(m.str(m_keep_first_submatch ? 0 : 1));
+        }
+        else
+        {
+            results = vv_list();
+            if (m_with_token) results << vv(m_token);
+            submatch_list(m, results);
+        }
+    }
 
     bool apply_regex_replace(const VV &str, VV &results)
     {
         std::string in(str->_s(0));
         std::string repl(str->_s(1));
-        VV s = vv(RE_PREFIX::regex_replace(in, *m_r, repl));
+        VV s = m_dfa ? vv(m_dfa->replace(in, repl))
+                     : vv(RE_PREFIX::regex_replace(in, *m_r, repl));
 
         if (m_with_token)
         {
@@ -188,9 +598,29 @@ struct regex_matcher
         return true;
     }
 
+    bool apply_dfa_regex_global(const std::string &in, VV &results)
+    {
+        const char *b = in.data();
+        const char *e = b + in.size();
+        dfa_regex::Match m;
+        if (!m_dfa->next(b, e, m))
+            return false;
+
+        results = vv_list();
+        if (m_with_token) results << vv(m_token);
+        do
+            results << global_result(m);
+        while (m_dfa->next(b, e, m));
+
+        return true;
+    }
+
     bool apply_regex_global(const VV &str, VV &results)
     {
         std::string in(str->s());
+        if (m_dfa)
+            return apply_dfa_regex_global(in, results);
+
         RE_PREFIX::regex_iterator<std::string::iterator> rit (in.begin(), in.end(), *m_r);
         RE_PREFIX::regex_iterator<std::string::iterator> rend;
         if (rit == rend)
@@ -200,26 +630,43 @@ struct regex_matcher
         if (m_with_token) results << vv(m_token);
         while (rit != rend)
         {
-            int start_idx = (m_keep_first_submatch ? 0 : 1);
-
-            if (flat_submatch_result())
-                results << vv((*rit)[start_idx].str());
-            else
-            {
-                VV sub(vv_list());
-                for (size_t i = start_idx; i < rit->size(); i++)
-                    sub << vv((*rit)[i].str());
-                results << sub;
-            }
+            results << global_result(*rit);
             ++rit;
         }
 
         return true;
     }
 
+    /// Splits like the sregex_token_iterator below: the pieces in front
+    /// of every match, and the rest, if it's not empty.
+    bool apply_dfa_regex_split(const std::string &in, VV &results)
+    {
+        const char *b    = in.data();
+        const char *e    = b + in.size();
+        const char *last = b;
+        bool        any  = false;
+        dfa_regex::Match m;
+
+        results = vv_list();
+        if (m_with_token) results << vv(m_token);
+        while (m_dfa->next(b, e, m))
+        {
+            results << vv(std::string(last, m.begin(0) - last));
+            last = m.end(0);
+            any  = true;
+        }
+        if (!any || last != e)
+            results << vv(std::string(last, e - last));
+
+        return true;
+    }
+
     bool apply_regex_split(const VV &str, VV &results)
     {
         std::string in(str->s());
+        if (m_dfa)
+            return apply_dfa_regex_split(in, results);
+
         RE_PREFIX::sregex_token_iterator rit(in.begin(), in.end(), *m_r, -1);
         RE_PREFIX::sregex_token_iterator rend;
         if (rit == rend)
@@ -245,30 +692,26 @@ struct regex_matcher
     {
         bool b = false;
         std::string in(str->s());
+
+        if (m_dfa)
+        {
+            dfa_regex::Match m;
+            if (m_match_whole_string)
+                b = m_dfa->match(in, m);
+            else
+                b = m_dfa->search(in, m);
+
+            if (b) match_result(m, results);
+            return b;
+        }
+
         RE_PREFIX::smatch m;
         if (m_match_whole_string)
             b = RE_PREFIX::regex_match(in, m, *m_r);
         else
             b = RE_PREFIX::regex_search(in, m, *m_r);
 
-        if (b)
-        {
-            int start_idx = (m_keep_first_submatch ? 0 : 1);
-
-            if (!m_with_token && flat_submatch_result())
-            {
-                results = vv(m[start_idx].str());
-            }
-            else
-            {
-                results = vv_list();
-                if (m_with_token) results << vv(m_token);
-                for (size_t i = start_idx; i < m.size(); i++)
-                {
-                    results << vv(m[i].str());
-                }
-            }
-        }
+        if (b) match_result(m, results);
         return b;
     }
 
@@ -283,13 +726,13 @@ struct regex_matcher
     bool flat_submatch_result() const
     {
         return
-            (m_keep_first_submatch && m_r->mark_count() == 0)
-            || (!m_keep_first_submatch && m_r->mark_count() == 1);
+            (m_keep_first_submatch && mark_count() == 0)
+            || (!m_keep_first_submatch && mark_count() == 1);
     }
 };
 //---------------------------------------------------------------------------
 
-static regex_matcher *build_single_regex_matcher(bool with_token, const VV &desc)
+static regex_matcher *build_single_regex_matcher(bool with_token, const VV &desc, bool linear)
 {
     RE_PREFIX::regex::flag_type flags = RE_PREFIX::regex::ECMAScript;
     regex_matcher *o = new regex_matcher;
@@ -313,6 +756,7 @@ static regex_matcher *build_single_regex_matcher(bool with_token, const VV &desc
         if (f.find_first_of("a") != std::string::npos) o->m_match_whole_string  = true;
         if (f.find_first_of("g") != std::string::npos) o->m_global_match        = true;
         if (f.find_first_of("s") != std::string::npos) o->m_split               = true;
+        if (f.find_first_of("l") != std::string::npos) linear                   = true;
     }
     else
     {
@@ -320,7 +764,20 @@ static regex_matcher *build_single_regex_matcher(bool with_token, const VV &desc
     }
 
 //    L_TRACE << "MKRE[" << (desc->is_list() ? desc->_s(0) : desc->s()) << "]";
-    o->new_regex(desc->is_list() ? desc->_s(0) : desc->s(), flags);
+    std::string re = desc->is_list() ? desc->_s(0) : desc->s();
+    o->m_icase = (flags & RE_PREFIX::regex::icase) != 0;
+    try
+    {
+        if (linear)
+            o->new_dfa_regex(re, o->m_icase);
+        else
+            o->new_regex(re, flags);
+    }
+    catch (...)
+    {
+        delete o;
+        throw;
+    }
 
     o->m_with_token = with_token;
     o->m_token      = desc->_s(2);
@@ -329,12 +786,13 @@ static regex_matcher *build_single_regex_matcher(bool with_token, const VV &desc
 }
 //---------------------------------------------------------------------------
 
-static void build_regex_from_desc(const VV &desc, std::list<regex_matcher *> &regexes)
+static void build_regex_from_desc(const VV &desc, std::list<regex_matcher *> &regexes,
+                                  bool linear)
 {
     if (!desc->_(0)->is_list())
     {
         regexes.push_back(
-            build_single_regex_matcher(desc->_(2)->is_defined(), desc));
+            build_single_regex_matcher(desc->_(2)->is_defined(), desc, linear));
     }
     else
     {
@@ -349,8 +807,46 @@ static void build_regex_from_desc(const VV &desc, std::list<regex_matcher *> &re
         }
 
         for (auto i : *desc)
-            regexes.push_back(build_single_regex_matcher(with_token, i));
+            regexes.push_back(build_single_regex_matcher(with_token, i, linear));
+    }
+}
+//---------------------------------------------------------------------------
+
+/// Returns the (cached) RegexSet of all matchers, that only return
+/// something if they match. set_index gets the index of every matcher
+/// in the set, or -1 for the split matchers, that have to run always.
+static regex_set_ptr regex_set_for(const std::list<regex_matcher *> &regexes,
+                                   std::vector<int> &set_index)
+{
+    std::string key;
+    int idx = 0;
+    for (auto m : regexes)
+    {
+        if (m->m_split)
+        {
+            set_index.push_back(-1);
+            continue;
+        }
+        set_index.push_back(idx++);
+        key += m->m_icase ? 'i' : '-';
+        key += m->m_match_whole_string ? 'a' : '-';
+        key += m->m_str;
+        key += '\0';
     }
+
+    return g_regex_set_cache.get_or_create(key, [&]()
+    {
+        auto set = std::make_shared<dfa_regex::RegexSet>();
+        for (auto m : regexes)
+        {
+            if (m->m_split)
+                continue;
+            set->add(m->m_str,
+                       (m->m_icase ? dfa_regex::RegexSet::ICASE : 0)
+                     | (m->m_match_whole_string ? dfa_regex::RegexSet::WHOLE : 0));
+        }
+        return regex_set_ptr(set);
+    });
 }
 
 //---------------------------------------------------------------------------
@@ -391,6 +887,10 @@ VV_CLOSURE_DOC(util_re,
 "                 (does not work with replacements.)\n"
 "       \"s\"   - split up the string using this regex.\n"
 "                 (does not work with replacements.)\n"
+"       \"l\"   - use the linear time matcher instead of the C++ regex\n"
+"                 library. No backreferences or lookahead, the grammar\n"
+"                 flags are ignored. Much faster on long inputs, that\n"
+"                 mostly don't match, like log files.\n"
 //"       \"r\"   - required match (this makes matching this regex\n"
 //"                 a requirement for matching any string.)\n"
 //"       \"R\"   - must not match (no string matches, that matches\n"
@@ -402,6 +902,10 @@ VV_CLOSURE_DOC(util_re,
 "       $´      - suffix\n"
 "_return-format-mode-str_ may contain:\n"
 "       \"n\"   - string index-numbers\n"
+"       \"m\"   - match all _regexes_ in one pass over each string first\n"
+"                 and only run the ones, that matched. Meant for\n"
+"                 classifying strings with many regexes. Implies the\n"
+"                 regex flag \"l\".\n"
 "\n"
 "Examples:\n"
 "\n"
@@ -425,15 +929,34 @@ VV_CLOSURE_DOC(util_re,
 
     std::string ret_mode = vv_args->_s(2);
     bool with_string_idxs = ret_mode.find_first_of("n") != std::string::npos;
+    bool multi            = ret_mode.find_first_of("m") != std::string::npos;
 
-    build_regex_from_desc(vv_args->_(1), matchers);
+    build_regex_from_desc(vv_args->_(1), matchers, multi);
+
+    regex_set_ptr    set;
+    std::vector<int> set_index;
+    std::vector<int> set_hits;
+    if (multi)
+        set = regex_set_for(matchers, set_index);
 
     VV ret = vv_list();
     int string_idx = 0;
     for (auto s : *(vv_args->_(0)))
     {
+        // replacements return something even without a match
+        bool filter = set && !s->is_list();
+        if (filter)
+            set->matches(s->s(), set_hits);
+
+        int matcher_idx = 0;
         for (auto m : matchers)
         {
+            int si = multi ? set_index[matcher_idx] : -1;
+            matcher_idx++;
+            if (filter && si >= 0
+                && !std::binary_search(set_hits.begin(), set_hits.end(), si))
+                continue;
+
             VV results;
             if ((*m)(s, results))
             {
@@ -466,10 +989,24 @@ void init_utillib(LuaThread *t, Lua::Instance &lua)
 
     LUA_REG(lua, "util", "fromCsv", obj, util_from_csv);
     LUA_REG(lua, "util", "toCsv",   obj, util_to_csv);
+    LUA_REG(lua, "util", "csvReader",         obj, util_csv_reader);
+    LUA_REG(lua, "util", "csvReaderFeed",     obj, util_csv_reader_feed);
+    LUA_REG(lua, "util", "csvReaderNext",     obj, util_csv_reader_next);
+    LUA_REG(lua, "util", "csvReaderDestroy",  obj, util_csv_reader_destroy);
+    LUA_REG(lua, "util", "csvWriter",         obj, util_csv_writer);
+    LUA_REG(lua, "util", "csvWriterRow",      obj, util_csv_writer_row);
+    LUA_REG(lua, "util", "csvWriterTake",     obj, util_csv_writer_take);
+    LUA_REG(lua, "util", "csvWriterDestroy",  obj, util_csv_writer_destroy);
     LUA_REG(lua, "util", "toUtf8",  obj, util_to_utf8);
     LUA_REG(lua, "util", "fromUtf8",obj, util_from_utf8);
     LUA_REG(lua, "util", "toJson",  obj, util_to_json);
     LUA_REG(lua, "util", "fromJson",obj, util_from_json);
+    LUA_REG(lua, "util", "toMsgpack",   obj, util_to_msgpack);
+    LUA_REG(lua, "util", "fromMsgpack", obj, util_from_msgpack);
+    LUA_REG(lua, "util", "jsonReader",        obj, util_json_reader);
+    LUA_REG(lua, "util", "jsonReaderFeed",    obj, util_json_reader_feed);
+    LUA_REG(lua, "util", "jsonReaderNext",    obj, util_json_reader_next);
+    LUA_REG(lua, "util", "jsonReaderDestroy", obj, util_json_reader_destroy);
     LUA_REG(lua, "util", "re"      ,obj, util_re);
 }
 
@@ -0,0 +1,78 @@
+-- Garbage collector benchmark for the embedded Lua interpreter.
+--
+-- Builds a big long lived heap (lookup tables, like a process holding
+-- a cache or an index) and then handles a stream of short lived message
+-- tables, that read from and sometimes write into the old heap.
+-- Reports the message throughput and the longest and 99th percentile
+-- batch latency. A batch only does a fixed amount of work, so its
+-- latency above the median is the time the collector paused it.
+--
+-- Usage: lua gc_bench.lua [incremental|generational] [live-mb] [messages]
+--        defaults: incremental 500 2000000
+--
+-- Collector parameters can be set before, for example:
+--        lua -e 'collectgarbage("setminormul", 5)' gc_bench.lua generational
+
+local mode     = arg[1] or "incremental"
+local live_mb  = tonumber(arg[2] or 500)
+local messages = tonumber(arg[3] or 2000000)
+local BATCH    = 1000
+
+collectgarbage(mode)
+
+local clock = os.clock
+
+-- long lived heap ----------------------------------------------------------
+
+local t0 = clock()
+local live = {}
+local n = 0
+while collectgarbage("count") < live_mb * 1024 do
+    for i = n + 1, n + 10000 do
+        live[i] = {
+            id    = i,
+            name  = "user" .. i,
+            tags  = { "a" .. (i % 97), "b" .. (i % 89) },
+            score = i * 0.5,
+        }
+    end
+    n = n + 10000
+end
+collectgarbage()
+local build_s = clock() - t0
+
+-- message stream -----------------------------------------------------------
+
+local lat = {}
+local acc = 0
+t0 = clock()
+for b = 1, messages // BATCH do
+    local bt = clock()
+    for m = 1, BATCH do
+        local k = (b * 7919 + m * 104729) % n + 1
+        local msg = { "msg", b, m, payload = { key = k, text = "m" .. m } }
+        local rec = live[k]
+        acc = acc + rec.score + #msg.payload.text
+        if m % 64 == 0 then
+            rec.last = msg  -- old object points to a young one
+        end
+    end
+    lat[b] = clock() - bt
+end
+local run_s = clock() - t0
+
+table.sort(lat)
+local median = lat[#lat // 2 + 1]
+local p99    = lat[math.floor(#lat * 0.99)]
+local max    = lat[#lat]
+
+io.write(string.format(
+    "%-12s live %d MB (%d records, built in %.1f s)\n"
+    .. "  throughput %.0f msg/s, %.2f s for %d messages\n"
+    .. "  batch of %d: median %.2f ms, p99 %.2f ms, max %.2f ms"
+    .. " (max pause ~%.2f ms)\n"
+    .. "  heap at end %d MB, checksum %.0f\n",
+    mode, live_mb, n, build_s,
+    messages / run_s, run_s, messages,
+    BATCH, median * 1000, p99 * 1000, max * 1000, (max - median) * 1000,
+    collectgarbage("count") // 1024, acc))
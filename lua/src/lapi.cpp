@@ -1078,8 +1078,8 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         luaC_checkGC(L);
       }
       g->gcrunning = oldrunning;  /* restore previous state */
-      if (debt > 0 && g->gcstate == GCSpause)  /* end of cycle? */
-        res = 1;  /* signal it */
+      if (debt > 0 && (g->gcstate == GCSpause || isgenerational(g)))
+        res = 1;  /* end of cycle (every generational step is one) */
       break;
     }
     case LUA_GCSETPAUSE: {
@@ -1097,6 +1097,23 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCGEN: case LUA_GCINC: {
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;  /* previous mode */
+      luaC_changemode(L, what == LUA_GCGEN);
+      break;
+    }
+    case LUA_GCSETMINORMUL: {
+      res = g->gcminormul;
+      if (data < 1) data = 1;  /* avoid a young collection per allocation */
+      g->gcminormul = data;
+      break;
+    }
+    case LUA_GCSETMAJORMUL: {
+      res = g->gcmajormul;
+      if (data < 1) data = 1;
+      g->gcmajormul = data;
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
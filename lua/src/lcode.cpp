@@ -1197,3 +1197,52 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+/*
+** Superinstructions. The pairs were picked from an opcode pair profile
+** of LAL generated code ('local x; x = ...', calls of builtins held in
+** upvalues, closures for 'let').
+*/
+static const struct {
+  lu_byte first, second, fused;
+} fusedops[] = {
+  {OP_MOVE, OP_CALL, OP_MOVE_CALL},
+  {OP_MOVE, OP_MOVE, OP_MOVE_MOVE},
+  {OP_MOVE, OP_LOADNIL, OP_MOVE_LOADNIL},
+  {OP_LOADK, OP_CALL, OP_LOADK_CALL},
+  {OP_LOADNIL, OP_TEST, OP_LOADNIL_TEST},
+  {OP_GETUPVAL, OP_MOVE, OP_GETUPVAL_MOVE},
+  {OP_CLOSURE, OP_MOVE, OP_CLOSURE_MOVE}
+};
+
+
+/*
+** Replace the first instruction of each pair in 'fusedops' by its
+** superinstruction. Only the first instruction changes, so jumps to
+** the second one stay valid; all first opcodes always fall through.
+** The pairs don't overlap: the second instruction of a pair is never
+** the first one of another, it has to keep its base opcode.
+** Must be called when the code of the function is complete, because
+** the code generator looks at the opcodes of emitted instructions.
+*/
+void luaK_fuse (FuncState *fs) {
+#if LUA_USE_SUPERINSTR
+  Instruction *code = fs->f->code;
+  int pc;
+  size_t j;
+  for (pc = 0; pc + 1 < fs->pc; pc++) {
+    OpCode op = GET_OPCODE(code[pc]);
+    OpCode next = GET_OPCODE(code[pc + 1]);
+    for (j = 0; j < sizeof(fusedops) / sizeof(fusedops[0]); j++) {
+      if (fusedops[j].first == op && fusedops[j].second == next) {
+        SET_OPCODE(code[pc], fusedops[j].fused);
+        pc++;  /* skip the second instruction */
+        break;
+      }
+    }
+  }
+#else
+  UNUSED(fs);
+#endif
+}
+
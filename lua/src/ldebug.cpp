@@ -91,6 +91,20 @@ LUA_API void lua_sethook (lua_State *L, lua_Hook func, int mask, int count) {
 }
 
 
+/*
+** Changes only the mask of the hook 'func', if that is the installed
+** hook of 'L' (used by sampling profilers). The hook and its count have
+** to be set with 'lua_sethook' by the thread running 'L' before; then
+** this may be called from another thread or a signal handler while 'L'
+** runs, as it writes nothing but the single byte 'hookmask', like
+** 'lua_sethook' from the SIGINT handler of lua.c does.
+*/
+LUA_API void lua_sethookmask (lua_State *L, lua_Hook func, int mask) {
+  if (L->hook == func)
+    L->hookmask = cast_byte(mask);
+}
+
+
 LUA_API lua_Hook lua_gethook (lua_State *L) {
   return L->hook;
 }
@@ -377,7 +391,7 @@ static int findsetreg (Proto *p, int lastpc, int reg) {
   int jmptarget = 0;  /* any code before this address is conditional */
   for (pc = 0; pc < lastpc; pc++) {
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOP(i);
     int a = GETARG_A(i);
     switch (op) {
       case OP_LOADNIL: {
@@ -427,7 +441,7 @@ static const char *getobjname (Proto *p, int lastpc, int reg,
   pc = findsetreg(p, lastpc, reg);
   if (pc != -1) {  /* could find instruction? */
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOP(i);
     switch (op) {
       case OP_MOVE: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
@@ -480,7 +494,7 @@ static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name) {
     *name = "?";
     return "hook";
   }
-  switch (GET_OPCODE(i)) {
+  switch (GET_BASEOP(i)) {
     case OP_CALL:
     case OP_TAILCALL:  /* get function name */
       return getobjname(p, pc, GETARG_A(i), name);
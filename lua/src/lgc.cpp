@@ -60,10 +60,10 @@
 
 
 /*
-** 'makewhite' erases all color bits then sets only the current white
-** bit
+** 'makewhite' erases all color bits (and the old bit) then sets only
+** the current white bit
 */
-#define maskcolors	(~(bitmask(BLACKBIT) | WHITEBITS))
+#define maskcolors	(~(bitmask(BLACKBIT) | WHITEBITS | bitmask(OLDBIT)))
 #define makewhite(g,x)	\
  (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
@@ -343,6 +343,37 @@ static void restartcollection (global_State *g) {
   markbeingfnz(g);  /* mark any finalizing object left from previous cycle */
 }
 
+
+/*
+** move all tables of a weak list to 'grayagain'
+*/
+static void weak2grayagain (global_State *g, GCObject **l) {
+  while (*l != NULL) {
+    Table *h = gco2t(*l);
+    *l = h->gclist;  /* remove it from weak list */
+    linkgclist(h, g->grayagain);
+  }
+}
+
+
+/*
+** mark root set to start a young collection. Unlike 'restartcollection',
+** keep the gray lists of the last collection: 'gray' has the objects
+** marked by barriers since then and 'grayagain' has all threads, weak
+** tables and old tables touched by back barriers. Weak tables left in
+** the weak lists by the last atomic phase are still gray and have to be
+** visited again too.
+*/
+static void restartyoung (global_State *g) {
+  weak2grayagain(g, &g->weak);
+  weak2grayagain(g, &g->allweak);
+  weak2grayagain(g, &g->ephemeron);
+  markobject(g, g->mainthread);
+  markvalue(g, &g->l_registry);
+  markmt(g);
+  markbeingfnz(g);
+}
+
 /* }====================================================== */
 
 
@@ -378,6 +409,8 @@ static void traverseweakvalue (global_State *g, Table *h) {
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
   else if (hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
+  else if (isgenerational(g))
+    linkgclist(h, g->grayagain);  /* revisit it in next young collection */
 }
 
 
@@ -426,6 +459,8 @@ static int traverseephemeron (global_State *g, Table *h) {
     linkgclist(h, g->ephemeron);  /* have to propagate again */
   else if (hasclears)  /* table has white keys? */
     linkgclist(h, g->allweak);  /* may have to clean white keys */
+  else if (isgenerational(g))
+    linkgclist(h, g->grayagain);  /* revisit it in next young collection */
   return marked;
 }
 
@@ -762,6 +797,29 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
   return p;
 }
 
+
+/*
+** sweep the young objects of a list in generational mode: free dead
+** objects and make the survivors old, keeping their colors. New objects
+** are always linked at the head of a list, so the young part ends with
+** the first old object. (Objects moved to the head of a list lose their
+** old bit, see 'udata2finalize' and 'luaC_checkfinalizer'.)
+*/
+static void sweepgen (lua_State *L, GCObject **p) {
+  int ow = otherwhite(G(L));
+  GCObject *curr;
+  while ((curr = *p) != NULL && !isold(curr)) {
+    if (isdeadm(ow, curr->marked)) {  /* is 'curr' dead? */
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else {
+      l_setbit(curr->marked, OLDBIT);  /* survivor is old now */
+      p = &curr->next;
+    }
+  }
+}
+
 /* }====================================================== */
 
 
@@ -791,6 +849,7 @@ static GCObject *udata2finalize (global_State *g) {
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
+  resetoldbit(o);  /* it is at the head of 'allgc' now (see 'sweepgen') */
   if (issweepphase(g))
     makewhite(g, o);  /* "sweep" object */
   return o;
@@ -914,6 +973,7 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
     o->next = g->finobj;  /* link it in 'finobj' list */
     g->finobj = o;
     l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
+    resetoldbit(o);  /* it is at the head of 'finobj' (see 'sweepgen') */
   }
 }
 
@@ -982,6 +1042,7 @@ static l_mem atomic (lua_State *L) {
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
+  g->grayagain = NULL;  /* threads and weak tables are linked here again */
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
   g->GCmemtrav = 0;  /* start counting work */
@@ -1120,6 +1181,112 @@ static l_mem getdebt (global_State *g) {
   }
 }
 
+/*
+** {======================================================
+** Generational mode
+** =======================================================
+** Objects that survive a collection become old (OLDBIT) and keep their
+** black color. A young collection marks only from the roots and the
+** objects caught by barriers since the last collection, so old objects
+** are neither traversed nor swept. A young collection runs in one step,
+** its work is proportional to the young objects plus the remembered
+** set ('grayagain'). When memory grew 'gcmajormul' percent beyond its
+** size after the last major collection, a major collection turns all
+** objects white and young again and does a complete mark and sweep.
+*/
+
+
+/*
+** set debt for the next young collection, after 'gcminormul' percent
+** of memory growth
+*/
+static void setminordebt (global_State *g) {
+  luaE_setdebt(g, -(cast(l_mem, (gettotalbytes(g) / 100)) * g->gcminormul));
+}
+
+
+static void finishgencycle (lua_State *L, global_State *g) {
+  checkSizes(L, g);
+  g->gcstate = GCSpropagate;  /* collector rests here between cycles */
+  if (g->gckind != KGC_EMERGENCY) {
+    while (g->tobefnz)  /* call all pending finalizers */
+      GCTM(L, 1);
+  }
+}
+
+
+static void youngcollection (lua_State *L, global_State *g) {
+  lua_assert(g->gcstate == GCSpropagate);
+  restartyoung(g);
+  propagateall(g);
+  atomic(L);
+  sweepgen(L, &g->allgc);
+  sweepgen(L, &g->finobj);
+  /* objects in 'tobefnz' are all marked, they need no sweep */
+  finishgencycle(L, g);
+}
+
+
+/*
+** complete collection that keeps the marks: all survivors become old.
+** All objects must be white and young when it starts.
+*/
+static void entergen (lua_State *L, global_State *g) {
+  luaC_runtilstate(L, bitmask(GCSpause));  /* finish sweeps/finalizers */
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* mark roots */
+  propagateall(g);
+  atomic(L);
+  sweepgen(L, &g->allgc);  /* nothing is old, so sweep whole lists */
+  sweepgen(L, &g->finobj);
+  g->GCestimate = gettotalbytes(g);  /* base for next major collection */
+  finishgencycle(L, g);
+}
+
+
+/*
+** major collection in generational mode
+*/
+static void fullgen (lua_State *L, global_State *g) {
+  entersweep(L);  /* turn all objects white and young (frees nothing) */
+  entergen(L, g);
+}
+
+
+static void genstep (lua_State *L, global_State *g) {
+  lu_mem majorbase = g->GCestimate;  /* memory after last major */
+  lu_mem majorinc = (majorbase / 100) * g->gcmajormul;
+  if (gettotalbytes(g) > majorbase + majorinc)
+    fullgen(L, g);
+  else
+    youngcollection(L, g);
+  setminordebt(g);
+}
+
+
+/*
+** switch between incremental and generational mode
+*/
+void luaC_changemode (lua_State *L, int generational) {
+  global_State *g = G(L);
+  if (generational == g->gcgen)
+    return;  /* nothing to be done */
+  if (generational) {
+    g->gcgen = 1;
+    entergen(L, g);
+    setminordebt(g);
+  }
+  else {
+    g->gcgen = 0;
+    entersweep(L);  /* turn all objects white and young again */
+    g->GCestimate = gettotalbytes(g);
+    luaC_runtilstate(L, bitmask(GCSpause));
+    setpause(g);
+  }
+}
+
+/* }====================================================== */
+
+
 /*
 ** performs a basic GC step when collector is running
 */
@@ -1130,6 +1297,10 @@ void luaC_step (lua_State *L) {
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  if (isgenerational(g)) {
+    genstep(L, g);
+    return;
+  }
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
@@ -1157,6 +1328,12 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
   lua_assert(g->gckind == KGC_NORMAL);
   if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
+  if (isgenerational(g)) {
+    fullgen(L, g);
+    g->gckind = KGC_NORMAL;
+    setminordebt(g);
+    return;
+  }
   if (keepinvariant(g)) {  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   }
@@ -61,6 +61,14 @@
 #define keepinvariant(g)	((g)->gcstate <= GCSatomic)
 
 
+/*
+** In generational mode the collector rests in GCSpropagate between
+** collections: objects that survived a collection are "old" and stay
+** black, so the invariant is always kept (see 'youngcollection').
+*/
+#define isgenerational(g)	((g)->gcgen)
+
+
 /*
 ** some useful bit tricks
 */
@@ -79,6 +87,7 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization */
+#define OLDBIT		6  /* object is old (only in generational mode) */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
@@ -91,6 +100,9 @@
 
 #define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
 
+#define isold(x)	testbit((x)->marked, OLDBIT)
+#define resetoldbit(x)	resetbit((x)->marked, OLDBIT)
+
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	(!(((m) ^ WHITEBITS) & (ow)))
 #define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
@@ -136,6 +148,7 @@ LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
+LUAI_FUNC void luaC_changemode (lua_State *L, int generational);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
@@ -65,6 +65,13 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "MOVE_CALL",
+  "MOVE_MOVE",
+  "MOVE_LOADNIL",
+  "LOADK_CALL",
+  "LOADNIL_TEST",
+  "GETUPVAL_MOVE",
+  "CLOSURE_MOVE",
   NULL
 };
 
@@ -120,5 +127,31 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVE_CALL */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVE_MOVE */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVE_LOADNIL */
+ ,opmode(0, 1, OpArgK, OpArgN, iABx)		/* OP_LOADK_CALL */
+ ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_LOADNIL_TEST */
+ ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_GETUPVAL_MOVE */
+ ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE_MOVE */
+};
+
+
+LUAI_DDEF const lu_byte luaP_baseop[NUM_OPCODES] = {
+  OP_MOVE, OP_LOADK, OP_LOADKX, OP_LOADBOOL, OP_LOADNIL, OP_GETUPVAL,
+  OP_GETTABUP, OP_GETTABLE, OP_SETTABUP, OP_SETUPVAL, OP_SETTABLE,
+  OP_NEWTABLE, OP_SELF, OP_ADD, OP_SUB, OP_MUL, OP_MOD, OP_POW, OP_DIV,
+  OP_IDIV, OP_BAND, OP_BOR, OP_BXOR, OP_SHL, OP_SHR, OP_UNM, OP_BNOT,
+  OP_NOT, OP_LEN, OP_CONCAT, OP_JMP, OP_EQ, OP_LT, OP_LE, OP_TEST,
+  OP_TESTSET, OP_CALL, OP_TAILCALL, OP_RETURN, OP_FORLOOP, OP_FORPREP,
+  OP_TFORCALL, OP_TFORLOOP, OP_SETLIST, OP_CLOSURE, OP_VARARG,
+  OP_EXTRAARG,
+  OP_MOVE,      /* OP_MOVE_CALL */
+  OP_MOVE,      /* OP_MOVE_MOVE */
+  OP_MOVE,      /* OP_MOVE_LOADNIL */
+  OP_LOADK,     /* OP_LOADK_CALL */
+  OP_LOADNIL,   /* OP_LOADNIL_TEST */
+  OP_GETUPVAL,  /* OP_GETUPVAL_MOVE */
+  OP_CLOSURE    /* OP_CLOSURE_MOVE */
 };
 
@@ -228,11 +228,24 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/*
+** Superinstructions: like the first opcode, but the next instruction
+** is known to be the second one and is executed without dispatch.
+** The next instruction keeps its own opcode. See 'luaK_fuse'.
+*/
+OP_MOVE_CALL,/*	A B	OP_MOVE, then OP_CALL				*/
+OP_MOVE_MOVE,/*	A B	OP_MOVE, then OP_MOVE				*/
+OP_MOVE_LOADNIL,/* A B	OP_MOVE, then OP_LOADNIL			*/
+OP_LOADK_CALL,/* A Bx	OP_LOADK, then OP_CALL				*/
+OP_LOADNIL_TEST,/* A B	OP_LOADNIL, then OP_TEST			*/
+OP_GETUPVAL_MOVE,/* A B	OP_GETUPVAL, then OP_MOVE			*/
+OP_CLOSURE_MOVE/* A Bx	OP_CLOSURE, then OP_MOVE			*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_CLOSURE_MOVE) + 1)
 
 
 
@@ -287,6 +300,11 @@ LUAI_DDEC const lu_byte luaP_opmodes[NUM_OPCODES];
 
 LUAI_DDEC const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
+/* opcode without the superinstruction, for code analysis */
+LUAI_DDEC const lu_byte luaP_baseop[NUM_OPCODES];
+
+#define GET_BASEOP(i)	(cast(OpCode, luaP_baseop[GET_OPCODE(i)]))
+
 
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
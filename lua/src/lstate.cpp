@@ -36,6 +36,14 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 #endif
 
+#if !defined(LUAI_GENMINORMUL)
+#define LUAI_GENMINORMUL	20  /* young collection after 20% growth */
+#endif
+
+#if !defined(LUAI_GENMAJORMUL)
+#define LUAI_GENMAJORMUL	100  /* major collection after 100% growth */
+#endif
+
 
 /*
 ** a macro to help the creation of a unique random seed when a state is
@@ -328,6 +336,9 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->gcgen = 0;
+  g->gcminormul = LUAI_GENMINORMUL;
+  g->gcmajormul = LUAI_GENMAJORMUL;
   L->embedOutput = NULL;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
@@ -759,6 +759,27 @@
 ** without modifying the main part of the file.
 */
 
+/*
+@@ LUA_USE_JUMPTABLE makes the interpreter loop dispatch with computed
+** gotos (threaded code) instead of a switch. Needs GCC or Clang.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+/*
+@@ LUA_USE_SUPERINSTR makes the code generator combine frequent opcode
+** pairs into superinstructions (see 'luaK_fuse'). The VM always executes
+** them, so precompiled chunks work either way.
+*/
+#if !defined(LUA_USE_SUPERINSTR)
+#define LUA_USE_SUPERINSTR	1
+#endif
+
 
 
 
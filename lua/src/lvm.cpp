@@ -762,9 +762,25 @@ void luaV_finishOp (lua_State *L) {
   lua_assert(base <= L->top && L->top < L->stack + L->stacksize); \
 }
 
+#if LUA_USE_JUMPTABLE
+/*
+** threaded dispatch: every instruction jumps directly to the code of the
+** next one through the label table in 'ljumptab.h'
+*/
+#define vmdispatch(o)	goto *disptab[o];
+#define vmcase(l)	L_##l:
+#define vmbreak		vmfetch(); vmdispatch(GET_OPCODE(i));
+#else
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
+#endif
+
+/*
+** end of the first half of a superinstruction: fetch the second
+** instruction (running hooks as usual) and go directly to its code
+*/
+#define vmfuse(op,l)	{ vmfetch(); lua_assert(GET_OPCODE(i) == op); goto l; }
 
 
 /*
@@ -788,6 +804,9 @@ void luaV_execute (lua_State *L) {
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
@@ -801,6 +820,7 @@ void luaV_execute (lua_State *L) {
     vmfetch();
     vmdispatch (GET_OPCODE(i)) {
       vmcase(OP_MOVE) {
+        l_move:
         setobjs2s(L, ra, RB(i));
         vmbreak;
       }
@@ -822,10 +842,12 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_LOADNIL) {
-        int b = GETARG_B(i);
-        do {
-          setnilvalue(ra++);
-        } while (b--);
+        l_loadnil: {
+          int b = GETARG_B(i);
+          do {
+            setnilvalue(ra++);
+          } while (b--);
+        }
         vmbreak;
       }
       vmcase(OP_GETUPVAL) {
@@ -1111,6 +1133,7 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_TEST) {
+        l_test:
         if (GETARG_C(i) ? l_isfalse(ra) : !l_isfalse(ra))
             ci->u.l.savedpc++;
           else
@@ -1128,17 +1151,19 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_CALL) {
-        int b = GETARG_B(i);
-        int nresults = GETARG_C(i) - 1;
-        if (b != 0) L->top = ra+b;  /* else previous instruction set top */
-        if (luaD_precall(L, ra, nresults)) {  /* C function? */
-          if (nresults >= 0)
-            L->top = ci->top;  /* adjust results */
-          Protect((void)0);  /* update 'base' */
-        }
-        else {  /* Lua function */
-          ci = L->ci;
-          goto newframe;  /* restart luaV_execute over new Lua function */
+        l_call: {
+          int b = GETARG_B(i);
+          int nresults = GETARG_C(i) - 1;
+          if (b != 0) L->top = ra+b;  /* else previous instruction set top */
+          if (luaD_precall(L, ra, nresults)) {  /* C function? */
+            if (nresults >= 0)
+              L->top = ci->top;  /* adjust results */
+            Protect((void)0);  /* update 'base' */
+          }
+          else {  /* Lua function */
+            ci = L->ci;
+            goto newframe;  /* restart luaV_execute over new Lua function */
+          }
         }
         vmbreak;
       }
@@ -1314,6 +1339,49 @@ void luaV_execute (lua_State *L) {
         lua_assert(0);
         vmbreak;
       }
+      /*
+      ** superinstructions (see 'luaK_fuse'): the code of the first
+      ** instruction followed by the second one without a dispatch
+      */
+      vmcase(OP_MOVE_CALL) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(OP_CALL, l_call);
+      }
+      vmcase(OP_MOVE_MOVE) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(OP_MOVE, l_move);
+      }
+      vmcase(OP_MOVE_LOADNIL) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(OP_LOADNIL, l_loadnil);
+      }
+      vmcase(OP_LOADK_CALL) {
+        TValue *rb = k + GETARG_Bx(i);
+        setobj2s(L, ra, rb);
+        vmfuse(OP_CALL, l_call);
+      }
+      vmcase(OP_LOADNIL_TEST) {
+        int b = GETARG_B(i);
+        do {
+          setnilvalue(ra++);
+        } while (b--);
+        vmfuse(OP_TEST, l_test);
+      }
+      vmcase(OP_GETUPVAL_MOVE) {
+        int b = GETARG_B(i);
+        setobj2s(L, ra, cl->upvals[b]->v);
+        vmfuse(OP_MOVE, l_move);
+      }
+      vmcase(OP_CLOSURE_MOVE) {
+        Proto *p = cl->p->p[GETARG_Bx(i)];
+        LClosure *ncl = getcached(p, cl->upvals, base);  /* cached closure */
+        if (ncl == NULL)  /* no match? */
+          pushclosure(L, p, cl->upvals, base, ra);  /* create a new one */
+        else
+          setclLvalue(L, ra, ncl);  /* push cashed closure */
+        checkGC(L, ra + 1);
+        vmfuse(OP_MOVE, l_move);
+      }
     }
   }
 }
@@ -75,6 +75,7 @@ int main(int argc, char *argv[])
 
     Poco::ThreadPool::defaultPool().joinAll();
     http_srv::shutdown_ssl();
+    stop_logging();
 
     return 0;
 }
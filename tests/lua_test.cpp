@@ -26,6 +26,15 @@
 #include <boost/test/unit_test.hpp>
 #include "base/vval.h"
 #include "lua/lua_instance.h"
+#include "lua/lua_bundle.h"
+#include "base/vv_persistent.h"
+#include "base/vv_hashed.h"
+#include "../lua/src/lauxlib.h"
+#include "../lua/src/lobject.h"
+#include "../lua/src/lopcodes.h"
+#include "../lua/src/lstate.h"
+#include <cstdio>
+#include <fstream>
 
 //---------------------------------------------------------------------------
 
@@ -50,6 +59,50 @@ BOOST_AUTO_TEST_CASE(basic_usage)
 }
 //---------------------------------------------------------------------------
 
+/// The opcode names of the main function of code, like luac -l lists them.
+static std::string opcode_listing(const char *code)
+{
+    lua_State *L = luaL_newstate();
+    BOOST_REQUIRE(luaL_loadstring(L, code) == LUA_OK);
+    const Proto *f = getproto(L->top - 1);
+
+    std::string ops;
+    for (int pc = 0; pc < f->sizecode; pc++)
+    {
+        if (pc) ops += " ";
+        ops += luaP_opnames[GET_OPCODE(f->code[pc])];
+
+        // the second instruction of a superinstruction keeps its opcode
+        if (pc > 0 && GET_OPCODE(f->code[pc - 1]) != GET_BASEOP(f->code[pc - 1]))
+            BOOST_CHECK_EQUAL(GET_OPCODE(f->code[pc]), GET_BASEOP(f->code[pc]));
+    }
+    lua_close(L);
+    return ops;
+}
+
+BOOST_AUTO_TEST_CASE(superinstructions)
+{
+    const char *code =
+        "local function f(a, b) return a + b end\n"
+        "local x, y = 1, 2\n"
+        "local r = f(x, y)\n"
+        "return r\n";
+#if LUA_USE_SUPERINSTR
+    // MOVE MOVE MOVE CALL fuses to two pairs, not three overlapping ones
+    BOOST_CHECK_EQUAL(opcode_listing(code),
+        "CLOSURE LOADK LOADK MOVE_MOVE MOVE MOVE_CALL CALL RETURN RETURN");
+#endif
+    opcode_listing("local a, b, c = 1, 2, 3\n"
+                   "local d, e, f, g = a, b, c, a\n"
+                   "local function h(...) return ... end\n"
+                   "return h(a, b, c, d, e, f, g)\n");
+
+    Lua::Instance li;
+    li.init_output_interface();
+    BOOST_CHECK_EQUAL(li.eval_code(code)->i(), 3);
+}
+//---------------------------------------------------------------------------
+
 VV_CLOSURE_DOC(testoutcall_closure, "call C++ VV closure")
 {
     return vv(vv_args->_s(0) + vv_args->_s(1) + vv_obj->_s(0));
@@ -103,3 +156,133 @@ BOOST_AUTO_TEST_CASE(pointerpassing)
 }
 //---------------------------------------------------------------------------
 
+BOOST_AUTO_TEST_CASE(persistent_handles)
+{
+    Lua::Instance li;
+    li.init_output_interface();
+
+    VV pm(vv_to_persistent(vv_map() << vv_kv("a", vv(1)) << vv_kv("b", vv(2))));
+    VV r = li.eval_code("local m = ...; return { m, #m, type(m) }", vv_list() << pm);
+    // the same value comes back, it isn't copied into a table
+    BOOST_CHECK(r->_(0).get() == pm.get());
+    BOOST_CHECK_EQUAL(r->_i(1), 2);
+    BOOST_CHECK_EQUAL(r->_s(2), "userdata");
+
+    r = vv_undef();
+    li.eval_code("collectgarbage()");
+    BOOST_CHECK_EQUAL(pm.use_count(), 1);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(hashed_handles)
+{
+    Lua::Instance li;
+    li.init_output_interface();
+
+    VV hm(vv_hmap());
+    hm->set("a", vv(1));
+    VV r = li.eval_code("local m = ...; return { m, #m }", vv_list() << hm);
+    BOOST_CHECK(r->_(0).get() == hm.get());
+    BOOST_CHECK_EQUAL(r->_i(1), 1);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(atom_strings)
+{
+    Lua::Instance la;
+    Lua::Instance lb;
+    la.init_output_interface();
+    lb.init_output_interface();
+
+    // predefined atoms are known to every state
+    VV m = la.eval_code("return { command = 'command', x = 'process::exit' }");
+    BOOST_CHECK_EQUAL(m->_("command")->atom(), atom::COMMAND);
+    BOOST_CHECK_EQUAL(m->_("x")->atom(),       atom::PROCESS_EXIT);
+    BOOST_CHECK_EQUAL(m->_s("x"),              "process::exit");
+
+    // table keys don't become atoms on their own
+    la.eval_code("return { ['lua-data-key'] = 1 }");
+    BOOST_CHECK_EQUAL(atom::find("lua-data-key"), atom::NONE);
+    BOOST_CHECK_EQUAL(la.eval_code("return 'lua-data-key'")->atom(), atom::NONE);
+
+    // declared atoms are learned from table keys, string values
+    // refer to them afterwards
+    uint32_t id = atom::intern("lua-test-key");
+    BOOST_CHECK(id != atom::NONE);
+    BOOST_CHECK_EQUAL(la.eval_code("return 'lua-test-key'")->atom(), atom::NONE);
+    la.eval_code("return { ['lua-test-key'] = 1 }");
+    VV v = la.eval_code("return 'lua-test-key'");
+    BOOST_CHECK_EQUAL(v->atom(), id);
+
+    // and cross to another state as the same string
+    VV r = lb.eval_code(
+        "local msg, name = ...\n"
+        "return msg['lua-test-key'] .. name .. msg.command .. tostring(name == 'lua-test-key')",
+        vv_list() << (vv_map() << vv_kv("lua-test-key", "A") << vv_kv("command", "B")) << v);
+    BOOST_CHECK_EQUAL(r->s(), "Alua-test-keyBtrue");
+
+    VV n = la.eval_code("return 'nonatom-' .. 'value'");
+    BOOST_CHECK_EQUAL(n->atom(), atom::NONE);
+    BOOST_CHECK_EQUAL(n->s(), "nonatom-value");
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(bundle)
+{
+    {
+        std::ofstream a("bundle_test_a.lua");
+        a << "local b = require 'bt.b'\nreturn { name = 'a' .. b.name }\n";
+        std::ofstream b("bundle_test_b.lua");
+        b << "return { name = 'b', src = debug.getinfo(1, 'S').source }\n";
+        std::ofstream c("bundle_test_c.lua");
+        c << "return 'bundled'\n";
+        std::ofstream d("bundle_test_d.lua");
+        d << "return debug.getinfo(1, 'S').source\n";
+    }
+
+    Lua::BundleWriter w;
+    w.add("bt.a", "bundle_test_a.lua");
+    w.add("bt.b", "bundle_test_b.lua");
+    w.add("bundle_test_c", "bundle_test_c.lua");
+    w.add("bundle_test_d", "bundle_test_d.lua");
+    w.write("bundle_test.bundle");
+    std::remove("bundle_test_a.lua");
+    std::remove("bundle_test_b.lua");
+    {
+        // found by the file searcher as ./bundle_test_c.lua
+        std::ofstream c("bundle_test_c.lua");
+        c << "return 'edited'\n";
+    }
+
+    std::shared_ptr<Lua::Bundle> b = Lua::Bundle::open("bundle_test.bundle");
+    BOOST_CHECK_EQUAL(b->count(), 4);
+
+    Lua::Instance li;
+    li.init_output_interface();
+    li.use_bundle(b);
+    VV r = li.eval_code(
+        "local a = require 'bt.a'\n"
+        "return { a.name, require('bt.b').src, pcall(require, 'bt.c') }");
+    BOOST_CHECK_EQUAL(r->_s(0), "ab");
+    // debug information is kept
+    BOOST_CHECK_EQUAL(r->_s(1), "@bundle_test_b.lua");
+    BOOST_CHECK_EQUAL(r->_b(2), false);
+    BOOST_CHECK(r->_s(3).find("no module 'bt.c' in bundle") != std::string::npos);
+
+    // a changed source is loaded instead of the bundled module,
+    // an unchanged one is not
+    r = li.eval_code("return { require 'bundle_test_c', require 'bundle_test_d' }");
+    BOOST_CHECK_EQUAL(r->_s(0), "edited");
+    BOOST_CHECK_EQUAL(r->_s(1), "@bundle_test_d.lua");
+    std::remove("bundle_test_c.lua");
+    std::remove("bundle_test_d.lua");
+
+    {
+        std::ofstream bad("bundle_test.bundle", std::ios::binary);
+        bad << "LALRTBC";
+    }
+    BOOST_CHECK_THROW(Lua::Bundle::open("bundle_test.bundle"), Lua::InstanceException);
+    std::remove("bundle_test.bundle");
+}
+//---------------------------------------------------------------------------
+
@@ -28,10 +28,13 @@
 #if defined BZVC
 #    include "bz/vval.h"
 #    include "bz/msg_queue.h"
+#    include "bz/protoframing.h"
 #else
 #    include "base/vval.h"
 #    include "base/msg_queue.h"
+#    include "msgpack/protoframing.h"
 #endif
+#include <random>
 
 using namespace std;
 using namespace VVal;
@@ -136,3 +139,102 @@ BOOST_AUTO_TEST_CASE(notifier)
 }
 //---------------------------------------------------------------------------
 
+struct FrameCollector : public msgpack::ProtoFraming
+{
+    std::vector<std::string> m_pkts;
+    std::vector<uint16_t>    m_types;
+
+    virtual void handle_recv_msg(const char *data, size_t len, uint16_t type)
+    {
+        m_pkts.push_back(std::string(data, len));
+        m_types.push_back(type);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(proto_framing_chunks)
+{
+    UTF8Buffer wire;
+    msgpack::ProtoFraming framer(&wire);
+
+    std::mt19937 rng(4711);
+    std::vector<std::string> sent;
+    for (int i = 0; i < 5000; i++)
+    {
+        // mostly small packets, some bigger than the initial ring
+        size_t len = (i % 97 == 0) ? 10000 + rng() % 5000 : rng() % 40;
+        std::string pkt(len, (char) ('a' + i % 26));
+        if (len > 0) pkt[0] = (char) (i & 0xFF);
+        framer.send_msg(pkt.data(), pkt.size(), (uint16_t) (i & 0xFFFF));
+        sent.push_back(pkt);
+    }
+
+    FrameCollector fc;
+    const char *p   = wire.buffer();
+    const char *end = p + wire.length();
+    while (p < end)
+    {
+        size_t chunk = 1 + rng() % 300;
+        if (chunk > (size_t) (end - p)) chunk = end - p;
+        fc.handle_recv(p, chunk);
+        p += chunk;
+    }
+
+    BOOST_REQUIRE_EQUAL(fc.m_pkts.size(), sent.size());
+    for (size_t i = 0; i < sent.size(); i++)
+    {
+        BOOST_REQUIRE(fc.m_pkts[i] == sent[i]);
+        BOOST_REQUIRE_EQUAL(fc.m_types[i], (uint16_t) (i & 0xFFFF));
+    }
+    BOOST_CHECK_EQUAL(fc.buffered(), 0);
+}
+//---------------------------------------------------------------------------
+
+struct LimitedCollector : public FrameCollector
+{
+    std::string m_error;
+
+    virtual void handle_frame_error(const std::string &err)
+    {
+        m_error = err;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(proto_framing_limits)
+{
+    UTF8Buffer wire;
+    msgpack::ProtoFraming framer(&wire);
+    framer.set_max_packet_len(100);
+    framer.set_max_send_buffer(250);
+
+    std::string small(50, 'x');
+    std::string big(101, 'y');
+    BOOST_CHECK(!framer.send_msg(big.data(), big.size(), 1));
+    BOOST_CHECK(framer.send_msg(small.data(), small.size(), 1));
+    BOOST_CHECK(framer.send_msg(small.data(), small.size(), 2));
+    BOOST_CHECK(framer.send_msg(small.data(), small.size(), 3));
+    BOOST_CHECK(framer.send_msg(small.data(), small.size(), 4));
+    BOOST_CHECK(!framer.send_msg(small.data(), small.size(), 5));
+    BOOST_CHECK_EQUAL(wire.length(), 4 * 56);
+
+    // a header announcing a too big packet stops the receiver,
+    // without buffering anything of it
+    UTF8Buffer bad;
+    bad.append_bytes(wire.buffer(), 56);
+    bad.append_uint32(0x7FFFFFFF);
+    bad.append_uint16(9);
+    bad.append_bytes(small.data(), small.size());
+
+    LimitedCollector lc;
+    lc.set_max_packet_len(100);
+    lc.handle_recv(bad.buffer(), 60);
+    lc.handle_recv(bad.buffer() + 60, bad.length() - 60);
+    BOOST_CHECK_EQUAL(lc.m_pkts.size(), 1);
+    BOOST_CHECK(lc.failed());
+    BOOST_CHECK(!lc.m_error.empty());
+    BOOST_CHECK_EQUAL(lc.buffered(), 0);
+
+    lc.handle_recv(wire.buffer(), wire.length());
+    BOOST_CHECK_EQUAL(lc.m_pkts.size(), 1);
+}
+//---------------------------------------------------------------------------
+
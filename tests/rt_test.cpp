@@ -27,6 +27,11 @@
 #include "rt/process.h"
 #include "rt/lua_thread.h"
 #include "rt/log.h"
+#include "rt/node.h"
+#include "base/dir_walker.h"
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <fstream>
 #include <sstream>
 #include <functional>
 //---------------------------------------------------------------------------
@@ -118,3 +123,193 @@ BOOST_AUTO_TEST_CASE(lua_proc_lib)
     BOOST_CHECK_EQUAL(m->_i(4), 99);
 }
 //---------------------------------------------------------------------------
+
+// Sends one message from a node with the given secret that dials the
+// node name dialed to a listening node "rtaccept" with the secret
+// "s3cr3t". Returns the message if it arrived within wait_ms.
+static VV node_link_roundtrip(const std::string &secret,
+                              const std::string &dialed,
+                              uint64_t wait_ms)
+{
+    lal_rt::Port dest;
+
+    lal_rt::Node acceptor;
+    acceptor.set_name("rtaccept");
+    acceptor.set_secret("s3cr3t");
+    int port = acceptor.listen(0);
+
+    lal_rt::Node dialer;
+    dialer.set_name("rtdial");
+    dialer.set_secret(secret);
+    dialer.connect(dialed, "127.0.0.1", port);
+    dialer.send(dialed, dest.pid(), vv_list() << "rtdial:0" << 0 << "ping" << 42);
+
+    return dest.m_queue.pop_waiting(wait_ms).value_or(vv_undef());
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(node_link)
+{
+    VV m = node_link_roundtrip("s3cr3t", "rtaccept", 2000);
+    BOOST_CHECK_EQUAL(m->_s(2), "ping");
+    BOOST_CHECK_EQUAL(m->_i(3), 42);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(node_link_rejected)
+{
+    // wrong secret
+    BOOST_CHECK(node_link_roundtrip("wrong", "rtaccept", 500)->is_undef());
+    // right secret, but the HELLO was made for another node
+    BOOST_CHECK(node_link_roundtrip("s3cr3t", "rtother", 500)->is_undef());
+}
+//---------------------------------------------------------------------------
+
+static std::string walk_dir(const std::string &root, bool recursive, int threads)
+{
+    dir_walker::Options o;
+    o.recursive   = recursive;
+    o.threads     = threads;
+    o.batch_size  = 1;
+    o.max_batches = 1;
+
+    std::vector<std::string> paths;
+    dir_walker::Walker w(root, o);
+    for (VV b = w.next_batch(); b->is_defined(); b = w.next_batch())
+        for (auto p : *b)
+            paths.push_back(p->s().substr(root.size()));
+
+    std::sort(paths.begin(), paths.end());
+    std::string out;
+    for (auto &p : paths)
+        out += p + ";";
+    return out;
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(dir_walker_inline)
+{
+    namespace fs = boost::filesystem;
+    fs::path root = fs::temp_directory_path() / fs::unique_path("rt_test_%%%%%%%%");
+    fs::create_directories(root / "sub" / "deep");
+    std::ofstream((root / "a").string());
+    std::ofstream((root / "b").string());
+    std::ofstream((root / "sub" / "c").string());
+    std::ofstream((root / "sub" / "deep" / "d").string());
+
+    std::string r = root.generic_string();
+    std::string all = "/a;/b;/sub;/sub/c;/sub/deep;/sub/deep/d;";
+    // one batch per entry, more than max_batches per directory
+    BOOST_CHECK_EQUAL(walk_dir(r, true,  0), all);
+    BOOST_CHECK_EQUAL(walk_dir(r, true,  1), all);
+    BOOST_CHECK_EQUAL(walk_dir(r, false, 0), "/a;/b;/sub;");
+
+    fs::remove_all(root);
+}
+//---------------------------------------------------------------------------
+
+/// Reads the lines of all files in dir, the file names go to files.
+static std::vector<std::string> read_log_dir(const boost::filesystem::path &dir,
+                                             std::vector<std::string> &files)
+{
+    namespace fs = boost::filesystem;
+    std::vector<std::string> lines;
+    for (fs::directory_iterator it(dir), end; it != end; ++it)
+    {
+        files.push_back(it->path().filename().string());
+        std::ifstream in(it->path().string());
+        std::string line;
+        while (std::getline(in, line))
+            lines.push_back(line);
+    }
+    std::sort(files.begin(), files.end());
+    return lines;
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(log_rotation)
+{
+    namespace fs = boost::filesystem;
+    fs::path dir = fs::temp_directory_path() / fs::unique_path("rt_test_%%%%%%%%");
+    fs::create_directories(dir);
+
+    lal_rt::log_options opts;
+    opts.max_file_size = 1000;
+    {
+        lal_rt::log_writer w((dir / "x.log").string(), opts);
+        for (int i = 0; i < 100; i++)
+        {
+            w.push("line " + std::to_string(i) + std::string(40, '.') + "\n", false);
+            w.flush();
+        }
+    }
+
+    std::vector<std::string> files;
+    std::vector<std::string> lines = read_log_dir(dir, files);
+
+    // x.log and the rotated x.log.<stamp>[-n]
+    BOOST_CHECK(files.size() > 2);
+    BOOST_CHECK_EQUAL(files[0], "x.log");
+    BOOST_CHECK_EQUAL(files[1].substr(0, 6), "x.log.");
+    for (auto &f : files)
+        BOOST_CHECK(fs::file_size(dir / f) <= opts.max_file_size);
+
+    // no line lost or duplicated
+    BOOST_CHECK_EQUAL(lines.size(), 100);
+    std::sort(lines.begin(), lines.end());
+    lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+    BOOST_CHECK_EQUAL(lines.size(), 100);
+
+    fs::remove_all(dir);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(log_level_runtime)
+{
+    namespace fs = boost::filesystem;
+    using namespace boost::log::trivial;
+    fs::path dir = fs::temp_directory_path() / fs::unique_path("rt_test_%%%%%%%%");
+    fs::create_directories(dir);
+
+    lal_rt::log_options opts;
+    opts.level = info;
+    lal_rt::start_logging((dir / "lvl.log").string(), opts);
+    BOOST_CHECK_EQUAL(lal_rt::get_log_level(), info);
+
+    L_DEBUG << "dropped-1";
+    L_INFO  << "kept-1";
+    lal_rt::set_log_level(warning);
+    L_INFO  << "dropped-2";
+    L_WARN  << "kept-2";
+
+    // sys-set-log-level from a Lua process
+    lal_rt::VVQ q;
+    lal_rt::LuaThread lt;
+    lt.m_port.m_parent_emitter.connect(std::bind(&lal_rt::VVQ::push, &q, std::placeholders::_1));
+    lt.start(
+        "function main(args)\n"
+        "return sys.setLogLevel('debug')\n"
+        "end\n",
+        vv_list());
+    VV m = q.pop_blocking();
+    BOOST_CHECK_EQUAL(m->_s(4), "warning");
+    BOOST_CHECK_EQUAL(lal_rt::get_log_level(), debug);
+
+    L_TRACE << "dropped-3";
+    L_DEBUG << "kept-3";
+
+    lal_rt::stop_logging();
+    lal_rt::set_log_level(trace);
+
+    std::vector<std::string> files;
+    std::string all;
+    for (auto &l : read_log_dir(dir, files))
+        all += l + "\n";
+    BOOST_CHECK(all.find("kept-1")    != std::string::npos);
+    BOOST_CHECK(all.find("kept-2")    != std::string::npos);
+    BOOST_CHECK(all.find("kept-3")    != std::string::npos);
+    BOOST_CHECK(all.find("dropped-")  == std::string::npos);
+
+    fs::remove_all(dir);
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,1119 @@
+/******************************************************************************
+* Copyright (C) 2017 Weird Constructor
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+/* Micro benchmarks for the VV library and the runtime. They are built
+ * with the tests, but not run by ctest, build with optimizations
+ * before reading the numbers.
+ *
+ * Usage: VVBench [name [args ...]]
+ *        runs all benchmarks if no name is given, the arguments
+ *        are described at the benchmark. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined BZVC
+#    include "bz/vval.h"
+#    include "bz/vv_persistent.h"
+#    include "bz/json_vv.h"
+#    include "bz/JSON.h"
+#    include "bz/utf8buffer.h"
+#    include "bz/csv.h"
+#    include "bz/msgpack_vv.h"
+#    include "bz/vval_util.h"
+#    include "bz/dfa_regex.h"
+#    include "bz/dir_walker.h"
+#else
+#    include "base/vval.h"
+#    include "base/vv_persistent.h"
+#    include "base/json_vv.h"
+#    include "base/JSON.h"
+#    include "base/utf8buffer.h"
+#    include "base/csv.h"
+#    include "base/msgpack_vv.h"
+#    include "base/vval_util.h"
+#    include "base/dfa_regex.h"
+#    include "base/dir_walker.h"
+#endif
+#include "msgpack/protoframing.h"
+#include "rt/node.h"
+#include "rt/process.h"
+#include <boost/filesystem.hpp>
+
+using namespace VVal;
+
+//---------------------------------------------------------------------------
+
+/// Results go here, so that the compiler can't drop the work.
+static volatile int64_t g_sink = 0;
+
+/// Average seconds per call of f, calling it for at least min_s seconds.
+static double time_per_call(const std::function<void()> &f, double min_s = 0.5)
+{
+    typedef std::chrono::steady_clock clk;
+
+    f(); // warm up
+    size_t n = 0;
+    auto t0 = clk::now();
+    double elapsed = 0;
+    do
+    {
+        f();
+        n++;
+        elapsed = std::chrono::duration<double>(clk::now() - t0).count();
+    }
+    while (elapsed < min_s);
+    return elapsed / n;
+}
+//---------------------------------------------------------------------------
+
+/// Prints the time per call and, if bytes is given, the throughput.
+static void report(const std::string &what, double secs, double bytes = 0)
+{
+    if (secs < 1e-3)
+        printf("    %-46s %10.3f us", what.c_str(), secs * 1e6);
+    else
+        printf("    %-46s %10.3f ms", what.c_str(), secs * 1e3);
+    if (bytes > 0)
+        printf("  %8.3f GB/s", bytes / secs / 1e9);
+    printf("\n");
+}
+//---------------------------------------------------------------------------
+
+static std::string read_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw VariantValueException(vv(path), "can't open file");
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+//---------------------------------------------------------------------------
+
+typedef std::vector<std::string> Args;
+
+static void bench_cow(const Args &)
+{
+    const int N = 100000;
+
+    std::vector<std::string> keys;
+    VV l(vv_list()), cl(vv_cow_list()), m(vv_map()), cm(vv_cow_map());
+    for (int i = 0; i < N; i++)
+    {
+        keys.push_back("key" + std::to_string(i));
+        l  << vv(i);
+        cl << vv(i);
+        m->set(keys.back(), vv(i));
+        cm->set(keys.back(), vv(i));
+    }
+
+    report("list clone(), 100k",            time_per_call([&]() { g_sink += l->clone()->size(); }));
+    report("cowlist clone(), 100k",         time_per_call([&]() { g_sink += cl->clone()->size(); }));
+    report("cowlist clone() + set(), 100k", time_per_call([&]()
+    {
+        VV c(cl->clone());
+        c->set(N / 2, vv(0));
+        g_sink += c->size();
+    }));
+    report("cowlist vv_to_persistent(), 100k", time_per_call([&]() { g_sink += vv_to_persistent(cl)->size(); }));
+
+    report("map clone(), 100k",             time_per_call([&]() { g_sink += m->clone()->size(); }));
+    report("cowmap clone(), 100k",          time_per_call([&]() { g_sink += cm->clone()->size(); }));
+    report("cowmap clone() + set(), 100k",  time_per_call([&]()
+    {
+        VV c(cm->clone());
+        c->set(keys[N / 2], vv(0));
+        g_sink += c->size();
+    }));
+
+    auto read_idx = [&](const VV &v)
+    {
+        return time_per_call([&]()
+        {
+            int64_t s = 0;
+            for (int i = 0; i < N; i++)
+                s += v->_(i)->i();
+            g_sink += s;
+        });
+    };
+    auto read_iter = [&](const VV &v)
+    {
+        return time_per_call([&]()
+        {
+            int64_t s = 0;
+            for (auto e : *v)
+                s += e->i();
+            g_sink += s;
+        });
+    };
+    auto read_key = [&](const VV &v)
+    {
+        return time_per_call([&]()
+        {
+            int64_t s = 0;
+            for (auto &k : keys)
+                s += v->_(k)->i();
+            g_sink += s;
+        });
+    };
+    report("list _(i), 100k",        read_idx(l));
+    report("cowlist _(i), 100k",     read_idx(cl));
+    report("list iteration, 100k",   read_iter(l));
+    report("cowlist iteration, 100k", read_iter(cl));
+    report("map _(key), 100k",       read_key(m));
+    report("cowmap _(key), 100k",    read_key(cm));
+}
+//---------------------------------------------------------------------------
+
+/// from_json() before json_vv, for comparison: json::Parser with
+/// callbacks, that keep their stacks in VV lists.
+class OldJSONParser : public json::Parser
+{
+    private:
+        VV              m_stack;
+        VV              m_obj_stack;
+        VV              m_obj_key_stack;
+        VV              m_cur_obj;
+        std::string     m_cur_key;
+
+    public:
+        std::string     m_error;
+
+        OldJSONParser()
+            : m_stack(vv_list()), m_obj_stack(vv_list()),
+              m_obj_key_stack(vv_list()), m_cur_obj(vv_undef())
+        { }
+
+        VV parseVV(const std::string &json)
+        {
+            UTF8Buffer u8b(json.data(), json.size());
+            if (this->parse(&u8b) && m_error == "")
+                return m_stack->pop();
+            return vv_undef();
+        }
+
+        virtual void onObjectStart()
+        {
+            m_obj_stack->push(m_cur_obj);
+            m_obj_key_stack->push(vv(m_cur_key));
+            m_cur_obj = vv_map();
+        }
+        virtual void onObjectKey(const std::string &sOut) { m_cur_key = sOut; }
+        virtual void onObjectValueDone() { m_cur_obj << vv_kv(m_cur_key, m_stack->pop()); }
+        virtual void onObjectEnd()
+        {
+            m_stack->push(m_cur_obj);
+            m_cur_obj = m_obj_stack->pop();
+            m_cur_key = m_obj_key_stack->pop()->s();
+        }
+        virtual void onArrayStart()
+        {
+            m_obj_stack->push(m_cur_obj);
+            m_cur_obj = vv_list();
+        }
+        virtual void onArrayValueDone() { m_cur_obj->push(m_stack->pop()); }
+        virtual void onArrayEnd()
+        {
+            m_stack->push(m_cur_obj);
+            m_cur_obj = m_obj_stack->pop();
+        }
+        virtual void onError(UTF8Buffer *, const char *csError) { m_error = csError; }
+
+        virtual void onValueBoolean(bool bValue) { m_stack->push(vv_bool(bValue)); }
+        virtual void onValueNull() { m_stack->push(vv_undef()); }
+        virtual void onValueNumber(const char *csNumber, bool bIsFloat)
+        {
+            VV tmp(vv(std::string(csNumber)));
+            if (bIsFloat) m_stack->push(vv(tmp->d()));
+            else          m_stack->push(vv(tmp->i()));
+        }
+        virtual void onValueString(const std::string &sString) { m_stack->push(vv(sString)); }
+};
+//---------------------------------------------------------------------------
+
+/// Documents shaped like the usual JSON corpora: twitter.json (objects
+/// with text, escapes and non ASCII), canada.json (coordinate arrays of
+/// doubles) and citm_catalog.json (nested objects of integers).
+static std::vector<std::pair<std::string, std::string>> json_corpora()
+{
+    std::mt19937 rng(4711);
+    auto rnd = [&rng](int n) { return (int) (rng() % n); };
+    const char *words[] = {
+        "lorem", "ipsum", "\\u00e4rger", "caf\\u00e9", "\\\"quoted\\\"",
+        "line\\nbreak", "http:\\/\\/t.co\\/x", "\xc3\xa4\xc3\xb6\xc3\xbc", "#tag", "@user" };
+
+    std::string tw = "{\"statuses\":[";
+    for (int i = 0; i < 4000; i++)
+    {
+        std::string text;
+        for (int w = 0; w < 5 + rnd(15); w++)
+            text += std::string(w ? " " : "") + words[rnd(10)];
+        tw += std::string(i ? "," : "")
+            + "{\"id\":" + std::to_string(500000000000000000LL + i * 7919LL)
+            + ",\"text\":\"" + text + "\",\"truncated\":false"
+            + ",\"user\":{\"id\":" + std::to_string(rnd(1000000))
+            + ",\"name\":\"" + words[rnd(10)] + "\",\"followers_count\":" + std::to_string(rnd(100000))
+            + ",\"verified\":" + (rnd(2) ? "true" : "false") + ",\"url\":null}"
+            + ",\"retweet_count\":" + std::to_string(rnd(1000))
+            + ",\"entities\":{\"hashtags\":[],\"urls\":[\"http:\\/\\/example.com\\/" + std::to_string(i) + "\"]}}";
+    }
+    tw += "]}";
+
+    std::string ca = "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[";
+    char num[64];
+    for (int r = 0; r < 400; r++)
+    {
+        ca += r ? ",[" : "[";
+        for (int p = 0; p < 250; p++)
+        {
+            snprintf(num, sizeof(num), "%s[%.15g,%.15g]", p ? "," : "",
+                     -65.0 - rng() / 4294967296.0 * 10.0, 43.0 + rng() / 4294967296.0 * 10.0);
+            ca += num;
+        }
+        ca += "]";
+    }
+    ca += "]}}]}";
+
+    std::string ci = "{\"events\":{";
+    for (int i = 0; i < 10000; i++)
+    {
+        ci += std::string(i ? "," : "") + "\"" + std::to_string(138586341 + i) + "\":{"
+            + "\"description\":null,\"id\":" + std::to_string(138586341 + i)
+            + ",\"logo\":\"\\/images\\/UE0AAAAACEKo6QAAAAZDSVRN\",\"name\":\"" + words[rnd(2)]
+            + "\",\"subTopicIds\":[337184269," + std::to_string(337184283 + rnd(100))
+            + "],\"subjectCode\":null,\"subtitle\":null,\"topicIds\":[324846099," + std::to_string(107888604 + rnd(100)) + "]}";
+    }
+    ci += "},\"performances\":[";
+    for (int i = 0; i < 5000; i++)
+        ci += std::string(i ? "," : "") + "{\"eventId\":" + std::to_string(138586341 + rnd(10000))
+            + ",\"id\":" + std::to_string(339887544 + i) + ",\"prices\":[{\"amount\":90250,\"audienceSubCategoryId\":337100890,\"seatCategoryId\":338937295}]"
+            + ",\"start\":1372701600000,\"venueCode\":\"PLEYEL_PLEYEL\"}";
+    ci += "]}";
+
+    return { { "twitter-like", tw }, { "canada-like", ca }, { "citm-like", ci } };
+}
+//---------------------------------------------------------------------------
+
+/// Args: JSON files, for example the real corpora, generated documents
+/// of the same shape otherwise.
+static void bench_json(const Args &args)
+{
+    std::vector<std::pair<std::string, std::string>> docs;
+    for (auto &f : args)
+        docs.push_back(std::make_pair(f, read_file(f)));
+    if (docs.empty())
+        docs = json_corpora();
+
+    for (auto &d : docs)
+    {
+        const std::string &s = d.second;
+        printf("  %s, %.1f MB\n", d.first.c_str(), s.size() / 1e6);
+        if (!json_vv::parse(s.data(), s.size())->is_map()
+            && !json_vv::parse(s.data(), s.size())->is_list())
+        {
+            printf("    parse error\n");
+            continue;
+        }
+
+        report("json_vv::parse()", time_per_call([&]()
+        { g_sink += json_vv::parse(s.data(), s.size())->size(); }), (double) s.size());
+        report("json::Parser (from_json() before)", time_per_call([&]()
+        { OldJSONParser p; g_sink += p.parseVV(s)->size(); }), (double) s.size());
+
+        VV v(json_vv::parse(s.data(), s.size()));
+        report("json_vv::to_json()", time_per_call([&]()
+        { g_sink += json_vv::to_json(v).size(); }), (double) s.size());
+    }
+}
+//---------------------------------------------------------------------------
+
+/// from_csv() before csv::Reader, for comparison: compares the input
+/// character by character and appends to the fields one at a time.
+class OldCSVParser
+{
+    private:
+        char        m_delim;
+        std::string m_row_sep;
+        std::string m_data;
+        int         m_pos;
+        VV          m_table;
+        VV          m_row;
+
+        int rest_len() { return (int) m_data.size() - m_pos; }
+        void skip_char(int cnt = 1) { m_pos += cnt; }
+        char next_char(bool do_skip = false)
+        {
+            if (rest_len() <= 0) return '\0';
+            char c = m_data[m_pos];
+            if (do_skip) skip_char();
+            return c;
+        }
+        bool check_char(char c) { return rest_len() >= 1 && next_char() == c; }
+        bool check_substr(const std::string &chrs)
+        {
+            if (((size_t) rest_len()) < chrs.size()) return false;
+            size_t i = 0;
+            for (auto c : chrs)
+                if (m_data[m_pos + i++] != c) return false;
+            return true;
+        }
+
+        void on_field(const std::string &data) { m_row << data; }
+        void on_row_end()
+        {
+            m_table << m_row;
+            m_row = vv_list();
+        }
+
+        bool parse_escaped_field()
+        {
+            std::string field_data;
+            bool end_found = false;
+            while (!end_found && rest_len() > 0)
+            {
+                if (check_char('"'))
+                {
+                    skip_char();
+                    if (check_char('"'))
+                    {
+                        skip_char();
+                        field_data += '"';
+                    }
+                    else
+                        end_found = true;
+                }
+                else if (check_char('\x0d'))
+                {
+                    skip_char();
+                    if (check_char('\x0a')) skip_char();
+                    field_data += "\x0a";
+                }
+                else if (check_char('\x0a'))
+                {
+                    skip_char();
+                    field_data += "\x0a";
+                }
+                else
+                    field_data += next_char(true);
+            }
+            if (rest_len() <= 0) end_found = true;
+            if (end_found) on_field(field_data);
+
+            if (rest_len() <= 0 || check_substr(m_row_sep))
+            {
+                skip_char((int) m_row_sep.size());
+                on_row_end();
+            }
+            else if (check_char(m_delim))
+                skip_char();
+            else
+                return false;
+            return end_found;
+        }
+
+        bool parse_delimited_field()
+        {
+            std::string field_data;
+            bool end_found = false;
+            bool row_end   = false;
+            while (!end_found && rest_len() > 0)
+            {
+                if (check_substr(m_row_sep))
+                {
+                    skip_char((int) m_row_sep.size());
+                    end_found = true;
+                    row_end   = true;
+                }
+                else if (check_char(m_delim))
+                {
+                    skip_char();
+                    end_found = true;
+                }
+                else
+                    field_data += next_char(true);
+            }
+            if (rest_len() <= 0)
+            {
+                end_found = true;
+                row_end   = true;
+            }
+            if (end_found) on_field(field_data);
+            if (row_end)   on_row_end();
+            return end_found;
+        }
+
+    public:
+        OldCSVParser(char delim, const std::string &row_sep)
+            : m_delim(delim), m_row_sep(row_sep), m_pos(0),
+              m_table(vv_list()), m_row(vv_list())
+        { }
+
+        VV parse(const std::string &data)
+        {
+            m_data = data;
+            m_pos  = 0;
+            while (rest_len() > 0)
+            {
+                bool ok = next_char() == '"'
+                    ? (skip_char(), parse_escaped_field())
+                    : parse_delimited_field();
+                if (!ok)
+                    break;
+            }
+            return m_table;
+        }
+};
+//---------------------------------------------------------------------------
+
+/// Args: a CSV file with "," and "\r\n" as separators, a generated log
+/// like table otherwise.
+static void bench_csv(const Args &args)
+{
+    std::string data;
+    if (!args.empty())
+        data = read_file(args[0]);
+    else
+    {
+        std::mt19937 rng(4711);
+        char line[256];
+        for (int i = 0; data.size() < 20 * 1000 * 1000; i++)
+        {
+            snprintf(line, sizeof(line),
+                     "%d,2017-03-%02d 12:%02d:%02d,%s,%u,%.4f,%s\r\n",
+                     i, 1 + i % 28, i % 60, (i / 60) % 60,
+                     (i % 3) ? "INFO" : "WARNING", (unsigned) (rng() % 100000),
+                     rng() / 4294967296.0 * 1000.0,
+                     (i % 5) ? "request handled in time"
+                             : "\"slow, \"\"retrying\"\" later\r\nsecond line\"");
+            data += line;
+        }
+    }
+    printf("  %.1f MB\n", data.size() / 1e6);
+
+    report("csv::from_csv()", time_per_call([&]()
+    { g_sink += csv::from_csv(data, ',', "\r\n")->size(); }), (double) data.size());
+    report("from_csv() before", time_per_call([&]()
+    { OldCSVParser p(',', "\r\n"); g_sink += p.parse(data)->size(); }), (double) data.size());
+
+    report("csv::Reader, set_input(), fields", time_per_call([&]()
+    {
+        csv::Reader r;
+        r.set_input(data.data(), data.size());
+        r.finish();
+        size_t n = 0;
+        while (r.next_row())
+            n += r.fields().size();
+        g_sink += n;
+    }), (double) data.size());
+    report("csv::Reader, feed() 64k chunks, fields", time_per_call([&]()
+    {
+        csv::Reader r;
+        size_t n = 0;
+        for (size_t offs = 0; offs < data.size(); offs += 65536)
+        {
+            r.feed(data.data() + offs, std::min((size_t) 65536, data.size() - offs));
+            while (r.next_row())
+                n += r.fields().size();
+        }
+        r.finish();
+        while (r.next_row())
+            n += r.fields().size();
+        g_sink += n;
+    }), (double) data.size());
+}
+//---------------------------------------------------------------------------
+
+/// A batch of n messages, like processes send them to each other:
+/// integer ids, timestamps, short strings, doubles and a binary payload.
+static VV message_batch(int n, size_t payload_len)
+{
+    std::mt19937 rng(4711);
+    VV batch(vv_list());
+    for (int i = 0; i < n; i++)
+    {
+        std::string payload(payload_len, '\0');
+        for (auto &c : payload)
+            c = (char) rng();
+
+        VV values(vv_list());
+        for (int j = 0; j < 8; j++)
+            values << rng() / 4294967296.0 * 100.0;
+
+        batch << (vv_list()
+            << vv("sensor-data")
+            << vv((int64_t) rng() << 20)
+            << (vv_map()
+                << vv_kv("id",      vv((int64_t) 1000000000000LL + i))
+                << vv_kv("ts",      vv_dt(1490000000 + i))
+                << vv_kv("host",    vv("node-" + std::to_string(i % 16)))
+                << vv_kv("ok",      vv_bool(i % 7 != 0))
+                << vv_kv("values",  values)
+                << vv_kv("payload", vv_bytes(payload))));
+    }
+    return batch;
+}
+//---------------------------------------------------------------------------
+
+static void bench_msgpack(const Args &)
+{
+    for (size_t payload : { (size_t) 16, (size_t) 1024 })
+    {
+        VV batch(message_batch(1000, payload));
+        std::string mp(msgpack_vv::to_msgpack(batch));
+        std::string js(as_json(batch));
+        printf("  1000 messages, %d byte payload: msgpack %.1f KB, json %.1f KB\n",
+               (int) payload, mp.size() / 1e3, js.size() / 1e3);
+
+        report("to_msgpack()",   time_per_call([&]() { g_sink += msgpack_vv::to_msgpack(batch).size(); }));
+        report("as_json()",      time_per_call([&]() { g_sink += as_json(batch).size(); }));
+        report("from_msgpack()", time_per_call([&]() { g_sink += msgpack_vv::from_msgpack(mp)->size(); }));
+        report("from_json()",    time_per_call([&]() { g_sink += from_json(js)->size(); }));
+    }
+}
+//---------------------------------------------------------------------------
+
+/// Decoding with copies of all strings, and with slices of the shared
+/// input for strings of msgpack_vv::SLICE_MIN_LEN or more bytes.
+static void bench_msgpack_span(const Args &)
+{
+    VV small(vv_list());
+    for (int i = 0; i < 100000; i++)
+        small << ("field-" + std::to_string(i) + std::string(i % 32, 'x'));
+
+    VV blobs(vv_list());
+    for (int i = 0; i < 4; i++)
+        blobs << vv_bytes(std::string(8 * 1024 * 1024, (char) ('a' + i)));
+
+    std::pair<const char *, VV> cases[] = {
+        { "100k strings of 7-43 bytes", small },
+        { "4 blobs of 8 MB",            blobs },
+    };
+    for (auto &c : cases)
+    {
+        auto mp = std::make_shared<const std::string>(msgpack_vv::to_msgpack(c.second));
+        printf("  %s, %.1f MB\n", c.first, mp->size() / 1e6);
+
+        report("from_msgpack(data, len), copies", time_per_call([&]()
+        { g_sink += msgpack_vv::from_msgpack(mp->data(), mp->size())->size(); }), (double) mp->size());
+        report("from_msgpack(shared input), slices", time_per_call([&]()
+        { g_sink += msgpack_vv::from_msgpack(mp)->size(); }), (double) mp->size());
+    }
+}
+//---------------------------------------------------------------------------
+
+/// Two nodes with their own I/O threads in this process, linked over
+/// TCP on the loopback interface. Messages go through the same msgpack
+/// encoding, framing and socket writes as between two lalrt instances.
+static void bench_node(const Args &)
+{
+    typedef std::chrono::steady_clock clk;
+
+    lal_rt::Port a, b;
+
+    lal_rt::Node acceptor;
+    acceptor.set_name("bench-a");
+    acceptor.set_secret("bench");
+    int port = acceptor.listen(0);
+
+    lal_rt::Node dialer;
+    dialer.set_name("bench-b");
+    dialer.set_secret("bench");
+    dialer.connect("bench-a", "127.0.0.1", port);
+
+    VV payload(vv(std::string(100, 'x')));
+    auto msg = [&](int64_t i) { return vv_list() << "bench-b:0" << i << "bench" << payload; };
+
+    // the acceptor knows the dialer by name once this arrived
+    dialer.send("bench-a", a.pid(), msg(0));
+    a.m_queue.pop_blocking();
+
+    // throughput, with at most WINDOW messages in flight
+    const int N = 200000, WINDOW = 10000;
+    auto t0 = clk::now();
+    int received = 0;
+    for (int sent = 0; sent < N; sent++)
+    {
+        dialer.send("bench-a", a.pid(), msg(sent));
+        while (sent - received >= WINDOW)
+        {
+            a.m_queue.pop_blocking();
+            received++;
+        }
+    }
+    while (received < N)
+    {
+        a.m_queue.pop_blocking();
+        received++;
+    }
+    double secs = std::chrono::duration<double>(clk::now() - t0).count();
+    printf("    %-46s %10.0f msg/s\n", "one way, 100 byte payload", N / secs);
+
+    // round trip latency, one message at a time
+    const int RT = 20000;
+    std::vector<double> rtt;
+    rtt.reserve(RT);
+    for (int i = 0; i < RT; i++)
+    {
+        auto t = clk::now();
+        dialer.send("bench-a", a.pid(), msg(i));
+        a.m_queue.pop_blocking();
+        acceptor.send("bench-b", b.pid(), msg(i));
+        b.m_queue.pop_blocking();
+        rtt.push_back(std::chrono::duration<double>(clk::now() - t).count());
+    }
+    std::sort(rtt.begin(), rtt.end());
+    report("round trip, median", rtt[RT / 2]);
+    report("round trip, p99",    rtt[RT * 99 / 100]);
+    report("round trip, max",    rtt.back());
+}
+//---------------------------------------------------------------------------
+
+/// ProtoFraming::handle_recv() before the packets were passed in place,
+/// for comparison: every chunk is appended to a UTF8Buffer.
+class OldFraming
+{
+    private:
+        UTF8Buffer m_u8RecvBuffer;
+
+    public:
+        virtual ~OldFraming() { }
+
+        void handle_recv(const char *csData, size_t iLen)
+        {
+            m_u8RecvBuffer.append_bytes(csData, iLen);
+            for (;;)
+            {
+                if (m_u8RecvBuffer.length() < 6)
+                    return;
+                const unsigned char *h =
+                    (const unsigned char *) m_u8RecvBuffer.buffer();
+                uint32_t iPktLen  = ((uint32_t) h[0] << 24) | ((uint32_t) h[1] << 16)
+                                  | ((uint32_t) h[2] << 8)  |  (uint32_t) h[3];
+                uint16_t iPktType = (uint16_t) ((h[4] << 8) | h[5]);
+                if (m_u8RecvBuffer.length() < 6 + (size_t) iPktLen)
+                    return;
+                m_u8RecvBuffer.skip_bytes(6);
+                this->handle_recv_msg(m_u8RecvBuffer.buffer(), iPktLen, iPktType);
+                m_u8RecvBuffer.skip_bytes(iPktLen);
+            }
+        }
+
+        virtual void handle_recv_msg(const char *, size_t, uint16_t) { }
+};
+//---------------------------------------------------------------------------
+
+template<class Framing>
+struct FrameCounter : public Framing
+{
+    size_t m_bytes = 0;
+
+    virtual void handle_recv_msg(const char *data, size_t len, uint16_t)
+    { m_bytes += len ? len + (uint8_t) *data : 1; }
+};
+//---------------------------------------------------------------------------
+
+/// 1M packets of 0-47 bytes, received in chunks of random size.
+static void bench_framing(const Args &)
+{
+    UTF8Buffer wire;
+    msgpack::ProtoFraming framer(&wire);
+    std::mt19937 rng(4711);
+    for (int i = 0; i < 1000000; i++)
+    {
+        std::string pkt(rng() % 48, 'x');
+        framer.send_msg(pkt.data(), pkt.size(), 2);
+    }
+    std::string data(wire.buffer(), wire.length());
+    printf("  1M packets, %.1f MB\n", data.size() / 1e6);
+
+    for (size_t max_chunk : { (size_t) 64, (size_t) 4096, (size_t) 65536 })
+    {
+        std::vector<size_t> chunks;
+        for (size_t offs = 0; offs < data.size(); )
+        {
+            size_t c = std::min((size_t) (1 + rng() % max_chunk), data.size() - offs);
+            chunks.push_back(c);
+            offs += c;
+        }
+
+        auto feed = [&](const std::function<void(const char *, size_t)> &f)
+        {
+            const char *p = data.data();
+            for (size_t c : chunks)
+            {
+                f(p, c);
+                p += c;
+            }
+        };
+        std::string what = "chunks of 1-" + std::to_string(max_chunk) + " bytes";
+        report("ProtoFraming, " + what, time_per_call([&]()
+        {
+            FrameCounter<msgpack::ProtoFraming> fc;
+            feed([&](const char *p, size_t c) { fc.handle_recv(p, c); });
+            g_sink += fc.m_bytes;
+        }), (double) data.size());
+        report("before, " + what, time_per_call([&]()
+        {
+            FrameCounter<OldFraming> fc;
+            feed([&](const char *p, size_t c) { fc.handle_recv(p, c); });
+            g_sink += fc.m_bytes;
+        }), (double) data.size());
+    }
+}
+//---------------------------------------------------------------------------
+
+/// Log lines with a timestamp, level, thread, request data and the
+/// occasional error, separated by "\n".
+static std::string generate_log(size_t bytes)
+{
+    std::mt19937 rng(4711);
+    const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+    const char *users[]  = { "alice", "bob", "carol", "dave", "eve" };
+    std::string log;
+    char line[512];
+    for (int i = 0; log.size() < bytes; i++)
+    {
+        const char *level = levels[rng() % 6];
+        int n = snprintf(line, sizeof(line),
+            "2017-03-%02d 12:%02d:%02d.%03d [%s] worker-%d: request id=%u user=%s"
+            " from 10.0.%u.%u path=/api/v1/items/%u status=%d time=%ums%s\n",
+            1 + i % 28, i % 60, (i / 7) % 60, i % 1000, level, (int) (rng() % 16),
+            (unsigned) rng(), users[rng() % 5], (unsigned) (rng() % 256), (unsigned) (rng() % 256),
+            (unsigned) (rng() % 100000), (rng() % 50) ? 200 : 503, (unsigned) (rng() % 2000),
+            strcmp(level, "ERROR") ? "" : " error=\"upstream connect timeout\"");
+        log.append(line, n);
+    }
+    return log;
+}
+//---------------------------------------------------------------------------
+
+/// Calls f(b, e) for each line of text.
+static void each_line(const std::string &text, const std::function<void(const char *, const char *)> &f)
+{
+    const char *p = text.data(), *end = p + text.size();
+    while (p < end)
+    {
+        const char *nl = (const char *) memchr(p, '\n', end - p);
+        if (!nl) nl = end;
+        f(p, nl);
+        p = nl + 1;
+    }
+}
+//---------------------------------------------------------------------------
+
+/// Args: a log file, 30 MB of generated log lines otherwise.
+/// Searches every line, like util-re over the lines of a log file.
+static void bench_regex(const Args &args)
+{
+    std::string log = args.empty() ? generate_log(30 * 1000 * 1000) : read_file(args[0]);
+    size_t lines = 0;
+    each_line(log, [&](const char *, const char *) { lines++; });
+    printf("  %.1f MB, %d lines\n", log.size() / 1e6, (int) lines);
+
+    const char *patterns[] = {
+        "upstream connect timeout",
+        "\\[ERROR\\].*user=(\\w+)",
+        "status=5\\d\\d time=(\\d{4,})ms",
+        "from (\\d+\\.\\d+\\.\\d+\\.\\d+) path=/api/v1/items/(\\d+)5 ",
+    };
+    for (auto pat : patterns)
+    {
+        printf("  /%s/\n", pat);
+        std::regex sre(pat);
+        dfa_regex::Regex dre(pat);
+        size_t n_std = 0, n_dfa = 0;
+
+        report("std::regex", time_per_call([&]()
+        {
+            size_t n = 0;
+            std::cmatch m;
+            each_line(log, [&](const char *b, const char *e)
+            { if (std::regex_search(b, e, m, sre)) n++; });
+            g_sink += n_std = n;
+        }, 0.1), (double) log.size());
+        report("dfa_regex (\"l\" flag)", time_per_call([&]()
+        {
+            size_t n = 0;
+            dfa_regex::Match m;
+            each_line(log, [&](const char *b, const char *e)
+            { if (dre.search(b, e, b, m)) n++; });
+            g_sink += n_dfa = n;
+        }, 0.1), (double) log.size());
+        if (n_std != n_dfa)
+            printf("    MISMATCH: %d lines with std::regex, %d with dfa_regex\n",
+                   (int) n_std, (int) n_dfa);
+    }
+
+    // what the cache saves, per util-re call
+    const char *pat = patterns[2];
+    report("compile std::regex", time_per_call([&]() { std::regex r(pat); g_sink += r.mark_count(); }));
+    report("compile dfa_regex",  time_per_call([&]() { dfa_regex::Regex r(pat); g_sink += r.mark_count(); }));
+}
+//---------------------------------------------------------------------------
+
+/// n filter patterns, like a set of alert rules over a log.
+static std::vector<std::string> filter_patterns(int n)
+{
+    std::mt19937 rng(815);
+    const char *users[] = { "alice", "bob", "carol", "dave", "eve" };
+    std::vector<std::string> pats;
+    char buf[128];
+    for (int i = 0; i < n; i++)
+    {
+        switch (i % 4)
+        {
+            case 0: snprintf(buf, sizeof(buf), "items/%u status=5\\d\\d", (unsigned) (rng() % 1000)); break;
+            case 1: snprintf(buf, sizeof(buf), "worker-%d: .*user=%s from 10\\.0\\.%u\\.",
+                             (int) (rng() % 16), users[rng() % 5], (unsigned) (rng() % 256)); break;
+            case 2: snprintf(buf, sizeof(buf), "\\[(WARN|ERROR)\\] worker-%d: request id=%u",
+                             (int) (rng() % 16), (unsigned) (rng() % 100)); break;
+            default: snprintf(buf, sizeof(buf), "time=%u\\d{2}ms", (unsigned) (rng() % 20)); break;
+        }
+        pats.push_back(buf);
+    }
+    return pats;
+}
+//---------------------------------------------------------------------------
+
+/// Args: number of lines, 20000 by default.
+/// Matches 10, 100 and 1000 patterns against each line, with a RegexSet
+/// and with the patterns one by one.
+static void bench_regexset(const Args &args)
+{
+    size_t lines = args.empty() ? 20000 : std::stoul(args[0]);
+    std::string log = generate_log(lines * 143);
+    lines = 0;
+    each_line(log, [&](const char *, const char *) { lines++; });
+    printf("  %.1f MB, %d lines\n", log.size() / 1e6, (int) lines);
+
+    for (int n : { 10, 100, 1000 })
+    {
+        std::vector<std::string> pats = filter_patterns(n);
+        printf("  %d patterns\n", n);
+        size_t n_set = 0, n_dfa = 0, n_std = 0;
+
+        dfa_regex::RegexSet set;
+        for (auto &p : pats)
+            set.add(p);
+        report("RegexSet::matches", time_per_call([&]()
+        {
+            size_t cnt = 0;
+            std::vector<int> out;
+            each_line(log, [&](const char *b, const char *e)
+            { set.matches(b, e, out); cnt += out.size(); });
+            g_sink += n_set = cnt;
+        }, 0.1), (double) log.size());
+
+        std::vector<std::unique_ptr<dfa_regex::Regex>> dres;
+        for (auto &p : pats)
+            dres.emplace_back(new dfa_regex::Regex(p));
+        report("dfa_regex one by one", time_per_call([&]()
+        {
+            size_t cnt = 0;
+            dfa_regex::Match m;
+            each_line(log, [&](const char *b, const char *e)
+            {
+                for (auto &re : dres)
+                    if (re->search(b, e, b, m)) cnt++;
+            });
+            g_sink += n_dfa = cnt;
+        }, 0.1), (double) log.size());
+
+        // std::regex takes minutes for 1000 patterns
+        if (n <= 100)
+        {
+            std::vector<std::regex> sres(pats.begin(), pats.end());
+            report("std::regex one by one", time_per_call([&]()
+            {
+                size_t cnt = 0;
+                each_line(log, [&](const char *b, const char *e)
+                {
+                    for (auto &re : sres)
+                        if (std::regex_search(b, e, re)) cnt++;
+                });
+                g_sink += n_std = cnt;
+            }, 0.1), (double) log.size());
+        }
+        else
+            n_std = n_set;
+
+        if (n_set != n_dfa || n_set != n_std)
+            printf("    MISMATCH: %d matches with RegexSet, %d with dfa_regex, %d with std::regex\n",
+                   (int) n_set, (int) n_dfa, (int) n_std);
+        else
+            printf("    %d matches\n", (int) n_set);
+    }
+}
+//---------------------------------------------------------------------------
+
+/// sys-find "R" and "RY" before the dir_walker, with
+/// recursive_directory_iterator.
+static VV old_find(const std::string &root, bool need_stat)
+{
+    namespace fs = boost::filesystem;
+    VV list(vv_list());
+    for (fs::directory_entry &e : fs::recursive_directory_iterator(root))
+    {
+        fs::path p = e.path();
+        if (!need_stat)
+        {
+            list << vv(p.generic_string());
+            continue;
+        }
+        boost::system::error_code ec;
+        VV ent(vv_map());
+        ent->set("path", vv(p.generic_string()));
+        ent->set("type", vv(e.status(ec).type() == fs::directory_file ? "directory" : "regular"));
+        ent->set("size",  vv((int64_t) fs::file_size(p, ec)));
+        ent->set("perms", vv(e.status(ec).permissions()));
+        ent->set("mtime", vv_dt(fs::last_write_time(p, ec)));
+        list << ent;
+    }
+    return list;
+}
+//---------------------------------------------------------------------------
+
+static VV walker_find(const std::string &root, bool need_stat, int threads)
+{
+    dir_walker::Options o;
+    o.need_stat = need_stat;
+    o.threads   = threads;
+    o.convert   = [need_stat](const dir_walker::Entry &e)
+    {
+        if (!need_stat)
+            return vv(e.path);
+        VV ent(vv_map());
+        ent->set("path",  vv(e.path));
+        ent->set("type",  vv(dir_walker::file_type_name(e.type)));
+        ent->set("size",  vv(e.size));
+        ent->set("perms", vv((int64_t) e.perms));
+        ent->set("mtime", vv_dt(e.mtime));
+        return ent;
+    };
+    dir_walker::Walker w(root, o);
+    VV list(vv_list());
+    for (VV batch = w.next_batch(); batch->is_defined(); batch = w.next_batch())
+        for (auto v : *batch)
+            list << v;
+    return list;
+}
+//---------------------------------------------------------------------------
+
+/// Args: number of files, 200000 by default, and optionally an existing
+/// directory to walk instead of the generated tree.
+/// The generated tree has 100 files per directory and 10 subdirectories
+/// per directory and is removed afterwards. The first walks are done
+/// with a warm cache anyway, as the tree was just written.
+static void bench_find(const Args &args)
+{
+    namespace fs = boost::filesystem;
+    size_t files = args.empty() ? 200000 : std::stoul(args[0]);
+    fs::path tmp;
+    std::string root;
+    if (args.size() > 1)
+        root = args[1];
+    else
+    {
+        tmp  = fs::temp_directory_path() / fs::unique_path("vvbench-%%%%-%%%%");
+        root = tmp.generic_string();
+        std::vector<fs::path> dirs { tmp };
+        fs::create_directory(tmp);
+        std::string data(100, 'x');
+        for (size_t i = 0, d = 0; i < files; d++)
+        {
+            for (int j = 0; j < 10; j++)
+            {
+                dirs.push_back(dirs[d] / ("d" + std::to_string(j)));
+                fs::create_directory(dirs.back());
+            }
+            for (int j = 0; j < 100 && i < files; j++, i++)
+                std::ofstream(
+                    (dirs[d] / ("f" + std::to_string(j) + ".txt")).string())
+                    .write(data.data(), i % data.size());
+        }
+    }
+
+    size_t n = old_find(root, false)->size();
+    printf("  %s: %d entries\n", root.c_str(), (int) n);
+
+    for (bool need_stat : { false, true })
+    {
+        printf("  %s\n", need_stat ? "with stat (\"RY\")" : "paths only (\"R\")");
+        report("recursive_directory_iterator", time_per_call([&]()
+        { g_sink += old_find(root, need_stat)->size(); }));
+        report("dir_walker, 1 thread", time_per_call([&]()
+        { g_sink += walker_find(root, need_stat, 1)->size(); }));
+        report("dir_walker, default threads", time_per_call([&]()
+        { g_sink += walker_find(root, need_stat, 0)->size(); }));
+        size_t m = walker_find(root, need_stat, 0)->size();
+        if (m != n)
+            printf("    MISMATCH: %d entries with dir_walker\n", (int) m);
+    }
+
+    if (!tmp.empty())
+        fs::remove_all(tmp);
+}
+//---------------------------------------------------------------------------
+
+struct Benchmark
+{
+    const char                      *name;
+    std::function<void(const Args &)> run;
+};
+
+static const Benchmark g_benchmarks[] = {
+    { "cow",    bench_cow },
+    { "json",   bench_json },
+    { "csv",    bench_csv },
+    { "msgpack", bench_msgpack },
+    { "msgpack-span", bench_msgpack_span },
+    { "framing", bench_framing },
+    { "regex",  bench_regex },
+    { "regexset", bench_regexset },
+    { "find",   bench_find },
+    { "node",   bench_node },
+};
+//---------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    Args args(argv + (argc > 1 ? 2 : 1), argv + argc);
+    for (auto &b : g_benchmarks)
+    {
+        if (argc > 1 && strcmp(argv[1], b.name))
+            continue;
+
+        printf("%s:\n", b.name);
+        b.run(args);
+    }
+    return 0;
+}
@@ -24,11 +24,29 @@
 #define BOOST_TEST_MAIN
 #include <boost/test/unit_test.hpp>
 #include <sstream>
+#include <cmath>
+#include <random>
 #if defined BZVC
 #    include "bz/vval.h"
 #    include "bz/vval_util.h"
+#    include "bz/json_vv.h"
+#    include "bz/msgpack_vv.h"
+#    include "bz/msgpack.h"
+#    include "bz/csv.h"
+#    include "bz/vv_persistent.h"
+#    include "bz/vv_hashed.h"
+#    include "bz/JSON.h"
+#    include "bz/dfa_regex.h"
 #else
 #    include "base/vval_util.h"
+#    include "base/json_vv.h"
+#    include "base/msgpack_vv.h"
+#    include "msgpack/msgpack.h"
+#    include "base/csv.h"
+#    include "base/vv_persistent.h"
+#    include "base/vv_hashed.h"
+#    include "base/JSON.h"
+#    include "base/dfa_regex.h"
 #endif
 
 using namespace VVal;
@@ -145,6 +163,12 @@ BOOST_AUTO_TEST_CASE(list_vval)
 
     v->set("0", vv("fart"));
     BOOST_CHECK_EQUAL(v->_s(0), "fart");
+
+    // indices beyond int32_t don't wrap around to element 0
+    BOOST_TEST_CHECK(v->_("4294967296")->is_undef());
+    v->set("4294967296", vv("x"));
+    BOOST_CHECK_EQUAL(v->_s(0), "fart");
+    BOOST_CHECK_EQUAL(v->size(), 3);
 }
 //---------------------------------------------------------------------------
 
@@ -186,6 +210,285 @@ BOOST_AUTO_TEST_CASE(map_vval)
 }
 //---------------------------------------------------------------------------
 
+BOOST_AUTO_TEST_CASE(clone_snapshot)
+{
+    VV cfg(vv_map());
+    cfg << vv_kv("name", vv("a"))
+        << vv_kv("ports", vv_list() << vv(80) << vv(443))
+        << vv_kv("db", vv_map() << vv_kv("host", vv("h")));
+
+    // handles to nested containers, taken before the clone
+    VV ports(cfg->_("ports"));
+    VV db(cfg->_("db"));
+
+    VV snap(cfg->clone());
+    ports << vv(8080);
+    db << vv_kv("host", vv("other"));
+    cfg << vv_kv("name", vv("b"));
+    BOOST_CHECK_EQUAL(cfg->_("ports")->size(), 3);
+    BOOST_CHECK_EQUAL(snap->_("ports")->size(), 2);
+    BOOST_CHECK_EQUAL(snap->_("db")->_s("host"), "h");
+    BOOST_CHECK_EQUAL(snap->_s("name"), "a");
+
+    // and the other way round
+    snap->_("ports")->pop();
+    BOOST_CHECK_EQUAL(snap->_("ports")->size(), 1);
+    BOOST_CHECK_EQUAL(ports->size(), 3);
+
+    VV l(vv_list() << vv(1) << vv(2));
+    VV lc(l->clone());
+    l->shift();
+    lc->push(vv(3));
+    BOOST_CHECK_EQUAL(l->size(), 1);
+    BOOST_CHECK_EQUAL(l->_i(0), 2);
+    BOOST_CHECK_EQUAL(lc->size(), 3);
+    BOOST_CHECK_EQUAL(lc->_i(0), 1);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(persistent_values)
+{
+    std::mt19937 rng(47);
+    std::unordered_map<std::string, int64_t> ref;
+    persistent::Map m;
+    std::vector<persistent::Map> versions;
+    for (int i = 0; i < 20000; i++)
+    {
+        std::string k = "k" + std::to_string(rng() % 5000);
+        if (rng() % 4 == 0)
+        {
+            ref.erase(k);
+            m = m.dissoc(k);
+        }
+        else
+        {
+            ref[k] = i;
+            m = m.assoc(k, vv(i));
+        }
+        if (i % 5000 == 0) versions.push_back(m);
+    }
+    BOOST_CHECK_EQUAL(m.size(), ref.size());
+    size_t found = 0;
+    for (auto &kv : ref)
+        if (m.find(kv.first) && m.get(kv.first)->i() == kv.second) found++;
+    BOOST_CHECK_EQUAL(found, ref.size());
+    BOOST_CHECK_EQUAL(versions[0].size(), 1);
+    BOOST_TEST_CHECK(m.get("nope")->is_undef());
+
+    VV pm(vv_pmap(m));
+    BOOST_TEST_CHECK(pm->is_map());
+    BOOST_TEST_CHECK(pm->is_persistent());
+    BOOST_CHECK_EQUAL(pm->size(), (int32_t) ref.size());
+    size_t n = 0;
+    for (auto kv : *pm)
+        if (ref[kv->_s(0)] == kv->_i(1)) n++;
+    BOOST_CHECK_EQUAL(n, ref.size());
+    BOOST_CHECK_THROW(pm->set("x", vv(1)), VariantValueException);
+
+    persistent::Vector v;
+    std::vector<persistent::Vector> vs;
+    for (int i = 0; i < 5000; i++)
+    {
+        v = v.conj(vv(i));
+        if (i == 31 || i == 1056) vs.push_back(v);
+    }
+    v = v.assoc(100, vv("x")).assoc(4999, vv("y"));
+    BOOST_CHECK_EQUAL(v.size(), 5000);
+    BOOST_CHECK_EQUAL(v.at(99)->i(), 99);
+    BOOST_CHECK_EQUAL(v.at(100)->s(), "x");
+    BOOST_CHECK_EQUAL(v.at(4999)->s(), "y");
+    BOOST_CHECK_EQUAL(vs[0].size(), 32);
+    BOOST_CHECK_EQUAL(vs[1].at(1056)->i(), 1056);
+    BOOST_TEST_CHECK(vs[1].at(1057)->is_undef());
+    BOOST_CHECK_THROW(v.assoc(5001, vv(1)), VariantValueException);
+
+    persistent::Vector p = v;
+    bool ok = true;
+    while (p.size() > 0)
+    {
+        p = p.pop();
+        size_t last = p.size() - 1;
+        if (p.size() > 0 && last != 100 && p.at(last)->i() != (int64_t) last) ok = false;
+    }
+    BOOST_TEST_CHECK(ok);
+    BOOST_CHECK_EQUAL(v.at(1024)->i(), 1024);
+
+    VV pv(vv_pvector(vs[1]));
+    int64_t s = 0;
+    for (auto e : *pv) s += e->i();
+    BOOST_CHECK_EQUAL(s, 1056 * 1057 / 2);
+    BOOST_CHECK_EQUAL(pv->_i("7"), 7);
+    BOOST_TEST_CHECK(pv->_("4294967296")->is_undef());
+    BOOST_CHECK_THROW(pv->set("4294967296", vv(1)), VariantValueException);
+
+    VV nested(vv_to_persistent(
+        vv_map() << vv_kv("l", vv_list() << vv(1) << (vv_map() << vv_kv("a", vv(2))))));
+    BOOST_TEST_CHECK(nested->is_persistent());
+    BOOST_TEST_CHECK(nested->_("l")->is_persistent());
+    BOOST_CHECK_EQUAL(nested->_("l")->_(1)->_i("a"), 2);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(cow_values)
+{
+    VV l(vv_cow_list());
+    for (int i = 0; i < 100; i++)
+        l << vv(i);
+    VV lc(l->clone());
+    l->set(3, vv(-3));
+    l->pop();
+    l->shift();
+    l->unshift(vv("x"));
+    l->set(101, vv(101));
+    BOOST_CHECK_EQUAL(lc->size(), 100);
+    BOOST_CHECK_EQUAL(lc->_i(3), 3);
+    BOOST_CHECK_EQUAL(lc->_i(99), 99);
+    BOOST_CHECK_EQUAL(l->size(), 102);
+    BOOST_CHECK_EQUAL(l->_s(0), "x");
+    BOOST_CHECK_EQUAL(l->_i(3), -3);
+    BOOST_TEST_CHECK(l->_(99)->is_undef());
+    BOOST_TEST_CHECK(l->_(100)->is_undef());
+    BOOST_CHECK_EQUAL(l->_i(101), 101);
+    int64_t s = 0;
+    for (auto e : *lc) s += e->i();
+    BOOST_CHECK_EQUAL(s, 99 * 100 / 2);
+
+    VV m(vv_cow_map());
+    m << vv_kv("a", vv(1)) << vv_kv("l", vv_list() << vv(1));
+    VV mc(m->clone());
+    m->set("a", vv(2));
+    m->remove("l");
+    BOOST_CHECK_EQUAL(mc->_i("a"), 1);
+    BOOST_CHECK_EQUAL(mc->size(), 2);
+    BOOST_CHECK_EQUAL(m->_i("a"), 2);
+    BOOST_CHECK_EQUAL(m->size(), 1);
+    BOOST_TEST_CHECK(!m->is_persistent());
+
+    // stored lists and maps are persistent copies, shared by the clones
+    BOOST_TEST_CHECK(mc->_("l")->is_persistent());
+    BOOST_CHECK_THROW(mc->_("l")->push(vv(2)), VariantValueException);
+
+    VV snap(vv_to_persistent(mc));
+    mc->set("b", vv(3));
+    BOOST_TEST_CHECK(snap->is_persistent());
+    BOOST_CHECK_EQUAL(snap->size(), 2);
+    BOOST_TEST_CHECK(vv_equals(snap, vv_map() << vv_kv("a", vv(1)) << vv_kv("l", vv_list() << vv(1))));
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(hash_equal_compare)
+{
+    auto eq = [](const VV &a, const VV &b)
+    { return vv_equals(a, b) && vv_hash(a) == vv_hash(b) && vv_compare(a, b) == 0; };
+
+    BOOST_TEST_CHECK(eq(vv(1), vv(1.0)));
+    BOOST_TEST_CHECK(eq(vv(-0.0), vv(0)));
+    BOOST_TEST_CHECK(eq(vv(std::nan("")), vv(std::nan(""))));
+    BOOST_TEST_CHECK(!vv_equals(vv((int64_t) 9007199254740993LL), vv(9007199254740992.0)));
+    // INT64_MAX rounds to 2^63 as a double, which is out of the int64 range
+    VV imax(vv(std::numeric_limits<int64_t>::max())), two63(vv(9223372036854775808.0));
+    BOOST_TEST_CHECK(!vv_equals(imax, two63));
+    BOOST_CHECK_LT(vv_compare(imax, two63), 0);
+    BOOST_CHECK_GT(vv_compare(two63, imax), 0);
+    BOOST_TEST_CHECK(eq(vv(std::numeric_limits<int64_t>::min()), vv(-9223372036854775808.0)));
+    BOOST_TEST_CHECK(eq(vv("abc"), vv_atom("abc")));
+    auto buf = std::make_shared<const std::string>("xxabcxx");
+    BOOST_TEST_CHECK(eq(vv("abc"), vv_slice(buf, 2, 3)));
+    BOOST_TEST_CHECK(!vv_equals(vv("abc"), vv_bytes("abc")));
+    BOOST_TEST_CHECK(!vv_equals(vv("1"), vv(1)));
+    BOOST_TEST_CHECK(eq(vv_undef(), VV()));
+
+    VV l1(vv_list() << vv(1) << vv("a") << (vv_map() << vv_kv("x", vv(2)) << vv_kv("y", vv(3))));
+    VV l2(vv_list() << vv(1.0) << vv("a") << (vv_map() << vv_kv("y", vv(3)) << vv_kv("x", vv(2))));
+    BOOST_TEST_CHECK(eq(l1, l2));
+    BOOST_TEST_CHECK(eq(l1, vv_to_persistent(l2)));
+    BOOST_TEST_CHECK(eq(l1->_(2), vv_to_persistent(l2->_(2))));
+    l2->_(2)->set("x", vv(4));
+    BOOST_TEST_CHECK(!vv_equals(l1, l2));
+    BOOST_CHECK_LT(vv_compare(l1, l2), 0);
+
+    // total order across kinds, lists lexicographic
+    std::vector<VV> sorted {
+        vv_undef(), vv_bool(false), vv_bool(true), vv(-1.5), vv(2), vv(std::nan("")),
+        vv_dt(100), vv(""), vv("a"), vv("ab"), vv("b"), vv_bytes("a"),
+        vv_list(), vv_list() << vv(1), vv_list() << vv(1) << vv(0), vv_list() << vv(2),
+        vv_map() << vv_kv("a", vv(1)), vv_map() << vv_kv("a", vv(2)), vv_map() << vv_kv("b", vv(0)),
+        vv_hset()
+    };
+    for (size_t i = 0; i < sorted.size(); i++)
+        for (size_t j = 0; j < sorted.size(); j++)
+            BOOST_CHECK_EQUAL(vv_compare(sorted[i], sorted[j]) < 0, i < j);
+
+    std::vector<VV> shuffled(sorted.rbegin(), sorted.rend());
+    std::sort(shuffled.begin(), shuffled.end(), VVLess());
+    for (size_t i = 0; i < sorted.size(); i++)
+        BOOST_TEST_CHECK(shuffled[i].get() == sorted[i].get());
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(hashed_containers)
+{
+    VV s(vv_hset());
+    HashSetValue *hs = dynamic_cast<HashSetValue *>(s.get());
+    BOOST_TEST_CHECK(hs->add(vv_list() << vv(1) << vv("a")));
+    BOOST_TEST_CHECK(!hs->add(vv_list() << vv(1.0) << vv("a")));
+    BOOST_TEST_CHECK(hs->add(vv_list() << vv("a") << vv(1)));
+    s->push(vv(3));
+    BOOST_TEST_CHECK(s->is_set());
+    BOOST_CHECK_EQUAL(s->size(), 3);
+    BOOST_TEST_CHECK(hs->contains(vv_list() << vv(1) << vv("a")));
+    BOOST_TEST_CHECK(hs->remove(vv_list() << vv(1) << vv("a")));
+    BOOST_CHECK_EQUAL(s->_i(0), 3);
+    BOOST_TEST_CHECK(s->_("4294967296")->is_undef());
+    BOOST_TEST_CHECK(!hs->contains(vv_list() << vv(1) << vv("a")));
+    BOOST_TEST_CHECK(vv_equals(s->clone(), s));
+
+    VV m(vv_hmap());
+    HashMapValue *hm = dynamic_cast<HashMapValue *>(m.get());
+    for (int i = 0; i < 10000; i++)
+        hm->put(vv_list() << vv(i % 100) << vv(i % 7), vv(i));
+    BOOST_CHECK_EQUAL(m->size(), 700);
+    BOOST_CHECK_EQUAL(hm->get(vv_list() << vv(99) << vv(1))->i(), 9899);
+    BOOST_TEST_CHECK(hm->get(vv_list() << vv(99) << vv(7))->is_undef());
+    m->set("k", vv(1));
+    BOOST_CHECK_EQUAL(m->_i("k"), 1);
+    BOOST_TEST_CHECK(hm->remove(vv("k")));
+    int n = 0;
+    for (auto kv : *m)
+        if (hm->get(kv->_(0))->i() == kv->_i(1)) n++;
+    BOOST_CHECK_EQUAL(n, 700);
+
+    auto rec = [](int id, const char *name, int v)
+    { return vv_map() << vv_kv("id", vv(id)) << vv_kv("name", vv(name)) << vv_kv("v", vv(v)); };
+    VV recs(vv_list() << rec(1, "a", 10) << rec(2, "b", 20) << rec(1, "a", 30) << rec(1, "c", 40));
+
+    VV d = vv_dedup(recs, vv_list() << vv("id") << vv("name"));
+    BOOST_CHECK_EQUAL(d->size(), 3);
+    BOOST_CHECK_EQUAL(d->_(2)->_i("v"), 40);
+    BOOST_CHECK_EQUAL(vv_dedup(vv_list() << vv(1) << vv(1.0) << vv(2) << vv(1))->size(), 2);
+
+    VV g = vv_group_by(recs, vv("id"));
+    BOOST_CHECK_EQUAL(g->size(), 2);
+    BOOST_CHECK_EQUAL(g->_(1)->size(), 3);
+    BOOST_CHECK_EQUAL(g->_(1)->_(2)->_s("name"), "c");
+
+    VV right(vv_list()
+        << (vv_map() << vv_kv("uid", vv(1)) << vv_kv("x", vv("one")))
+        << (vv_map() << vv_kv("uid", vv(3)) << vv_kv("x", vv("three"))));
+    VV j = vv_hash_join(recs, right, vv("id"), vv("uid"));
+    BOOST_CHECK_EQUAL(j->size(), 3);
+    BOOST_CHECK_EQUAL(j->_(0)->_(1)->_s("x"), "one");
+    VV lj = vv_hash_join(recs, right, vv("id"), vv("uid"), true);
+    BOOST_CHECK_EQUAL(lj->size(), 4);
+    BOOST_TEST_CHECK(lj->_(1)->_(1)->is_undef());
+
+    VV srt = vv_sorted(recs, vv_list() << vv("name") << vv("v"));
+    BOOST_CHECK_EQUAL(srt->_(0)->_i("v"), 10);
+    BOOST_CHECK_EQUAL(srt->_(1)->_i("v"), 30);
+    BOOST_CHECK_EQUAL(srt->_(3)->_s("name"), "c");
+}
+//---------------------------------------------------------------------------
+
 BOOST_AUTO_TEST_CASE(int_vval)
 {
     VV v(vv(12));
@@ -200,6 +503,68 @@ BOOST_AUTO_TEST_CASE(int_vval)
 }
 //---------------------------------------------------------------------------
 
+BOOST_AUTO_TEST_CASE(string_numbers)
+{
+    // same leniency as std::stoll()/std::stod(), but 0 instead of throwing
+    BOOST_CHECK_EQUAL(vv(" \t-42xyz")->i(),            -42);
+    BOOST_CHECK_EQUAL(vv("+17")->i(),                   17);
+    BOOST_CHECK_EQUAL(vv("12.9")->i(),                  12);
+    BOOST_CHECK_EQUAL(vv("9223372036854775807")->i(),   INT64_MAX);
+    BOOST_CHECK_EQUAL(vv("-9223372036854775808")->i(),  INT64_MIN);
+    BOOST_CHECK_EQUAL(vv("9223372036854775808")->i(),   0);
+    BOOST_CHECK_EQUAL(vv("")->i(),                      0);
+
+    BOOST_CHECK_EQUAL(vv("  1.25e2 m")->d(),            125.0);
+    BOOST_CHECK_EQUAL(vv(".5")->d(),                    0.5);
+    BOOST_CHECK_EQUAL(vv("-3.")->d(),                   -3.0);
+    BOOST_CHECK_EQUAL(vv("7e")->d(),                    7.0);
+    BOOST_CHECK_EQUAL(vv("0.1")->d(),                   0.1);
+    BOOST_CHECK_EQUAL(vv("1e999")->d(),                 0.0);
+    BOOST_CHECK_EQUAL(vv("abc")->d(),                   0.0);
+    BOOST_CHECK(std::isinf(vv("-inf")->d()));
+    BOOST_CHECK_EQUAL(vv("3.14159265358979323846")->d(), 3.14159265358979323846);
+
+    VV d(vv(0.0));
+    d->s_set(std::wstring(L"2.5"));
+    BOOST_CHECK_EQUAL(d->d(), 2.5);
+
+    // printf("%f") formatting, independent of the locale
+    BOOST_CHECK_EQUAL(vv(44.23)->s(),       "44.230000");
+    BOOST_CHECK_EQUAL(vv(-0.0000004)->s(),  "-0.000000");
+    BOOST_CHECK_EQUAL(vv(0.0078125)->s(),   "0.007812");
+    BOOST_CHECK_EQUAL(vv(1e20)->s(),        "100000000000000000000.000000");
+    VV s(vv(""));
+    s->d_set(2.5);
+    BOOST_CHECK_EQUAL(s->s(), "2.500000");
+    s->i_set(-7);
+    BOOST_CHECK_EQUAL(s->s(), "-7");
+
+    BOOST_CHECK_EQUAL(numconv::double_string(0.1),  "0.1");
+    BOOST_CHECK_EQUAL(numconv::double_string(1e21), "1e+21");
+    BOOST_CHECK_EQUAL(numconv::double_string(-0.0), "-0");
+    BOOST_CHECK_EQUAL(numconv::double_string(1e-5), "1e-05");
+    BOOST_CHECK_EQUAL(numconv::double_string(5e-324), "5e-324");
+    BOOST_CHECK_EQUAL(numconv::double_string(123456789012345680.0), "1.2345678901234568e+17");
+    BOOST_CHECK_EQUAL(numconv::double_string(1.7976931348623157e308), "1.7976931348623157e+308");
+
+    // every formatted value parses back to the same double
+    std::mt19937_64 rng(27);
+    int bad = 0;
+    for (int i = 0; i < 100000; i++)
+    {
+        uint64_t bits = rng();
+        double   v    = 0.0;
+        std::memcpy(&v, &bits, sizeof(v));
+        if (!std::isfinite(v)) continue;
+        std::string ds = numconv::double_string(v);
+        double back = 0.0;
+        if (!numconv::parse_double(ds.data(), ds.data() + ds.size(), back) || back != v)
+            bad++;
+    }
+    BOOST_CHECK_EQUAL(bad, 0);
+}
+//---------------------------------------------------------------------------
+
 BOOST_AUTO_TEST_CASE(special_construct_syntax)
 {
     VV sv(vv("x"));
@@ -453,6 +818,632 @@ BOOST_AUTO_TEST_CASE(from_json_test)
 }
 //---------------------------------------------------------------------------
 
+BOOST_AUTO_TEST_CASE(from_json_strings)
+{
+    VV d = VVal::from_json(
+        "[\"a\\\"b\\\\\", \"\\\\\\\\\\\"x\", \"\\/\\b\\f\\n\\r\\t\","
+        " \"\\u00e4\\u20AC\", \"\\ud83d\\ude00\", \"\xC3\xB6\", \"{[:,]}\"]");
+
+    BOOST_CHECK_EQUAL(d->size(), 7);
+    BOOST_CHECK_EQUAL(d->_s(0), "a\"b\\");
+    BOOST_CHECK_EQUAL(d->_s(1), "\\\\\"x");
+    BOOST_CHECK_EQUAL(d->_s(2), "/\b\f\n\r\t");
+    BOOST_CHECK_EQUAL(d->_s(3), "\xC3\xA4\xE2\x82\xAC");
+    BOOST_CHECK_EQUAL(d->_s(4), "\xF0\x9F\x98\x80");
+    BOOST_CHECK_EQUAL(d->_s(5), "\xC3\xB6");
+    BOOST_CHECK_EQUAL(d->_s(6), "{[:,]}");
+
+    // escapes and quotes crossing the 64 byte block boundaries
+    std::string long_str;
+    std::string json = "{\"k\":\"";
+    for (int i = 0; i < 50; i++)
+    {
+        json     += "abc\\\\\\\"";
+        long_str += "abc\\\"";
+    }
+    json += "\", \"n\": [1, 2, {\"x\": \"}\"}]}";
+    d = VVal::from_json(json);
+    BOOST_CHECK_EQUAL(d->_s("k"), long_str);
+    BOOST_CHECK_EQUAL(d->_("n")->_(2)->_s("x"), "}");
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(from_json_numbers)
+{
+    VV d = VVal::from_json(
+        "[0, -0, 42, -17, 9223372036854775807, -9223372036854775808,"
+        " 1.5, -2.25e2, 1E-3, 0.1, 18446744073709551616, 1e400, 123456789012345678901234.5]");
+
+    BOOST_TEST_CHECK(d->_(0)->is_int());
+    BOOST_CHECK_EQUAL(d->_i(0), 0);
+    BOOST_CHECK_EQUAL(d->_i(1), 0);
+    BOOST_CHECK_EQUAL(d->_i(2), 42);
+    BOOST_CHECK_EQUAL(d->_i(3), -17);
+    BOOST_CHECK_EQUAL(d->_i(4), INT64_MAX);
+    BOOST_CHECK_EQUAL(d->_i(5), INT64_MIN);
+    BOOST_TEST_CHECK(d->_(6)->is_double());
+    BOOST_CHECK_EQUAL(d->_d(6), 1.5);
+    BOOST_CHECK_EQUAL(d->_d(7), -225.0);
+    BOOST_CHECK_EQUAL(d->_d(8), 0.001);
+    BOOST_CHECK_EQUAL(d->_d(9), 0.1);
+    BOOST_TEST_CHECK(d->_(10)->is_double());
+    BOOST_CHECK_EQUAL(d->_d(10), 18446744073709551616.0);
+    BOOST_CHECK_EQUAL(d->_d(11), HUGE_VAL);
+    BOOST_CHECK_EQUAL(d->_d(12), 123456789012345678901234.5);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(from_json_errors)
+{
+    BOOST_TEST_CHECK(VVal::from_json("")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("42")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[1, 2")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[1 2]")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[01]")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[1.]")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[truex]")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("{\"a\" 1}")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("{\"a\": 1,}")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[\"abc]")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[\"\\x\"]")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[\"\\ud83d\"]")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[\"\xC3\"]")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[1] x")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("{}{}")->is_undef());
+    BOOST_TEST_CHECK(VVal::from_json("[1],")->is_undef());
+    std::string err;
+    BOOST_TEST_CHECK(VVal::json_vv::parse("[1] 2", 5, &err)->is_undef());
+    BOOST_CHECK_EQUAL(err, "json: unexpected data after value (at offset 4)");
+    BOOST_TEST_CHECK(VVal::from_json("[1] \r\n\t ")->is_list());
+
+    VV d = VVal::from_json(" { } ");
+    BOOST_TEST_CHECK(d->is_map());
+    BOOST_CHECK_EQUAL(d->size(), 0);
+    d = VVal::from_json("[[], {}, null, true, false]");
+    BOOST_CHECK_EQUAL(d->size(), 5);
+    BOOST_TEST_CHECK(d->_(2)->is_undef());
+    BOOST_TEST_CHECK(d->_(3)->is_boolean());
+    BOOST_TEST_CHECK(d->_b(3));
+    BOOST_TEST_CHECK(!d->_b(4));
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(as_json_output)
+{
+    VV l = vv_list();
+    l << vv(INT64_MAX) << vv(INT64_MIN) << vv(0.1) << vv(1.0 / 3.0) << vv(-2.5e-300);
+    l << vv("a\"b\\c\n\x01/\xC3\xA4") << vv_bool(true) << vv_undef();
+    l->push(vv_list());
+    BOOST_CHECK_EQUAL(VVal::as_json(l),
+        "[9223372036854775807,-9223372036854775808,0.1,0.3333333333333333,"
+        "-2.5e-300,\"a\\\"b\\\\c\\n\\u0001/\xC3\xA4\",true,null,[]]");
+
+    VV r = VVal::from_json(VVal::as_json(l));
+    BOOST_CHECK_EQUAL(r->_i(0), INT64_MAX);
+    BOOST_CHECK_EQUAL(r->_i(1), INT64_MIN);
+    BOOST_CHECK_EQUAL(r->_d(3), 1.0 / 3.0);
+    BOOST_CHECK_EQUAL(r->_s(5), l->_s(5));
+
+    VV m = vv_map();
+    m << vv_kv("x", vv_list() << vv(1) << vv(2));
+    BOOST_CHECK_EQUAL(VVal::as_json(m, true), "{\n  \"x\": [\n    1,\n    2\n  ]\n}");
+
+    std::string long_str(100000, 'x');
+    long_str[77777] = '"';
+    std::stringstream ss;
+    VVal::json_vv::write_json(ss, vv_list() << vv(long_str));
+    BOOST_CHECK_EQUAL(ss.str().size(), long_str.size() + 5);
+    BOOST_CHECK_EQUAL(VVal::from_json(ss.str())->_s(0), long_str);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(json_stream_reader)
+{
+    std::string doc =
+        "{\"meta\": {\"skip\": [1, \"]\"]}, \"results\": ["
+        "{\"id\": 1}, {\"id\": 2, \"s\": \"a\\\"]}\"}, 3]}";
+
+    VVal::json_vv::StreamReader r(false, "results/*");
+    VV recs = vv_list();
+    VV rec;
+    for (size_t i = 0; i < doc.size(); i += 5)
+    {
+        r.feed(doc.data() + i, std::min((size_t) 5, doc.size() - i));
+        while (r.next(rec)) recs->push(rec);
+        BOOST_TEST_CHECK(r.buffered() < 30);
+    }
+    r.finish();
+    while (r.next(rec)) recs->push(rec);
+
+    BOOST_CHECK_EQUAL(r.error(), "");
+    BOOST_CHECK_EQUAL(recs->size(), 3);
+    BOOST_CHECK_EQUAL(recs->_(0)->_i("id"), 1);
+    BOOST_CHECK_EQUAL(recs->_(1)->_s("s"), "a\"]}");
+    BOOST_CHECK_EQUAL(recs->_i(2), 3);
+
+    std::string nd = "{\"a\":1}\r\n\n[2]\n\"x\"";
+    VVal::json_vv::StreamReader nr(true);
+    nr.feed(nd.data(), nd.size());
+    BOOST_TEST_CHECK(nr.next(rec));
+    BOOST_CHECK_EQUAL(rec->_i("a"), 1);
+    BOOST_TEST_CHECK(nr.next(rec));
+    BOOST_CHECK_EQUAL(rec->_i(0), 2);
+    BOOST_TEST_CHECK(!nr.next(rec));
+    nr.finish();
+    BOOST_TEST_CHECK(nr.next(rec));
+    BOOST_CHECK_EQUAL(rec->s(), "x");
+    BOOST_TEST_CHECK(!nr.next(rec));
+    BOOST_CHECK_EQUAL(nr.error(), "");
+
+    VVal::json_vv::StreamReader er(true);
+    er.feed("[1]\n[1 2]\n", 10);
+    BOOST_TEST_CHECK(er.next(rec));
+    BOOST_TEST_CHECK(!er.next(rec));
+    BOOST_TEST_CHECK(er.error().find("line 2") == 0);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(csv_reader)
+{
+    std::string doc = "a,\"b,\"\"c\"\"\r\nd\",e\r\n,\r\nf,g,";
+
+    VV t = VVal::csv::from_csv(doc, ',', "\r\n");
+    BOOST_CHECK_EQUAL(t->size(), 3);
+    BOOST_CHECK_EQUAL(t->_(0)->_s(1), "b,\"c\"\nd");
+    BOOST_CHECK_EQUAL(t->_(0)->_s(2), "e");
+    BOOST_CHECK_EQUAL(t->_(1)->size(), 2);
+    BOOST_CHECK_EQUAL(t->_(2)->size(), 3);
+
+    VVal::csv::Reader r(',', "\r\n");
+    VV rows = vv_list();
+    VV row;
+    for (size_t i = 0; i < doc.size(); i++)
+    {
+        r.feed(&doc[i], 1);
+        while (r.next(row)) rows << row;
+    }
+    r.finish();
+    while (r.next(row)) rows << row;
+    BOOST_CHECK_EQUAL(rows->size(), 3);
+    BOOST_CHECK_EQUAL(rows->_(0)->_s(1), "b,\"c\"\nd");
+    BOOST_CHECK_EQUAL(rows->_(2)->_s(1), "g");
+
+    VVal::csv::Reader br(';', "\n");
+    std::string mem = "x;yy\n";
+    br.set_input(mem.data(), mem.size());
+    BOOST_TEST_CHECK(br.next_row());
+    BOOST_CHECK_EQUAL(br.fields().size(), 2);
+    BOOST_TEST_CHECK(br.fields()[1].data == mem.data() + 2);
+    BOOST_TEST_CHECK(!br.next_row());
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(csv_writer)
+{
+    VV t = vv_list() << (vv_list() << vv(1) << vv("a b") << vv("x\"y") << vv(""))
+                     << (vv_list() << vv("c,d") << vv("\"q\"") << vv("l1\nl2"));
+
+    std::string out = VVal::csv::to_csv(t, ',', "\r\n");
+    BOOST_CHECK_EQUAL(out, "1,\"a b\",\"x\"\"y\",\r\n\"c,d\",\"\"\"q\"\"\",\"l1\nl2\"\r\n");
+
+    VV back = VVal::csv::from_csv(out, ',', "\r\n");
+    BOOST_CHECK_EQUAL(back->_(0)->_s(2), "x\"y");
+    BOOST_CHECK_EQUAL(back->_(1)->_s(1), "\"q\"");
+    BOOST_CHECK_EQUAL(back->_(1)->_s(2), "l1\nl2");
+
+    BOOST_CHECK_EQUAL(VVal::csv::escape_csv_field("plain", ';'), "plain");
+    BOOST_CHECK_EQUAL(VVal::csv::escape_csv_field("a;b", ';'), "\"a;b\"");
+
+    std::string long_field(100, 'x');
+    long_field[70] = ';';
+    BOOST_CHECK_EQUAL(VVal::csv::escape_csv_field(long_field, ';'), "\"" + long_field + "\"");
+
+    std::string streamed;
+    size_t      chunks = 0;
+    VVal::csv::Writer w([&](const char *data, size_t len)
+    {
+        streamed.append(data, len);
+        chunks++;
+    }, ';', "\n");
+    for (int i = 0; i < 10000; i++)
+    {
+        w.field(std::to_string(i));
+        w.field(long_field);
+        w.end_row();
+    }
+    w.flush();
+    BOOST_TEST_CHECK(chunks > 1);
+    BOOST_CHECK_EQUAL(streamed.substr(0, 2), "0;");
+    BOOST_CHECK_EQUAL(VVal::csv::from_csv(streamed, ';', "\n")->size(), 10000);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(columnar_table)
+{
+    VV t(vv_table());
+    t << (vv_map() << vv_kv("id", vv(3)) << vv_kv("name", vv("c")) << vv_kv("val", vv(1.5)));
+    t << (vv_map() << vv_kv("id", vv(1)) << vv_kv("name", vv("a")));
+    t << (vv_map() << vv_kv("id", vv(2)) << vv_kv("name", vv("b")) << vv_kv("val", vv(-2)));
+    t << (vv_map() << vv_kv("id", vv(4)) << vv_kv("name", vv("a")) << vv_kv("val", vv(10)));
+
+    BOOST_TEST_CHECK(t->is_list());
+    BOOST_CHECK_EQUAL(t->size(), 4);
+    BOOST_CHECK_EQUAL(t->_(0)->_s("name"), "c");
+    BOOST_TEST_CHECK(t->_(1)->_("val")->is_undef());
+    BOOST_CHECK_EQUAL(t->_(2)->_d("val"), -2.0);
+
+    table::TablePtr tp = vv_to_table(t);
+    BOOST_CHECK_EQUAL(tp->column("id")->type(), table::T_INT);
+    BOOST_CHECK_EQUAL(tp->column("val")->type(), table::T_DOUBLE);
+    BOOST_CHECK_EQUAL(tp->column("name")->dict().size(), 3);
+
+    VV ids(t->_("id"));
+    BOOST_CHECK_EQUAL(ids->size(), 4);
+    BOOST_CHECK_EQUAL(ids->type(), "int");
+    int64_t s = 0;
+    for (auto v : *ids) s += v->i();
+    BOOST_CHECK_EQUAL(s, 10);
+    BOOST_CHECK_EQUAL(ids->_i("1"), 1);
+    BOOST_TEST_CHECK(ids->_("4294967296")->is_undef());
+    int rows = 0;
+    for (auto r : *t) { BOOST_TEST_CHECK(r->is_map()); rows++; }
+    BOOST_CHECK_EQUAL(rows, 4);
+
+    BOOST_CHECK_EQUAL(tp->sum("id")->i(), 10);
+    BOOST_CHECK_EQUAL(tp->sum("val")->d(), 9.5);
+    BOOST_CHECK_EQUAL(tp->min("val")->d(), -2.0);
+    BOOST_CHECK_EQUAL(tp->max("name")->s(), "c");
+    BOOST_TEST_CHECK(tp->sum("name")->is_undef());
+
+    table::TablePtr f = tp->filter("val", ">", vv(0));
+    BOOST_CHECK_EQUAL(f->rows(), 2);
+    BOOST_CHECK_EQUAL(f->filter("name", "==", vv("a"))->row(0)->_i("id"), 4);
+    BOOST_CHECK_EQUAL(tp->filter("id", "<=", vv(2.5))->rows(), 2);
+    BOOST_CHECK_THROW(tp->filter("id", "~", vv(1)), VariantValueException);
+    BOOST_CHECK_THROW(tp->sum("nope"), VariantValueException);
+
+    table::TablePtr srt = tp->sort_by("val");
+    BOOST_CHECK_EQUAL(srt->row(0)->_i("id"), 2);
+    BOOST_CHECK_EQUAL(srt->row(2)->_i("id"), 4);
+    BOOST_TEST_CHECK(srt->row(3)->_("val")->is_undef());
+    BOOST_CHECK_EQUAL(tp->sort_by("name", true)->row(0)->_s("name"), "c");
+
+    // widening on push, the column keeps the values
+    t << (vv_map() << vv_kv("id", vv("x")));
+    BOOST_CHECK_EQUAL(tp->column("id")->type(), table::T_STRING);
+    BOOST_CHECK_EQUAL(t->_(0)->_s("id"), "3");
+    BOOST_CHECK_EQUAL(t->_(4)->_s("id"), "x");
+
+    VV c(t->clone());
+    c << (vv_list() << vv("y"));
+    BOOST_CHECK_EQUAL(c->size(), 6);
+    BOOST_CHECK_EQUAL(t->size(), 5);
+
+    VV ct(VVal::csv::from_csv_table(
+        "a,b,c,d\r\n1,1.5,x,\r\n2,,y,\r\n-3,1e3,7,\r\n", ',', "\r\n"));
+    table::TablePtr cp = vv_to_table(ct);
+    BOOST_CHECK_EQUAL(ct->size(), 3);
+    BOOST_CHECK_EQUAL(cp->column("a")->type(), table::T_INT);
+    BOOST_CHECK_EQUAL(cp->column("b")->type(), table::T_DOUBLE);
+    BOOST_CHECK_EQUAL(cp->column("c")->type(), table::T_STRING);
+    BOOST_CHECK_EQUAL(cp->column("d")->type(), table::T_STRING);
+    BOOST_TEST_CHECK(ct->_(1)->_("b")->is_undef());
+    BOOST_CHECK_EQUAL(cp->sum("a")->i(), 0);
+    BOOST_CHECK_EQUAL(cp->sum("b")->d(), 1001.5);
+    BOOST_CHECK_EQUAL(ct->_(2)->_s("c"), "7");
+
+    // an int sum, that overflows int64, is continued as double
+    const int64_t big = 9000000000000000000LL;
+    VV bt(vv_table());
+    bt << (vv_map() << vv_kv("n", vv(big)));
+    bt << (vv_map() << vv_kv("n", vv(big)));
+    bt << (vv_map() << vv_kv("n", vv((int64_t) -big)));
+    table::TablePtr bp = vv_to_table(bt);
+    BOOST_CHECK_EQUAL(bp->column("n")->type(), table::T_INT);
+    BOOST_TEST_CHECK(bp->sum("n")->is_double());
+    BOOST_CHECK_EQUAL(bp->sum("n")->d(), 9e18);
+    bt << (vv_map() << vv_kv("n", vv((int64_t) -big)));
+    BOOST_TEST_CHECK(bp->sum("n")->is_double());
+    BOOST_CHECK_EQUAL(bp->sum("n")->d(), 0.0);
+
+    BOOST_CHECK_EQUAL(VVal::csv::to_csv(ct, ',', "\n"), "a,b,c,d\n1,1.5,x,\n2,,y,\n-3,1000,7,\n");
+    BOOST_CHECK_EQUAL(
+        VVal::csv::from_csv_table("1;2\n3;4\n", ';', "\n", false)->_(1)->_i("1"), 4);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(msgpack_roundtrip)
+{
+    VV m = vv_map();
+    m->set("i",  vv((int64_t) -5000000000LL));
+    m->set("d",  vv(1.5));
+    m->set("b",  vv_bytes(std::string("\x00\x01\xFF", 3)));
+    m->set("t",  vv_dt(1500000000));
+    m->set("t2", vv_dt(-100));
+    m->set("l",  vv_list() << vv(1) << vv("x") << vv_undef() << vv_bool(true));
+
+    std::string enc = VVal::msgpack_vv::to_msgpack(m);
+    std::string err;
+    VV r = VVal::msgpack_vv::from_msgpack(enc, &err);
+    BOOST_CHECK_EQUAL(err, "");
+    BOOST_CHECK_EQUAL(r->_("i")->i(), -5000000000LL);
+    BOOST_TEST_CHECK(r->_("i")->is_int());
+    BOOST_TEST_CHECK(r->_("d")->is_double());
+    BOOST_TEST_CHECK(r->_("b")->is_bytes());
+    BOOST_CHECK_EQUAL(r->_("b")->s(), std::string("\x00\x01\xFF", 3));
+    BOOST_TEST_CHECK(r->_("t")->is_datetime());
+    BOOST_CHECK_EQUAL(r->_("t")->i(), 1500000000);
+    BOOST_CHECK_EQUAL(r->_("t2")->i(), -100);
+    BOOST_CHECK_EQUAL(r->_("l")->size(), 4);
+    BOOST_TEST_CHECK(r->_("l")->_(2)->is_undef());
+    BOOST_TEST_CHECK(r->_("l")->_(3)->is_true());
+
+    BOOST_CHECK_EQUAL(VVal::msgpack_vv::to_msgpack(vv(1)), "\x01");
+
+    for (size_t i = 0; i < enc.size(); i++)
+    {
+        err.clear();
+        VVal::msgpack_vv::from_msgpack(enc.data(), i, &err);
+        BOOST_TEST_CHECK(!err.empty());
+    }
+    err.clear();
+    VVal::msgpack_vv::from_msgpack(enc + "x", &err);
+    BOOST_CHECK_EQUAL(err, "msgpack: trailing data after value");
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(msgpack_shared_input)
+{
+    std::string blob(100000, 'B');
+    VV l = vv_list() << vv("small") << vv_bytes(blob) << vv(std::string(300, 'S'));
+
+    auto input = std::make_shared<const std::string>(VVal::msgpack_vv::to_msgpack(l));
+    std::string err;
+    VV r = VVal::msgpack_vv::from_msgpack(input, &err);
+    BOOST_CHECK_EQUAL(err, "");
+    BOOST_CHECK_EQUAL(r->_s(0), "small");
+    BOOST_TEST_CHECK(r->_(1)->is_bytes());
+    BOOST_CHECK_EQUAL(r->_s(1), blob);
+    BOOST_TEST_CHECK(r->_(2)->is_string());
+    BOOST_CHECK_EQUAL(r->_s(2), std::string(300, 'S'));
+    BOOST_TEST_CHECK(dynamic_cast<VVal::StringSliceValue *>(r->_(1).get()) != nullptr);
+    BOOST_TEST_CHECK(dynamic_cast<VVal::StringSliceValue *>(r->_(0).get()) == nullptr);
+
+    r->_(2)->s_set("changed");
+    BOOST_CHECK_EQUAL(r->_s(2), "changed");
+    BOOST_CHECK_EQUAL(r->_s(1), blob);
+
+    // The UTF8Buffer interface consumes the decoded value
+    UTF8Buffer buf(input->data(), input->size());
+    buf.append_bytes("\xC3", 1);
+    msgpack::Deserializer d;
+    BOOST_TEST_CHECK(d.parse(&buf));
+    BOOST_CHECK_EQUAL(buf.length(), 1);
+    BOOST_TEST_CHECK(d.parse(nullptr));
+    BOOST_CHECK_EQUAL(buf.length(), 0);
+    BOOST_TEST_CHECK(!d.parse(nullptr));
+}
+//---------------------------------------------------------------------------
+
+struct JSONStrings : public json::Parser
+{
+    std::vector<std::string> m_strs;
+    std::string              m_err;
+
+    virtual void onValueString(const std::string &s) { m_strs.push_back(s); }
+    virtual void onError(UTF8Buffer *, const char *e) { m_err = e; }
+};
+
+BOOST_AUTO_TEST_CASE(utf8buffer)
+{
+    // small contents stay inline, moving leaves an empty buffer
+    UTF8Buffer a("short");
+    BOOST_CHECK_EQUAL(a.capacity(), (size_t) UTF8Buffer::INLINE_SIZE);
+    UTF8Buffer b(std::move(a));
+    BOOST_CHECK_EQUAL(b.as_string(), "short");
+    BOOST_CHECK_EQUAL(a.length(), 0);
+
+    std::string big(1000, 'x');
+    UTF8Buffer c(big.data(), big.size());
+    const char *heap = c.buffer();
+    UTF8Buffer d(std::move(c));
+    BOOST_TEST_CHECK((const void *) d.buffer() == (const void *) heap);
+    c = std::move(d);
+    BOOST_CHECK_EQUAL(c.as_string(), big);
+
+    size_t cap = c.capacity();
+    c.clear();
+    BOOST_CHECK_EQUAL(c.length(), 0);
+    BOOST_CHECK_EQUAL(c.capacity(), cap);
+    c.reset();
+    BOOST_CHECK_EQUAL(c.capacity(), (size_t) UTF8Buffer::INLINE_SIZE);
+
+    // queue like use: consuming and appending keeps the data intact
+    UTF8Buffer q;
+    std::string expected;
+    for (int i = 0; i < 1000; i++)
+    {
+        std::string s = std::to_string(i) + ",";
+        q.append_bytes(s.data(), s.size());
+        expected += s;
+        if (i % 3 == 0)
+        {
+            q.skip_bytes(2);
+            expected.erase(0, 2);
+        }
+    }
+    BOOST_CHECK_EQUAL(q.as_string(), expected);
+
+    uint32_t u32 = 0;
+    UTF8Buffer nums;
+    nums.append_uint8(1);
+    nums.append_uint32(0x12345678);
+    nums.skip_bytes(1);
+    BOOST_TEST_CHECK(nums.read_uint32(u32));
+    BOOST_CHECK_EQUAL(u32, 0x12345678);
+
+    std::string text = std::string(100, 'a') + "\xC3\xA4" + "bc";
+    UTF8Buffer t(text.data(), text.size());
+    BOOST_CHECK_EQUAL(t.ascii_run_length(), 100);
+    BOOST_TEST_CHECK(t.is_valid_utf8());
+    BOOST_TEST_CHECK(!UTF8Buffer("a\xC3(").is_valid_utf8());
+    BOOST_TEST_CHECK(!UTF8Buffer("\xC0\xAF").is_valid_utf8());    // overlong
+    BOOST_TEST_CHECK(!UTF8Buffer("\xED\xA0\x80").is_valid_utf8()); // surrogate
+    BOOST_TEST_CHECK(!UTF8Buffer("\xF4\x90\x80\x80").is_valid_utf8());
+    BOOST_TEST_CHECK(UTF8Buffer("\xF0\x9F\x98\x80").is_valid_utf8());
+
+    UTF8Buffer out;
+    UTF8Buffer("a/\"\\\x01\n\xC3\xA4//").dump_as_json_string(out);
+    BOOST_CHECK_EQUAL(out.as_string(), "\"a\\/\\\"\\\\\\u0001\\n\xC3\xA4\\/\\/\"");
+
+    JSONStrings p;
+    std::string long_str(200, 'y');
+    UTF8Buffer json(("[\"" + long_str + "\xC3\xA4\\n\", \"\\u00e4\"]").c_str());
+    BOOST_TEST_CHECK(p.parse(&json));
+    BOOST_REQUIRE_EQUAL(p.m_strs.size(), 2);
+    BOOST_CHECK_EQUAL(p.m_strs[0], long_str + "\xC3\xA4\n");
+    BOOST_CHECK_EQUAL(p.m_strs[1], "\xC3\xA4");
+
+    JSONStrings p2;
+    UTF8Buffer bad("[\"ab\xC3\"]");
+    BOOST_TEST_CHECK(!p2.parse(&bad));
+    BOOST_CHECK_EQUAL(p2.m_err, "UTF-8 Encoding Error");
+
+    JSONStrings p3;
+    UTF8Buffer unterminated("[\"abc");
+    BOOST_TEST_CHECK(!p3.parse(&unterminated));
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(dfa_regex_matching)
+{
+    using dfa_regex::Regex;
+    dfa_regex::Match m;
+
+    // m points into the subject, which has to stay alive
+    std::string xfooo("xfooo"), foo("foo"), bar("bar");
+    Regex r("(f)(o+)");
+    BOOST_CHECK_EQUAL(r.mark_count(), 2);
+    BOOST_TEST_CHECK(r.search(xfooo, m));
+    BOOST_CHECK_EQUAL(m.str(0), "fooo");
+    BOOST_CHECK_EQUAL(m.str(2), "ooo");
+    BOOST_TEST_CHECK(!r.match(xfooo, m));
+    BOOST_TEST_CHECK(r.match(foo, m));
+    BOOST_TEST_CHECK(!r.search(bar, m));
+
+    // leftmost, then greedy/lazy and alternatives in order
+    std::string baaa("baaa"), xabc("xabc"), c("c");
+    BOOST_TEST_CHECK(Regex("a+?").search(baaa, m));
+    BOOST_CHECK_EQUAL(m.str(0), "a");
+    BOOST_TEST_CHECK(Regex("ab|abc").search(xabc, m));
+    BOOST_CHECK_EQUAL(m.str(0), "ab");
+    BOOST_TEST_CHECK(Regex("(a|b)?c").search(c, m));
+    BOOST_TEST_CHECK(!m.matched(1));
+
+    // groups are cleared at the start of every iteration
+    std::string ab("ab"), aba("aba"), space(" ");
+    BOOST_TEST_CHECK(Regex("(?:(a)|b)+").match(ab, m));
+    BOOST_TEST_CHECK(!m.matched(1));
+    BOOST_TEST_CHECK(Regex("(?:(a)|(b))*").match(aba, m));
+    BOOST_CHECK_EQUAL(m.str(1), "a");
+    BOOST_TEST_CHECK(!m.matched(2));
+    BOOST_TEST_CHECK(Regex("((a)|b){2}").match(ab, m));
+    BOOST_CHECK_EQUAL(m.str(1), "b");
+    BOOST_TEST_CHECK(!m.matched(2));
+    // iterations beyond the minimum must not match the empty string,
+    // positions are the ones of ECMAScript
+    std::string s1("1_b 1ac"), s2("c 11"), s3("1 ");
+    BOOST_TEST_CHECK(Regex("([^ab]*?){1,2}").search(space, m));
+    BOOST_CHECK_EQUAL(m.str(0), " ");
+    BOOST_TEST_CHECK(Regex("([^a]*?)+").search(s1, m));
+    BOOST_CHECK_EQUAL(m.str(0), "1_b 1");
+    BOOST_CHECK_EQUAL(m.str(1), "1");
+    BOOST_TEST_CHECK(Regex("(\\w*?)?").search(s2, m));
+    BOOST_CHECK_EQUAL(m.str(0), "c");
+    BOOST_TEST_CHECK(Regex("(?:.*?)+").search(s3, m));
+    BOOST_CHECK_EQUAL(m.str(0), "1 ");
+    BOOST_TEST_CHECK(Regex("(?:.*?)+").match(s3, m));
+    BOOST_TEST_CHECK(!Regex("(a?)*").match(aba, m));
+    BOOST_TEST_CHECK(Regex("(a*)*").search(ab, m));
+    BOOST_CHECK_EQUAL(m.str(0), "a");
+    BOOST_CHECK_EQUAL(m.str(1), "a");
+
+    std::string digits_ok("123-ab.c"), digits_bad("1234-abc");
+    std::string foo_word("a foo."), afoo("afoo"), abcx("aBcx"), a_nl_b("a\nb");
+    BOOST_TEST_CHECK(Regex("^\\d{2,3}-[^-\\s]+$").match(digits_ok, m));
+    BOOST_TEST_CHECK(!Regex("^\\d{2,3}-[^-\\s]+$").match(digits_bad, m));
+    BOOST_TEST_CHECK(Regex("\\bfoo\\b").search(foo_word, m));
+    BOOST_TEST_CHECK(!Regex("\\bfoo\\b").search(afoo, m));
+    BOOST_TEST_CHECK(Regex("[a-c]+X", true).match(abcx, m));
+    BOOST_TEST_CHECK(!Regex("a.b").search(a_nl_b, m));
+
+    // the DFA state limit is hit, the NFA has to take over
+    std::mt19937 rng(1);
+    std::string many;
+    for (int i = 0; i < 20000; i++) many += (rng() & 1) ? 'a' : 'b';
+    many[many.size() - 13] = 'b';
+    std::string many_x = many + "x";
+    BOOST_TEST_CHECK(!Regex("(a|b)*a(a|b){12}x").search(many_x, m));
+    many[many.size() - 13] = 'a';
+    BOOST_TEST_CHECK(Regex("(a|b)*a(a|b){12}$").search(many, m));
+
+    BOOST_CHECK_EQUAL(Regex("(\\w+)@(\\w+)").replace("a@b, c@d", "$2 at $1"),
+                      "b at a, d at c");
+    BOOST_CHECK_EQUAL(Regex("x*").replace("abc", "-"), "-a-b-c-");
+    BOOST_CHECK_EQUAL(Regex("o").replace("foo", "[$`|$&|$'|$$]"),
+                      "f[f|o|o|$][fo|o||$]");
+
+    BOOST_CHECK_THROW(Regex("(a)\\1"), dfa_regex::RegexError);
+    BOOST_CHECK_THROW(Regex("(?=a)"),   dfa_regex::RegexError);
+    BOOST_CHECK_THROW(Regex("*a"),      dfa_regex::RegexError);
+    BOOST_CHECK_THROW(Regex("(a"),      dfa_regex::RegexError);
+    BOOST_CHECK_THROW(Regex("[a"),      dfa_regex::RegexError);
+    BOOST_CHECK_THROW(Regex("a{1000000}"), dfa_regex::RegexError);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(dfa_regex_set)
+{
+    using dfa_regex::RegexSet;
+
+    RegexSet set;
+    BOOST_CHECK_EQUAL(set.add("ERROR"), 0);
+    BOOST_CHECK_EQUAL(set.add("^\\d+$", RegexSet::WHOLE), 1);
+    BOOST_CHECK_EQUAL(set.add("warn(ing)?", RegexSet::ICASE), 2);
+    BOOST_CHECK_EQUAL(set.add("\\bid=\\d+"), 3);  // matched on its own
+    BOOST_CHECK_EQUAL(set.add("x$"), 4);
+    BOOST_CHECK_EQUAL(set.size(), 5);
+
+    std::vector<int> hits;
+    set.matches("12345", hits);
+    BOOST_CHECK_EQUAL(hits.size(), 1);
+    BOOST_CHECK_EQUAL(hits[0], 1);
+
+    set.matches("WARNING: ERROR in id=42", hits);
+    std::vector<int> expected = { 0, 2, 3 };
+    BOOST_TEST_CHECK(hits == expected);
+
+    set.matches("ERROR ... ERROR box", hits);
+    expected = { 0, 4 };
+    BOOST_TEST_CHECK(hits == expected);
+
+    set.matches("pid=3", hits);
+    BOOST_TEST_CHECK(hits.empty());
+
+    // many patterns, the DFA cache gets flushed on the way
+    RegexSet big;
+    for (int i = 0; i < 1000; i++)
+        big.add("key" + std::to_string(i) + "=(\\w+)");
+    std::string line;
+    for (int i = 0; i < 1000; i += 7)
+        line += "key" + std::to_string(i) + "=v ";
+    big.matches(line, hits);
+    BOOST_REQUIRE_EQUAL(hits.size(), 143);
+    BOOST_CHECK_EQUAL(hits[1], 7);
+    BOOST_CHECK_EQUAL(hits[142], 994);
+}
+//---------------------------------------------------------------------------
+
 BOOST_AUTO_TEST_CASE(one_iterator)
 {
     VV s(vv("FOOBAR"));
@@ -478,6 +1469,48 @@ BOOST_AUTO_TEST_CASE(wstr_handling)
 }
 //---------------------------------------------------------------------------
 
+BOOST_AUTO_TEST_CASE(atoms)
+{
+    BOOST_CHECK_EQUAL(atom::find("command"), atom::COMMAND);
+    BOOST_CHECK_EQUAL(atom::str(atom::PROCESS_EXIT), "process::exit");
+    BOOST_CHECK_EQUAL(atom::str(atom::NONE), "");
+    BOOST_CHECK(atom::count() >= atom::PREDEFINED_END - 1);
+
+    BOOST_CHECK_EQUAL(atom::find("vv-test-atom"), atom::NONE);
+    uint32_t id = atom::intern("vv-test-atom");
+    BOOST_CHECK(id >= atom::PREDEFINED_END);
+    BOOST_CHECK_EQUAL(atom::intern("vv-test-atom"), id);
+    BOOST_CHECK_EQUAL(atom::find("vv-test-atom"), id);
+    BOOST_CHECK_EQUAL(atom::intern(std::string(atom::MAX_LEN + 1, 'x')), atom::NONE);
+
+    // concurrent interning hands out one id per string
+    std::vector<std::thread> threads;
+    std::vector<std::vector<uint32_t>> ids(4);
+    for (int t = 0; t < 4; t++)
+        threads.push_back(std::thread([t, &ids]() {
+            for (int i = 0; i < 200; i++)
+                ids[t].push_back(atom::intern("vv-test-" + std::to_string(i)));
+        }));
+    for (auto &t : threads) t.join();
+    for (int t = 1; t < 4; t++)
+        BOOST_CHECK(ids[t] == ids[0]);
+    BOOST_CHECK_EQUAL(atom::str(ids[0][17]), "vv-test-17");
+
+    VV a = vv_atom("vv-test-atom");
+    BOOST_CHECK(a->is_string());
+    BOOST_CHECK_EQUAL(a->atom(), id);
+    BOOST_CHECK_EQUAL(a->s(), "vv-test-atom");
+    BOOST_CHECK_EQUAL(a->clone()->atom(), id);
+    BOOST_CHECK_EQUAL(vv_atom(atom::TOKEN)->s(), "token");
+    BOOST_CHECK_EQUAL(vv("token")->atom(), atom::NONE);
+
+    a->s_set("changed");
+    BOOST_CHECK_EQUAL(a->atom(), atom::NONE);
+    BOOST_CHECK_EQUAL(a->s(), "changed");
+    BOOST_CHECK_EQUAL(atom::str(id), "vv-test-atom");
+}
+//---------------------------------------------------------------------------
+
 BOOST_AUTO_TEST_CASE(hex_conv)
 {
     VV s(vv_bytes(std::string("\x00\x01""ABCDEF\xFF", 9)));